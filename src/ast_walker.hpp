@@ -0,0 +1,128 @@
+#pragma once
+#include <set>
+#include <string>
+
+#include "expr.hpp"
+#include "statement.hpp"
+
+// Visits every node of a tree without doing anything. Analyses derive from
+// it, override the nodes they care about and call the base visit to keep
+// descending.
+class AstWalker: public ExprVisitor, public StmtVisitor {
+public:
+    void walk(const std::vector<std::unique_ptr<Stmt>>& statements) {
+        for (const auto& stmt : statements) {
+            stmt->accept(*this);
+        }
+    }
+
+    void visit(const Binary& expr) override {
+        expr.left->accept(*this);
+        expr.right->accept(*this);
+    }
+    void visit(const Logical& expr) override {
+        expr.left->accept(*this);
+        expr.right->accept(*this);
+    }
+    void visit(const Ternary& expr) override {
+        expr.condition->accept(*this);
+        expr.thenBranch->accept(*this);
+        expr.elseBranch->accept(*this);
+    }
+    void visit(const Grouping& expr) override {
+        expr.expression->accept(*this);
+    }
+    void visit(const Literal&) override {}
+    void visit(const Unary& expr) override {
+        expr.right->accept(*this);
+    }
+    void visit(const Postfix& expr) override {
+        expr.operand->accept(*this);
+    }
+    void visit(const Variable&) override {}
+    void visit(const Assignment& expr) override {
+        expr.right->accept(*this);
+    }
+    void visit(const Call& expr) override {
+        expr.callee->accept(*this);
+        for (const auto& argument : expr.arguments) {
+            argument->accept(*this);
+        }
+    }
+    void visit(const ArrayLiteral& expr) override {
+        for (const auto& element : expr.elements) {
+            element->accept(*this);
+        }
+    }
+    void visit(const MapLiteral& expr) override {
+        for (const auto& [key, value] : expr.pairs) {
+            key->accept(*this);
+            value->accept(*this);
+        }
+    }
+    void visit(const Subscript& expr) override {
+        expr.object->accept(*this);
+        expr.index->accept(*this);
+    }
+    void visit(const PropertyAccess& expr) override {
+        expr.object->accept(*this);
+    }
+    void visit(const SubscriptAssignment& expr) override {
+        expr.object->accept(*this);
+        expr.index->accept(*this);
+        expr.value->accept(*this);
+    }
+    void visit(const FunctionExpr& expr) override {
+        walk(expr.body->statements);
+    }
+
+    void visit(const ExpressionStmt& stmt) override {
+        stmt.expr->accept(*this);
+    }
+    void visit(const PrintStmt& stmt) override {
+        stmt.expr->accept(*this);
+    }
+    void visit(const VarStmt& stmt) override {
+        if (stmt.initializer) stmt.initializer->accept(*this);
+    }
+    void visit(const BlockStmt& stmt) override {
+        walk(stmt.statements);
+    }
+    void visit(const IfStmt& stmt) override {
+        stmt.condition->accept(*this);
+        stmt.thenBlock->accept(*this);
+        if (stmt.elseBlock) stmt.elseBlock->accept(*this);
+    }
+    void visit(const WhileStmt& stmt) override {
+        stmt.condition->accept(*this);
+        stmt.body->accept(*this);
+        if (stmt.increment) stmt.increment->accept(*this);
+    }
+    void visit(const FunctionStmt& stmt) override {
+        walk(stmt.body->statements);
+    }
+    void visit(const ReturnStmt& stmt) override {
+        if (stmt.value) stmt.value->accept(*this);
+    }
+    void visit(const BreakStmt&) override {}
+    void visit(const ContinueStmt&) override {}
+};
+
+// Names assigned or incremented (++/--) anywhere in a tree, at any depth.
+// Ordered, so code generated from it comes out the same on every run.
+class AssignedNames: public AstWalker {
+public:
+    std::set<std::string> names;
+
+    using AstWalker::visit;
+    void visit(const Assignment& expr) override {
+        names.insert(expr.name.lexeme);
+        AstWalker::visit(expr);
+    }
+    void visit(const Postfix& expr) override {
+        if (const auto* variable = dynamic_cast<const Variable*>(expr.operand.get())) {
+            names.insert(variable->name.lexeme);
+        }
+        AstWalker::visit(expr);
+    }
+};
@@ -0,0 +1,574 @@
+#include "closure_compiler.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+#include "exception.hpp"
+
+using Flow = ClosureCompiler::Flow;
+using Eval = ClosureCompiler::Eval;
+using Exec = ClosureCompiler::Exec;
+
+namespace {
+
+class CompiledFunction final : public LoxCallable {
+private:
+    std::shared_ptr<const ClosureCompiler::Function> function;
+    std::shared_ptr<Environment> closure;
+public:
+    CompiledFunction(std::shared_ptr<const ClosureCompiler::Function> function, std::shared_ptr<Environment> closure)
+        : function(std::move(function)), closure(std::move(closure)) {}
+
+    Value call(RuntimeContext *ctxt, std::vector<Value> arguments) override {
+        // compiled functions only ever run under the interpreter that made them
+        auto& interpreter = static_cast<Interpreter&>(*ctxt);
+        auto env = std::make_shared<Environment>(closure);
+        for (int i = 0; i < function->arity; i++) {
+            env->push(std::move(arguments[i]));
+        }
+        EnvGuard guard(interpreter, std::move(env));
+        Value returned = nullptr;
+        for (auto& statement : function->body) {
+            switch (statement(interpreter, returned)) {
+                case Flow::Normal:
+                    break;
+                case Flow::Return:
+                    return returned;
+                // out of a function, as the interpreter lets them escape
+                case Flow::Break:
+                    throw Break();
+                case Flow::Continue:
+                    throw Continue();
+            }
+        }
+        return nullptr;
+    }
+
+    int arity() override {
+        return function->arity;
+    }
+
+    std::string toString() override {
+        return function->name.empty() ? "<anonymous fn>" : "<fn " + function->name + ">";
+    }
+};
+
+// whether running stmt defines a variable in the scope it is in
+bool declares(const Stmt& stmt) {
+    if (dynamic_cast<const VarStmt*>(&stmt) || dynamic_cast<const FunctionStmt*>(&stmt)) {
+        return true;
+    }
+    if (auto ifStmt = dynamic_cast<const IfStmt*>(&stmt)) {
+        return declares(*ifStmt->thenBlock) || (ifStmt->elseBlock && declares(*ifStmt->elseBlock));
+    }
+    if (auto whileStmt = dynamic_cast<const WhileStmt*>(&stmt)) {
+        return declares(*whileStmt->body);
+    }
+    return false;
+}
+
+Eval readLocal(int hops, int index) {
+    if (hops == 0) {
+        return [index](Interpreter& I) { return I.env->get_by_index(index); };
+    }
+    return [hops, index](Interpreter& I) { return I.env->getAt(hops, index); };
+}
+
+void writeLocal(Interpreter& I, int hops, int index, const Value& value) {
+    if (hops == 0) {
+        I.env->assign_by_index(index, value);
+    } else {
+        I.env->assignAt(hops, index, value);
+    }
+}
+
+// an operator on two numbers; with a number literal on the right it is
+// folded into the closure instead of evaluated each time
+template<typename Op>
+Eval numeric(Eval left, Eval right, const Expr& rightExpr, Op op) {
+    auto literal = dynamic_cast<const Literal*>(&rightExpr);
+    if (literal && std::holds_alternative<double>(literal->value)) {
+        double constant = std::get<double>(literal->value);
+        return [left = std::move(left), constant, op](Interpreter& I) -> Value {
+            Value l = left(I);
+            return op(std::get<double>(l), constant);
+        };
+    }
+    return [left = std::move(left), right = std::move(right), op](Interpreter& I) -> Value {
+        Value l = left(I);
+        Value r = right(I);
+        return op(std::get<double>(l), std::get<double>(r));
+    };
+}
+
+}
+
+void ClosureCompiler::run(const std::vector<std::unique_ptr<Stmt>>& stmts) {
+    std::vector<Exec> program;
+    program.reserve(stmts.size());
+    for (auto& stmt : stmts) {
+        program.push_back(compile(*stmt));
+    }
+    Value returned = nullptr;
+    for (auto& statement : program) {
+        switch (statement(interpreter, returned)) {
+            case Flow::Break:
+                throw Break();
+            case Flow::Continue:
+                throw Continue();
+            default:
+                break;
+        }
+    }
+}
+
+Eval ClosureCompiler::compile(const Expr& expr) {
+    expr.accept(*this);
+    return std::move(compiledExpr);
+}
+
+Exec ClosureCompiler::compile(const Stmt& stmt) {
+    stmt.accept(*this);
+    return std::move(compiledStmt);
+}
+
+Exec ClosureCompiler::compileSequence(const std::vector<std::unique_ptr<Stmt>>& stmts) {
+    if (stmts.size() == 1) {
+        return compile(*stmts.front());
+    }
+    std::vector<Exec> body;
+    body.reserve(stmts.size());
+    for (auto& stmt : stmts) {
+        body.push_back(compile(*stmt));
+    }
+    return [body = std::move(body)](Interpreter& I, Value& returned) {
+        for (auto& statement : body) {
+            Flow flow = statement(I, returned);
+            if (flow != Flow::Normal) {
+                return flow;
+            }
+        }
+        return Flow::Normal;
+    };
+}
+
+std::shared_ptr<const ClosureCompiler::Function> ClosureCompiler::compileFunction(
+        const std::string& name, const std::vector<Token>& params, const BlockStmt& body) {
+    auto function = std::make_shared<Function>();
+    function->name = name;
+    function->arity = static_cast<int>(params.size());
+    // the parameters and the body's own declarations share the call's scope
+    scopes.push_back(true);
+    for (auto& stmt : body.statements) {
+        function->body.push_back(compile(*stmt));
+    }
+    scopes.pop_back();
+    return function;
+}
+
+int ClosureCompiler::hops(int distance) const {
+    return static_cast<int>(std::count(scopes.end() - distance, scopes.end(), true));
+}
+
+
+void ClosureCompiler::visit(const Literal& lit) {
+    compiledExpr = [value = lit.value](Interpreter&) { return value; };
+}
+
+void ClosureCompiler::visit(const Grouping& grouping) {
+    compiledExpr = compile(*grouping.expression);
+}
+
+void ClosureCompiler::visit(const Unary& unary) {
+    auto right = compile(*unary.right);
+    switch (unary.op.type) {
+        case TokenType::MINUS:
+            compiledExpr = [right = std::move(right)](Interpreter& I) -> Value {
+                Value value = right(I);
+                return - std::get<double>(value);
+            };
+            break;
+        case TokenType::BANG:
+            compiledExpr = [right = std::move(right)](Interpreter& I) -> Value {
+                return !is_truthy(right(I));
+            };
+            break;
+        default:
+            compiledExpr = [right = std::move(right)](Interpreter& I) -> Value {
+                right(I);
+                return nullptr;
+            };
+    }
+}
+
+void ClosureCompiler::visit(const Binary& expr) {
+    auto left = compile(*expr.left);
+    auto right = compile(*expr.right);
+    switch (expr.op.type) {
+        case TokenType::MINUS:
+            compiledExpr = numeric(std::move(left), std::move(right), *expr.right, std::minus<>());
+            return;
+        case TokenType::STAR:
+            compiledExpr = numeric(std::move(left), std::move(right), *expr.right, std::multiplies<>());
+            return;
+        case TokenType::SLASH:
+            compiledExpr = numeric(std::move(left), std::move(right), *expr.right, std::divides<>());
+            return;
+        case TokenType::GREATER:
+            compiledExpr = numeric(std::move(left), std::move(right), *expr.right, std::greater<>());
+            return;
+        case TokenType::GREATER_EQUAL:
+            compiledExpr = numeric(std::move(left), std::move(right), *expr.right, std::greater_equal<>());
+            return;
+        case TokenType::LESS:
+            compiledExpr = numeric(std::move(left), std::move(right), *expr.right, std::less<>());
+            return;
+        case TokenType::LESS_EQUAL:
+            compiledExpr = numeric(std::move(left), std::move(right), *expr.right, std::less_equal<>());
+            return;
+        case TokenType::PLUS:
+            compiledExpr = [left = std::move(left), right = std::move(right), op = &expr.op](Interpreter& I) -> Value {
+                Value l = left(I);
+                Value r = right(I);
+                if (std::holds_alternative<double>(l) && std::holds_alternative<double>(r)) {
+                    return std::get<double>(l) + std::get<double>(r);
+                }
+                return Interpreter::binary(*op, l, r);
+            };
+            return;
+        default:
+            compiledExpr = [left = std::move(left), right = std::move(right), op = &expr.op](Interpreter& I) {
+                Value l = left(I);
+                Value r = right(I);
+                return Interpreter::binary(*op, l, r);
+            };
+    }
+}
+
+void ClosureCompiler::visit(const Logical& logical) {
+    auto left = compile(*logical.left);
+    auto right = compile(*logical.right);
+    if (logical.op.type == TokenType::OR) {
+        compiledExpr = [left = std::move(left), right = std::move(right)](Interpreter& I) {
+            Value value = left(I);
+            return is_truthy(value) ? value : right(I);
+        };
+    } else if (logical.op.type == TokenType::AND) {
+        compiledExpr = [left = std::move(left), right = std::move(right)](Interpreter& I) {
+            Value value = left(I);
+            return is_truthy(value) ? right(I) : value;
+        };
+    } else {
+        throw std::runtime_error("Invalid logical operator");
+    }
+}
+
+void ClosureCompiler::visit(const Ternary& ternary) {
+    compiledExpr = [condition = compile(*ternary.condition),
+                    thenBranch = compile(*ternary.thenBranch),
+                    elseBranch = compile(*ternary.elseBranch)](Interpreter& I) {
+        return is_truthy(condition(I)) ? thenBranch(I) : elseBranch(I);
+    };
+}
+
+void ClosureCompiler::visit(const Variable& variable) {
+    if (variable.location.isLocal()) {
+        compiledExpr = readLocal(hops(variable.location.distance), variable.location.index);
+        return;
+    }
+    compiledExpr = [name = &variable.name](Interpreter& I) { return I.globals->get(*name); };
+}
+
+void ClosureCompiler::visit(const Assignment& assignment) {
+    auto right = compile(*assignment.right);
+    if (assignment.location.isLocal()) {
+        compiledExpr = [right = std::move(right), hops = hops(assignment.location.distance),
+                        index = assignment.location.index](Interpreter& I) {
+            Value value = right(I);
+            writeLocal(I, hops, index, value);
+            return value;
+        };
+        return;
+    }
+    compiledExpr = [right = std::move(right), name = &assignment.name](Interpreter& I) {
+        Value value = right(I);
+        I.globals->assign(*name, value);
+        return value;
+    };
+}
+
+void ClosureCompiler::visit(const Postfix& postfix) {
+    auto op = &postfix.op;
+    if (auto variable = dynamic_cast<const Variable*>(postfix.operand.get())) {
+        if (variable->location.isLocal()) {
+            compiledExpr = [op, hops = hops(variable->location.distance),
+                            index = variable->location.index](Interpreter& I) {
+                Value slot = I.env->getAt(hops, index);
+                Value oldValue = Interpreter::postfixStep(slot, *op);
+                writeLocal(I, hops, index, slot);
+                return oldValue;
+            };
+            return;
+        }
+        compiledExpr = [op, name = &variable->name](Interpreter& I) {
+            Value slot = I.globals->get(*name);
+            Value oldValue = Interpreter::postfixStep(slot, *op);
+            I.globals->assign(*name, slot);
+            return oldValue;
+        };
+        return;
+    }
+
+    if (auto subscript = dynamic_cast<const Subscript*>(postfix.operand.get())) {
+        compiledExpr = [op, object = compile(*subscript->object), index = compile(*subscript->index),
+                        bracket = &subscript->bracket](Interpreter& I) {
+            Value obj = object(I);
+            Value key = index(I);
+            return Interpreter::postfixElement(obj, key, *op, *bracket);
+        };
+        return;
+    }
+
+    if (auto property = dynamic_cast<const PropertyAccess*>(postfix.operand.get())) {
+        compiledExpr = [op, object = compile(*property->object), name = &property->name](Interpreter& I) {
+            Value obj = object(I);
+            return Interpreter::postfixProperty(obj, *op, *name);
+        };
+        return;
+    }
+
+    compiledExpr = [op](Interpreter&) -> Value {
+        throw RuntimeError(*op, "Invalid assignment target for postfix operator");
+    };
+}
+
+void ClosureCompiler::visit(const Call& call) {
+    auto callee = compile(*call.callee);
+    std::vector<Eval> arguments;
+    arguments.reserve(call.arguments.size());
+    for (auto& argument : call.arguments) {
+        arguments.push_back(compile(*argument));
+    }
+    compiledExpr = [callee = std::move(callee), arguments = std::move(arguments),
+                    paren = &call.paren](Interpreter& I) {
+        Value function = callee(I);
+        std::vector<Value> values;
+        values.reserve(arguments.size());
+        for (auto& argument : arguments) {
+            values.push_back(argument(I));
+        }
+        if (!std::holds_alternative<LoxCallable*>(function)) {
+            throw RuntimeError(*paren, "Can only call functions and classes.");
+        }
+        auto f = std::get<LoxCallable*>(function);
+        // arity -1 means variable number of arguments
+        if (f->arity() != -1 && f->arity() != static_cast<int>(values.size())) {
+            throw RuntimeError(*paren, std::format("expected {} arguments but got {}", f->arity(), values.size()));
+        }
+        return f->call(&I, std::move(values));
+    };
+}
+
+void ClosureCompiler::visit(const ArrayLiteral& alit) {
+    std::vector<Eval> elements;
+    elements.reserve(alit.elements.size());
+    for (auto& element : alit.elements) {
+        elements.push_back(compile(*element));
+    }
+    compiledExpr = [elements = std::move(elements)](Interpreter& I) -> Value {
+        std::vector<Value> values;
+        values.reserve(elements.size());
+        for (auto& element : elements) {
+            values.push_back(element(I));
+        }
+        return std::make_shared<Array>(values);
+    };
+}
+
+void ClosureCompiler::visit(const MapLiteral& mlit) {
+    std::vector<std::pair<Eval, Eval>> pairs;
+    pairs.reserve(mlit.pairs.size());
+    for (auto& pair : mlit.pairs) {
+        auto key = compile(*pair.first);
+        pairs.emplace_back(std::move(key), compile(*pair.second));
+    }
+    compiledExpr = [pairs = std::move(pairs)](Interpreter& I) -> Value {
+        std::unordered_map<Value, Value> values;
+        values.reserve(pairs.size());
+        for (auto& pair : pairs) {
+            Value key = pair.first(I);
+            Value val = pair.second(I);
+            if (!std::holds_alternative<std::nullptr_t>(val)) // nil cannot be value in a map
+                values[key] = val;
+        }
+        return std::make_shared<Map>(values);
+    };
+}
+
+void ClosureCompiler::visit(const Subscript& sub) {
+    compiledExpr = [object = compile(*sub.object), index = compile(*sub.index),
+                    bracket = &sub.bracket](Interpreter& I) {
+        Value obj = object(I);
+        Value key = index(I);
+        return Interpreter::subscript(obj, key, *bracket);
+    };
+}
+
+void ClosureCompiler::visit(const SubscriptAssignment& assignment) {
+    compiledExpr = [object = compile(*assignment.object), index = compile(*assignment.index),
+                    value = compile(*assignment.value), bracket = &assignment.bracket](Interpreter& I) {
+        Value obj = object(I);
+        Value key = index(I);
+        Value val = value(I);
+        return Interpreter::assignSubscript(obj, key, val, *bracket);
+    };
+}
+
+void ClosureCompiler::visit(const PropertyAccess& prop) {
+    compiledExpr = [object = compile(*prop.object), name = &prop.name](Interpreter& I) {
+        Value obj = object(I);
+        return Interpreter::property(obj, *name);
+    };
+}
+
+void ClosureCompiler::visit(const FunctionExpr& expr) {
+    compiledExpr = [function = compileFunction("", expr.params, *expr.body)](Interpreter& I) -> Value {
+        LoxCallable* callable = new CompiledFunction(function, I.env); // leaks like the interpreter's do
+        return callable;
+    };
+}
+
+
+void ClosureCompiler::visit(const ExpressionStmt& exprStmt) {
+    compiledStmt = [expr = compile(*exprStmt.expr)](Interpreter& I, Value&) {
+        expr(I);
+        return Flow::Normal;
+    };
+}
+
+void ClosureCompiler::visit(const PrintStmt& printStmt) {
+    compiledStmt = [expr = compile(*printStmt.expr)](Interpreter& I, Value&) {
+        std::cout << expr(I) << std::endl;
+        return Flow::Normal;
+    };
+}
+
+void ClosureCompiler::visit(const VarStmt& varStmt) {
+    Eval initializer;
+    if (varStmt.initializer != nullptr) {
+        initializer = compile(*varStmt.initializer);
+    }
+    if (scopes.empty()) {
+        compiledStmt = [initializer = std::move(initializer), name = varStmt.name.lexeme](Interpreter& I, Value&) {
+            I.env->define(name, initializer ? initializer(I) : Value(nullptr));
+            return Flow::Normal;
+        };
+        return;
+    }
+    compiledStmt = [initializer = std::move(initializer)](Interpreter& I, Value&) {
+        I.env->push(initializer ? initializer(I) : Value(nullptr));
+        return Flow::Normal;
+    };
+}
+
+void ClosureCompiler::visit(const BlockStmt& block) {
+    bool hasEnvironment = std::any_of(block.statements.begin(), block.statements.end(),
+                                      [](auto& stmt) { return declares(*stmt); });
+    scopes.push_back(hasEnvironment);
+    auto body = compileSequence(block.statements);
+    scopes.pop_back();
+    if (!hasEnvironment) {
+        compiledStmt = std::move(body);
+        return;
+    }
+    compiledStmt = [body = std::move(body)](Interpreter& I, Value& returned) {
+        EnvGuard guard(I, std::make_shared<Environment>(I.env));
+        return body(I, returned);
+    };
+}
+
+void ClosureCompiler::visit(const IfStmt& ifStmt) {
+    auto condition = compile(*ifStmt.condition);
+    auto thenBlock = compile(*ifStmt.thenBlock);
+    if (ifStmt.elseBlock == nullptr) {
+        compiledStmt = [condition = std::move(condition), thenBlock = std::move(thenBlock)](Interpreter& I, Value& returned) {
+            return is_truthy(condition(I)) ? thenBlock(I, returned) : Flow::Normal;
+        };
+        return;
+    }
+    compiledStmt = [condition = std::move(condition), thenBlock = std::move(thenBlock),
+                    elseBlock = compile(*ifStmt.elseBlock)](Interpreter& I, Value& returned) {
+        return is_truthy(condition(I)) ? thenBlock(I, returned) : elseBlock(I, returned);
+    };
+}
+
+void ClosureCompiler::visit(const WhileStmt& whileStmt) {
+    Eval increment;
+    if (whileStmt.increment) {
+        increment = compile(*whileStmt.increment);
+    }
+    compiledStmt = [condition = compile(*whileStmt.condition), body = compile(*whileStmt.body),
+                    increment = std::move(increment)](Interpreter& I, Value& returned) {
+        while (is_truthy(condition(I))) {
+            Flow flow;
+            // a break or continue can still be thrown out of a function called in the body
+            try {
+                flow = body(I, returned);
+            } catch (const Break&) {
+                flow = Flow::Break;
+            } catch (const Continue&) {
+                flow = Flow::Continue;
+            }
+            if (flow == Flow::Break) {
+                break;
+            }
+            if (flow == Flow::Return) {
+                return flow;
+            }
+            if (increment) {
+                increment(I);
+            }
+        }
+        return Flow::Normal;
+    };
+}
+
+void ClosureCompiler::visit(const FunctionStmt& stmt) {
+    // the name is declared before the body is resolved, so it is in scope there
+    auto function = compileFunction(stmt.name.lexeme, stmt.params, *stmt.body);
+    if (scopes.empty()) {
+        compiledStmt = [function = std::move(function)](Interpreter& I, Value&) {
+            LoxCallable* callable = new CompiledFunction(function, I.env);
+            I.env->define(function->name, callable);
+            return Flow::Normal;
+        };
+        return;
+    }
+    compiledStmt = [function = std::move(function)](Interpreter& I, Value&) {
+        LoxCallable* callable = new CompiledFunction(function, I.env);
+        I.env->push(callable);
+        return Flow::Normal;
+    };
+}
+
+void ClosureCompiler::visit(const ReturnStmt& returnStmt) {
+    if (returnStmt.value == nullptr) {
+        compiledStmt = [](Interpreter&, Value& returned) {
+            returned = nullptr;
+            return Flow::Return;
+        };
+        return;
+    }
+    compiledStmt = [value = compile(*returnStmt.value)](Interpreter& I, Value& returned) {
+        returned = value(I);
+        return Flow::Return;
+    };
+}
+
+void ClosureCompiler::visit(const BreakStmt&) {
+    compiledStmt = [](Interpreter&, Value&) { return Flow::Break; };
+}
+
+void ClosureCompiler::visit(const ContinueStmt&) {
+    compiledStmt = [](Interpreter&, Value&) { return Flow::Continue; };
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "expr.hpp"
+#include "statement.hpp"
+#include "interpreter.hpp"
+
+// Turns a resolved program into a tree of closures once and runs that
+// instead of visiting the AST (`rhythm --closures`). Every node becomes a
+// lambda bound to what the resolver and the operator already decided: the
+// slot a variable lives in, which arithmetic to do, which constant is the
+// right operand. Running it is one indirect call per node, with no visitor
+// double dispatch and no result parked in the interpreter between calls.
+//
+// Values, environments and natives are the interpreter's own, and operators
+// go through the same Interpreter helpers, so a program prints and fails as
+// it does when interpreted. Two things differ underneath: `return`, `break`
+// and `continue` are reported to the enclosing statement instead of thrown,
+// and a block that declares nothing runs in the environment it is in
+// instead of a new, empty one.
+class ClosureCompiler: ExprVisitor, StmtVisitor {
+public:
+    // how a statement finished; anything but Normal unwinds to the loop or
+    // function that handles it
+    enum class Flow { Normal, Break, Continue, Return };
+
+    using Eval = std::function<Value(Interpreter&)>;
+    // a statement that returns stores the value in its second argument
+    using Exec = std::function<Flow(Interpreter&, Value&)>;
+
+    struct Function {
+        std::string name; // empty for a function expression
+        int arity;
+        std::vector<Exec> body;
+    };
+
+    explicit ClosureCompiler(Interpreter& interpreter) : interpreter(interpreter) {}
+
+    // compiles the top-level statements, then runs them
+    void run(const std::vector<std::unique_ptr<Stmt>>& stmts);
+
+private:
+    Interpreter& interpreter;
+    Eval compiledExpr;
+    Exec compiledStmt;
+    // one entry per scope the resolver opened around the node being compiled:
+    // whether it gets an Environment at run time
+    std::vector<bool> scopes;
+
+    Eval compile(const Expr& expr);
+    Exec compile(const Stmt& stmt);
+    Exec compileSequence(const std::vector<std::unique_ptr<Stmt>>& stmts);
+    std::shared_ptr<const Function> compileFunction(const std::string& name,
+                                                    const std::vector<Token>& params,
+                                                    const BlockStmt& body);
+    // environments to walk up from the current one to reach a variable the
+    // resolver placed `distance` scopes out, skipping scopes that have none
+    int hops(int distance) const;
+
+    void visit(const Binary&) override;
+    void visit(const Logical&) override;
+    void visit(const Ternary&) override;
+    void visit(const Grouping&) override;
+    void visit(const Literal&) override;
+    void visit(const Unary&) override;
+    void visit(const Postfix&) override;
+    void visit(const Variable&) override;
+    void visit(const Assignment&) override;
+    void visit(const SubscriptAssignment&) override;
+    void visit(const Call&) override;
+    void visit(const ArrayLiteral&) override;
+    void visit(const MapLiteral&) override;
+    void visit(const Subscript&) override;
+    void visit(const PropertyAccess&) override;
+    void visit(const FunctionExpr&) override;
+
+    void visit(const ExpressionStmt&) override;
+    void visit(const PrintStmt&) override;
+    void visit(const VarStmt&) override;
+    void visit(const BlockStmt&) override;
+    void visit(const IfStmt&) override;
+    void visit(const WhileStmt&) override;
+    void visit(const FunctionStmt&) override;
+    void visit(const ReturnStmt&) override;
+    void visit(const ContinueStmt&) override;
+    void visit(const BreakStmt&) override;
+};
@@ -0,0 +1,265 @@
+#include "constant_folder.hpp"
+
+#include <cmath>
+#include <limits>
+
+namespace {
+
+const Literal* asLiteral(const std::unique_ptr<Expr>& expr) {
+    return dynamic_cast<const Literal*>(expr.get());
+}
+
+bool isTerminator(const Stmt& stmt) {
+    return dynamic_cast<const ReturnStmt*>(&stmt) || dynamic_cast<const BreakStmt*>(&stmt)
+        || dynamic_cast<const ContinueStmt*>(&stmt);
+}
+
+bool isNaN(const Value& value) {
+    return std::holds_alternative<double>(value) && std::isnan(std::get<double>(value));
+}
+
+bool fitsInInt(double x) {
+    return x >= std::numeric_limits<int>::min() && x <= std::numeric_limits<int>::max();
+}
+
+}
+
+void ConstantFolder::fold(std::vector<std::unique_ptr<Stmt>>& statements) {
+    foldBlock(statements);
+}
+
+void ConstantFolder::foldBlock(std::vector<std::unique_ptr<Stmt>>& statements) {
+    std::vector<std::unique_ptr<Stmt>> kept;
+    kept.reserve(statements.size());
+    for (auto& stmt : statements) {
+        auto folded = foldStatement(std::move(stmt));
+        if (!folded) continue;
+        bool terminates = isTerminator(*folded);
+        kept.push_back(std::move(folded));
+        if (terminates) break; // the rest of the block is unreachable
+    }
+    statements = std::move(kept);
+}
+
+std::unique_ptr<Stmt> ConstantFolder::foldStatement(std::unique_ptr<Stmt> stmt) {
+    if (auto* exprStmt = dynamic_cast<ExpressionStmt*>(stmt.get())) {
+        foldExpression(exprStmt->expr);
+        if (asLiteral(exprStmt->expr)) return nullptr; // no side effects
+        return stmt;
+    }
+    if (auto* print = dynamic_cast<PrintStmt*>(stmt.get())) {
+        foldExpression(print->expr);
+        return stmt;
+    }
+    if (auto* var = dynamic_cast<VarStmt*>(stmt.get())) {
+        if (var->initializer) foldExpression(var->initializer);
+        return stmt;
+    }
+    if (auto* block = dynamic_cast<BlockStmt*>(stmt.get())) {
+        foldBlock(block->statements);
+        return stmt;
+    }
+    if (auto* ifStmt = dynamic_cast<IfStmt*>(stmt.get())) {
+        foldExpression(ifStmt->condition);
+        ifStmt->thenBlock = foldStatement(std::move(ifStmt->thenBlock));
+        if (ifStmt->elseBlock) ifStmt->elseBlock = foldStatement(std::move(ifStmt->elseBlock));
+        if (const auto* condition = asLiteral(ifStmt->condition)) {
+            return is_truthy(condition->value) ? std::move(ifStmt->thenBlock) : std::move(ifStmt->elseBlock);
+        }
+        if (!ifStmt->thenBlock) {
+            ifStmt->thenBlock = BlockStmt::create({}, ifStmt->condition->get_line());
+        }
+        return stmt;
+    }
+    if (auto* whileStmt = dynamic_cast<WhileStmt*>(stmt.get())) {
+        foldExpression(whileStmt->condition);
+        if (const auto* condition = asLiteral(whileStmt->condition); condition && !is_truthy(condition->value)) {
+            return nullptr;
+        }
+        whileStmt->body = foldStatement(std::move(whileStmt->body));
+        if (!whileStmt->body) {
+            whileStmt->body = BlockStmt::create({}, whileStmt->condition->get_line());
+        }
+        if (whileStmt->increment) foldExpression(whileStmt->increment);
+        return stmt;
+    }
+    if (auto* function = dynamic_cast<FunctionStmt*>(stmt.get())) {
+        foldBlock(function->body->statements);
+        return stmt;
+    }
+    if (auto* ret = dynamic_cast<ReturnStmt*>(stmt.get())) {
+        if (ret->value) foldExpression(ret->value);
+        return stmt;
+    }
+    return stmt; // break, continue
+}
+
+void ConstantFolder::foldExpression(std::unique_ptr<Expr>& expr) {
+    if (auto* binary = dynamic_cast<Binary*>(expr.get())) {
+        foldExpression(binary->left);
+        foldExpression(binary->right);
+        const auto* left = asLiteral(binary->left);
+        const auto* right = asLiteral(binary->right);
+        Value result;
+        if (left && right && foldBinary(binary->op, left->value, right->value, result)) {
+            expr = Literal::create(result, binary->op.line);
+        }
+        return;
+    }
+    if (auto* logical = dynamic_cast<Logical*>(expr.get())) {
+        foldExpression(logical->left);
+        foldExpression(logical->right);
+        if (const auto* left = asLiteral(logical->left)) {
+            // and/or yield one of their operands, not a bool
+            bool shortCircuits = logical->op.type == TokenType::AND ? !is_truthy(left->value) : is_truthy(left->value);
+            expr = std::move(shortCircuits ? logical->left : logical->right);
+        }
+        return;
+    }
+    if (auto* ternary = dynamic_cast<Ternary*>(expr.get())) {
+        foldExpression(ternary->condition);
+        foldExpression(ternary->thenBranch);
+        foldExpression(ternary->elseBranch);
+        if (const auto* condition = asLiteral(ternary->condition)) {
+            expr = std::move(is_truthy(condition->value) ? ternary->thenBranch : ternary->elseBranch);
+        }
+        return;
+    }
+    if (auto* grouping = dynamic_cast<Grouping*>(expr.get())) {
+        foldExpression(grouping->expression);
+        if (asLiteral(grouping->expression)) {
+            expr = std::move(grouping->expression);
+        }
+        return;
+    }
+    if (auto* unary = dynamic_cast<Unary*>(expr.get())) {
+        foldExpression(unary->right);
+        const auto* right = asLiteral(unary->right);
+        Value result;
+        if (right && foldUnary(unary->op, right->value, result)) {
+            expr = Literal::create(result, unary->op.line);
+        }
+        return;
+    }
+    if (auto* postfix = dynamic_cast<Postfix*>(expr.get())) {
+        foldExpression(postfix->operand); // an lvalue; only its subexpressions can fold
+        return;
+    }
+    if (auto* assignment = dynamic_cast<Assignment*>(expr.get())) {
+        foldExpression(assignment->right);
+        return;
+    }
+    if (auto* assignment = dynamic_cast<SubscriptAssignment*>(expr.get())) {
+        foldExpression(assignment->object);
+        foldExpression(assignment->index);
+        foldExpression(assignment->value);
+        return;
+    }
+    if (auto* call = dynamic_cast<Call*>(expr.get())) {
+        foldExpression(call->callee);
+        for (auto& argument : call->arguments) {
+            foldExpression(argument);
+        }
+        return;
+    }
+    if (auto* array = dynamic_cast<ArrayLiteral*>(expr.get())) {
+        for (auto& element : array->elements) {
+            foldExpression(element);
+        }
+        return;
+    }
+    if (auto* map = dynamic_cast<MapLiteral*>(expr.get())) {
+        for (auto& [key, value] : map->pairs) {
+            foldExpression(key);
+            foldExpression(value);
+        }
+        return;
+    }
+    if (auto* subscript = dynamic_cast<Subscript*>(expr.get())) {
+        foldExpression(subscript->object);
+        foldExpression(subscript->index);
+        return;
+    }
+    if (auto* property = dynamic_cast<PropertyAccess*>(expr.get())) {
+        foldExpression(property->object);
+        return;
+    }
+    if (auto* function = dynamic_cast<FunctionExpr*>(expr.get())) {
+        foldBlock(function->body->statements);
+        return;
+    }
+    // Literal, Variable: nothing to fold
+}
+
+// Mirrors the VM opcodes the compiler would otherwise emit for op; returns
+// false whenever the VM would raise an error instead of producing a value.
+bool ConstantFolder::foldBinary(const Token& op, const Value& left, const Value& right, Value& out) {
+    bool numbers = std::holds_alternative<double>(left) && std::holds_alternative<double>(right);
+    bool strings = std::holds_alternative<std::string>(left) && std::holds_alternative<std::string>(right);
+    // NaN is an error operand for the JavaScript runtime; inf - inf and 0 / 0 produce one
+    if (isNaN(left) || isNaN(right)) return false;
+    switch (op.type) {
+        case TokenType::PLUS:
+            if (numbers) {
+                out = std::get<double>(left) + std::get<double>(right);
+                return !isNaN(out);
+            }
+            if (strings) {
+                out = std::get<std::string>(left) + std::get<std::string>(right);
+                return true;
+            }
+            return false;
+        case TokenType::MINUS:
+            if (!numbers) return false;
+            out = std::get<double>(left) - std::get<double>(right);
+            return !isNaN(out);
+        case TokenType::STAR:
+            if (!numbers) return false;
+            out = std::get<double>(left) * std::get<double>(right);
+            return !isNaN(out);
+        case TokenType::SLASH:
+            if (!numbers) return false;
+            out = std::get<double>(left) / std::get<double>(right);
+            return !isNaN(out);
+        case TokenType::PERCENT: {
+            if (!numbers) return false;
+            double l = std::get<double>(left);
+            double r = std::get<double>(right);
+            if (!is_integer(l) || !is_integer(r) || !fitsInInt(l) || !fitsInInt(r) || r == 0) return false;
+            out = (double)((int)l % (int)r);
+            return true;
+        }
+        case TokenType::EQUAL_EQUAL:
+            out = left == right;
+            return true;
+        case TokenType::BANG_EQUAL:
+            out = !(left == right);
+            return true;
+        // >= and <= compile to the negation of < and >
+        case TokenType::GREATER:
+        case TokenType::LESS_EQUAL:
+        case TokenType::LESS:
+        case TokenType::GREATER_EQUAL: {
+            if (!numbers) return false; // the JavaScript runtime only compares numbers
+            bool greater = op.type == TokenType::GREATER || op.type == TokenType::LESS_EQUAL;
+            bool result = greater ? std::get<double>(left) > std::get<double>(right) : std::get<double>(left) < std::get<double>(right);
+            bool negated = op.type == TokenType::LESS_EQUAL || op.type == TokenType::GREATER_EQUAL;
+            out = negated ? !result : result;
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+bool ConstantFolder::foldUnary(const Token& op, const Value& right, Value& out) {
+    if (op.type == TokenType::MINUS && std::holds_alternative<double>(right) && !isNaN(right)) {
+        out = -std::get<double>(right);
+        return true;
+    }
+    if (op.type == TokenType::BANG) {
+        out = !is_truthy(right);
+        return true;
+    }
+    return false;
+}
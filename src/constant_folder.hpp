@@ -0,0 +1,29 @@
+#pragma once
+#include <memory>
+#include <vector>
+
+#include "expr.hpp"
+#include "statement.hpp"
+
+// Folding pass between the parser and the beat compiler.
+// Rewrites the AST in place: operators applied to literals become literals,
+// branches on constant conditions are resolved, and statements that can never
+// run (after return/break/continue, inside if (false) or while (false)) are
+// dropped. Anything whose evaluation would raise a runtime error in the VM
+// (e.g. "a" - 1, 5 % 0) is left alone so that the error still happens.
+// The result has to hold for every backend, so operations the JavaScript
+// runtime treats differently (comparing strings, NaN operands) are kept too.
+class ConstantFolder {
+public:
+    void fold(std::vector<std::unique_ptr<Stmt>>& statements);
+
+    // also used by the SSA constant propagation in src/ir
+    static bool foldBinary(const Token& op, const Value& left, const Value& right, Value& out);
+    static bool foldUnary(const Token& op, const Value& right, Value& out);
+
+private:
+    void foldBlock(std::vector<std::unique_ptr<Stmt>>& statements);
+    // returns the statement to keep in place of stmt, or nullptr to drop it
+    std::unique_ptr<Stmt> foldStatement(std::unique_ptr<Stmt> stmt);
+    void foldExpression(std::unique_ptr<Expr>& expr);
+};
@@ -0,0 +1,269 @@
+#include "escape_analysis.hpp"
+
+#include <utility>
+
+#include "native_properties.hpp"
+
+namespace {
+
+bool isEquality(TokenType type) {
+    return type == TokenType::EQUAL_EQUAL || type == TokenType::BANG_EQUAL;
+}
+
+}
+
+void EscapeAnalysis::analyze(const std::vector<std::unique_ptr<Stmt>>& statements,
+                             const std::function<bool(const std::string&)>& predefined) {
+    AssignedNames assigned;
+    assigned.walk(statements);
+    programGlobals = {assigned.names.begin(), assigned.names.end()};
+    std::unordered_map<std::string, int> declarationCount;
+    for (const auto& stmt : statements) {
+        if (const auto* var = dynamic_cast<const VarStmt*>(stmt.get())) {
+            programGlobals.insert(var->name.lexeme);
+            declarationCount[var->name.lexeme]++;
+        }
+        if (const auto* function = dynamic_cast<const FunctionStmt*>(stmt.get())) {
+            programGlobals.insert(function->name.lexeme);
+            declarationCount[function->name.lexeme]++;
+        }
+    }
+    for (const auto& stmt : statements) {
+        const auto* function = dynamic_cast<const FunctionStmt*>(stmt.get());
+        if (!function) continue;
+        const auto& name = function->name.lexeme;
+        if (declarationCount[name] != 1 || assigned.names.count(name) || predefined(name)) continue;
+        knownFunctions[name] = function;
+        paramEscapes[function].assign(function->params.size(), false);
+    }
+
+    // summaries only ever go from "stays" to "escapes", so this terminates
+    do {
+        changed = false;
+        declarations.clear();
+        scopes.clear();
+        sites.clear();
+        walk(statements);
+    } while (changed);
+
+    for (const auto& site : sites) {
+        if (site.owner < 0 || !declarations[site.owner].escapes) {
+            frameLocal.insert(site.node);
+        }
+    }
+}
+
+void EscapeAnalysis::use(const Expr& expr, bool keepsInFrame) {
+    auto enclosingContained = std::exchange(contained, keepsInFrame);
+    auto enclosingOwner = std::exchange(owner, -1);
+    expr.accept(*this);
+    contained = enclosingContained;
+    owner = enclosingOwner;
+}
+
+void EscapeAnalysis::allocation(const void* node) {
+    if (contained) sites.push_back({node, owner});
+}
+
+int EscapeAnalysis::declare(const std::string& name) {
+    int index = declarations.size();
+    declarations.push_back({functionDepth});
+    scopes.back()[name] = index;
+    return index;
+}
+
+int EscapeAnalysis::resolve(const std::string& name) const {
+    for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+        auto it = scope->find(name);
+        if (it != scope->end()) return it->second;
+    }
+    return -1;
+}
+
+void EscapeAnalysis::walkFunction(const FunctionStmt* summarized, const std::vector<Token>& params, const BlockStmt& body) {
+    functionDepth++;
+    scopes.emplace_back();
+    std::vector<int> indices;
+    for (const auto& param : params) {
+        indices.push_back(declare(param.lexeme));
+    }
+    body.accept(*this);
+    scopes.pop_back();
+    functionDepth--;
+
+    if (!summarized) return;
+    auto& escapes = paramEscapes[summarized];
+    for (size_t i = 0; i < indices.size(); i++) {
+        if (declarations[indices[i]].escapes && !escapes[i]) {
+            escapes[i] = true;
+            changed = true;
+        }
+    }
+}
+
+bool EscapeAnalysis::argumentStays(const Call& call, size_t index) const {
+    const auto* variable = dynamic_cast<const Variable*>(call.callee.get());
+    if (!variable || resolve(variable->name.lexeme) >= 0) return false;
+    const auto& name = variable->name.lexeme;
+    auto known = knownFunctions.find(name);
+    if (known != knownFunctions.end()) {
+        const auto& escapes = paramEscapes.at(known->second);
+        return call.arguments.size() == escapes.size() && !escapes[index];
+    }
+    const auto* native = nativeProperties(name);
+    if (!native || programGlobals.count(name)) return false;
+    return native->keeps == NativeProperties::ALL_ARGUMENTS || native->keeps == (int)index;
+}
+
+void EscapeAnalysis::visit(const Binary& expr) {
+    bool keeps = isEquality(expr.op.type);
+    use(*expr.left, keeps);
+    use(*expr.right, keeps);
+}
+
+// the value of `a or b` is one of the operands
+void EscapeAnalysis::visit(const Logical& expr) {
+    expr.left->accept(*this);
+    expr.right->accept(*this);
+}
+
+void EscapeAnalysis::visit(const Ternary& expr) {
+    use(*expr.condition, true);
+    expr.thenBranch->accept(*this);
+    expr.elseBranch->accept(*this);
+}
+
+void EscapeAnalysis::visit(const Grouping& expr) {
+    expr.expression->accept(*this);
+}
+
+void EscapeAnalysis::visit(const Unary& expr) {
+    use(*expr.right, true);
+}
+
+void EscapeAnalysis::visit(const Postfix& expr) {
+    if (const auto* subscript = dynamic_cast<const Subscript*>(expr.operand.get())) {
+        use(*subscript->object, true);
+        use(*subscript->index, false);
+    } else if (const auto* property = dynamic_cast<const PropertyAccess*>(expr.operand.get())) {
+        use(*property->object, true);
+    }
+}
+
+// Reading a local of another function means a closure captured it, and
+// reading one into another local loses track of it.
+void EscapeAnalysis::visit(const Variable& expr) {
+    int index = resolve(expr.name.lexeme);
+    if (index < 0) return;
+    auto& declaration = declarations[index];
+    if (declaration.function != functionDepth || !contained || owner >= 0) {
+        declaration.escapes = true;
+    }
+}
+
+void EscapeAnalysis::visit(const Assignment& expr) {
+    use(*expr.right, false);
+}
+
+void EscapeAnalysis::visit(const Call& expr) {
+    use(*expr.callee, true);
+    for (size_t i = 0; i < expr.arguments.size(); i++) {
+        use(*expr.arguments[i], argumentStays(expr, i));
+    }
+}
+
+void EscapeAnalysis::visit(const ArrayLiteral& expr) {
+    allocation(&expr);
+    for (const auto& element : expr.elements) {
+        use(*element, false);
+    }
+}
+
+void EscapeAnalysis::visit(const MapLiteral& expr) {
+    allocation(&expr);
+    for (const auto& [key, value] : expr.pairs) {
+        use(*key, false);
+        use(*value, false);
+    }
+}
+
+void EscapeAnalysis::visit(const Subscript& expr) {
+    use(*expr.object, true);
+    use(*expr.index, false);
+}
+
+void EscapeAnalysis::visit(const PropertyAccess& expr) {
+    use(*expr.object, true);
+}
+
+void EscapeAnalysis::visit(const SubscriptAssignment& expr) {
+    use(*expr.object, true);
+    use(*expr.index, false);
+    use(*expr.value, false);
+}
+
+void EscapeAnalysis::visit(const FunctionExpr& expr) {
+    allocation(&expr);
+    walkFunction(nullptr, expr.params, *expr.body);
+}
+
+void EscapeAnalysis::visit(const ExpressionStmt& stmt) {
+    use(*stmt.expr, true);
+}
+
+void EscapeAnalysis::visit(const PrintStmt& stmt) {
+    use(*stmt.expr, true);
+}
+
+void EscapeAnalysis::visit(const VarStmt& stmt) {
+    if (scopes.empty()) { // a global
+        if (stmt.initializer) use(*stmt.initializer, false);
+        return;
+    }
+    int index = declarations.size();
+    declarations.push_back({functionDepth});
+    if (stmt.initializer) {
+        // the initializer is in scope only after the declaration
+        auto enclosingContained = std::exchange(contained, true);
+        auto enclosingOwner = std::exchange(owner, index);
+        stmt.initializer->accept(*this);
+        contained = enclosingContained;
+        owner = enclosingOwner;
+    }
+    scopes.back()[stmt.name.lexeme] = index;
+}
+
+void EscapeAnalysis::visit(const BlockStmt& stmt) {
+    scopes.emplace_back();
+    walk(stmt.statements);
+    scopes.pop_back();
+}
+
+void EscapeAnalysis::visit(const IfStmt& stmt) {
+    use(*stmt.condition, true);
+    stmt.thenBlock->accept(*this);
+    if (stmt.elseBlock) stmt.elseBlock->accept(*this);
+}
+
+void EscapeAnalysis::visit(const WhileStmt& stmt) {
+    use(*stmt.condition, true);
+    stmt.body->accept(*this);
+    if (stmt.increment) use(*stmt.increment, true);
+}
+
+void EscapeAnalysis::visit(const FunctionStmt& stmt) {
+    if (scopes.empty()) { // a global
+        auto known = knownFunctions.find(stmt.name.lexeme);
+        bool summarized = known != knownFunctions.end() && known->second == &stmt;
+        walkFunction(summarized ? &stmt : nullptr, stmt.params, *stmt.body);
+        return;
+    }
+    // declared before its body, so a recursive reference counts as a capture
+    int index = declare(stmt.name.lexeme);
+    sites.push_back({&stmt, index});
+    walkFunction(nullptr, stmt.params, *stmt.body);
+}
+
+void EscapeAnalysis::visit(const ReturnStmt& stmt) {
+    if (stmt.value) use(*stmt.value, false);
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "ast_walker.hpp"
+
+// Finds the array literals, map literals and closures whose value can never
+// outlive the frame that creates them, so the VM may put them in that frame's
+// arena. A value stays in its frame as long as it is only
+//  - subscripted, assigned into, or read a property of;
+//  - called, printed, compared with == / !=, tested for truth or discarded;
+//  - passed to a native that does not keep it (len, push/pop's array,
+//    keys, to_json, printf, sprintf, assert), or to a parameter of a
+//    top-level function that itself keeps the parameter in its frame.
+// Anything else (returning it, storing it in a variable, array, map or
+// global, capturing it in a closure) lets it escape. A literal qualifies
+// where it appears in such a position, or as the initializer of a local
+// whose every read does.
+//
+// Parameter summaries start optimistic ("stays") and are iterated to a
+// fixpoint, so recursive and mutually recursive functions qualify too. They
+// are only used for functions declared once at the top level, never assigned
+// and not already defined before the program runs (natives, the core
+// library): only then is every call by that name a call to that body.
+class EscapeAnalysis: public AstWalker {
+public:
+    // predefined: whether a global of this name exists before the program runs
+    void analyze(const std::vector<std::unique_ptr<Stmt>>& statements,
+                 const std::function<bool(const std::string&)>& predefined);
+
+    // node: an ArrayLiteral, MapLiteral, FunctionExpr or local FunctionStmt
+    bool isFrameLocal(const void* node) const { return frameLocal.count(node) > 0; }
+
+    using AstWalker::visit;
+    void visit(const Binary& expr) override;
+    void visit(const Logical& expr) override;
+    void visit(const Ternary& expr) override;
+    void visit(const Grouping& expr) override;
+    void visit(const Unary& expr) override;
+    void visit(const Postfix& expr) override;
+    void visit(const Variable& expr) override;
+    void visit(const Assignment& expr) override;
+    void visit(const Call& expr) override;
+    void visit(const ArrayLiteral& expr) override;
+    void visit(const MapLiteral& expr) override;
+    void visit(const Subscript& expr) override;
+    void visit(const PropertyAccess& expr) override;
+    void visit(const SubscriptAssignment& expr) override;
+    void visit(const FunctionExpr& expr) override;
+
+    void visit(const ExpressionStmt& stmt) override;
+    void visit(const PrintStmt& stmt) override;
+    void visit(const VarStmt& stmt) override;
+    void visit(const BlockStmt& stmt) override;
+    void visit(const IfStmt& stmt) override;
+    void visit(const WhileStmt& stmt) override;
+    void visit(const FunctionStmt& stmt) override;
+    void visit(const ReturnStmt& stmt) override;
+
+private:
+    struct Declaration {
+        int function;         // nesting depth of the function declaring it
+        bool escapes = false;
+    };
+    struct Site {
+        const void* node;
+        int owner;            // the local it initializes, or -1
+    };
+
+    std::vector<Declaration> declarations;
+    std::vector<std::unordered_map<std::string, int>> scopes;
+    std::vector<Site> sites;
+    std::unordered_map<std::string, const FunctionStmt*> knownFunctions;
+    std::unordered_map<const FunctionStmt*, std::vector<bool>> paramEscapes;
+    std::unordered_set<std::string> programGlobals; // globals the program defines or assigns
+    std::unordered_set<const void*> frameLocal;
+    int functionDepth = 0;
+    bool contained = false; // whether the expression being visited is used in a way that keeps it in its frame
+    int owner = -1;         // set while visiting the initializer of a local that may own it
+    bool changed = false;
+
+    void use(const Expr& expr, bool keepsInFrame);
+    void allocation(const void* node);
+    int declare(const std::string& name);
+    int resolve(const std::string& name) const;
+    void walkFunction(const FunctionStmt* summarized, const std::vector<Token>& params, const BlockStmt& body);
+    bool argumentStays(const Call& call, size_t index) const;
+};
@@ -20,6 +20,16 @@ class Subscript;
 class PropertyAccess;
 class FunctionExpr;
 
+// Where the resolver found a local variable: how many scopes out from the
+// use, and its slot in that scope's environment. A variable it did not find
+// is global and keeps distance -1.
+struct VarLocation {
+    int distance = -1;
+    int index = -1;
+
+    bool isLocal() const { return distance >= 0; }
+};
+
 class ExprVisitor {
 public:
     virtual ~ExprVisitor() = default;
@@ -211,6 +221,7 @@ public:
 class Variable : public Expr {
 public:
     Token name;
+    mutable VarLocation location; // filled in by the Resolver
 
     explicit Variable(const Token& name): name(name) {}
     static std::unique_ptr<Variable> create(const Token& name) {
@@ -229,6 +240,7 @@ class Assignment : public Expr {
 public:
     Token name;
     std::unique_ptr<Expr> right;
+    mutable VarLocation location; // filled in by the Resolver
 
     Assignment(const Token& _name, std::unique_ptr<Expr> _right): name(_name), right(std::move(_right)) {}
     static std::unique_ptr<Assignment> create(const Token& _name, std::unique_ptr<Expr> _right) {
@@ -87,29 +87,67 @@ void Interpreter::visit(const Unary &unary) {
     }
 }
 
-void Interpreter::visit(const Postfix& postfix) {
-    double delta = postfix.op.type == TokenType::PLUS_PLUS ? 1.0 : -1.0;
+Value Interpreter::postfixStep(Value& slot, const Token& op) {
+    double number = ensure_numeric_for_postfix(slot, op);
+    Value oldValue = slot;
+    slot = number + (op.type == TokenType::PLUS_PLUS ? 1.0 : -1.0);
+    return oldValue;
+}
 
-    auto apply_to_value = [&](Value& slot) {
-        double number = ensure_numeric_for_postfix(slot, postfix.op);
-        Value oldValue = slot;
-        slot = number + delta;
-        return oldValue;
-    };
+Value Interpreter::postfixElement(const Value& obj, const Value& index, const Token& op, const Token& bracket) {
+    if (std::holds_alternative<std::shared_ptr<Array>>(obj)) {
+        if (!std::holds_alternative<double>(index)) {
+            throw RuntimeError(bracket, "array index must be a number");
+        }
+        double ind = std::get<double>(index);
+        if (!is_integer(ind)) {
+            throw RuntimeError(bracket, "index must be an integer");
+        }
+        auto& array = std::get<std::shared_ptr<Array>>(obj);
+        auto idx = static_cast<int>(ind);
+        if (idx < 0 || idx >= static_cast<int>(array->data.size())) {
+            throw RuntimeError(bracket,
+                "Index out of bounds: " + std::to_string(idx) +
+                " (size: " + std::to_string(array->data.size()) + ")");
+        }
+        return postfixStep(array->data[idx], op);
+    }
 
-    if (auto variable = dynamic_cast<Variable*>(postfix.operand.get())) {
-        auto location = varLocations.find(variable);
-        if (location != varLocations.end()) {
-            Value slot = env->getAt(location->second.distance, location->second.index);
-            Value oldValue = apply_to_value(slot);
-            env->assignAt(location->second.distance, location->second.index, slot);
-            _result = oldValue;
-            return;
+    if (std::holds_alternative<std::shared_ptr<Map>>(obj)) {
+        auto map = std::get<std::shared_ptr<Map>>(obj);
+        auto it = map->data.find(index);
+        if (it == map->data.end()) {
+            throw RuntimeError(op, "Postfix operator requires an existing numeric value.");
         }
+        return postfixStep(it->second, op);
+    }
+
+    throw RuntimeError(bracket, "subscript must be of an array or map");
+}
 
-        Value slot = globals->get(variable->name);
-        Value oldValue = apply_to_value(slot);
-        globals->assign(variable->name, slot);
+Value Interpreter::postfixProperty(const Value& obj, const Token& op, const Token& name) {
+    if (!std::holds_alternative<std::shared_ptr<Map>>(obj)) {
+        throw RuntimeError(name, "Only maps can have properties accessed with dot notation");
+    }
+    auto map = std::get<std::shared_ptr<Map>>(obj);
+    Value key = name.lexeme;
+    auto it = map->data.find(key);
+    if (it == map->data.end()) {
+        throw RuntimeError(name, "Postfix operator requires an existing numeric value.");
+    }
+    return postfixStep(it->second, op);
+}
+
+void Interpreter::visit(const Postfix& postfix) {
+    if (auto variable = dynamic_cast<Variable*>(postfix.operand.get())) {
+        auto& location = variable->location;
+        Value slot = lookUpVariable(variable->name, location);
+        Value oldValue = postfixStep(slot, postfix.op);
+        if (location.isLocal()) {
+            env->assignAt(location.distance, location.index, slot);
+        } else {
+            globals->assign(variable->name, slot);
+        }
         _result = oldValue;
         return;
     }
@@ -117,118 +155,66 @@ void Interpreter::visit(const Postfix& postfix) {
     if (auto subscript = dynamic_cast<Subscript*>(postfix.operand.get())) {
         Value obj = eval(*subscript->object);
         Value index = eval(*subscript->index);
-
-        if (std::holds_alternative<std::shared_ptr<Array>>(obj)) {
-            if (!std::holds_alternative<double>(index)) {
-                throw RuntimeError(subscript->bracket, "array index must be a number");
-            }
-            double ind = std::get<double>(index);
-            if (!is_integer(ind)) {
-                throw RuntimeError(subscript->bracket, "index must be an integer");
-            }
-            auto& array = std::get<std::shared_ptr<Array>>(obj);
-            auto idx = static_cast<int>(ind);
-            if (idx < 0 || idx >= static_cast<int>(array->data.size())) {
-                throw RuntimeError(subscript->bracket,
-                    "Index out of bounds: " + std::to_string(idx) +
-                    " (size: " + std::to_string(array->data.size()) + ")");
-            }
-            Value& slot = array->data[idx];
-            Value oldValue = apply_to_value(slot);
-            _result = oldValue;
-            return;
-        }
-
-        if (std::holds_alternative<std::shared_ptr<Map>>(obj)) {
-            auto map = std::get<std::shared_ptr<Map>>(obj);
-            auto it = map->data.find(index);
-            if (it == map->data.end()) {
-                throw RuntimeError(postfix.op, "Postfix operator requires an existing numeric value.");
-            }
-            Value oldValue = apply_to_value(it->second);
-            _result = oldValue;
-            return;
-        }
-
-        throw RuntimeError(subscript->bracket, "subscript must be of an array or map");
+        _result = postfixElement(obj, index, postfix.op, subscript->bracket);
+        return;
     }
 
     if (auto property = dynamic_cast<PropertyAccess*>(postfix.operand.get())) {
         Value obj = eval(*property->object);
-        if (!std::holds_alternative<std::shared_ptr<Map>>(obj)) {
-            throw RuntimeError(property->name, "Only maps can have properties accessed with dot notation");
-        }
-        auto map = std::get<std::shared_ptr<Map>>(obj);
-        Value key = property->name.lexeme;
-        auto it = map->data.find(key);
-        if (it == map->data.end()) {
-            throw RuntimeError(property->name, "Postfix operator requires an existing numeric value.");
-        }
-        Value oldValue = apply_to_value(it->second);
-        _result = oldValue;
+        _result = postfixProperty(obj, postfix.op, property->name);
         return;
     }
 
     throw RuntimeError(postfix.op, "Invalid assignment target for postfix operator");
 }
 
-void Interpreter::visit(const Binary &expr) {
-    auto left = eval(*expr.left);
-    auto right = eval(*expr.right);
-
-    switch (expr.op.type) {
+Value Interpreter::binary(const Token& op, const Value& left, const Value& right) {
+    switch (op.type) {
         case TokenType::MINUS:
-            _result = std::get<double>(left)  - std::get<double>(right);
-            break;
+            return std::get<double>(left)  - std::get<double>(right);
         case TokenType::SLASH:
-            _result = std::get<double>(left)  / std::get<double>(right);
-            break;
+            return std::get<double>(left)  / std::get<double>(right);
         case TokenType::STAR:
-            _result = std::get<double>(left)  * std::get<double>(right);
-            break;
+            return std::get<double>(left)  * std::get<double>(right);
         case TokenType::PLUS:
             if (std::holds_alternative<double>(left) && std::holds_alternative<double>(right))
-                _result = std::get<double>(left) + std::get<double>(right);
+                return std::get<double>(left) + std::get<double>(right);
             else if (std::holds_alternative<std::string>(left) && std::holds_alternative<std::string>(right))
-                _result = std::get<std::string>(left) + std::get<std::string>(right);
+                return std::get<std::string>(left) + std::get<std::string>(right);
             else
-                throw RuntimeError(expr.op, "+ can only be between two numbers or two strings");
-            break;
+                throw RuntimeError(op, "+ can only be between two numbers or two strings");
         case TokenType::PERCENT:
             if (std::holds_alternative<double>(left) && std::holds_alternative<double>(right)) {
                 double l = std::get<double>(left);
                 double r = std::get<double>(right);
                 if (!is_integer(l) || !is_integer(r)) {
-                    throw RuntimeError(expr.op, "% operation is between integers");
+                    throw RuntimeError(op, "% operation is between integers");
                 }
-                _result = (double)((int)l % (int)r);
-                break;
+                return (double)((int)l % (int)r);
             }else {
-                throw RuntimeError(expr.op, "% operation is between numbers");
+                throw RuntimeError(op, "% operation is between numbers");
             }
-            break;
         case TokenType::GREATER:
-            _result = std::get<double>(left) > std::get<double>(right);
-            break;
+            return std::get<double>(left) > std::get<double>(right);
         case TokenType::GREATER_EQUAL:
-            _result = std::get<double>(left) >= std::get<double>(right);
-            break;
+            return std::get<double>(left) >= std::get<double>(right);
         case TokenType::LESS:
-            _result = std::get<double>(left) < std::get<double>(right);
-            break;
+            return std::get<double>(left) < std::get<double>(right);
         case TokenType::LESS_EQUAL:
-            _result = std::get<double>(left) <= std::get<double>(right);
-            break;
+            return std::get<double>(left) <= std::get<double>(right);
         case TokenType::BANG_EQUAL:
-            _result = (left != right);
-            break;
+            return (left != right);
         case TokenType::EQUAL_EQUAL:
-            _result = (left == right);
-            break;
+            return (left == right);
         default:
-            _result = nullptr;
+            return nullptr;
     }
+}
 
+void Interpreter::visit(const Binary &expr) {
+    auto left = eval(*expr.left);
+    auto right = eval(*expr.right);
+    _result = binary(expr.op, left, right);
 }
 
 void Interpreter::visit(const Logical& logical) {
@@ -299,32 +285,33 @@ void Interpreter::visit(const MapLiteral &mlit) {
     _result =  std::make_shared<Map>(values);
 }
 
-void Interpreter::visit(const Subscript& sub) {
-    auto obj = eval(*sub.object);
-    auto index = eval(*sub.index);
+Value Interpreter::subscript(const Value& obj, const Value& index, const Token& bracket) {
     if (std::holds_alternative<std::shared_ptr<Array>>(obj)) {
         if (!std::holds_alternative<double>(index)) {
-            throw RuntimeError(sub.bracket, "array index must be a number");
+            throw RuntimeError(bracket, "array index must be a number");
         }
         auto ind = std::get<double>(index);
         if (!is_integer(ind)) {
-            throw RuntimeError(sub.bracket, "index must be an integer");
+            throw RuntimeError(bracket, "index must be an integer");
         }
         auto& array = std::get<std::shared_ptr<Array>>(obj);
-        _result =  array->data.at((int)ind);
-        return;
+        return array->data.at((int)ind);
     }
     if (std::holds_alternative<std::shared_ptr<Map>>(obj)) {
         auto map = std::get<std::shared_ptr<Map>>(obj);
         auto it = map->data.find(index);
         if (it == map->data.end()) {
-            _result = nullptr;
-        } else {
-            _result = it->second;
+            return nullptr;
         }
-        return;
+        return it->second;
     }
-    throw RuntimeError(sub.bracket, "subscript must be of an array or map");
+    throw RuntimeError(bracket, "subscript must be of an array or map");
+}
+
+void Interpreter::visit(const Subscript& sub) {
+    auto obj = eval(*sub.object);
+    auto index = eval(*sub.index);
+    _result = subscript(obj, index, sub.bracket);
 }
 
 
@@ -357,73 +344,67 @@ void Interpreter::visit(const VarStmt& varStmt) {
     env->define(varStmt.name.lexeme, value);
 }
 
-void Interpreter::visit(const Variable& variable) {
-    // _result = env->get(variable.name);
-    // _result = lookUpVariable(variable.name,  &variable);
-    auto it = varLocations.find(&variable);
-    if (it != varLocations.end()) {
+Value Interpreter::lookUpVariable(const Token& name, const VarLocation& location) {
+    if (location.isLocal()) {
         // Fast path: direct index access
-        _result = env->getAt(it->second.distance, it->second.index);
-        return;
+        return env->getAt(location.distance, location.index);
     }
     // Fallback for globals or unresolved variables
-    _result = globals->get(variable.name);
+    return globals->get(name);
+}
+
+void Interpreter::visit(const Variable& variable) {
+    _result = lookUpVariable(variable.name, variable.location);
 }
 
 void Interpreter::visit(const Assignment& assignment) {
     auto value = eval(*assignment.right);
-    // env->assign(assignment.name, value);
-    auto it = varLocations.find(&assignment);
-    if (it != varLocations.end()) {
-        env->assignAt(it->second.distance, it->second.index, value);
+    if (assignment.location.isLocal()) {
+        env->assignAt(assignment.location.distance, assignment.location.index, value);
     } else {
         globals->assign(assignment.name, value);
     }
     _result = value; // Why? chain of assignment?
 }
 
-void Interpreter::visit(const PropertyAccess& prop) {
-    auto obj = eval(*prop.object);
-
+Value Interpreter::property(const Value& obj, const Token& name) {
     // Convert property access to subscript access with string key
     if (std::holds_alternative<std::shared_ptr<Map>>(obj)) {
         auto map = std::get<std::shared_ptr<Map>>(obj);
-        Value key = prop.name.lexeme;  // Use the property name as string key
+        Value key = name.lexeme;  // Use the property name as string key
         auto it = map->data.find(key);
         if (it == map->data.end()) {
-            _result = nullptr;
-        } else {
-            _result = it->second;
+            return nullptr;
         }
-        return;
+        return it->second;
     }
 
-    throw RuntimeError(prop.name, "Only maps can have properties accessed with dot notation");
+    throw RuntimeError(name, "Only maps can have properties accessed with dot notation");
 }
 
-void Interpreter::visit(const SubscriptAssignment& assignment) {
-    Value obj = eval(*assignment.object);
-    Value index = eval(*assignment.index);
-    Value value = eval(*assignment.value);
+void Interpreter::visit(const PropertyAccess& prop) {
+    auto obj = eval(*prop.object);
+    _result = property(obj, prop.name);
+}
 
+Value Interpreter::assignSubscript(const Value& obj, const Value& index, const Value& value, const Token& bracket) {
     if (std::holds_alternative<std::shared_ptr<Array>>(obj)) {
         if (!std::holds_alternative<double>(index)) {
-            throw RuntimeError(assignment.bracket, "array index must be a number");
+            throw RuntimeError(bracket, "array index must be a number");
         }
         auto ind = std::get<double>(index);
         if (!is_integer(ind)) {
-            throw RuntimeError(assignment.bracket, "index must be an integer");
+            throw RuntimeError(bracket, "index must be an integer");
         }
         auto idx = (int) ind;
         auto& array = std::get<std::shared_ptr<Array>>(obj);
         if (idx < 0 || idx >= array->data.size()) {
-            throw RuntimeError(assignment.bracket,
+            throw RuntimeError(bracket,
                 "Index out of bounds: " + std::to_string(idx) +
                 " (size: " + std::to_string(array->data.size()) + ")");
         }
         array->data[idx] = value;
-        _result =  value;
-        return;
+        return value;
     }
 
     if (std::holds_alternative<std::shared_ptr<Map>>(obj)) {
@@ -434,15 +415,20 @@ void Interpreter::visit(const SubscriptAssignment& assignment) {
         if (std::holds_alternative<std::nullptr_t>(value)) {
             if (it != map->data.end()) // remove key if val is nil
                 map->data.erase(it);
-            _result = nullptr;
-            return;
+            return nullptr;
         }
         map->data[index] = value;
-        _result =  value;
-        return;
+        return value;
     }
 
-    throw RuntimeError(assignment.bracket, "Only arrays and maps can be subscripted.");
+    throw RuntimeError(bracket, "Only arrays and maps can be subscripted.");
+}
+
+void Interpreter::visit(const SubscriptAssignment& assignment) {
+    Value obj = eval(*assignment.object);
+    Value index = eval(*assignment.index);
+    Value value = eval(*assignment.value);
+    _result = assignSubscript(obj, index, value, assignment.bracket);
 }
 
 
@@ -516,7 +502,3 @@ void Interpreter::visit(const ContinueStmt& continueStmt) {
     throw Continue();
 }
 
-
-void Interpreter::resolveWithIndex(const Expr* expr, int distance, int index) {
-    varLocations[expr] = {distance, index};
-}
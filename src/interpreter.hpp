@@ -1,7 +1,6 @@
 #pragma once
 #include <utility>
 #include <unordered_map>
-#include <map>
 #include <variant>
 
 #include "expr.hpp"
@@ -34,6 +33,12 @@ public:
         return index;
     }
 
+    // Appends a local at the next index without recording its name, for
+    // callers that only ever reach it by index.
+    void push(Value value) {
+        values.push_back(std::move(value));
+    }
+
     [[nodiscard]] Value get_by_index(int index) const {
         return values[index];
     }
@@ -83,11 +88,6 @@ public:
 class Interpreter: public ExprVisitor, public StmtVisitor, public  RuntimeContext{
 private:
     Value _result;
-    // Store both distance and index for each variable
-    struct VarLocation {
-        int distance;
-        int index;
-    };
 
     // void parenthesize(const std::string& name, const std::vector<const Expr*>& exprs);
     static bool isTruthy(const Value&);
@@ -95,8 +95,6 @@ private:
 public:
     std::shared_ptr<Environment> globals;
     std::shared_ptr<Environment> env;
-    // std::unordered_map<const Expr*, int> locals;
-    std::map<const Expr*, VarLocation> varLocations;
 
 
     Interpreter();
@@ -145,11 +143,19 @@ public:
     void visit(const ContinueStmt& continueStmt) override;
     void visit(const BreakStmt& breakStmt) override;
 
-    Value lookUpVariable(const Token & name, const Variable * variable);
+    Value lookUpVariable(const Token& name, const VarLocation& location);
+
+    // What an operator does to values already evaluated; shared with the
+    // closure compiler so both modes fail the same way.
+    static Value binary(const Token& op, const Value& left, const Value& right);
+    static Value subscript(const Value& obj, const Value& index, const Token& bracket);
+    static Value assignSubscript(const Value& obj, const Value& index, const Value& value, const Token& bracket);
+    static Value property(const Value& obj, const Token& name);
+    // x++ / x-- on a slot, an element or a property; returns the old value
+    static Value postfixStep(Value& slot, const Token& op);
+    static Value postfixElement(const Value& obj, const Value& index, const Token& op, const Token& bracket);
+    static Value postfixProperty(const Value& obj, const Token& op, const Token& name);
     void executeBlock(const std::vector<std::unique_ptr<Stmt>>& stmts,  std::shared_ptr<Environment> env);
-
-    // void resolve(const Expr*, int);
-    void resolveWithIndex(const Expr*, int distance, int index);
 };
 
 // Interpreter.hpp
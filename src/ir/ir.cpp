@@ -0,0 +1,269 @@
+#include "ir/ir.hpp"
+
+#include <algorithm>
+#include <functional>
+
+namespace ir {
+
+const char* opName(Op op) {
+    switch (op) {
+        case Op::Const: return "const";
+        case Op::Param: return "param";
+        case Op::Phi: return "phi";
+        case Op::Neg: return "neg";
+        case Op::Not: return "not";
+        case Op::Add: return "add";
+        case Op::Sub: return "sub";
+        case Op::Mul: return "mul";
+        case Op::Div: return "div";
+        case Op::Mod: return "mod";
+        case Op::Eq: return "eq";
+        case Op::Ne: return "ne";
+        case Op::Lt: return "lt";
+        case Op::Le: return "le";
+        case Op::Gt: return "gt";
+        case Op::Ge: return "ge";
+        case Op::Load: return "load";
+        case Op::Store: return "store";
+        case Op::Call: return "call";
+        case Op::Index: return "index";
+        case Op::SetIndex: return "setindex";
+        case Op::Array: return "array";
+        case Op::Map: return "map";
+        case Op::Closure: return "closure";
+        case Op::Print: return "print";
+        case Op::Jump: return "jump";
+        case Op::Branch: return "branch";
+        case Op::Return: return "return";
+    }
+    return "?";
+}
+
+bool isTerminator(Op op) {
+    return op == Op::Jump || op == Op::Branch || op == Op::Return;
+}
+
+bool isPure(Op op) {
+    switch (op) {
+        case Op::Const:
+        case Op::Neg:
+        case Op::Not:
+        case Op::Add:
+        case Op::Sub:
+        case Op::Mul:
+        case Op::Div:
+        case Op::Mod:
+        case Op::Eq:
+        case Op::Ne:
+        case Op::Lt:
+        case Op::Le:
+        case Op::Gt:
+        case Op::Ge:
+            return true;
+        default:
+            return false;
+    }
+}
+
+int Function::addBlock() {
+    blocks.emplace_back();
+    return blocks.size() - 1;
+}
+
+int Function::append(int block, Instr instr) {
+    int id = values.size();
+    instr.block = block;
+    values.push_back(std::move(instr));
+    forward.push_back(id);
+    blocks[block].instrs.push_back(id);
+    return id;
+}
+
+int Function::prepend(int block, Instr instr) {
+    int id = values.size();
+    instr.block = block;
+    values.push_back(std::move(instr));
+    forward.push_back(id);
+    auto& instrs = blocks[block].instrs;
+    instrs.insert(instrs.begin(), id);
+    return id;
+}
+
+int Function::addPhi(int block, int line) {
+    Instr phi{Op::Phi};
+    phi.line = line;
+    return prepend(block, std::move(phi));
+}
+
+int Function::constant(int block, const Value& value, int line) {
+    Instr instr{Op::Const};
+    instr.constant = value;
+    instr.line = line;
+    return append(block, std::move(instr));
+}
+
+int Function::resolve(int id) const {
+    while (forward[id] != id) id = forward[id];
+    return id;
+}
+
+void Function::replaceAllUses(int from, int to) {
+    from = resolve(from);
+    to = resolve(to);
+    if (from == to) return;
+    forward[from] = to;
+    for (auto& instr : values) {
+        if (instr.removed) continue;
+        for (auto& arg : instr.args) {
+            if (arg == from) arg = to;
+        }
+    }
+}
+
+void Function::remove(int id) {
+    auto& instr = values[id];
+    if (instr.removed) return;
+    instr.removed = true;
+    auto& instrs = blocks[instr.block].instrs;
+    instrs.erase(std::find(instrs.begin(), instrs.end(), id));
+}
+
+void Function::moveToEnd(int id, int block) {
+    auto& instr = values[id];
+    auto& from = blocks[instr.block].instrs;
+    from.erase(std::find(from.begin(), from.end(), id));
+    auto& to = blocks[block].instrs;
+    auto position = to.end();
+    if (!to.empty() && isTerminator(values[to.back()].op)) --position;
+    to.insert(position, id);
+    instr.block = block;
+}
+
+std::vector<int> Function::successors(int block) const {
+    const auto& instrs = blocks[block].instrs;
+    if (instrs.empty()) return {};
+    const auto& last = values[instrs.back()];
+    return isTerminator(last.op) ? last.targets : std::vector<int>{};
+}
+
+// Drops the edge from -> to, along with the matching operand of every phi in to.
+void Function::removeEdge(int from, int to) {
+    auto& preds = blocks[to].preds;
+    auto it = std::find(preds.begin(), preds.end(), from);
+    if (it == preds.end()) return;
+    size_t index = it - preds.begin();
+    preds.erase(it);
+    for (int id : blocks[to].instrs) {
+        auto& instr = values[id];
+        if (instr.op != Op::Phi) break;
+        instr.args.erase(instr.args.begin() + index);
+    }
+}
+
+std::vector<int> Function::reversePostorder() const {
+    std::vector<int> order;
+    std::vector<bool> visited(blocks.size(), false);
+    std::function<void(int)> visit = [&](int block) {
+        visited[block] = true;
+        for (int succ : successors(block)) {
+            if (!visited[succ]) visit(succ);
+        }
+        order.push_back(block);
+    };
+    visit(0);
+    std::reverse(order.begin(), order.end());
+    return order;
+}
+
+// Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm".
+std::vector<int> Function::dominators() const {
+    auto order = reversePostorder();
+    std::vector<int> position(blocks.size(), -1);
+    for (size_t i = 0; i < order.size(); i++) position[order[i]] = i;
+
+    std::vector<int> idom(blocks.size(), -1);
+    idom[0] = 0;
+    auto intersect = [&](int a, int b) {
+        while (a != b) {
+            while (position[a] > position[b]) a = idom[a];
+            while (position[b] > position[a]) b = idom[b];
+        }
+        return a;
+    };
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 1; i < order.size(); i++) {
+            int block = order[i];
+            int newIdom = -1;
+            for (int pred : blocks[block].preds) {
+                if (idom[pred] == -1) continue;
+                newIdom = newIdom == -1 ? pred : intersect(pred, newIdom);
+            }
+            if (newIdom != idom[block]) {
+                idom[block] = newIdom;
+                changed = true;
+            }
+        }
+    }
+    return idom;
+}
+
+bool Function::dominates(const std::vector<int>& idom, int a, int b) const {
+    if (idom[b] == -1) return false;
+    while (b != a && b != 0) b = idom[b];
+    return b == a;
+}
+
+namespace {
+
+void printConstant(std::ostream& out, const Value& value) {
+    if (const auto* string = std::get_if<std::string>(&value)) {
+        out << '"' << *string << '"';
+    } else {
+        out << value;
+    }
+}
+
+}
+
+void Function::print(std::ostream& out) const {
+    out << "function " << (name.empty() ? "<script>" : name) << " {\n";
+    for (int block : reversePostorder()) {
+        out << "b" << block << ":";
+        if (!blocks[block].preds.empty()) {
+            out << "  ; preds";
+            for (int pred : blocks[block].preds) out << " b" << pred;
+        }
+        if (blocks[block].loop) out << "  ; loop header";
+        out << "\n";
+        for (int id : blocks[block].instrs) {
+            const auto& instr = values[id];
+            out << "  ";
+            bool hasValue = !isTerminator(instr.op) && instr.op != Op::Store && instr.op != Op::SetIndex &&
+                            instr.op != Op::Print;
+            if (hasValue) out << "v" << id << ":" << typeName(instr.type) << " = ";
+            out << opName(instr.op);
+            if (instr.op == Op::Const) {
+                out << " ";
+                printConstant(out, instr.constant);
+            }
+            if (!instr.name.empty()) out << " " << instr.name;
+            for (size_t i = 0; i < instr.args.size(); i++) {
+                out << (i == 0 ? " " : ", ") << "v" << instr.args[i];
+                if (instr.op == Op::Phi) out << " [b" << blocks[block].preds[i] << "]";
+            }
+            for (int target : instr.targets) out << " b" << target;
+            out << "\n";
+        }
+    }
+    out << "}\n";
+}
+
+void Program::print(std::ostream& out) const {
+    for (const auto& function : functions) {
+        function->print(out);
+    }
+}
+
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "token.hpp"
+#include "type_inference.hpp"
+
+class Expr;
+class WhileStmt;
+
+// A typed SSA form of a Rhythm program, one Function per function body plus
+// one for the top-level script. Local variables that no closure refers to
+// become SSA values; globals and captured variables are memory, accessed
+// through Load/Store by name.
+namespace ir {
+
+enum class Op {
+    Const, Param, Phi,
+    Neg, Not,
+    Add, Sub, Mul, Div, Mod, Eq, Ne, Lt, Le, Gt, Ge,
+    Load, Store, Call, Index, SetIndex, Array, Map, Closure, Print,
+    Jump, Branch, Return,
+};
+
+const char* opName(Op op);
+bool isTerminator(Op op);
+// no side effects and no dependence on memory: safe to remove, merge or move
+// as long as it stays after its operands
+bool isPure(Op op);
+
+struct Instr {
+    Op op;
+    std::vector<int> args{};      // operand value ids; for a Phi, one per predecessor
+    Value constant = nullptr;     // Const
+    std::string name{};           // Param, Load, Store, Closure
+    std::vector<int> targets{};   // Jump: {target}; Branch: {then, else}
+    InferredType type = InferredType::UNKNOWN;
+    const Expr* origin = nullptr; // the expression this computes, if any
+    int block = -1;
+    int line = 0;
+    bool removed = false;
+};
+
+struct Block {
+    std::vector<int> instrs;      // phis first, terminator last
+    std::vector<int> preds;
+    const WhileStmt* loop = nullptr; // set on the header of a while loop
+    int preheader = -1;              // for a loop header: the block entering the loop
+};
+
+class Function {
+public:
+    std::string name;
+    std::vector<Instr> values;
+    std::vector<Block> blocks;
+    // instructions moved out of a loop by LICM -> header of the outermost such loop
+    std::map<int, int> hoisted;
+
+    explicit Function(std::string name): name(std::move(name)) {}
+
+    int addBlock();
+    // appends to the end of block; callers add the terminator last
+    int append(int block, Instr instr);
+    int prepend(int block, Instr instr);
+    // inserts an empty phi at the top of block
+    int addPhi(int block, int line);
+    int constant(int block, const Value& value, int line);
+
+    // follows replaceAllUses chains: the value that now stands for id
+    int resolve(int id) const;
+    void replaceAllUses(int from, int to);
+    void remove(int id);
+    // moves a live instruction to the end of block, before its terminator
+    void moveToEnd(int id, int block);
+
+    std::vector<int> successors(int block) const;
+    void removeEdge(int from, int to);
+    std::vector<int> reversePostorder() const;
+    // immediate dominator of every reachable block (the entry is its own), -1 otherwise
+    std::vector<int> dominators() const;
+    bool dominates(const std::vector<int>& idom, int a, int b) const;
+
+    void print(std::ostream& out) const;
+
+private:
+    std::vector<int> forward; // replaceAllUses: forward[from] = to
+};
+
+struct Program {
+    std::vector<std::unique_ptr<Function>> functions;
+    void print(std::ostream& out) const;
+};
+
+}
@@ -0,0 +1,491 @@
+#include "ir/ir_builder.hpp"
+
+#include "ast_walker.hpp"
+
+namespace ir {
+
+namespace {
+
+// Names read or written inside functions nested in a body. Locals with one of
+// these names may be captured by a closure, so they are kept in memory.
+class CapturedNames: public AstWalker {
+public:
+    std::unordered_set<std::string>& names;
+    int depth = 0;
+    explicit CapturedNames(std::unordered_set<std::string>& names): names(names) {}
+
+    using AstWalker::visit;
+    void visit(const Variable& expr) override {
+        if (depth > 0) names.insert(expr.name.lexeme);
+    }
+    void visit(const Assignment& expr) override {
+        if (depth > 0) names.insert(expr.name.lexeme);
+        AstWalker::visit(expr);
+    }
+    void visit(const FunctionExpr& expr) override {
+        depth++;
+        AstWalker::visit(expr);
+        depth--;
+    }
+    void visit(const FunctionStmt& stmt) override {
+        depth++;
+        AstWalker::visit(stmt);
+        depth--;
+    }
+};
+
+Op binaryOp(TokenType type) {
+    switch (type) {
+        case TokenType::PLUS: return Op::Add;
+        case TokenType::MINUS: return Op::Sub;
+        case TokenType::STAR: return Op::Mul;
+        case TokenType::SLASH: return Op::Div;
+        case TokenType::PERCENT: return Op::Mod;
+        case TokenType::EQUAL_EQUAL: return Op::Eq;
+        case TokenType::BANG_EQUAL: return Op::Ne;
+        case TokenType::LESS: return Op::Lt;
+        case TokenType::LESS_EQUAL: return Op::Le;
+        case TokenType::GREATER: return Op::Gt;
+        default: return Op::Ge;
+    }
+}
+
+}
+
+Program IrBuilder::build(const std::vector<std::unique_ptr<Stmt>>& statements) {
+    program = Program{};
+    values.clear();
+    lowerFunction("", {}, statements);
+    return std::move(program);
+}
+
+void IrBuilder::lowerFunction(const std::string& name, const std::vector<Token>& params,
+                              const std::vector<std::unique_ptr<Stmt>>& body) {
+    program.functions.push_back(std::make_unique<Function>(name));
+    states.push_back(State{program.functions.back().get()});
+    int savedResult = result;
+    newBlock(true);
+
+    CapturedNames{state().captured}.walk(body);
+    bool isScript = states.size() == 1;
+    if (!isScript) {
+        state().scopes.emplace_back(); // parameters and the body share a scope
+        for (const auto& param : params) {
+            Instr instr{Op::Param};
+            instr.name = param.lexeme;
+            instr.line = param.line;
+            int value = function().append(state().block, std::move(instr));
+            declare(param.lexeme, &param);
+            writeName(param, value);
+        }
+    }
+    for (const auto& stmt : body) {
+        stmt->accept(*this);
+    }
+    emit(Op::Return, {constant(nullptr, 0)}, 0);
+
+    states.pop_back();
+    result = savedResult;
+}
+
+int IrBuilder::lower(const Expr& expr) {
+    expr.accept(*this);
+    values[&expr] = {state().function, result};
+    return result;
+}
+
+int IrBuilder::emit(Op op, std::vector<int> args, int line, const Expr* origin) {
+    Instr instr{op};
+    instr.args = std::move(args);
+    instr.line = line;
+    instr.origin = origin;
+    return function().append(state().block, std::move(instr));
+}
+
+int IrBuilder::constant(const Value& value, int line) {
+    return function().constant(state().block, value, line);
+}
+
+int IrBuilder::newBlock(bool sealed) {
+    state().sealed.push_back(sealed);
+    return function().addBlock();
+}
+
+void IrBuilder::sealBlock(int block) {
+    auto pending = std::move(state().incompletePhis[block]);
+    state().incompletePhis.erase(block);
+    for (auto [variable, phi] : pending) {
+        addPhiOperands(variable, phi);
+    }
+    state().sealed[block] = true;
+}
+
+void IrBuilder::jump(int target, int line) {
+    int id = emit(Op::Jump, {}, line);
+    function().values[id].targets = {target};
+    function().blocks[target].preds.push_back(state().block);
+}
+
+void IrBuilder::branch(int condition, int thenBlock, int elseBlock, int line) {
+    int id = emit(Op::Branch, {condition}, line);
+    function().values[id].targets = {thenBlock, elseBlock};
+    function().blocks[thenBlock].preds.push_back(state().block);
+    function().blocks[elseBlock].preds.push_back(state().block);
+}
+
+// code after return/break/continue: a block nothing jumps to
+void IrBuilder::startUnreachable() {
+    state().block = newBlock(true);
+}
+
+IrBuilder::Key IrBuilder::resolve(const std::string& name) const {
+    const auto& scopes = states.back().scopes;
+    for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+        auto it = scope->find(name);
+        if (it != scope->end()) return it->second;
+    }
+    return nullptr;
+}
+
+void IrBuilder::declare(const std::string& name, Key key) {
+    if (state().scopes.empty()) return; // a global
+    state().scopes.back()[name] = state().captured.count(name) ? nullptr : key;
+}
+
+int IrBuilder::readName(const Token& name) {
+    if (Key key = resolve(name.lexeme)) {
+        return readVariable(key, state().block);
+    }
+    Instr instr{Op::Load};
+    instr.name = name.lexeme;
+    instr.line = name.line;
+    return function().append(state().block, std::move(instr));
+}
+
+void IrBuilder::writeName(const Token& name, int value) {
+    if (Key key = resolve(name.lexeme)) {
+        writeVariable(key, state().block, value);
+        return;
+    }
+    Instr instr{Op::Store};
+    instr.name = name.lexeme;
+    instr.args = {value};
+    instr.line = name.line;
+    function().append(state().block, std::move(instr));
+}
+
+void IrBuilder::writeVariable(Key variable, int block, int value) {
+    state().definitions[variable][block] = value;
+}
+
+int IrBuilder::readVariable(Key variable, int block) {
+    const auto& definitions = state().definitions[variable];
+    auto it = definitions.find(block);
+    if (it != definitions.end()) return function().resolve(it->second);
+    return readVariableRecursive(variable, block);
+}
+
+int IrBuilder::readVariableRecursive(Key variable, int block) {
+    int value;
+    const auto& preds = function().blocks[block].preds;
+    if (!state().sealed[block]) {
+        value = function().addPhi(block, 0);
+        state().incompletePhis[block].push_back({variable, value});
+    } else if (preds.empty()) {
+        // unreachable code: any value will do
+        Instr undefined{Op::Const};
+        value = function().prepend(0, std::move(undefined));
+    } else if (preds.size() == 1) {
+        value = readVariable(variable, preds[0]);
+    } else {
+        value = function().addPhi(block, 0);
+        writeVariable(variable, block, value); // breaks cycles through loops
+        value = addPhiOperands(variable, value);
+    }
+    writeVariable(variable, block, value);
+    return value;
+}
+
+int IrBuilder::addPhiOperands(Key variable, int phi) {
+    int block = function().values[phi].block;
+    auto preds = function().blocks[block].preds;
+    for (int pred : preds) {
+        int operand = readVariable(variable, pred);
+        function().values[phi].args.push_back(operand);
+    }
+    return tryRemoveTrivialPhi(phi);
+}
+
+// A phi whose operands are all the same value (or itself) is that value.
+int IrBuilder::tryRemoveTrivialPhi(int phi) {
+    auto& f = function();
+    int same = -1;
+    for (int arg : f.values[phi].args) {
+        arg = f.resolve(arg);
+        if (arg == same || arg == phi) continue;
+        if (same != -1) return phi;
+        same = arg;
+    }
+    if (same == -1) {
+        Instr undefined{Op::Const};
+        same = f.prepend(0, std::move(undefined));
+    }
+    f.replaceAllUses(phi, same);
+    f.remove(phi);
+    return same;
+}
+
+// expressions
+
+void IrBuilder::visit(const Binary& expr) {
+    int left = lower(*expr.left);
+    int right = lower(*expr.right);
+    result = emit(binaryOp(expr.op.type), {left, right}, expr.op.line, &expr);
+}
+
+// and/or: the result is whichever operand was evaluated last
+void IrBuilder::visit(const Logical& expr) {
+    int left = lower(*expr.left);
+    writeVariable(&expr, state().block, left);
+    int right = newBlock(false);
+    int join = newBlock(false);
+    if (expr.op.type == TokenType::AND) {
+        branch(left, right, join, expr.op.line);
+    } else {
+        branch(left, join, right, expr.op.line);
+    }
+    sealBlock(right);
+    state().block = right;
+    writeVariable(&expr, state().block, lower(*expr.right));
+    jump(join, expr.op.line);
+    sealBlock(join);
+    state().block = join;
+    result = readVariable(&expr, join);
+}
+
+void IrBuilder::visit(const Ternary& expr) {
+    int condition = lower(*expr.condition);
+    int thenBlock = newBlock(false);
+    int elseBlock = newBlock(false);
+    int join = newBlock(false);
+    branch(condition, thenBlock, elseBlock, expr.question.line);
+    sealBlock(thenBlock);
+    sealBlock(elseBlock);
+    state().block = thenBlock;
+    writeVariable(&expr, state().block, lower(*expr.thenBranch));
+    jump(join, expr.question.line);
+    state().block = elseBlock;
+    writeVariable(&expr, state().block, lower(*expr.elseBranch));
+    jump(join, expr.question.line);
+    sealBlock(join);
+    state().block = join;
+    result = readVariable(&expr, join);
+}
+
+void IrBuilder::visit(const Grouping& expr) {
+    result = lower(*expr.expression);
+}
+
+void IrBuilder::visit(const Literal& expr) {
+    result = constant(expr.value, expr.get_line());
+}
+
+void IrBuilder::visit(const Unary& expr) {
+    int right = lower(*expr.right);
+    result = emit(expr.op.type == TokenType::MINUS ? Op::Neg : Op::Not, {right}, expr.op.line, &expr);
+}
+
+void IrBuilder::visit(const Postfix& expr) {
+    Op step = expr.op.type == TokenType::PLUS_PLUS ? Op::Add : Op::Sub;
+    int line = expr.op.line;
+    if (const auto* variable = dynamic_cast<const Variable*>(expr.operand.get())) {
+        int old = readName(variable->name);
+        writeName(variable->name, emit(step, {old, constant(1.0, line)}, line));
+        result = old;
+        return;
+    }
+    int object, index;
+    if (const auto* subscript = dynamic_cast<const Subscript*>(expr.operand.get())) {
+        object = lower(*subscript->object);
+        index = lower(*subscript->index);
+    } else if (const auto* property = dynamic_cast<const PropertyAccess*>(expr.operand.get())) {
+        object = lower(*property->object);
+        index = constant(property->name.lexeme, line);
+    } else {
+        result = lower(*expr.operand);
+        return;
+    }
+    int old = emit(Op::Index, {object, index}, line);
+    emit(Op::SetIndex, {object, index, emit(step, {old, constant(1.0, line)}, line)}, line);
+    result = old;
+}
+
+void IrBuilder::visit(const Variable& expr) {
+    result = readName(expr.name);
+}
+
+void IrBuilder::visit(const Assignment& expr) {
+    int value = lower(*expr.right);
+    writeName(expr.name, value);
+    result = value;
+}
+
+void IrBuilder::visit(const Call& expr) {
+    std::vector<int> args = {lower(*expr.callee)};
+    for (const auto& argument : expr.arguments) {
+        args.push_back(lower(*argument));
+    }
+    result = emit(Op::Call, std::move(args), expr.paren.line);
+}
+
+void IrBuilder::visit(const ArrayLiteral& expr) {
+    std::vector<int> elements;
+    for (const auto& element : expr.elements) {
+        elements.push_back(lower(*element));
+    }
+    result = emit(Op::Array, std::move(elements), expr.get_line());
+}
+
+void IrBuilder::visit(const MapLiteral& expr) {
+    std::vector<int> pairs;
+    for (const auto& [key, value] : expr.pairs) {
+        pairs.push_back(lower(*key));
+        pairs.push_back(lower(*value));
+    }
+    result = emit(Op::Map, std::move(pairs), expr.get_line());
+}
+
+void IrBuilder::visit(const Subscript& expr) {
+    int object = lower(*expr.object);
+    int index = lower(*expr.index);
+    result = emit(Op::Index, {object, index}, expr.bracket.line);
+}
+
+void IrBuilder::visit(const PropertyAccess& expr) {
+    int object = lower(*expr.object);
+    result = emit(Op::Index, {object, constant(expr.name.lexeme, expr.name.line)}, expr.name.line);
+}
+
+void IrBuilder::visit(const SubscriptAssignment& expr) {
+    int object = lower(*expr.object);
+    int index = lower(*expr.index);
+    int value = lower(*expr.value);
+    emit(Op::SetIndex, {object, index, value}, expr.bracket.line);
+    result = value;
+}
+
+void IrBuilder::visit(const FunctionExpr& expr) {
+    lowerFunction("anon", expr.params, expr.body->statements);
+    Instr closure{Op::Closure};
+    closure.name = "anon";
+    closure.line = expr.get_line();
+    result = function().append(state().block, std::move(closure));
+}
+
+// statements
+
+void IrBuilder::visit(const ExpressionStmt& stmt) {
+    lower(*stmt.expr);
+}
+
+void IrBuilder::visit(const PrintStmt& stmt) {
+    emit(Op::Print, {lower(*stmt.expr)}, stmt.expr->get_line());
+}
+
+void IrBuilder::visit(const VarStmt& stmt) {
+    // reading the variable in its own initializer is an error; keep it opaque
+    declare(stmt.name.lexeme, nullptr);
+    int value = stmt.initializer ? lower(*stmt.initializer) : constant(nullptr, stmt.name.line);
+    declare(stmt.name.lexeme, &stmt);
+    writeName(stmt.name, value);
+}
+
+void IrBuilder::visit(const BlockStmt& stmt) {
+    state().scopes.emplace_back();
+    for (const auto& inner : stmt.statements) {
+        inner->accept(*this);
+    }
+    state().scopes.pop_back();
+}
+
+void IrBuilder::visit(const IfStmt& stmt) {
+    int condition = lower(*stmt.condition);
+    int line = stmt.condition->get_line();
+    int thenBlock = newBlock(false);
+    int join = newBlock(false);
+    int elseBlock = stmt.elseBlock ? newBlock(false) : join;
+    branch(condition, thenBlock, elseBlock, line);
+    sealBlock(thenBlock);
+    state().block = thenBlock;
+    stmt.thenBlock->accept(*this);
+    jump(join, line);
+    if (stmt.elseBlock) {
+        sealBlock(elseBlock);
+        state().block = elseBlock;
+        stmt.elseBlock->accept(*this);
+        jump(join, line);
+    }
+    sealBlock(join);
+    state().block = join;
+}
+
+void IrBuilder::visit(const WhileStmt& stmt) {
+    int line = stmt.condition->get_line();
+    int preheader = state().block;
+    int header = newBlock(false);
+    jump(header, line);
+    function().blocks[header].loop = &stmt;
+    function().blocks[header].preheader = preheader;
+
+    state().block = header;
+    int condition = lower(*stmt.condition);
+    int body = newBlock(false);
+    int exit = newBlock(false);
+    branch(condition, body, exit, line);
+    sealBlock(body);
+
+    int step = stmt.increment ? newBlock(false) : header;
+    state().loops.push_back({step, exit});
+    state().block = body;
+    stmt.body->accept(*this);
+    jump(step, line);
+    state().loops.pop_back();
+    if (stmt.increment) {
+        sealBlock(step);
+        state().block = step;
+        lower(*stmt.increment);
+        jump(header, line);
+    }
+    sealBlock(header);
+    sealBlock(exit);
+    state().block = exit;
+}
+
+void IrBuilder::visit(const FunctionStmt& stmt) {
+    declare(stmt.name.lexeme, &stmt);
+    lowerFunction(stmt.name.lexeme, stmt.params, stmt.body->statements);
+    Instr closure{Op::Closure};
+    closure.name = stmt.name.lexeme;
+    closure.line = stmt.name.line;
+    writeName(stmt.name, function().append(state().block, std::move(closure)));
+}
+
+void IrBuilder::visit(const ReturnStmt& stmt) {
+    int value = stmt.value ? lower(*stmt.value) : constant(nullptr, stmt.kw.line);
+    emit(Op::Return, {value}, stmt.kw.line);
+    startUnreachable();
+}
+
+void IrBuilder::visit(const BreakStmt& stmt) {
+    if (state().loops.empty()) return; // reported by the backends
+    jump(state().loops.back().exit, stmt.kw.line);
+    startUnreachable();
+}
+
+void IrBuilder::visit(const ContinueStmt& stmt) {
+    if (state().loops.empty()) return;
+    jump(state().loops.back().continueTarget, stmt.kw.line);
+    startUnreachable();
+}
+
+}
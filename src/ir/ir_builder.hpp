@@ -0,0 +1,110 @@
+#pragma once
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "expr.hpp"
+#include "ir/ir.hpp"
+#include "statement.hpp"
+
+namespace ir {
+
+// Where the value of an expression lives in the IR.
+struct ValueRef {
+    Function* function;
+    int id;
+};
+
+// Lowers the AST to SSA with the algorithm of Braun et al., "Simple and
+// Efficient Construction of Static Single Assignment Form": variables are
+// looked up per block on demand, and phis are only placed where two
+// different definitions meet.
+class IrBuilder: public ExprVisitor, public StmtVisitor {
+public:
+    Program build(const std::vector<std::unique_ptr<Stmt>>& statements);
+
+    // the value of every expression lowered (the script's and all functions')
+    std::unordered_map<const Expr*, ValueRef> values;
+
+    void visit(const Binary& expr) override;
+    void visit(const Logical& expr) override;
+    void visit(const Ternary& expr) override;
+    void visit(const Grouping& expr) override;
+    void visit(const Literal& expr) override;
+    void visit(const Unary& expr) override;
+    void visit(const Postfix& expr) override;
+    void visit(const Variable& expr) override;
+    void visit(const Assignment& expr) override;
+    void visit(const Call& expr) override;
+    void visit(const ArrayLiteral& expr) override;
+    void visit(const MapLiteral& expr) override;
+    void visit(const Subscript& expr) override;
+    void visit(const PropertyAccess& expr) override;
+    void visit(const SubscriptAssignment& expr) override;
+    void visit(const FunctionExpr& expr) override;
+
+    void visit(const ExpressionStmt& stmt) override;
+    void visit(const PrintStmt& stmt) override;
+    void visit(const VarStmt& stmt) override;
+    void visit(const BlockStmt& stmt) override;
+    void visit(const IfStmt& stmt) override;
+    void visit(const WhileStmt& stmt) override;
+    void visit(const FunctionStmt& stmt) override;
+    void visit(const ReturnStmt& stmt) override;
+    void visit(const BreakStmt& stmt) override;
+    void visit(const ContinueStmt& stmt) override;
+
+private:
+    // a variable: its declaring node (VarStmt, FunctionStmt or parameter Token),
+    // or the expression whose branches merge for and/or and ?:
+    using Key = const void*;
+
+    struct Loop {
+        int continueTarget;
+        int exit;
+    };
+
+    struct State {
+        Function* function;
+        int block = 0;
+        std::vector<std::unordered_map<std::string, Key>> scopes{};
+        std::unordered_set<std::string> captured{}; // names used by nested functions
+        std::unordered_map<Key, std::unordered_map<int, int>> definitions{};
+        std::unordered_map<int, std::vector<std::pair<Key, int>>> incompletePhis{};
+        std::vector<bool> sealed{};
+        std::vector<Loop> loops{};
+    };
+
+    Program program;
+    std::vector<State> states;
+    int result = -1;
+
+    State& state() { return states.back(); }
+    Function& function() { return *state().function; }
+
+    void lowerFunction(const std::string& name, const std::vector<Token>& params,
+                       const std::vector<std::unique_ptr<Stmt>>& body);
+    int lower(const Expr& expr);
+    int emit(Op op, std::vector<int> args, int line, const Expr* origin = nullptr);
+    int constant(const Value& value, int line);
+
+    int newBlock(bool sealed);
+    void sealBlock(int block);
+    void jump(int target, int line);
+    void branch(int condition, int thenBlock, int elseBlock, int line);
+    void startUnreachable();
+
+    // nullptr for globals and captured locals, which live in memory
+    Key resolve(const std::string& name) const;
+    void declare(const std::string& name, Key key);
+    int readName(const Token& name);
+    void writeName(const Token& name, int value);
+
+    void writeVariable(Key variable, int block, int value);
+    int readVariable(Key variable, int block);
+    int readVariableRecursive(Key variable, int block);
+    int addPhiOperands(Key variable, int phi);
+    int tryRemoveTrivialPhi(int phi);
+};
+
+}
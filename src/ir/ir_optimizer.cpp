@@ -0,0 +1,242 @@
+#include "ir/ir_optimizer.hpp"
+
+#include <algorithm>
+#include <utility>
+
+#include "ast_walker.hpp"
+#include "ir/passes.hpp"
+
+namespace {
+
+// no side effects and no memory reads other than locals
+bool isPureTree(const Expr& expr) {
+    if (dynamic_cast<const Literal*>(&expr) || dynamic_cast<const Variable*>(&expr)) return true;
+    if (const auto* grouping = dynamic_cast<const Grouping*>(&expr)) return isPureTree(*grouping->expression);
+    if (const auto* unary = dynamic_cast<const Unary*>(&expr)) return isPureTree(*unary->right);
+    if (const auto* binary = dynamic_cast<const Binary*>(&expr)) {
+        return isPureTree(*binary->left) && isPureTree(*binary->right);
+    }
+    if (const auto* logical = dynamic_cast<const Logical*>(&expr)) {
+        return isPureTree(*logical->left) && isPureTree(*logical->right);
+    }
+    if (const auto* ternary = dynamic_cast<const Ternary*>(&expr)) {
+        return isPureTree(*ternary->condition) && isPureTree(*ternary->thenBranch) && isPureTree(*ternary->elseBranch);
+    }
+    return false;
+}
+
+// Whether expr is arithmetic on variables none of which is in names.
+bool isArithmeticOutside(const Expr& expr, const std::set<std::string>& names) {
+    if (dynamic_cast<const Literal*>(&expr)) return true;
+    if (const auto* variable = dynamic_cast<const Variable*>(&expr)) return !names.count(variable->name.lexeme);
+    if (const auto* grouping = dynamic_cast<const Grouping*>(&expr)) return isArithmeticOutside(*grouping->expression, names);
+    if (const auto* unary = dynamic_cast<const Unary*>(&expr)) return isArithmeticOutside(*unary->right, names);
+    if (const auto* binary = dynamic_cast<const Binary*>(&expr)) {
+        return isArithmeticOutside(*binary->left, names) && isArithmeticOutside(*binary->right, names);
+    }
+    return false;
+}
+
+class DeclaredNames: public AstWalker {
+public:
+    std::set<std::string>& names;
+    explicit DeclaredNames(std::set<std::string>& names): names(names) {}
+
+    using AstWalker::visit;
+    void visit(const VarStmt& stmt) override {
+        names.insert(stmt.name.lexeme);
+        AstWalker::visit(stmt);
+    }
+    void visit(const FunctionStmt& stmt) override {
+        names.insert(stmt.name.lexeme);
+        for (const auto& param : stmt.params) names.insert(param.lexeme);
+        AstWalker::visit(stmt);
+    }
+    void visit(const FunctionExpr& expr) override {
+        for (const auto& param : expr.params) names.insert(param.lexeme);
+        AstWalker::visit(expr);
+    }
+};
+
+}
+
+void IrOptimizer::optimize(std::vector<std::unique_ptr<Stmt>>& statements, std::ostream* dump) {
+    auto program = builder.build(statements);
+    ir::PassManager::standard().run(program);
+    if (dump) program.print(*dump);
+
+    // a value moved out of a loop can move further out on the next round
+    do {
+        changed = false;
+        rewriteBlock(statements, false);
+    } while (changed);
+}
+
+void IrOptimizer::rewriteBlock(std::vector<std::unique_ptr<Stmt>>& statements, bool splice) {
+    for (auto& stmt : statements) {
+        rewriteStatement(stmt);
+    }
+    if (!splice) return;
+    std::vector<std::unique_ptr<Stmt>> merged;
+    for (auto& stmt : statements) {
+        if (wrappers.erase(stmt.get())) {
+            auto* block = static_cast<BlockStmt*>(stmt.get());
+            for (auto& inner : block->statements) merged.push_back(std::move(inner));
+        } else {
+            merged.push_back(std::move(stmt));
+        }
+    }
+    statements = std::move(merged);
+}
+
+void IrOptimizer::rewriteStatement(std::unique_ptr<Stmt>& stmt) {
+    if (auto* exprStmt = dynamic_cast<ExpressionStmt*>(stmt.get())) {
+        rewriteExpression(exprStmt->expr);
+    } else if (auto* print = dynamic_cast<PrintStmt*>(stmt.get())) {
+        rewriteExpression(print->expr);
+    } else if (auto* var = dynamic_cast<VarStmt*>(stmt.get())) {
+        if (var->initializer) rewriteExpression(var->initializer);
+    } else if (auto* block = dynamic_cast<BlockStmt*>(stmt.get())) {
+        rewriteBlock(block->statements, true);
+    } else if (auto* ifStmt = dynamic_cast<IfStmt*>(stmt.get())) {
+        rewriteExpression(ifStmt->condition);
+        rewriteStatement(ifStmt->thenBlock);
+        if (ifStmt->elseBlock) rewriteStatement(ifStmt->elseBlock);
+    } else if (auto* whileStmt = dynamic_cast<WhileStmt*>(stmt.get())) {
+        loops.push_back(whileStmt);
+        rewriteExpression(whileStmt->condition);
+        rewriteStatement(whileStmt->body);
+        if (whileStmt->increment) rewriteExpression(whileStmt->increment);
+        loops.pop_back();
+        auto it = hoisted.find(whileStmt);
+        if (it != hoisted.end()) {
+            // { var $inv0 = ...; while (...) ... }
+            auto statements = std::move(it->second);
+            hoisted.erase(it);
+            int line = whileStmt->condition->get_line();
+            statements.push_back(std::move(stmt));
+            stmt = BlockStmt::create(std::move(statements), line);
+            wrappers.insert(stmt.get());
+        }
+    } else if (auto* function = dynamic_cast<FunctionStmt*>(stmt.get())) {
+        rewriteFunction(function->body->statements);
+    } else if (auto* ret = dynamic_cast<ReturnStmt*>(stmt.get())) {
+        if (ret->value) rewriteExpression(ret->value);
+    }
+}
+
+void IrOptimizer::rewriteFunction(std::vector<std::unique_ptr<Stmt>>& body) {
+    auto enclosing = std::exchange(loops, {});
+    rewriteBlock(body, true);
+    loops = std::move(enclosing);
+}
+
+void IrOptimizer::rewriteExpression(std::unique_ptr<Expr>& expr) {
+    if (replaceWithConstant(expr) || hoist(expr)) {
+        changed = true;
+        return;
+    }
+    if (auto* binary = dynamic_cast<Binary*>(expr.get())) {
+        rewriteExpression(binary->left);
+        rewriteExpression(binary->right);
+    } else if (auto* logical = dynamic_cast<Logical*>(expr.get())) {
+        rewriteExpression(logical->left);
+        rewriteExpression(logical->right);
+    } else if (auto* ternary = dynamic_cast<Ternary*>(expr.get())) {
+        rewriteExpression(ternary->condition);
+        rewriteExpression(ternary->thenBranch);
+        rewriteExpression(ternary->elseBranch);
+    } else if (auto* grouping = dynamic_cast<Grouping*>(expr.get())) {
+        rewriteExpression(grouping->expression);
+    } else if (auto* unary = dynamic_cast<Unary*>(expr.get())) {
+        rewriteExpression(unary->right);
+    } else if (auto* postfix = dynamic_cast<Postfix*>(expr.get())) {
+        // the operand is an lvalue; only its subexpressions can change
+        if (auto* subscript = dynamic_cast<Subscript*>(postfix->operand.get())) {
+            rewriteExpression(subscript->object);
+            rewriteExpression(subscript->index);
+        } else if (auto* property = dynamic_cast<PropertyAccess*>(postfix->operand.get())) {
+            rewriteExpression(property->object);
+        }
+    } else if (auto* assignment = dynamic_cast<Assignment*>(expr.get())) {
+        rewriteExpression(assignment->right);
+    } else if (auto* assignment = dynamic_cast<SubscriptAssignment*>(expr.get())) {
+        rewriteExpression(assignment->object);
+        rewriteExpression(assignment->index);
+        rewriteExpression(assignment->value);
+    } else if (auto* call = dynamic_cast<Call*>(expr.get())) {
+        rewriteExpression(call->callee);
+        for (auto& argument : call->arguments) {
+            rewriteExpression(argument);
+        }
+    } else if (auto* array = dynamic_cast<ArrayLiteral*>(expr.get())) {
+        for (auto& element : array->elements) {
+            rewriteExpression(element);
+        }
+    } else if (auto* map = dynamic_cast<MapLiteral*>(expr.get())) {
+        for (auto& [key, value] : map->pairs) {
+            rewriteExpression(key);
+            rewriteExpression(value);
+        }
+    } else if (auto* subscript = dynamic_cast<Subscript*>(expr.get())) {
+        rewriteExpression(subscript->object);
+        rewriteExpression(subscript->index);
+    } else if (auto* property = dynamic_cast<PropertyAccess*>(expr.get())) {
+        rewriteExpression(property->object);
+    } else if (auto* function = dynamic_cast<FunctionExpr*>(expr.get())) {
+        rewriteFunction(function->body->statements);
+    }
+    // Literal, Variable: nothing to rewrite
+}
+
+ir::ValueRef IrOptimizer::valueOf(const Expr& expr) const {
+    auto it = builder.values.find(&expr);
+    if (it == builder.values.end()) return {nullptr, -1};
+    return {it->second.function, it->second.function->resolve(it->second.id)};
+}
+
+bool IrOptimizer::replaceWithConstant(std::unique_ptr<Expr>& expr) {
+    if (dynamic_cast<const Literal*>(expr.get()) || !isPureTree(*expr)) return false;
+    auto value = valueOf(*expr);
+    if (!value.function || value.function->values[value.id].op != ir::Op::Const) return false;
+    auto literal = Literal::create(value.function->values[value.id].constant, expr->get_line());
+    replaced.push_back(std::exchange(expr, std::move(literal)));
+    return true;
+}
+
+bool IrOptimizer::hoist(std::unique_ptr<Expr>& expr) {
+    if (loops.empty() || (!dynamic_cast<const Binary*>(expr.get()) && !dynamic_cast<const Unary*>(expr.get()))) {
+        return false;
+    }
+    auto value = valueOf(*expr);
+    if (!value.function) return false;
+    auto it = value.function->hoisted.find(value.id);
+    if (it == value.function->hoisted.end()) return false;
+    const auto* loop = value.function->blocks[it->second].loop;
+    if (std::find(loops.begin(), loops.end(), loop) == loops.end() || !canMoveBefore(*expr, *loop)) return false;
+
+    int line = expr->get_line();
+    auto [temporary, inserted] = temporaries.try_emplace({value.function, value.id}, "");
+    if (inserted) {
+        temporary->second = "$inv" + std::to_string(temporaries.size() - 1);
+        Token name(TokenType::IDENTIFIER, temporary->second, nullptr, line);
+        hoisted[loop].push_back(VarStmt::create(name, std::move(expr)));
+    }
+    auto variable = Variable::create(Token(TokenType::IDENTIFIER, temporary->second, nullptr, line));
+    if (expr) replaced.push_back(std::move(expr));
+    expr = std::move(variable);
+    return true;
+}
+
+// The expression will be evaluated right before the loop, so every name in it
+// must mean the same thing there.
+bool IrOptimizer::canMoveBefore(const Expr& expr, const WhileStmt& loop) {
+    auto [names, inserted] = declaredIn.try_emplace(&loop);
+    if (inserted) {
+        DeclaredNames declared{names->second};
+        loop.condition->accept(declared);
+        loop.body->accept(declared);
+        if (loop.increment) loop.increment->accept(declared);
+    }
+    return isArithmeticOutside(expr, names->second);
+}
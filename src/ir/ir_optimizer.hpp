@@ -0,0 +1,54 @@
+#pragma once
+#include <map>
+#include <memory>
+#include <ostream>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "expr.hpp"
+#include "ir/ir_builder.hpp"
+#include "statement.hpp"
+
+// Runs the SSA passes over a program and applies their results to the AST,
+// which both backends (the beat compiler and the JavaScript generator) then
+// translate as usual:
+//  - an expression without side effects whose value the passes proved
+//    constant becomes a literal;
+//  - an expression LICM moved out of a loop is computed once into a fresh
+//    local before the loop, and every expression in the loop that value
+//    numbering found equal to it reads that local instead.
+// Only passes whose results can be written back this way run: removing dead
+// instructions or forwarding copies in the IR would change nothing either
+// backend emits, since both still compile the tree.
+class IrOptimizer {
+public:
+    // dump, if given, receives the optimized IR
+    void optimize(std::vector<std::unique_ptr<Stmt>>& statements, std::ostream* dump = nullptr);
+
+private:
+    ir::IrBuilder builder;
+    std::vector<const WhileStmt*> loops; // enclosing loops in the current function
+    std::map<const WhileStmt*, std::vector<std::unique_ptr<Stmt>>> hoisted;
+    std::map<std::pair<const ir::Function*, int>, std::string> temporaries;
+    std::unordered_map<const WhileStmt*, std::set<std::string>> declaredIn;
+    std::set<const Stmt*> wrappers; // blocks added to hold hoisted locals
+    bool changed = false;
+    // replaced expressions, kept alive so that no new node reuses an address
+    // that is still a key of builder.values
+    std::vector<std::unique_ptr<Expr>> replaced;
+
+    // splice: whether a wrapper block may be merged into statements, i.e.
+    // statements is a local scope
+    void rewriteBlock(std::vector<std::unique_ptr<Stmt>>& statements, bool splice);
+    void rewriteStatement(std::unique_ptr<Stmt>& stmt);
+    void rewriteFunction(std::vector<std::unique_ptr<Stmt>>& body);
+    void rewriteExpression(std::unique_ptr<Expr>& expr);
+
+    // the IR value of expr, resolved, or {nullptr, -1}
+    ir::ValueRef valueOf(const Expr& expr) const;
+    bool replaceWithConstant(std::unique_ptr<Expr>& expr);
+    bool hoist(std::unique_ptr<Expr>& expr);
+    bool canMoveBefore(const Expr& expr, const WhileStmt& loop);
+};
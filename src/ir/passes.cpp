@@ -0,0 +1,341 @@
+#include "ir/passes.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <map>
+
+#include "constant_folder.hpp"
+
+namespace ir {
+
+namespace {
+
+InferredType join(InferredType a, InferredType b) {
+    if (a == InferredType::NONE) return b;
+    if (b == InferredType::NONE) return a;
+    return a == b ? a : InferredType::UNKNOWN;
+}
+
+InferredType typeOfValue(const Value& value) {
+    if (std::holds_alternative<double>(value)) return InferredType::NUMBER;
+    if (std::holds_alternative<bool>(value)) return InferredType::BOOL;
+    if (std::holds_alternative<std::string>(value)) return InferredType::STRING;
+    if (std::holds_alternative<std::nullptr_t>(value)) return InferredType::NIL;
+    return InferredType::UNKNOWN;
+}
+
+InferredType typeOfInstr(const Function& function, const Instr& instr) {
+    auto arg = [&](size_t i) { return function.values[instr.args[i]].type; };
+    switch (instr.op) {
+        case Op::Const:
+            return typeOfValue(instr.constant);
+        case Op::Phi: {
+            auto type = InferredType::NONE;
+            for (size_t i = 0; i < instr.args.size(); i++) type = join(type, arg(i));
+            return type;
+        }
+        case Op::Not:
+        case Op::Eq:
+        case Op::Ne:
+        case Op::Lt:
+        case Op::Le:
+        case Op::Gt:
+        case Op::Ge:
+            return InferredType::BOOL;
+        // arithmetic raises an error unless its operands have the right types,
+        // so any value it produces is a number (or, for +, maybe a string)
+        case Op::Neg:
+        case Op::Sub:
+        case Op::Mul:
+        case Op::Div:
+        case Op::Mod:
+            return InferredType::NUMBER;
+        case Op::Add:
+            if (arg(0) == InferredType::NUMBER || arg(1) == InferredType::NUMBER) return InferredType::NUMBER;
+            if (arg(0) == InferredType::STRING || arg(1) == InferredType::STRING) return InferredType::STRING;
+            if (arg(0) == InferredType::NONE || arg(1) == InferredType::NONE) return InferredType::NONE;
+            return InferredType::UNKNOWN;
+        case Op::Array: return InferredType::ARRAY;
+        case Op::Map: return InferredType::MAP;
+        case Op::Closure: return InferredType::FUNCTION;
+        default: return InferredType::UNKNOWN;
+    }
+}
+
+TokenType tokenType(Op op) {
+    switch (op) {
+        case Op::Neg: return TokenType::MINUS;
+        case Op::Not: return TokenType::BANG;
+        case Op::Add: return TokenType::PLUS;
+        case Op::Sub: return TokenType::MINUS;
+        case Op::Mul: return TokenType::STAR;
+        case Op::Div: return TokenType::SLASH;
+        case Op::Mod: return TokenType::PERCENT;
+        case Op::Eq: return TokenType::EQUAL_EQUAL;
+        case Op::Ne: return TokenType::BANG_EQUAL;
+        case Op::Lt: return TokenType::LESS;
+        case Op::Le: return TokenType::LESS_EQUAL;
+        case Op::Gt: return TokenType::GREATER;
+        default: return TokenType::GREATER_EQUAL;
+    }
+}
+
+bool isConst(const Function& function, int id) {
+    return function.values[id].op == Op::Const;
+}
+
+// Whether the VM and the JavaScript runtime both evaluate instr without an
+// error, given the operand types. Only such instructions may run speculatively.
+bool cannotThrow(const Function& function, const Instr& instr) {
+    auto number = [&](size_t i) { return function.values[instr.args[i]].type == InferredType::NUMBER; };
+    auto string = [&](size_t i) { return function.values[instr.args[i]].type == InferredType::STRING; };
+    switch (instr.op) {
+        case Op::Not:
+        case Op::Eq:
+        case Op::Ne:
+            return true;
+        case Op::Neg:
+            return number(0);
+        case Op::Add:
+            return (number(0) && number(1)) || (string(0) && string(1));
+        case Op::Sub:
+        case Op::Mul:
+        case Op::Div:
+        case Op::Lt:
+        case Op::Le:
+        case Op::Gt:
+        case Op::Ge:
+            return number(0) && number(1);
+        default:
+            return false; // % also needs integer operands
+    }
+}
+
+std::string constantKey(const Value& value) {
+    if (const auto* number = std::get_if<double>(&value)) {
+        uint64_t bits;
+        std::memcpy(&bits, number, sizeof bits); // keeps 0 and -0 apart
+        return "d" + std::to_string(bits);
+    }
+    if (const auto* string = std::get_if<std::string>(&value)) return "s" + std::to_string(string->size()) + ":" + *string;
+    if (const auto* boolean = std::get_if<bool>(&value)) return *boolean ? "t" : "f";
+    return "n";
+}
+
+// constants are compared by value, so equal constants at different places match
+std::string valueKey(const Function& function, const Instr& instr) {
+    if (instr.op == Op::Const) return "c" + constantKey(instr.constant);
+    std::vector<std::string> args;
+    for (int arg : instr.args) {
+        const auto& operand = function.values[arg];
+        args.push_back(operand.op == Op::Const ? "=" + constantKey(operand.constant) : "#" + std::to_string(arg));
+    }
+    if (instr.op == Op::Mul || instr.op == Op::Eq || instr.op == Op::Ne) {
+        std::sort(args.begin(), args.end());
+    }
+    std::string key = opName(instr.op);
+    for (const auto& arg : args) key += " " + arg;
+    return key;
+}
+
+}
+
+void inferTypes(Function& function) {
+    auto order = function.reversePostorder();
+    for (int block : order) {
+        for (int id : function.blocks[block].instrs) function.values[id].type = InferredType::NONE;
+    }
+    // values start optimistic and only widen, so this terminates
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int block : order) {
+            for (int id : function.blocks[block].instrs) {
+                auto type = typeOfInstr(function, function.values[id]);
+                if (type != function.values[id].type) {
+                    function.values[id].type = type;
+                    changed = true;
+                }
+            }
+        }
+    }
+    for (int block : order) {
+        for (int id : function.blocks[block].instrs) {
+            if (function.values[id].type == InferredType::NONE) function.values[id].type = InferredType::UNKNOWN;
+        }
+    }
+}
+
+bool ConstantPropagation::run(Function& function) {
+    bool changed = false;
+    for (int block : function.reversePostorder()) {
+        auto instrs = function.blocks[block].instrs;
+        for (int id : instrs) {
+            auto& instr = function.values[id];
+            if (instr.removed) continue;
+            if (instr.op == Op::Phi) {
+                if (instr.args.empty() || !isConst(function, instr.args[0])) continue;
+                const auto& first = function.values[instr.args[0]].constant;
+                bool same = std::all_of(instr.args.begin(), instr.args.end(), [&](int arg) {
+                    return isConst(function, arg) && function.values[arg].constant == first;
+                });
+                if (same) {
+                    function.replaceAllUses(id, instr.args[0]);
+                    function.remove(id);
+                    changed = true;
+                }
+            } else if (isPure(instr.op) && instr.op != Op::Const) {
+                bool constants = std::all_of(instr.args.begin(), instr.args.end(), [&](int arg) {
+                    return isConst(function, arg);
+                });
+                if (!constants) continue;
+                Token op(tokenType(instr.op), "", nullptr, instr.line);
+                Value result;
+                bool folded = instr.args.size() == 1
+                    ? ConstantFolder::foldUnary(op, function.values[instr.args[0]].constant, result)
+                    : ConstantFolder::foldBinary(op, function.values[instr.args[0]].constant,
+                                                 function.values[instr.args[1]].constant, result);
+                if (folded) {
+                    instr.op = Op::Const;
+                    instr.constant = result;
+                    instr.args.clear();
+                    changed = true;
+                }
+            } else if (instr.op == Op::Branch && isConst(function, instr.args[0])) {
+                bool truthy = is_truthy(function.values[instr.args[0]].constant);
+                int taken = instr.targets[truthy ? 0 : 1];
+                int skipped = instr.targets[truthy ? 1 : 0];
+                instr.op = Op::Jump;
+                instr.args.clear();
+                instr.targets = {taken};
+                function.removeEdge(block, skipped);
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+bool GlobalValueNumbering::run(Function& function) {
+    auto idom = function.dominators();
+    std::vector<std::vector<int>> children(function.blocks.size());
+    for (size_t block = 1; block < function.blocks.size(); block++) {
+        if (idom[block] != -1) children[idom[block]].push_back(block);
+    }
+
+    bool changed = false;
+    std::map<std::string, int> available;
+    std::function<void(int)> visit = [&](int block) {
+        std::vector<std::string> added;
+        auto instrs = function.blocks[block].instrs;
+        for (int id : instrs) {
+            const auto& instr = function.values[id];
+            if (!isPure(instr.op)) continue;
+            auto key = valueKey(function, instr);
+            auto it = available.find(key);
+            if (it != available.end()) {
+                function.replaceAllUses(id, it->second);
+                function.remove(id);
+                changed = true;
+            } else {
+                available.emplace(key, id);
+                added.push_back(key);
+            }
+        }
+        for (int child : children[block]) visit(child);
+        for (const auto& key : added) available.erase(key);
+    };
+    visit(0);
+    return changed;
+}
+
+bool LoopInvariantCodeMotion::run(Function& function) {
+    auto idom = function.dominators();
+    auto order = function.reversePostorder();
+
+    struct Loop {
+        int header;
+        std::vector<bool> body;
+        size_t size;
+    };
+    std::vector<Loop> loops;
+    for (int header : order) {
+        if (!function.blocks[header].loop) continue;
+        Loop loop{header, std::vector<bool>(function.blocks.size(), false), 0};
+        loop.body[header] = true;
+        std::vector<int> worklist;
+        for (int pred : function.blocks[header].preds) {
+            if (function.dominates(idom, header, pred)) worklist.push_back(pred); // a back edge
+        }
+        if (worklist.empty()) continue; // the loop never repeats
+        while (!worklist.empty()) {
+            int block = worklist.back();
+            worklist.pop_back();
+            if (loop.body[block]) continue;
+            loop.body[block] = true;
+            for (int pred : function.blocks[block].preds) worklist.push_back(pred);
+        }
+        loop.size = std::count(loop.body.begin(), loop.body.end(), true);
+        loops.push_back(std::move(loop));
+    }
+    // inner loops first, so that values can move out one level at a time
+    std::stable_sort(loops.begin(), loops.end(), [](const Loop& a, const Loop& b) { return a.size < b.size; });
+
+    bool changed = false;
+    for (const auto& loop : loops) {
+        int preheader = function.blocks[loop.header].preheader;
+        if (preheader < 0 || idom[preheader] == -1) continue;
+        if (function.successors(preheader) != std::vector<int>{loop.header}) continue;
+        for (int block : order) {
+            if (!loop.body[block]) continue;
+            auto instrs = function.blocks[block].instrs;
+            for (int id : instrs) {
+                const auto& instr = function.values[id];
+                if (!isPure(instr.op) || instr.op == Op::Const || !cannotThrow(function, instr)) continue;
+                bool invariant = std::all_of(instr.args.begin(), instr.args.end(), [&](int arg) {
+                    return isConst(function, arg) || !loop.body[function.values[arg].block];
+                });
+                if (!invariant) continue;
+                for (int arg : instr.args) {
+                    if (loop.body[function.values[arg].block]) function.moveToEnd(arg, preheader); // a constant
+                }
+                function.moveToEnd(id, preheader);
+                function.hoisted[id] = loop.header;
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+void PassManager::add(std::unique_ptr<Pass> pass) {
+    passes.push_back(std::move(pass));
+}
+
+void PassManager::run(Program& program) {
+    for (auto& function : program.functions) {
+        inferTypes(*function);
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (auto& pass : passes) {
+                if (pass->run(*function)) {
+                    inferTypes(*function);
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+PassManager PassManager::standard() {
+    PassManager manager;
+    manager.add(std::make_unique<ConstantPropagation>());
+    manager.add(std::make_unique<GlobalValueNumbering>());
+    manager.add(std::make_unique<LoopInvariantCodeMotion>());
+    return manager;
+}
+
+}
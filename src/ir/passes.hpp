@@ -0,0 +1,59 @@
+#pragma once
+#include <memory>
+#include <vector>
+
+#include "ir/ir.hpp"
+
+namespace ir {
+
+// Recomputes the type of every value: constants by their value, arithmetic
+// from its operands, phis as the join of theirs. Passes read the result.
+void inferTypes(Function& function);
+
+class Pass {
+public:
+    virtual ~Pass() = default;
+    virtual const char* name() const = 0;
+    // returns whether the function changed
+    virtual bool run(Function& function) = 0;
+};
+
+// Sparse constant propagation: folds pure instructions on constants with the
+// same rules as ConstantFolder, merges phis of equal constants and turns
+// branches on constants into jumps.
+class ConstantPropagation: public Pass {
+public:
+    const char* name() const override { return "constprop"; }
+    bool run(Function& function) override;
+};
+
+// Dominator-scoped value numbering: a pure instruction that recomputes a value
+// already available in a dominating block is replaced by it.
+class GlobalValueNumbering: public Pass {
+public:
+    const char* name() const override { return "gvn"; }
+    bool run(Function& function) override;
+};
+
+// Moves pure instructions whose operands are defined outside a loop, and that
+// cannot raise an error, into the loop's preheader. Records each in
+// Function::hoisted.
+class LoopInvariantCodeMotion: public Pass {
+public:
+    const char* name() const override { return "licm"; }
+    bool run(Function& function) override;
+};
+
+class PassManager {
+public:
+    void add(std::unique_ptr<Pass> pass);
+    // runs the passes in order over every function, repeating until none changes anything
+    void run(Program& program);
+
+    static PassManager standard();
+
+private:
+    std::vector<std::unique_ptr<Pass>> passes;
+};
+
+}
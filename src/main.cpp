@@ -7,6 +7,7 @@
 #include <stdlib.h>
 
 #include "ast_printer.hpp"
+#include "closure_compiler.hpp"
 #include "scanner.hpp"
 #include "interpreter.hpp"
 #include "expr.hpp"
@@ -16,6 +17,7 @@
 bool printAst = false;
 bool noLoop = false;
 bool op_counters_flag = false;
+bool compileClosures = false;
 
 void printVersion() {
     std::cout << "rhythm version " << CCLOX_VERSION << std::endl;
@@ -32,6 +34,7 @@ void printUsage() {
     std::cout << "  -a, --ast        Print AST before execution" << std::endl;
     std::cout << "  -c, --counters   Print counters for OP codes" << std::endl;
     std::cout << "  -n, --no-loop    Disable loop constructs (forces recursion)" << std::endl;
+    std::cout << "  --closures       Compile the tree to closures once, then run those" << std::endl;
 }
 
 void run(Interpreter &interpreter, Resolver &resolver, std::string &source)
@@ -68,7 +71,11 @@ void run(Interpreter &interpreter, Resolver &resolver, std::string &source)
     }
 
     resolver.resolve(stmts);
-    interpreter.interpret(stmts);
+    if (compileClosures) {
+        ClosureCompiler(interpreter).run(stmts);
+    } else {
+        interpreter.interpret(stmts);
+    }
 
 }
 
@@ -95,7 +102,7 @@ void runPrompt(Interpreter &interpreter, Resolver &resolver)
 
 int main(int argc, char **argv) {
     Interpreter interpreter;
-    Resolver resolver(&interpreter);
+    Resolver resolver;
     // Parse command line arguments
     for (int i = 1; i < argc; i++) {
         if (std::strcmp(argv[i], "-v") == 0 || std::strcmp(argv[i], "--version") == 0) {
@@ -115,6 +122,9 @@ int main(int argc, char **argv) {
         if (std::strcmp(argv[i], "-n") == 0 || std::strcmp(argv[i], "--no-loop") == 0) {  // Add this block
             noLoop = true;
         }
+        if (std::strcmp(argv[i], "--closures") == 0) {
+            compileClosures = true;
+        }
     }
 
     // Count non-option arguments
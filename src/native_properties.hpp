@@ -0,0 +1,53 @@
+#pragma once
+#include <string>
+#include <unordered_map>
+
+// What the analyses may assume about a call to a native, as long as the
+// program does not define a global of the same name. One row per native, so
+// adding a native (or changing one) means updating a single place.
+struct NativeProperties {
+    bool returnsNumber;  // always returns a number (or raises an error)
+    bool loopSafe;       // cannot run user code or shrink an array; push only grows one
+    int keeps;           // argument it leaves where it found it; ALL_ARGUMENTS or NO_ARGUMENT
+
+    static constexpr int ALL_ARGUMENTS = -1;
+    static constexpr int NO_ARGUMENT = -2;
+};
+
+// nullptr for names that are not a native the analyses know about
+inline const NativeProperties* nativeProperties(const std::string& name) {
+    constexpr int ALL = NativeProperties::ALL_ARGUMENTS;
+    constexpr int NONE = NativeProperties::NO_ARGUMENT;
+    static const std::unordered_map<std::string, NativeProperties> natives = {
+        //              number  loopSafe  keeps
+        {"len",       {true,   true,     0}},
+        {"clock",     {true,   true,     NONE}},
+        {"floor",     {true,   true,     NONE}},
+        {"ceil",      {true,   true,     NONE}},
+        {"sin",       {true,   true,     NONE}},
+        {"cos",       {true,   true,     NONE}},
+        {"tan",       {true,   true,     NONE}},
+        {"asin",      {true,   true,     NONE}},
+        {"acos",      {true,   true,     NONE}},
+        {"atan",      {true,   true,     NONE}},
+        {"log",       {true,   true,     NONE}},
+        {"log10",     {true,   true,     NONE}},
+        {"sqrt",      {true,   true,     NONE}},
+        {"exp",       {true,   true,     NONE}},
+        {"fabs",      {true,   true,     NONE}},
+        {"pow",       {true,   true,     NONE}},
+        {"atan2",     {true,   true,     NONE}},
+        {"fmod",      {true,   true,     NONE}},
+        {"printf",    {false,  true,     ALL}},
+        {"sprintf",   {false,  true,     ALL}},
+        {"assert",    {false,  true,     ALL}},
+        {"tonumber",  {false,  true,     NONE}},
+        {"substring", {false,  true,     NONE}},
+        {"keys",      {false,  true,     0}},
+        {"to_json",   {false,  true,     0}},
+        {"push",      {false,  true,     0}},
+        {"pop",       {false,  false,    0}},
+    };
+    auto it = natives.find(name);
+    return it == natives.end() ? nullptr : &it->second;
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include <functional>
+#include <initializer_list>
 #include <sstream>
 #include <stdexcept>
 #include <vector>
@@ -455,7 +456,7 @@ private:
         error(peek(), msg);
         return {};
     }
-    bool match(const std::vector<TokenType>& types) {
+    bool match(std::initializer_list<TokenType> types) {
         for (const auto type : types) {
             if (check(type)) {
                 advance();
@@ -470,7 +471,7 @@ private:
         return peek().type == type;
     }
 
-    Token advance() {
+    const Token& advance() {
         if (!isAtEnd()) current++;
         return previous();
     }
@@ -479,11 +480,11 @@ private:
         return peek().type == TokenType::END_TOKEN;
     }
 
-    Token peek() {
+    const Token& peek() const {
         return tokens[current];
     }
 
-    Token previous() {
+    const Token& previous() const {
         return tokens[current-1];
     }
 
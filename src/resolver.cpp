@@ -1,7 +1,6 @@
 #include "resolver.hpp"
 
 #include "exception.hpp"
-#include "interpreter.hpp"
 
 void Resolver::visit(const BlockStmt &stmts) {
     beginScope();
@@ -65,19 +64,19 @@ void Resolver::visit(const Variable& var) {
             throw RuntimeError(var.name, "Can't read local variable in its own initializer.");
         }
     }
-    resolveLocal(var, var.name);
+    resolveLocal(var.location, var.name);
 }
 
-void Resolver::resolveLocal(const Expr& expr, const Token& name) {
+void Resolver::resolveLocal(VarLocation& location, const Token& name) {
     for (int i = scopes.size() -1; i >= 0; i--) {
         auto it = scopes[i].variables.find(name.lexeme);
         if (it != scopes[i].variables.end()) {
-            int distance = scopes.size() - i - 1;
-            int index = it->second.index;
-            interpreter->resolveWithIndex(&expr, distance, index);
+            location.distance = scopes.size() - i - 1;
+            location.index = it->second.index;
             return;
         }
     }
+    location = {};
 }
 
 void Resolver::visit(const PropertyAccess& prop) {
@@ -87,7 +86,7 @@ void Resolver::visit(const PropertyAccess& prop) {
 
 void Resolver::visit(const Assignment& assignment) {
     resolve(assignment.right.get());
-    resolveLocal(assignment, assignment.name);
+    resolveLocal(assignment.location, assignment.name);
 }
 
 void Resolver::visit(const SubscriptAssignment& assignment) {
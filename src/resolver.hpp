@@ -9,6 +9,8 @@
 // walk the tree and determine static references of each variables
 // specifically, how many hops to go to enclosing env from current
 // env to find the declaration env?
+// The answer is written into each Variable and Assignment node, where the
+// interpreter reads it; the transpiler only needs the checks.
 class Resolver: ExprVisitor, StmtVisitor {
 private:
     struct VarInfo {
@@ -20,7 +22,6 @@ private:
         int nextIndex = 0; // Each scope tracks its own next available index
     };
 
-    Interpreter* interpreter;
     std::vector<Scope> scopes; // used as stack
     FunctionType current_function = FunctionType::NONE;
 
@@ -31,13 +32,13 @@ private:
     void endScope();
     void declare(Token name);
     void define(Token name);
-    void resolveLocal(const Expr& expr, const Token& name);
+    void resolveLocal(VarLocation& location, const Token& name);
     void resolveFunction(const FunctionStmt&, FunctionType);
     void resolveFunction(const FunctionExpr&, FunctionType);
 
 
 public:
-    explicit Resolver(Interpreter* interpreter) : interpreter(interpreter) {}
+    Resolver() = default;
     void resolve(const std::vector<std::unique_ptr<Stmt>>&);
 
 
@@ -40,5 +40,7 @@ private:
 
 public:
     explicit Scanner(std::string _source): source(std::move(_source)) {}
+    // source starts at the given line of a larger file
+    Scanner(std::string _source, int _line): line(_line), lastTokenLine(_line), source(std::move(_source)) {}
     std::vector<Token> scanTokens();
 };
@@ -0,0 +1,374 @@
+#include "transpose/batch.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include "transpose/runtime.hpp"
+#include "transpose/transpiler.hpp"
+
+namespace transpose {
+
+namespace {
+
+// Runs in each worker. It is sent the runtime prelude first, as its length
+// in bytes on a line followed by its text, then jobs, each as
+// `<program bytes> <stdin bytes>` on a line followed by both, and answers
+// each as runBatch prints it, without the script. A job sees its own
+// process, fs and console, which capture what it writes and turn
+// process.exit into the end of the job.
+const char* const workerScript = R"JS(
+'use strict';
+class Exit {
+  constructor(code) {
+    this.code = code;
+  }
+}
+
+function run(makeRuntime, program, stdin) {
+  const stdout = [];
+  const stderr = [];
+  const exitHandlers = [];
+  let stdinPos = 0;
+  const jobProcess = {
+    versions: process.versions,
+    env: process.env,
+    exit(code) {
+      throw new Exit(code === undefined ? 0 : code);
+    },
+    on(event, handler) {
+      if (event === 'exit') exitHandlers.push(handler);
+      return jobProcess;
+    },
+  };
+  const jobFs = {
+    readSync(fd, buffer, offset, length) {
+      const end = Math.min(stdin.length, stdinPos + length);
+      const read = stdin.copy(buffer, offset, stdinPos, end);
+      stdinPos = end;
+      return read;
+    },
+    writeSync(fd, buffer, offset, length) {
+      (fd === 2 ? stderr : stdout).push(Buffer.from(buffer.subarray(offset, offset + length)));
+      return length;
+    },
+  };
+  const jobRequire = (name) => (name === 'fs' ? jobFs : require(name));
+  const writer = (chunks) => (...args) => chunks.push(Buffer.from(args.join(' ') + '\n'));
+  const jobConsole = { log: writer(stdout), error: writer(stderr) };
+
+  let status = 0;
+  try {
+    const __rt = makeRuntime(jobProcess, jobRequire, jobConsole);
+    new Function('__rt', 'process', 'require', 'console', program)(__rt, jobProcess, jobRequire, jobConsole);
+  } catch (err) {
+    if (err instanceof Exit) {
+      status = err.code;
+    } else {
+      stderr.push(Buffer.from(String(err && err.stack ? err.stack : err) + '\n'));
+      status = 1;
+    }
+  }
+  for (const handler of exitHandlers) {
+    handler(status);
+  }
+  const out = Buffer.concat(stdout);
+  const err = Buffer.concat(stderr);
+  return Buffer.concat([Buffer.from(`${status} ${out.length} ${err.length}\n`), out, err]);
+}
+
+let received = Buffer.alloc(0);
+let makeRuntime = null;
+process.stdin.on('data', (chunk) => {
+  received = Buffer.concat([received, chunk]);
+  while (true) {
+    const newline = received.indexOf(10);
+    if (newline < 0) return;
+    const lengths = received.toString('latin1', 0, newline).split(' ').map(Number);
+    const total = lengths.reduce((sum, length) => sum + length, 0);
+    if (received.length < newline + 1 + total) return;
+    const body = received.subarray(newline + 1, newline + 1 + total);
+    received = received.subarray(newline + 1 + total);
+    if (makeRuntime === null) {
+      makeRuntime = new Function('process', 'require', 'console', body.toString('utf8') + '\nreturn __rt;');
+      continue;
+    }
+    const program = body.toString('utf8', 0, lengths[0]);
+    process.stdout.write(run(makeRuntime, program, Buffer.from(body.subarray(lengths[0]))));
+  }
+});
+)JS";
+
+struct Job {
+    std::string script;
+    std::string input; // the file given as stdin, if any
+};
+
+struct Result {
+    int status = 0;
+    std::string out;
+    std::string err;
+};
+
+std::vector<Job> readManifest(const std::string& manifest) {
+    std::ifstream file(manifest);
+    if (!file.is_open()) {
+        throw std::runtime_error("Could not open manifest: " + manifest);
+    }
+    auto base = std::filesystem::path(manifest).parent_path();
+    std::vector<Job> jobs;
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream fields(line);
+        std::string script;
+        std::string input;
+        if (!(fields >> script) || script.front() == '#') continue;
+        fields >> input;
+        jobs.push_back({(base / script).string(), input.empty() ? std::string() : (base / input).string()});
+    }
+    return jobs;
+}
+
+std::string readFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::runtime_error("Could not open file: " + path);
+    }
+    return {std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+}
+
+// Transpiles the job's script into program, or else fails the way
+// transpose would. What the scanner reports goes ahead of the job's output.
+std::optional<Result> prepare(const Job& job, std::string& program, std::string& diagnostics) {
+    std::ostringstream reported;
+    auto* out = std::cout.rdbuf(reported.rdbuf());
+    std::optional<Result> failed;
+    try {
+        program = transpileToJavascriptWithoutRuntime(readFile(job.script));
+    } catch (const std::exception& ex) {
+        failed = Result{1, {}, std::string(ex.what()) + '\n'};
+    }
+    std::cout.rdbuf(out);
+    diagnostics = reported.str();
+    if (failed) failed->out = std::move(diagnostics);
+    return failed;
+}
+
+#ifndef _WIN32
+
+class Worker {
+public:
+    std::optional<size_t> job; // the one it is running
+
+    Worker(const std::string& node, const std::string& prelude) {
+        int toChild[2];
+        int fromChild[2];
+        if (pipe(toChild) != 0 || pipe(fromChild) != 0) {
+            throw std::runtime_error("Unable to create pipes for a Node worker");
+        }
+        pid_ = fork();
+        if (pid_ < 0) {
+            throw std::runtime_error("Unable to start a Node worker");
+        }
+        if (pid_ == 0) {
+            dup2(toChild[0], STDIN_FILENO);
+            dup2(fromChild[1], STDOUT_FILENO);
+            for (int fd : {toChild[0], toChild[1], fromChild[0], fromChild[1]}) close(fd);
+            execlp(node.c_str(), node.c_str(), "-e", workerScript, static_cast<char*>(nullptr));
+            _exit(127);
+        }
+        close(toChild[0]);
+        close(fromChild[1]);
+        in_ = toChild[1];
+        out_ = fromChild[0];
+        fcntl(in_, F_SETFD, FD_CLOEXEC);
+        fcntl(out_, F_SETFD, FD_CLOEXEC);
+        send(std::to_string(prelude.size()) + '\n' + prelude);
+    }
+
+    ~Worker() {
+        close(in_);
+        close(out_);
+        int status;
+        if (pid_ > 0) waitpid(pid_, &status, 0);
+    }
+
+    Worker(const Worker&) = delete;
+    Worker& operator=(const Worker&) = delete;
+
+    int output() const { return out_; }
+
+    // Whether the worker took it; it may have died since the last job.
+    bool start(size_t index, const std::string& program, const std::string& input) {
+        job = index;
+        return send(std::to_string(program.size()) + ' ' + std::to_string(input.size()) + '\n' + program + input);
+    }
+
+    // Reads what the worker has written: its answer once it is complete, or
+    // a failure once the worker is gone.
+    std::optional<Result> receive() {
+        char chunk[1 << 16];
+        ssize_t count = read(out_, chunk, sizeof chunk);
+        if (count < 0 && errno == EINTR) return std::nullopt;
+        if (count <= 0) return died();
+        received_.append(chunk, static_cast<size_t>(count));
+
+        size_t newline = received_.find('\n');
+        if (newline == std::string::npos) return std::nullopt;
+        Result result;
+        size_t outSize = 0;
+        size_t errSize = 0;
+        std::istringstream(received_.substr(0, newline)) >> result.status >> outSize >> errSize;
+        if (received_.size() < newline + 1 + outSize + errSize) return std::nullopt;
+        result.out = received_.substr(newline + 1, outSize);
+        result.err = received_.substr(newline + 1 + outSize, errSize);
+        received_.erase(0, newline + 1 + outSize + errSize);
+        return result;
+    }
+
+    bool alive() const { return alive_; }
+
+private:
+    pid_t pid_ = -1;
+    int in_ = -1;
+    int out_ = -1;
+    std::string received_;
+    bool alive_ = true;
+
+    bool send(const std::string& data) {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            ssize_t count = write(in_, data.data() + sent, data.size() - sent);
+            if (count < 0 && errno == EINTR) continue;
+            if (count <= 0) return false;
+            sent += static_cast<size_t>(count);
+        }
+        return true;
+    }
+
+    Result died() {
+        alive_ = false;
+        int status = 0;
+        waitpid(pid_, &status, 0);
+        pid_ = -1;
+        int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + (WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+        return {code == 0 ? 1 : code, {}, "the Node worker running this program exited\n"};
+    }
+};
+
+#endif
+
+}  // namespace
+
+#ifdef _WIN32
+
+int runBatch(const std::string&, unsigned, const std::string&) {
+    throw std::runtime_error("--batch is not supported on Windows");
+}
+
+#else
+
+int runBatch(const std::string& manifest, unsigned workers, const std::string& node) {
+    auto start = std::chrono::steady_clock::now();
+    auto jobs = readManifest(manifest);
+    workers = std::max(1u, std::min<unsigned>(workers, static_cast<unsigned>(jobs.size())));
+    // a worker that died is noticed by reading from it, not by a signal
+    auto previousHandler = std::signal(SIGPIPE, SIG_IGN);
+
+    const auto prelude = runtimePrelude();
+    std::vector<std::unique_ptr<Worker>> pool;
+    for (unsigned i = 0; i < workers && !jobs.empty(); ++i) {
+        pool.push_back(std::make_unique<Worker>(node, prelude));
+    }
+
+    std::vector<std::optional<Result>> results(jobs.size());
+    std::vector<std::string> diagnostics(jobs.size());
+    size_t next = 0;
+    size_t printed = 0;
+    size_t failed = 0;
+    auto finish = [&](size_t index, Result result) {
+        if (result.status != 0) ++failed;
+        results[index] = std::move(result);
+        for (; printed < jobs.size() && results[printed]; ++printed) {
+            const auto& done = *results[printed];
+            std::cout << done.status << ' ' << done.out.size() << ' ' << done.err.size() << ' ' << jobs[printed].script
+                      << '\n'
+                      << done.out << done.err;
+            results[printed].reset();
+        }
+        std::cout.flush();
+    };
+    while (printed < jobs.size()) {
+        for (auto& worker : pool) {
+            while (!worker->job && next < jobs.size()) {
+                size_t index = next++;
+                std::string program;
+                std::string input;
+                try {
+                    if (auto failure = prepare(jobs[index], program, diagnostics[index])) {
+                        finish(index, std::move(*failure));
+                        continue;
+                    }
+                    if (!jobs[index].input.empty()) input = readFile(jobs[index].input);
+                } catch (const std::exception& ex) {
+                    finish(index, {1, {}, std::string(ex.what()) + '\n'});
+                    continue;
+                }
+                if (!worker->start(index, program, input)) {
+                    // it died after its last job; its output says how
+                    break;
+                }
+            }
+        }
+
+        std::vector<pollfd> busy;
+        for (const auto& worker : pool) {
+            if (worker->job) busy.push_back({worker->output(), POLLIN, 0});
+        }
+        if (busy.empty()) continue;
+        if (poll(busy.data(), busy.size(), -1) < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error("Failed waiting for the Node workers");
+        }
+        for (auto& worker : pool) {
+            if (!worker->job) continue;
+            auto ready = std::find_if(busy.begin(), busy.end(), [&](const pollfd& fd) { return fd.fd == worker->output(); });
+            if (ready == busy.end() || ready->revents == 0) continue;
+            auto result = worker->receive();
+            if (!result) continue;
+            size_t index = *worker->job;
+            worker->job.reset();
+            if (!worker->alive()) worker = std::make_unique<Worker>(node, prelude);
+            result->out.insert(0, diagnostics[index]);
+            finish(index, std::move(*result));
+        }
+    }
+    pool.clear();
+    std::signal(SIGPIPE, previousHandler);
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    std::cerr << jobs.size() << " programs on " << workers << " workers in " << elapsed.count() << " ms, " << failed
+              << " failed" << std::endl;
+    return failed == 0 ? 0 : 1;
+}
+
+#endif
+
+}  // namespace transpose
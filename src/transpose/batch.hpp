@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+
+namespace transpose {
+
+// Runs every program a manifest lists on a pool of long-lived Node
+// processes, so that a large corpus does not pay for starting Node once per
+// program. Each line of the manifest names a script and, optionally after
+// it, a file to give it as stdin (relative to the manifest's directory);
+// blank lines and lines starting with `#` are skipped.
+//
+// Each worker loads the runtime prelude once; the programs, without it, and
+// their stdin are streamed to whichever worker is free. For each job, in
+// manifest order, stdout gets `<exit status> <stdout bytes> <stderr bytes>
+// <script>` on a line followed by what the program wrote to each. Returns 0
+// if every program exited with 0.
+int runBatch(const std::string& manifest, unsigned workers, const std::string& node);
+
+}  // namespace transpose
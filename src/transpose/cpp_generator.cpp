@@ -0,0 +1,751 @@
+#include "transpose/cpp_generator.hpp"
+
+#include <charconv>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+#include "ast_walker.hpp"
+#include "token.hpp"
+#include "transpose/cpp_runtime.hpp"
+#include "transpose/program_analysis.hpp"
+
+namespace transpose {
+
+namespace {
+
+struct NativeFunction {
+    const char* name;
+    int arity;
+    const char* display;
+};
+
+// the natives of the runtime, as rhythm::n_<name>
+const NativeFunction natives[] = {
+    {"clock", 0, "<native fn>"},           {"printf", -1, "<native printf>"},
+    {"sprintf", -1, "<native printf>"},    {"len", 1, "<native fn>"},
+    {"push", 2, "<native fn>"},            {"pop", 1, "<native fn>"},
+    {"readline", 0, "<native fn>"},        {"split", 2, "<native fn>"},
+    {"assert", -1, "<native fn>"},         {"for_each", 2, "<native fn>"},
+    {"tonumber", 1, "<native fn>"},        {"slurp", 0, "<native fn>"},
+    {"keys", 1, "<native fn>"},            {"floor", 1, "<native fn floor>"},
+    {"ceil", 1, "<native fn ceil>"},       {"sin", 1, "<native fn sin>"},
+    {"cos", 1, "<native fn cos>"},         {"tan", 1, "<native fn tan>"},
+    {"asin", 1, "<native fn asin>"},       {"acos", 1, "<native fn acos>"},
+    {"atan", 1, "<native fn atan>"},       {"log", 1, "<native fn log>"},
+    {"log10", 1, "<native fn log10>"},     {"sqrt", 1, "<native fn sqrt>"},
+    {"exp", 1, "<native fn exp>"},         {"fabs", 1, "<native fn fabs>"},
+    {"pow", 2, "<native fn pow>"},         {"atan2", 2, "<native fn atan2>"},
+    {"fmod", 2, "<native fn fmod>"},       {"from_json", 1, "<native fn>"},
+    {"to_json", 1, "<native fn>"},         {"inf", 0, "<native fn>"},
+    {"substring", 3, "<native fn>"},       {"random_int", 3, "<native fn>"},
+};
+
+const NativeFunction* findNative(const std::string& name) {
+    for (const auto& native : natives) {
+        if (name == native.name) return &native;
+    }
+    return nullptr;
+}
+
+// C++ leaves the order in which operands and arguments are evaluated
+// unspecified; Rhythm evaluates them left to right. That only shows when one
+// has side effects and another is not stable under them.
+template <class Stable>
+bool needsOrder(const std::vector<const Expr*>& exprs, Stable stable) {
+    for (size_t i = 0; i < exprs.size(); ++i) {
+        if (!hasSideEffects(*exprs[i])) continue;
+        for (size_t j = 0; j < exprs.size(); ++j) {
+            if (j != i && !stable(*exprs[j])) return true;
+        }
+    }
+    return false;
+}
+
+std::string wrap(const std::string& prefix, const std::string& text) {
+    return prefix.empty() ? text : "[&] { " + prefix + "return " + text + "; }()";
+}
+
+std::string join(const std::vector<std::string>& parts) {
+    std::string joined;
+    for (size_t i = 0; i < parts.size(); ++i) {
+        if (i != 0) joined += ", ";
+        joined += parts[i];
+    }
+    return joined;
+}
+
+std::string numberLiteral(double number) {
+    if (std::isnan(number)) return "std::numeric_limits<double>::quiet_NaN()";
+    if (std::isinf(number)) {
+        return number > 0 ? "std::numeric_limits<double>::infinity()" : "(-std::numeric_limits<double>::infinity())";
+    }
+    char buffer[32];
+    auto [end, ec] = std::to_chars(buffer, buffer + sizeof buffer, number);
+    std::string text(buffer, end);
+    if (text.find_first_of(".e") == std::string::npos) text += ".0";
+    return std::signbit(number) ? "(" + text + ")" : text;
+}
+
+std::string cppString(const std::string& value) {
+    static const char octal[] = "01234567";
+    std::string escaped = "\"";
+    for (char ch : value) {
+        switch (ch) {
+            case '\\': escaped += "\\\\"; break;
+            case '"': escaped += "\\\""; break;
+            case '\n': escaped += "\\n"; break;
+            case '\r': escaped += "\\r"; break;
+            case '\t': escaped += "\\t"; break;
+            default: {
+                auto byte = static_cast<unsigned char>(ch);
+                if (byte < 0x20 || byte == 0x7F) {
+                    escaped += '\\';
+                    escaped += octal[byte >> 6];
+                    escaped += octal[(byte >> 3) & 7];
+                    escaped += octal[byte & 7];
+                } else {
+                    escaped += ch;
+                }
+            }
+        }
+    }
+    escaped += '"';
+    return escaped;
+}
+
+}  // namespace
+
+CppGenerator::CppGenerator(const TypeInference& types) : types_(types) {}
+
+std::string CppGenerator::generate(const std::vector<std::unique_ptr<Stmt>>& statements) {
+    CaptureAnalysis capture;
+    capture.analyze(statements);
+    captured_ = std::move(capture.captured);
+    AssignedNames assigned;
+    assigned.walk(statements);
+    assigned_ = std::move(assigned.names);
+
+    // every global gets a C++ global up front: functions refer to globals
+    // defined after them
+    scopes_.assign(1, {});
+    std::ostringstream globals;
+    for (const auto& native : natives) {
+        scopes_[0][native.name] = Binding{std::string("g_") + native.name, true};
+        globals << "rhythm::Value g_" << native.name << " = rhythm::makeNative(\"" << native.display << "\", "
+                << native.arity << ", rhythm::n_" << native.name << ");\n";
+    }
+    std::unordered_map<std::string, int> definitions;
+    for (const auto& stmt : statements) {
+        const Token* name = nullptr;
+        if (const auto* var = dynamic_cast<const VarStmt*>(stmt.get())) {
+            name = &var->name;
+            definitions[name->lexeme] += 2; // a var is never a direct function
+        } else if (const auto* function = dynamic_cast<const FunctionStmt*>(stmt.get())) {
+            name = &function->name;
+            definitions[name->lexeme]++;
+        }
+        if (name && !scopes_[0].contains(name->lexeme)) {
+            scopes_[0][name->lexeme] = Binding{"g_" + name->lexeme, true};
+            globals << "rhythm::Value g_" << name->lexeme << ";\n";
+        }
+    }
+    // assigning to a name nothing declares defines a global
+    for (const auto& name : assigned_) {
+        if (!scopes_[0].contains(name)) {
+            scopes_[0][name] = Binding{"g_" + name, true};
+            globals << "rhythm::Value g_" << name << ";\n";
+        }
+    }
+    for (const auto& native : natives) {
+        if (!definitions.contains(native.name) && !assigned_.contains(native.name)) {
+            directNatives_.insert(native.name);
+        }
+    }
+    for (const auto& stmt : statements) {
+        if (const auto* function = dynamic_cast<const FunctionStmt*>(stmt.get())) {
+            const auto& name = function->name.lexeme;
+            if (definitions[name] == 1 && !findNative(name) && !assigned_.contains(name)) {
+                directFunctions_[name] = DirectFunction{"f_" + name, function->params.size()};
+            }
+        }
+    }
+
+    std::ostringstream program;
+    current_ = &program;
+    indent_ = 1;
+    for (const auto& stmt : statements) {
+        emitStatement(*stmt);
+    }
+
+    std::ostringstream out;
+    out << cppRuntimePrelude() << "\n";
+    out << "namespace {\n\n";
+    out << globals.str() << "\n";
+    out << constantDefinitions_.str() << "\n";
+    out << functionDeclarations_.str() << "\n";
+    out << functionDefinitions_.str();
+    out << "void program() {\n" << program.str() << "}\n\n";
+    out << "}  // namespace\n\n";
+    out << "int main() {\n    return rhythm::run(program);\n}\n";
+    return out.str();
+}
+
+void CppGenerator::emitLine(const std::string& line) {
+    (*current_) << std::string(indent_ * 4, ' ') << line << '\n';
+}
+
+void CppGenerator::emitStatement(const Stmt& stmt) {
+    stmt.accept(*this);
+}
+
+void CppGenerator::emitStatementBody(const Stmt& stmt) {
+    indent_++;
+    if (const auto* block = dynamic_cast<const BlockStmt*>(&stmt)) {
+        scopes_.emplace_back();
+        for (const auto& inner : block->statements) {
+            emitStatement(*inner);
+        }
+        scopes_.pop_back();
+    } else {
+        emitStatement(stmt);
+    }
+    indent_--;
+}
+
+CppGenerator::Code CppGenerator::generateExpression(const Expr& expr) {
+    expr.accept(*this);
+    return std::exchange(result_, Code{});
+}
+
+std::string CppGenerator::value(const Code& code) const {
+    return code.kind == Kind::VALUE ? code.text : "rhythm::Value(" + code.text + ")";
+}
+
+std::string CppGenerator::number(const Code& code) const {
+    return code.kind == Kind::NUMBER ? code.text : "std::get<double>(" + value(code) + ")";
+}
+
+// subscripts take numbers as they are
+std::string CppGenerator::index(const Code& code) const {
+    return code.kind == Kind::NUMBER ? code.text : value(code);
+}
+
+// the C++ test for whether expr is truthy
+std::string CppGenerator::condition(const Expr& expr) {
+    if (const auto* grouping = dynamic_cast<const Grouping*>(&expr)) {
+        return condition(*grouping->expression);
+    }
+    if (const auto* logical = dynamic_cast<const Logical*>(&expr)) {
+        auto op = logical->op.type == TokenType::AND ? " && " : " || ";
+        return "(" + condition(*logical->left) + op + condition(*logical->right) + ")";
+    }
+    if (const auto* unary = dynamic_cast<const Unary*>(&expr); unary && unary->op.type == TokenType::BANG) {
+        return "!" + condition(*unary->right);
+    }
+    auto code = generateExpression(expr);
+    switch (code.kind) {
+        case Kind::BOOL:
+            return code.text;
+        case Kind::NUMBER:
+            return hasSideEffects(expr) ? "((void)" + code.text + ", true)" : "true";
+        case Kind::VALUE:
+            break;
+    }
+    return "rhythm::truthy(" + code.text + ")";
+}
+
+// Moves the operands into temporaries, in order, when their order matters;
+// returns the declarations to put before the expression using them.
+std::string CppGenerator::sequence(std::vector<Code>& operands, const std::vector<const Expr*>& exprs) {
+    // constants stay put, as do locals no closure can reach and the operands
+    // themselves do not assign
+    AssignedNames assigned;
+    for (const auto* expr : exprs) {
+        expr->accept(assigned);
+    }
+    auto stable = [&](const Expr& expr) {
+        if (dynamic_cast<const Literal*>(&expr)) return true;
+        const auto* variable = dynamic_cast<const Variable*>(&expr);
+        if (!variable || assigned.names.contains(variable->name.lexeme)) return false;
+        const auto* binding = resolve(variable->name.lexeme);
+        return binding && !binding->global && !binding->boxed;
+    };
+    if (!needsOrder(exprs, stable)) return {};
+    std::string prefix;
+    for (auto& operand : operands) {
+        auto name = "t" + std::to_string(temporaries_++);
+        prefix += "auto " + name + " = " + operand.text + "; ";
+        operand.text = name;
+    }
+    return prefix;
+}
+
+std::string CppGenerator::constant(const std::string& text) {
+    auto [it, inserted] = constants_.try_emplace(text, "k_" + std::to_string(constants_.size()));
+    if (inserted) {
+        constantDefinitions_ << "const rhythm::Value " << it->second << " = std::string(" << cppString(text) << ");\n";
+    }
+    return it->second;
+}
+
+// The body of a function, braces included. A direct function receives its
+// parameters as C++ parameters, a closure as the argument array.
+std::string CppGenerator::functionBody(const std::vector<Token>& params, const BlockStmt& body, bool direct) {
+    std::ostringstream out;
+    auto* previous = current_;
+    int previousIndent = indent_;
+    current_ = &out;
+    indent_ = direct ? 1 : previousIndent + 1;
+    out << "{\n";
+    scopes_.emplace_back();
+    for (size_t i = 0; i < params.size(); ++i) {
+        auto& binding = declare(params[i], &params[i]);
+        if (direct) {
+            if (binding.boxed) {
+                emitLine("auto " + binding.name + " = std::make_shared<rhythm::Value>(std::move(p_" +
+                         params[i].lexeme + "));");
+            }
+        } else if (binding.boxed) {
+            emitLine("auto " + binding.name + " = std::make_shared<rhythm::Value>(args[" + std::to_string(i) + "]);");
+        } else {
+            emitLine("rhythm::Value " + binding.name + " = args[" + std::to_string(i) + "];");
+        }
+    }
+    for (const auto& stmt : body.statements) {
+        emitStatement(*stmt);
+    }
+    if (body.statements.empty() || !dynamic_cast<const ReturnStmt*>(body.statements.back().get())) {
+        emitLine("return nullptr;");
+    }
+    scopes_.pop_back();
+    current_ = previous;
+    indent_ = previousIndent;
+    out << std::string(direct ? 0 : indent_ * 4, ' ') << "}";
+    return out.str();
+}
+
+std::string CppGenerator::lambda(const std::vector<Token>& params, const BlockStmt& body) {
+    auto parameter = params.empty() ? "const rhythm::Value*" : "const rhythm::Value* args";
+    return std::string("[=](") + parameter + ") -> rhythm::Value " + functionBody(params, body, false);
+}
+
+void CppGenerator::hoist(const FunctionStmt& stmt, const DirectFunction& direct) {
+    std::vector<std::string> params;
+    for (const auto& param : stmt.params) {
+        params.push_back((captured_.contains(&param) ? "rhythm::Value p_" : "rhythm::Value v_") + param.lexeme);
+    }
+    auto signature = "rhythm::Value " + direct.name + "(" + join(params) + ")";
+    functionDeclarations_ << signature << ";\n";
+    functionDefinitions_ << signature << " " << functionBody(stmt.params, *stmt.body, true) << "\n\n";
+}
+
+const CppGenerator::Binding* CppGenerator::resolve(const std::string& name) const {
+    for (auto scope = scopes_.rbegin(); scope != scopes_.rend(); ++scope) {
+        auto it = scope->find(name);
+        if (it != scope->end()) return &it->second;
+    }
+    return nullptr;
+}
+
+CppGenerator::Binding& CppGenerator::declare(const Token& name, const void* node) {
+    Binding binding{"v_" + name.lexeme};
+    binding.boxed = captured_.contains(node);
+    binding.number = !binding.boxed && types_.declarationType(node) == InferredType::NUMBER;
+    return scopes_.back()[name.lexeme] = binding;
+}
+
+// the C++ lvalue holding a variable
+std::string CppGenerator::slot(const Binding& binding) const {
+    return binding.boxed ? "(*" + binding.name + ")" : binding.name;
+}
+
+void CppGenerator::visit(const Binary& expr) {
+    std::vector<Code> operands{generateExpression(*expr.left), generateExpression(*expr.right)};
+    auto prefix = sequence(operands, {expr.left.get(), expr.right.get()});
+    const auto& left = operands[0];
+    const auto& right = operands[1];
+    const auto line = std::to_string(expr.op.line);
+    bool numbers = left.kind == Kind::NUMBER && right.kind == Kind::NUMBER;
+    auto call = [&](const char* helper) {
+        return std::string("rhythm::") + helper + "(" + index(left) + ", " + index(right) + ", " + line + ")";
+    };
+    auto inlined = [&](const char* op) { return "(" + left.text + " " + op + " " + right.text + ")"; };
+
+    Code code;
+    switch (expr.op.type) {
+        case TokenType::PLUS:
+            if (numbers) {
+                code = {inlined("+"), Kind::NUMBER};
+            } else {
+                // with one number known the result is one too
+                bool number = left.kind == Kind::NUMBER || right.kind == Kind::NUMBER;
+                code = {call("add"), number ? Kind::NUMBER : Kind::VALUE};
+            }
+            break;
+        case TokenType::MINUS:
+            code = {numbers ? inlined("-") : call("subtract"), Kind::NUMBER};
+            break;
+        case TokenType::STAR:
+            code = {numbers ? inlined("*") : call("multiply"), Kind::NUMBER};
+            break;
+        case TokenType::SLASH:
+            code = {numbers ? inlined("/") : call("divide"), Kind::NUMBER};
+            break;
+        case TokenType::PERCENT:
+            code = {call("modulo"), Kind::NUMBER};
+            break;
+        case TokenType::LESS:
+            code = {numbers ? inlined("<") : call("less"), Kind::BOOL};
+            break;
+        case TokenType::LESS_EQUAL:
+            code = {numbers ? inlined("<=") : call("lessEqual"), Kind::BOOL};
+            break;
+        case TokenType::GREATER:
+            code = {numbers ? inlined(">") : call("greater"), Kind::BOOL};
+            break;
+        case TokenType::GREATER_EQUAL:
+            code = {numbers ? inlined(">=") : call("greaterEqual"), Kind::BOOL};
+            break;
+        case TokenType::EQUAL_EQUAL:
+        case TokenType::BANG_EQUAL: {
+            bool equal = expr.op.type == TokenType::EQUAL_EQUAL;
+            if (numbers || (left.kind == Kind::BOOL && right.kind == Kind::BOOL)) {
+                code = {inlined(equal ? "==" : "!="), Kind::BOOL};
+            } else {
+                code = {std::string(equal ? "" : "!") + "rhythm::equals(" + index(left) + ", " + index(right) + ")",
+                        Kind::BOOL};
+            }
+            break;
+        }
+        default:
+            throw std::runtime_error("Invalid binary operator");
+    }
+    code.text = wrap(prefix, code.text);
+    result_ = code;
+}
+
+void CppGenerator::visit(const Logical& expr) {
+    auto left = generateExpression(*expr.left);
+    auto right = generateExpression(*expr.right);
+    bool isAnd = expr.op.type == TokenType::AND;
+    if (left.kind == Kind::BOOL && right.kind == Kind::BOOL) {
+        result_ = {"(" + left.text + (isAnd ? " && " : " || ") + right.text + ")", Kind::BOOL};
+        return;
+    }
+    // the value of whichever operand decided
+    auto name = "t" + std::to_string(temporaries_++);
+    result_.text = "[&]() -> rhythm::Value { rhythm::Value " + name + " = " + value(left) + "; if (" +
+                   (isAnd ? "!" : "") + "rhythm::truthy(" + name + ")) return " + name + "; return " +
+                   value(right) + "; }()";
+}
+
+void CppGenerator::visit(const Ternary& expr) {
+    auto test = condition(*expr.condition);
+    auto thenBranch = generateExpression(*expr.thenBranch);
+    auto elseBranch = generateExpression(*expr.elseBranch);
+    if (thenBranch.kind == elseBranch.kind && thenBranch.kind != Kind::VALUE) {
+        result_ = {"(" + test + " ? " + thenBranch.text + " : " + elseBranch.text + ")", thenBranch.kind};
+        return;
+    }
+    result_.text = "(" + test + " ? " + value(thenBranch) + " : " + value(elseBranch) + ")";
+}
+
+void CppGenerator::visit(const Grouping& expr) {
+    auto inner = generateExpression(*expr.expression);
+    result_ = {"(" + inner.text + ")", inner.kind};
+}
+
+void CppGenerator::visit(const Literal& expr) {
+    if (const auto* number = std::get_if<double>(&expr.value)) {
+        result_ = {numberLiteral(*number), Kind::NUMBER};
+    } else if (const auto* text = std::get_if<std::string>(&expr.value)) {
+        result_.text = constant(*text);
+    } else if (const auto* boolean = std::get_if<bool>(&expr.value)) {
+        result_ = {*boolean ? "true" : "false", Kind::BOOL};
+    } else {
+        result_.text = "rhythm::Value(nullptr)";
+    }
+}
+
+void CppGenerator::visit(const Unary& expr) {
+    if (expr.op.type == TokenType::BANG) {
+        result_ = {"!" + condition(*expr.right), Kind::BOOL};
+        return;
+    }
+    auto right = generateExpression(*expr.right);
+    if (right.kind == Kind::NUMBER) {
+        result_ = {"(-" + right.text + ")", Kind::NUMBER};
+    } else {
+        result_ = {"rhythm::negate(" + value(right) + ", " + std::to_string(expr.op.line) + ")", Kind::NUMBER};
+    }
+}
+
+void CppGenerator::visit(const Postfix& expr) {
+    bool increment = expr.op.type == TokenType::PLUS_PLUS;
+    const std::string delta = increment ? "1.0" : "-1.0";
+    const auto line = std::to_string(expr.op.line);
+
+    if (const auto* variable = dynamic_cast<const Variable*>(expr.operand.get())) {
+        const auto& name = variable->name.lexeme;
+        const auto* binding = resolve(name);
+        if (binding && binding->number) {
+            result_ = {"(" + binding->name + (increment ? "++" : "--") + ")", Kind::NUMBER};
+            return;
+        }
+        auto target = binding ? slot(*binding) : "rhythm::undefinedVariable(" + cppString(name) + ", " + line + ")";
+        result_ = {"rhythm::postfix(" + target + ", " + delta + ", " + line + ")", Kind::NUMBER};
+        return;
+    }
+
+    if (const auto* subscript = dynamic_cast<const Subscript*>(expr.operand.get())) {
+        std::vector<Code> operands{generateExpression(*subscript->object), generateExpression(*subscript->index)};
+        auto prefix = sequence(operands, {subscript->object.get(), subscript->index.get()});
+        result_ = {wrap(prefix, "rhythm::postfixIndex(" + value(operands[0]) + ", " + index(operands[1]) + ", " +
+                                    delta + ", " + std::to_string(subscript->bracket.line) + ")"),
+                   Kind::NUMBER};
+        return;
+    }
+
+    if (const auto* property = dynamic_cast<const PropertyAccess*>(expr.operand.get())) {
+        auto object = generateExpression(*property->object);
+        result_ = {"rhythm::postfixProperty(" + value(object) + ", " + constant(property->name.lexeme) + ", " + delta +
+                       ", " + std::to_string(property->name.line) + ")",
+                   Kind::NUMBER};
+        return;
+    }
+
+    throw std::runtime_error("Invalid postfix operand");
+}
+
+void CppGenerator::visit(const Variable& expr) {
+    const auto* binding = resolve(expr.name.lexeme);
+    if (!binding) {
+        result_.text = "rhythm::undefinedVariable(" + cppString(expr.name.lexeme) + ", " +
+                       std::to_string(expr.name.line) + ")";
+        return;
+    }
+    result_ = {slot(*binding), binding->number ? Kind::NUMBER : Kind::VALUE};
+}
+
+void CppGenerator::visit(const Assignment& expr) {
+    auto right = generateExpression(*expr.right);
+    const auto* binding = resolve(expr.name.lexeme);
+    if (!binding) {
+        result_.text = "(rhythm::undefinedVariable(" + cppString(expr.name.lexeme) + ", " +
+                       std::to_string(expr.name.line) + ") = " + value(right) + ")";
+        return;
+    }
+    if (binding->number) {
+        result_ = {"(" + binding->name + " = " + number(right) + ")", Kind::NUMBER};
+        return;
+    }
+    result_.text = "(" + slot(*binding) + " = " + value(right) + ")";
+}
+
+void CppGenerator::visit(const SubscriptAssignment& expr) {
+    std::vector<Code> operands{generateExpression(*expr.object), generateExpression(*expr.index),
+                               generateExpression(*expr.value)};
+    auto prefix = sequence(operands, {expr.object.get(), expr.index.get(), expr.value.get()});
+    result_.text = wrap(prefix, "rhythm::setIndex(" + value(operands[0]) + ", " + index(operands[1]) + ", " +
+                                    value(operands[2]) + ", " + std::to_string(expr.bracket.line) + ")");
+}
+
+void CppGenerator::visit(const Call& expr) {
+    std::vector<Code> args;
+    std::vector<const Expr*> exprs;
+    for (const auto& argument : expr.arguments) {
+        args.push_back(generateExpression(*argument));
+        exprs.push_back(argument.get());
+    }
+    auto values = [&] {
+        std::vector<std::string> texts;
+        for (const auto& arg : args) texts.push_back(value(arg));
+        return join(texts);
+    };
+
+    if (const auto* variable = dynamic_cast<const Variable*>(expr.callee.get())) {
+        const auto& name = variable->name.lexeme;
+        const auto* binding = resolve(name);
+        if (binding && binding->global) {
+            auto direct = directFunctions_.find(name);
+            if (direct != directFunctions_.end() && direct->second.arity == args.size()) {
+                auto prefix = sequence(args, exprs);
+                result_.text = wrap(prefix, direct->second.name + "(" + values() + ")");
+                return;
+            }
+            const auto* native = findNative(name);
+            if (directNatives_.contains(name) &&
+                (native->arity == -1 || static_cast<size_t>(native->arity) == args.size())) {
+                // a braced list is evaluated in order
+                result_.text = "rhythm::callNative(rhythm::n_" + name + ", {" + values() + "})";
+                return;
+            }
+        }
+    }
+
+    auto callee = generateExpression(*expr.callee);
+    auto arguments = values();
+    result_.text = "rhythm::call(" + std::to_string(expr.paren.line) + ", {" + value(callee) +
+                   (arguments.empty() ? "" : ", " + arguments) + "})";
+}
+
+void CppGenerator::visit(const ArrayLiteral& expr) {
+    std::vector<std::string> elements;
+    for (const auto& element : expr.elements) {
+        elements.push_back(value(generateExpression(*element)));
+    }
+    result_.text = "rhythm::makeArray({" + join(elements) + "})";
+}
+
+void CppGenerator::visit(const MapLiteral& expr) {
+    std::vector<std::string> pairs;
+    for (const auto& [key, element] : expr.pairs) {
+        auto keyCode = value(generateExpression(*key));
+        pairs.push_back("{" + keyCode + ", " + value(generateExpression(*element)) + "}");
+    }
+    result_.text = "rhythm::makeMap({" + join(pairs) + "})";
+}
+
+void CppGenerator::visit(const Subscript& expr) {
+    std::vector<Code> operands{generateExpression(*expr.object), generateExpression(*expr.index)};
+    auto prefix = sequence(operands, {expr.object.get(), expr.index.get()});
+    result_.text = wrap(prefix, "rhythm::getIndex(" + value(operands[0]) + ", " + index(operands[1]) + ", " +
+                                    std::to_string(expr.bracket.line) + ")");
+}
+
+void CppGenerator::visit(const PropertyAccess& expr) {
+    auto object = generateExpression(*expr.object);
+    result_.text = "rhythm::getProperty(" + value(object) + ", " + constant(expr.name.lexeme) + ", " +
+                   std::to_string(expr.name.line) + ")";
+}
+
+void CppGenerator::visit(const FunctionExpr& expr) {
+    result_.text = "rhythm::makeAnonymous(" + std::to_string(expr.params.size()) + ", " +
+                   lambda(expr.params, *expr.body) + ")";
+}
+
+void CppGenerator::visit(const ExpressionStmt& stmt) {
+    auto code = generateExpression(*stmt.expr);
+    const Expr* expr = stmt.expr.get();
+    bool effect = dynamic_cast<const Call*>(expr) || dynamic_cast<const Assignment*>(expr) ||
+                  dynamic_cast<const SubscriptAssignment*>(expr) || dynamic_cast<const Postfix*>(expr);
+    emitLine(effect ? code.text + ";" : "(void)(" + code.text + ");");
+}
+
+void CppGenerator::visit(const PrintStmt& stmt) {
+    emitLine("rhythm::print(" + value(generateExpression(*stmt.expr)) + ");");
+}
+
+void CppGenerator::visit(const VarStmt& stmt) {
+    const auto& name = stmt.name.lexeme;
+    if (scopes_.size() == 1 || scopes_.back().contains(name)) { // a global, or a redeclaration
+        Code initializer{"rhythm::Value(nullptr)"};
+        if (stmt.initializer) {
+            initializer = generateExpression(*stmt.initializer);
+        }
+        const auto& binding = scopes_.back().at(name);
+        emitLine(slot(binding) + " = " + (binding.number ? number(initializer) : value(initializer)) + ";");
+        return;
+    }
+    // declared first: a function in the initializer may refer to it, and
+    // then captures it, so it is boxed and the box exists before the call
+    const auto binding = declare(stmt.name, &stmt);
+    if (binding.boxed) {
+        emitLine("auto " + binding.name + " = std::make_shared<rhythm::Value>();");
+        if (stmt.initializer) {
+            emitLine("*" + binding.name + " = " + value(generateExpression(*stmt.initializer)) + ";");
+        }
+        return;
+    }
+    Code initializer{"rhythm::Value(nullptr)"};
+    if (stmt.initializer) {
+        initializer = generateExpression(*stmt.initializer);
+    }
+    if (binding.number) {
+        emitLine("double " + binding.name + " = " + number(initializer) + ";");
+    } else {
+        emitLine("rhythm::Value " + binding.name + " = " + value(initializer) + ";");
+    }
+}
+
+void CppGenerator::visit(const BlockStmt& stmt) {
+    emitLine("{");
+    emitStatementBody(stmt);
+    emitLine("}");
+}
+
+void CppGenerator::visit(const IfStmt& stmt) {
+    emitLine("if (" + condition(*stmt.condition) + ") {");
+    emitStatementBody(*stmt.thenBlock);
+    if (stmt.elseBlock) {
+        emitLine("} else {");
+        emitStatementBody(*stmt.elseBlock);
+    }
+    emitLine("}");
+}
+
+void CppGenerator::visit(const WhileStmt& stmt) {
+    auto test = condition(*stmt.condition);
+    if (stmt.increment) {
+        emitLine("for (; " + test + "; " + generateExpression(*stmt.increment).text + ") {");
+    } else {
+        emitLine("while (" + test + ") {");
+    }
+    emitStatementBody(*stmt.body);
+    emitLine("}");
+}
+
+void CppGenerator::visit(const FunctionStmt& stmt) {
+    const auto& name = stmt.name.lexeme;
+    const auto arity = std::to_string(stmt.params.size());
+    if (scopes_.size() == 1) {
+        auto direct = directFunctions_.find(name);
+        std::string body;
+        if (direct != directFunctions_.end()) {
+            hoist(stmt, direct->second);
+            std::vector<std::string> args;
+            for (size_t i = 0; i < stmt.params.size(); ++i) {
+                args.push_back("args[" + std::to_string(i) + "]");
+            }
+            auto parameter = args.empty() ? "const rhythm::Value*" : "const rhythm::Value* args";
+            body = std::string("[](") + parameter + ") -> rhythm::Value { return " + direct->second.name + "(" +
+                   join(args) + "); }";
+        } else {
+            body = lambda(stmt.params, *stmt.body);
+        }
+        emitLine("g_" + name + " = rhythm::makeFunction(" + cppString(name) + ", " + arity + ", " + body + ");");
+        return;
+    }
+
+    bool redeclaration = scopes_.back().contains(name);
+    // declared first: the body may call it
+    const auto binding = redeclaration ? scopes_.back().at(name) : declare(stmt.name, &stmt);
+    auto function = "rhythm::makeFunction(" + cppString(name) + ", " + arity + ", " + lambda(stmt.params, *stmt.body) + ")";
+    if (redeclaration) {
+        emitLine(slot(binding) + " = " + function + ";");
+    } else if (binding.boxed) {
+        emitLine("auto " + binding.name + " = std::make_shared<rhythm::Value>();");
+        emitLine("*" + binding.name + " = " + function + ";");
+    } else {
+        emitLine("rhythm::Value " + binding.name + " = " + function + ";");
+    }
+}
+
+void CppGenerator::visit(const ReturnStmt& stmt) {
+    if (stmt.value) {
+        emitLine("return " + value(generateExpression(*stmt.value)) + ";");
+    } else {
+        emitLine("return nullptr;");
+    }
+}
+
+void CppGenerator::visit(const BreakStmt&) {
+    emitLine("break;");
+}
+
+void CppGenerator::visit(const ContinueStmt&) {
+    emitLine("continue;");
+}
+
+}  // namespace transpose
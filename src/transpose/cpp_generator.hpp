@@ -0,0 +1,110 @@
+#pragma once
+
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "expr.hpp"
+#include "statement.hpp"
+#include "type_inference.hpp"
+
+namespace transpose {
+
+// Translates a resolved program into one self-contained C++ translation unit:
+// the runtime of cpp_runtime.cpp, then the program. Globals become C++
+// globals and locals C++ locals, boxed in a shared_ptr only when a closure
+// captures them; locals TypeInference proves to be numbers are doubles.
+// Top-level functions that are never redefined become C++ functions called
+// directly, as do the natives.
+class CppGenerator : public ExprVisitor, public StmtVisitor {
+public:
+    explicit CppGenerator(const TypeInference& types);
+    std::string generate(const std::vector<std::unique_ptr<Stmt>>& statements);
+
+private:
+    // what the C++ text of an expression evaluates to: a Value, or a plain
+    // double or bool where the generator knows the type
+    enum class Kind { VALUE, NUMBER, BOOL };
+    struct Code {
+        std::string text;
+        Kind kind = Kind::VALUE;
+    };
+    struct Binding {
+        std::string name; // C++ name
+        bool global = false;
+        bool boxed = false;  // a std::shared_ptr<rhythm::Value>
+        bool number = false; // a double
+    };
+    struct DirectFunction {
+        std::string name;
+        size_t arity;
+    };
+
+    const TypeInference& types_;
+    std::unordered_set<const void*> captured_; // declarations closures capture
+    std::set<std::string> assigned_; // names assigned or ++/--'d anywhere
+    std::vector<std::unordered_map<std::string, Binding>> scopes_; // [0] holds the globals
+    std::unordered_map<std::string, DirectFunction> directFunctions_;
+    std::unordered_set<std::string> directNatives_;
+    std::unordered_map<std::string, std::string> constants_; // string literal -> name
+    std::ostringstream constantDefinitions_;
+    std::ostringstream functionDeclarations_;
+    std::ostringstream functionDefinitions_;
+    std::ostringstream* current_ = nullptr;
+    int indent_ = 0;
+    int temporaries_ = 0;
+    Code result_;
+
+    void emitLine(const std::string& line);
+    void emitStatement(const Stmt& stmt);
+    void emitStatementBody(const Stmt& stmt);
+    Code generateExpression(const Expr& expr);
+    std::string value(const Code& code) const;
+    std::string number(const Code& code) const;
+    std::string condition(const Expr& expr);
+    std::string index(const Code& code) const;
+    std::string sequence(std::vector<Code>& operands, const std::vector<const Expr*>& exprs);
+    std::string constant(const std::string& text);
+    std::string functionBody(const std::vector<Token>& params, const BlockStmt& body, bool direct);
+    std::string lambda(const std::vector<Token>& params, const BlockStmt& body);
+    void hoist(const FunctionStmt& stmt, const DirectFunction& direct);
+    const Binding* resolve(const std::string& name) const;
+    Binding& declare(const Token& name, const void* node);
+    std::string slot(const Binding& binding) const;
+
+    // ExprVisitor overrides
+    void visit(const Binary& expr) override;
+    void visit(const Logical& expr) override;
+    void visit(const Ternary& expr) override;
+    void visit(const Grouping& expr) override;
+    void visit(const Literal& expr) override;
+    void visit(const Unary& expr) override;
+    void visit(const Postfix& expr) override;
+    void visit(const Variable& expr) override;
+    void visit(const Assignment& expr) override;
+    void visit(const SubscriptAssignment& expr) override;
+    void visit(const Call& expr) override;
+    void visit(const ArrayLiteral& expr) override;
+    void visit(const MapLiteral& expr) override;
+    void visit(const Subscript& expr) override;
+    void visit(const PropertyAccess& expr) override;
+    void visit(const FunctionExpr& expr) override;
+
+    // StmtVisitor overrides
+    void visit(const ExpressionStmt& stmt) override;
+    void visit(const PrintStmt& stmt) override;
+    void visit(const VarStmt& stmt) override;
+    void visit(const BlockStmt& stmt) override;
+    void visit(const IfStmt& stmt) override;
+    void visit(const WhileStmt& stmt) override;
+    void visit(const FunctionStmt& stmt) override;
+    void visit(const ReturnStmt& stmt) override;
+    void visit(const BreakStmt& stmt) override;
+    void visit(const ContinueStmt& stmt) override;
+};
+
+}  // namespace transpose
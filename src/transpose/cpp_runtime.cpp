@@ -0,0 +1,934 @@
+#include "transpose/cpp_runtime.hpp"
+
+namespace transpose {
+
+std::string cppRuntimePrelude() {
+    static const char* const parts[] = {
+        R"CPP(// Rhythm runtime for programs compiled ahead of time by transpose --emit-cpp.
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <initializer_list>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#endif
+
+namespace rhythm {
+
+struct Function;
+struct Array;
+struct Map;
+
+// The interpreter's alternatives in the interpreter's order, so that maps hash,
+// iterate and print alike.
+using Value = std::variant<double, std::string, std::nullptr_t, bool, std::shared_ptr<Function>,
+                           std::shared_ptr<Array>, std::shared_ptr<Map>>;
+
+struct Array {
+    std::vector<Value> data;
+};
+
+struct Map {
+    std::unordered_map<Value, Value> data;
+};
+
+struct Function {
+    int arity; // -1 takes any number of arguments
+    std::string display;
+
+    Function(int arity, std::string display) : arity(arity), display(std::move(display)) {}
+    virtual ~Function() = default;
+    virtual Value call(const Value* args, size_t argc) = 0;
+};
+
+template <class Body>
+struct Closure final : Function {
+    Body body;
+
+    Closure(int arity, std::string display, Body body)
+        : Function(arity, std::move(display)), body(std::move(body)) {}
+    Value call(const Value* args, size_t) override { return body(args); }
+};
+
+using NativeFn = Value (*)(const Value* args, size_t argc);
+
+struct Native final : Function {
+    NativeFn fn;
+
+    Native(int arity, std::string display, NativeFn fn) : Function(arity, std::move(display)), fn(fn) {}
+    Value call(const Value* args, size_t argc) override { return fn(args, argc); }
+};
+
+class RuntimeError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// natives pass line 0: they do not know where they were called from
+[[noreturn]] inline void fail(int line, const std::string& message) {
+    if (line > 0) {
+        throw RuntimeError("[line " + std::to_string(line) + "] " + message);
+    }
+    throw RuntimeError(message);
+}
+
+[[noreturn]] inline Value& undefinedVariable(const char* name, int line) {
+    fail(line, std::string("Undefined global variable '") + name + "'.");
+}
+
+inline void write(std::ostream& os, const Value& value) {
+    switch (value.index()) {
+        case 0:
+            os << std::get<double>(value);
+            break;
+        case 1:
+            os << std::get<std::string>(value);
+            break;
+        case 2:
+            os << "nil";
+            break;
+        case 3:
+            os << (std::get<bool>(value) ? "true" : "false");
+            break;
+        case 4:
+            os << std::get<std::shared_ptr<Function>>(value)->display;
+            break;
+        case 5:
+            os << '[';
+            for (const auto& element : std::get<std::shared_ptr<Array>>(value)->data) {
+                write(os, element);
+                os << ", ";
+            }
+            os << ']';
+            break;
+        case 6:
+            os << '{';
+            for (const auto& [key, element] : std::get<std::shared_ptr<Map>>(value)->data) {
+                write(os, key);
+                os << ": ";
+                write(os, element);
+                os << ", ";
+            }
+            os << '}';
+            break;
+    }
+}
+
+inline std::string toString(const Value& value) {
+    std::ostringstream os;
+    write(os, value);
+    return os.str();
+}
+
+inline void print(const Value& value) {
+    write(std::cout, value);
+    std::cout << '\n';
+}
+
+// false and nil are falsy; everything else is truthy
+inline bool truthy(const Value& value) {
+    if (const auto* b = std::get_if<bool>(&value)) return *b;
+    return !std::holds_alternative<std::nullptr_t>(value);
+}
+inline bool truthy(bool value) { return value; }
+inline bool truthy(double) { return true; }
+
+// Operands are Values or, where the generated code knows they are numbers,
+// plain doubles.
+inline double number(double value, int, const char*) { return value; }
+inline double number(const Value& value, int line, const char* message) {
+    if (const auto* d = std::get_if<double>(&value)) return *d;
+    fail(line, message);
+}
+
+inline const Value& toValue(const Value& value) { return value; }
+inline Value toValue(double value) { return value; }
+
+inline bool isInteger(double x) {
+    return std::isfinite(x) && x == std::trunc(x);
+}
+
+inline Value add(const Value& a, const Value& b, int line) {
+    if (const auto* x = std::get_if<double>(&a)) {
+        if (const auto* y = std::get_if<double>(&b)) return *x + *y;
+    } else if (const auto* s = std::get_if<std::string>(&a)) {
+        if (const auto* t = std::get_if<std::string>(&b)) return *s + *t;
+    }
+    fail(line, "+ can only be between two numbers or two strings");
+}
+// with one number the other has to be one too
+inline double add(const Value& a, double b, int line) {
+    return number(a, line, "+ can only be between two numbers or two strings") + b;
+}
+inline double add(double a, const Value& b, int line) {
+    return a + number(b, line, "+ can only be between two numbers or two strings");
+}
+
+template <class A, class B>
+double subtract(const A& a, const B& b, int line) {
+    return number(a, line, "operands must be numbers") - number(b, line, "operands must be numbers");
+}
+
+template <class A, class B>
+double multiply(const A& a, const B& b, int line) {
+    return number(a, line, "operands must be numbers") * number(b, line, "operands must be numbers");
+}
+
+template <class A, class B>
+double divide(const A& a, const B& b, int line) {
+    return number(a, line, "operands must be numbers") / number(b, line, "operands must be numbers");
+}
+
+template <class A, class B>
+double modulo(const A& a, const B& b, int line) {
+    double x = number(a, line, "% operation is between numbers");
+    double y = number(b, line, "% operation is between numbers");
+    if (!isInteger(x) || !isInteger(y)) fail(line, "% operation is between integers");
+    return std::fmod(x, y);
+}
+
+// Numbers compare as numbers and, as in beat, two strings lexicographically.
+template <class A, class B, class Compare>
+bool compare(const A& a, const B& b, int line, Compare op) {
+    if constexpr (std::is_same_v<A, Value> && std::is_same_v<B, Value>) {
+        const auto* s = std::get_if<std::string>(&a);
+        const auto* t = std::get_if<std::string>(&b);
+        if (s && t) return op(*s, *t);
+    }
+    return op(number(a, line, "operands must be numbers"), number(b, line, "operands must be numbers"));
+}
+
+template <class A, class B>
+bool less(const A& a, const B& b, int line) {
+    return compare(a, b, line, [](const auto& x, const auto& y) { return x < y; });
+}
+
+template <class A, class B>
+bool lessEqual(const A& a, const B& b, int line) {
+    return compare(a, b, line, [](const auto& x, const auto& y) { return x <= y; });
+}
+
+template <class A, class B>
+bool greater(const A& a, const B& b, int line) {
+    return compare(a, b, line, [](const auto& x, const auto& y) { return x > y; });
+}
+
+template <class A, class B>
+bool greaterEqual(const A& a, const B& b, int line) {
+    return compare(a, b, line, [](const auto& x, const auto& y) { return x >= y; });
+}
+
+inline double negate(const Value& value, int line) {
+    return -number(value, line, "operand must be a number");
+}
+
+inline bool equals(const Value& a, const Value& b) { return a == b; }
+inline bool equals(double a, double b) { return a == b; }
+inline bool equals(const Value& a, double b) {
+    const auto* x = std::get_if<double>(&a);
+    return x && *x == b;
+}
+inline bool equals(double a, const Value& b) { return equals(b, a); }
+
+// x++ and x--: the old value
+inline double postfix(Value& slot, double delta, int line) {
+    double old = number(slot, line, "Postfix operator requires a number.");
+    slot = old + delta;
+    return old;
+}
+
+inline size_t arrayIndex(const Array& array, double index, int line) {
+    if (!isInteger(index)) fail(line, "index must be an integer");
+    if (index < 0 || index >= static_cast<double>(array.data.size())) {
+        fail(line, "Index out of bounds: " + std::to_string(static_cast<long long>(index)) +
+                       " (size: " + std::to_string(array.data.size()) + ")");
+    }
+    return static_cast<size_t>(index);
+}
+
+// By value: a reference into the container would dangle once the statement
+// replaces what holds it.
+template <class I>
+Value getIndex(const Value& object, const I& index, int line) {
+    if (const auto* array = std::get_if<std::shared_ptr<Array>>(&object)) {
+        return (*array)->data[arrayIndex(**array, number(index, line, "array index must be a number"), line)];
+    }
+    if (const auto* map = std::get_if<std::shared_ptr<Map>>(&object)) {
+        auto it = (*map)->data.find(toValue(index));
+        return it == (*map)->data.end() ? Value(nullptr) : it->second;
+    }
+    fail(line, "subscript must be of an array or map");
+}
+
+// a[i] = v; assigning nil to a map key removes it
+template <class I>
+Value setIndex(const Value& object, const I& index, const Value& value, int line) {
+    if (const auto* array = std::get_if<std::shared_ptr<Array>>(&object)) {
+        (*array)->data[arrayIndex(**array, number(index, line, "array index must be a number"), line)] = value;
+        return value;
+    }
+    if (const auto* map = std::get_if<std::shared_ptr<Map>>(&object)) {
+        if (std::holds_alternative<std::nullptr_t>(value)) {
+            (*map)->data.erase(toValue(index));
+            return nullptr;
+        }
+        (*map)->data[toValue(index)] = value;
+        return value;
+    }
+    fail(line, "Only arrays and maps can be subscripted.");
+}
+
+template <class I>
+double postfixIndex(const Value& object, const I& index, double delta, int line) {
+    if (const auto* array = std::get_if<std::shared_ptr<Array>>(&object)) {
+        return postfix((*array)->data[arrayIndex(**array, number(index, line, "array index must be a number"), line)],
+                       delta, line);
+    }
+    if (const auto* map = std::get_if<std::shared_ptr<Map>>(&object)) {
+        auto it = (*map)->data.find(toValue(index));
+        if (it == (*map)->data.end()) fail(line, "Postfix operator requires an existing numeric value.");
+        return postfix(it->second, delta, line);
+    }
+    fail(line, "subscript must be of an array or map");
+}
+
+inline Value getProperty(const Value& object, const Value& key, int line) {
+    const auto* map = std::get_if<std::shared_ptr<Map>>(&object);
+    if (!map) fail(line, "Only maps can have properties accessed with dot notation");
+    auto it = (*map)->data.find(key);
+    return it == (*map)->data.end() ? Value(nullptr) : it->second;
+}
+
+inline double postfixProperty(const Value& object, const Value& key, double delta, int line) {
+    const auto* map = std::get_if<std::shared_ptr<Map>>(&object);
+    if (!map) fail(line, "Only maps can have properties accessed with dot notation");
+    auto it = (*map)->data.find(key);
+    if (it == (*map)->data.end()) fail(line, "Postfix operator requires an existing numeric value.");
+    return postfix(it->second, delta, line);
+}
+
+inline Value makeArray(std::initializer_list<Value> elements) {
+    return std::make_shared<Array>(Array{std::vector<Value>(elements)});
+}
+
+inline Value makeMap(std::initializer_list<std::pair<Value, Value>> pairs) {
+    std::unordered_map<Value, Value> data;
+    data.reserve(pairs.size());
+    for (const auto& [key, value] : pairs) {
+        if (!std::holds_alternative<std::nullptr_t>(value)) { // nil cannot be a value in a map
+            data[key] = value;
+        }
+    }
+    return std::make_shared<Map>(Map{data});
+}
+
+template <class Body>
+Value makeFunction(const char* name, int arity, Body body) {
+    return std::shared_ptr<Function>(
+        std::make_shared<Closure<Body>>(arity, std::string("<fn ") + name + ">", std::move(body)));
+}
+
+template <class Body>
+Value makeAnonymous(int arity, Body body) {
+    return std::shared_ptr<Function>(std::make_shared<Closure<Body>>(arity, "<anonymous fn>", std::move(body)));
+}
+
+inline Value makeNative(const char* display, int arity, NativeFn fn) {
+    return std::shared_ptr<Function>(std::make_shared<Native>(arity, display, fn));
+}
+
+// The callee comes first so that it is evaluated before the arguments.
+inline Value call(int line, std::initializer_list<Value> calleeAndArgs) {
+    const Value* callee = calleeAndArgs.begin();
+    size_t argc = calleeAndArgs.size() - 1;
+    const auto* function = std::get_if<std::shared_ptr<Function>>(callee);
+    if (!function) fail(line, "Can only call functions and classes.");
+    int arity = (*function)->arity;
+    if (arity != -1 && static_cast<size_t>(arity) != argc) {
+        fail(line, "expected " + std::to_string(arity) + " arguments but got " + std::to_string(argc));
+    }
+    return (*function)->call(callee + 1, argc);
+}
+
+// a native the program never redefines, called with the right arguments
+inline Value callNative(NativeFn fn, std::initializer_list<Value> args) {
+    return fn(args.begin(), args.size());
+}
+
+)CPP",
+        R"CPP(inline Value n_clock(const Value*, size_t) {
+    using namespace std::chrono;
+    auto now = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+    return static_cast<double>(now) / 1000.0;
+}
+
+inline std::string unescape(const std::string& in) {
+    std::string out;
+    out.reserve(in.size());
+    for (size_t i = 0; i < in.size(); ++i) {
+        if (in[i] == '\\' && i + 1 < in.size()) {
+            switch (in[++i]) {
+                case 'n': out.push_back('\n'); break;
+                case 't': out.push_back('\t'); break;
+                case 'r': out.push_back('\r'); break;
+                case '\\': out.push_back('\\'); break;
+                default: out.append("\\").push_back(in[i]); break;
+            }
+        } else {
+            out.push_back(in[i]);
+        }
+    }
+    return out;
+}
+
+// printf and sprintf
+inline std::string format(const Value* args, size_t argc) {
+    if (argc == 0) fail(0, "printf needs a format string");
+    const auto* raw = std::get_if<std::string>(&args[0]);
+    if (!raw) fail(0, "first printf argument must be a string");
+    const std::string fmt = unescape(*raw);
+    std::ostringstream out;
+    size_t next = 1;
+    for (size_t i = 0; i < fmt.size(); ++i) {
+        if (fmt[i] != '%') {
+            out << fmt[i];
+            continue;
+        }
+        if (++i == fmt.size()) fail(0, "lone % at end of format string");
+        char spec = fmt[i];
+        if (spec == '%') {
+            out << '%';
+            continue;
+        }
+        if (next >= argc) fail(0, "too few arguments for printf");
+        const Value& value = args[next++];
+        switch (spec) {
+            case 'd':
+            case 'i':
+                if (const auto* d = std::get_if<double>(&value)) {
+                    out << static_cast<long long>(*d);
+                } else if (const auto* b = std::get_if<bool>(&value)) {
+                    out << (*b ? 1 : 0);
+                } else {
+                    fail(0, "%d expects number/bool; got wrong argument" + toString(value));
+                }
+                break;
+            case 'f':
+                out << std::fixed << number(value, 0, "%f expects number");
+                break;
+            case 'e':
+                out << std::scientific << number(value, 0, "%e expects number");
+                break;
+            case 's':
+                write(out, value);
+                break;
+            case 'c':
+                if (const auto* d = std::get_if<double>(&value)) {
+                    out << static_cast<char>(*d);
+                } else if (const auto* s = std::get_if<std::string>(&value); s && s->size() == 1) {
+                    out << (*s)[0];
+                } else {
+                    fail(0, "%c expects char");
+                }
+                break;
+            default:
+                fail(0, std::string("unsupported %") + spec);
+        }
+    }
+    if (next != argc) fail(0, "too many arguments for printf");
+    return out.str();
+}
+
+inline Value n_printf(const Value* args, size_t argc) {
+    std::cout << format(args, argc);
+    return nullptr;
+}
+
+inline Value n_sprintf(const Value* args, size_t argc) {
+    return format(args, argc);
+}
+
+inline Value n_len(const Value* args, size_t) {
+    if (const auto* array = std::get_if<std::shared_ptr<Array>>(&args[0])) return static_cast<double>((*array)->data.size());
+    if (const auto* map = std::get_if<std::shared_ptr<Map>>(&args[0])) return static_cast<double>((*map)->data.size());
+    if (const auto* s = std::get_if<std::string>(&args[0])) return static_cast<double>(s->size());
+    fail(0, "len() argument must be array or map");
+}
+
+inline Value n_push(const Value* args, size_t) {
+    const auto* array = std::get_if<std::shared_ptr<Array>>(&args[0]);
+    if (!array) fail(0, "push(array, v) needs array as first argument");
+    (*array)->data.push_back(args[1]);
+    return args[1];
+}
+
+inline Value n_pop(const Value* args, size_t) {
+    const auto* array = std::get_if<std::shared_ptr<Array>>(&args[0]);
+    if (!array) fail(0, "pop(array): array must be an array");
+    auto& data = (*array)->data;
+    if (data.empty()) fail(0, "pop() from empty array");
+    Value value = std::move(data.back());
+    data.pop_back();
+    return value;
+}
+
+inline Value n_readline(const Value*, size_t) {
+    std::string line;
+    if (!std::getline(std::cin, line)) return false;
+    return line;
+}
+
+inline Value n_slurp(const Value*, size_t) {
+    return std::string(std::istreambuf_iterator<char>(std::cin), {});
+}
+
+inline Value n_split(const Value* args, size_t) {
+    const auto* text = std::get_if<std::string>(&args[0]);
+    const auto* delimiter = std::get_if<std::string>(&args[1]);
+    if (!text || !delimiter) fail(0, "split(string, string) expected");
+    auto result = std::make_shared<Array>();
+    if (delimiter->empty()) {
+        for (char ch : *text) result->data.emplace_back(std::string(1, ch));
+        return result;
+    }
+    size_t start = 0;
+    for (size_t found; (found = text->find(*delimiter, start)) != std::string::npos; start = found + delimiter->size()) {
+        result->data.emplace_back(text->substr(start, found - start));
+    }
+    result->data.emplace_back(text->substr(start));
+    return result;
+}
+
+inline Value n_assert(const Value* args, size_t argc) {
+    if (argc > 0 && truthy(args[0])) return nullptr;
+    fail(0, "assert failed; " + (argc > 1 ? toString(args[1]) : std::string()));
+}
+
+inline Value n_for_each(const Value* args, size_t) {
+    const auto* map = std::get_if<std::shared_ptr<Map>>(&args[0]);
+    if (!map) fail(0, "for_each(m, f), m must be an map");
+    const auto* function = std::get_if<std::shared_ptr<Function>>(&args[1]);
+    if (!function) fail(0, "for_each(m, f), f must be a function");
+    if ((*function)->arity != 2) fail(0, "for_each(m, f), f must take 2 arguments (k,v)");
+    // f may change the map
+    std::vector<std::pair<Value, Value>> entries((*map)->data.begin(), (*map)->data.end());
+    for (const auto& [key, value] : entries) {
+        const Value pair[] = {key, value};
+        (*function)->call(pair, 2);
+    }
+    return nullptr;
+}
+
+inline Value n_tonumber(const Value* args, size_t) {
+    if (std::holds_alternative<double>(args[0])) return args[0];
+    if (const auto* b = std::get_if<bool>(&args[0])) return *b ? 1.0 : 0.0;
+    if (const auto* s = std::get_if<std::string>(&args[0])) {
+        char* end = nullptr;
+        double value = std::strtod(s->c_str(), &end);
+        if (end == s->c_str()) fail(0, "tonumber() could not convert string to number");
+        return value;
+    }
+    fail(0, "tonumber() argument must be a number, bool or string");
+}
+
+inline Value n_keys(const Value* args, size_t) {
+    const auto* map = std::get_if<std::shared_ptr<Map>>(&args[0]);
+    if (!map) fail(0, "keys(map) requires map argument");
+    auto result = std::make_shared<Array>();
+    result->data.reserve((*map)->data.size());
+    for (const auto& [key, value] : (*map)->data) result->data.push_back(key);
+    return result;
+}
+
+#define RHYTHM_MATH1(name)                                                       \
+    inline Value n_##name(const Value* args, size_t) {                           \
+        return std::name(number(args[0], 0, #name "() argument must be a number.")); \
+    }
+RHYTHM_MATH1(floor)
+RHYTHM_MATH1(ceil)
+RHYTHM_MATH1(sin)
+RHYTHM_MATH1(cos)
+RHYTHM_MATH1(tan)
+RHYTHM_MATH1(asin)
+RHYTHM_MATH1(acos)
+RHYTHM_MATH1(atan)
+RHYTHM_MATH1(log)
+RHYTHM_MATH1(log10)
+RHYTHM_MATH1(sqrt)
+RHYTHM_MATH1(exp)
+RHYTHM_MATH1(fabs)
+#undef RHYTHM_MATH1
+
+#define RHYTHM_MATH2(name)                                                       \
+    inline Value n_##name(const Value* args, size_t) {                           \
+        return std::name(number(args[0], 0, #name "() first argument must be a number."), \
+                         number(args[1], 0, #name "() second argument must be a number.")); \
+    }
+RHYTHM_MATH2(pow)
+RHYTHM_MATH2(atan2)
+RHYTHM_MATH2(fmod)
+#undef RHYTHM_MATH2
+
+inline Value n_inf(const Value*, size_t) {
+    return std::numeric_limits<double>::infinity();
+}
+
+inline Value n_substring(const Value* args, size_t) {
+    const auto* text = std::get_if<std::string>(&args[0]);
+    if (!text) fail(0, "substring() requires string as first argument");
+    double start = number(args[1], 0, "substring() indices must be integers");
+    double end = number(args[2], 0, "substring() indices must be integers");
+    if (!isInteger(start) || !isInteger(end)) fail(0, "substring() indices must be integers");
+    if (start < 0 || end < start || end > static_cast<double>(text->size())) {
+        fail(0, "substring() indices out of range");
+    }
+    return text->substr(static_cast<size_t>(start), static_cast<size_t>(end - start));
+}
+
+inline Value n_random_int(const Value* args, size_t) {
+    const auto* a = std::get_if<double>(&args[0]);
+    const auto* b = std::get_if<double>(&args[1]);
+    const auto* n = std::get_if<double>(&args[2]);
+    if (!a || !b || !n) fail(0, "random_int needs two int numbers and an integer size");
+    if (!isInteger(*a) || !isInteger(*b) || !isInteger(*n)) fail(0, "random_int needs three integer numbers");
+    if (*a >= *b) fail(0, "random_int(a,b,n):  a should be less than b");
+    if (*n < 1) fail(0, "random_int(a,b,n): n cannot be less than 1");
+    static std::mt19937_64 engine{std::random_device{}()};
+    std::uniform_int_distribution<long long> distribution(static_cast<long long>(*a), static_cast<long long>(*b));
+    auto result = std::make_shared<Array>();
+    for (long long i = 0; i < static_cast<long long>(*n); ++i) {
+        result->data.emplace_back(static_cast<double>(distribution(engine)));
+    }
+    return result;
+}
+
+)CPP",
+        R"CPP(// from_json and to_json, laid out like the interpreter's JSON library:
+// objects have their keys sorted, numbers are doubles.
+class JsonReader {
+public:
+    explicit JsonReader(const std::string& text) : text(text) {}
+
+    Value read() {
+        Value value = parseValue();
+        skipSpace();
+        if (pos != text.size()) error();
+        return value;
+    }
+
+private:
+    const std::string& text;
+    size_t pos = 0;
+
+    [[noreturn]] void error() { fail(0, "from_json() could not parse JSON"); }
+
+    void skipSpace() {
+        while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '\n' || text[pos] == '\r')) {
+            ++pos;
+        }
+    }
+
+    bool consume(const std::string& word) {
+        if (text.compare(pos, word.size(), word) != 0) return false;
+        pos += word.size();
+        return true;
+    }
+
+    void expect(char ch) {
+        skipSpace();
+        if (pos >= text.size() || text[pos] != ch) error();
+        ++pos;
+    }
+
+    Value parseValue() {
+        skipSpace();
+        if (pos >= text.size()) error();
+        switch (text[pos]) {
+            case '{': return parseObject();
+            case '[': return parseArray();
+            case '"': return parseString();
+        }
+        if (consume("true")) return true;
+        if (consume("false")) return false;
+        if (consume("null")) return nullptr;
+        const char* begin = text.c_str() + pos;
+        char* end = nullptr;
+        double value = std::strtod(begin, &end);
+        if (end == begin) error();
+        pos += end - begin;
+        return value;
+    }
+
+    unsigned hex4() {
+        if (pos + 4 > text.size()) error();
+        unsigned code = 0;
+        auto [end, ec] = std::from_chars(text.data() + pos, text.data() + pos + 4, code, 16);
+        if (ec != std::errc() || end != text.data() + pos + 4) error();
+        pos += 4;
+        return code;
+    }
+
+    static void appendUtf8(std::string& out, unsigned code) {
+        if (code < 0x80) {
+            out += static_cast<char>(code);
+        } else if (code < 0x800) {
+            out += static_cast<char>(0xC0 | (code >> 6));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        } else if (code < 0x10000) {
+            out += static_cast<char>(0xE0 | (code >> 12));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (code >> 18));
+            out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        }
+    }
+
+    std::string parseString() {
+        expect('"');
+        std::string out;
+        while (true) {
+            if (pos >= text.size()) error();
+            char ch = text[pos++];
+            if (ch == '"') return out;
+            if (ch != '\\') {
+                out += ch;
+                continue;
+            }
+            if (pos >= text.size()) error();
+            switch (char escaped = text[pos++]) {
+                case '"':
+                case '\\':
+                case '/': out += escaped; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': {
+                    unsigned code = hex4();
+                    if (code >= 0xD800 && code < 0xDC00 && consume("\\u")) { // surrogate pair
+                        code = 0x10000 + ((code - 0xD800) << 10) + (hex4() - 0xDC00);
+                    }
+                    appendUtf8(out, code);
+                    break;
+                }
+                default: error();
+            }
+        }
+    }
+
+    Value parseArray() {
+        expect('[');
+        auto array = std::make_shared<Array>();
+        skipSpace();
+        if (pos < text.size() && text[pos] == ']') {
+            ++pos;
+            return array;
+        }
+        while (true) {
+            array->data.push_back(parseValue());
+            skipSpace();
+            if (pos < text.size() && text[pos] == ',') {
+                ++pos;
+                continue;
+            }
+            expect(']');
+            return array;
+        }
+    }
+
+    Value parseObject() {
+        expect('{');
+        std::map<std::string, Value> members;
+        skipSpace();
+        if (pos < text.size() && text[pos] == '}') {
+            ++pos;
+        } else {
+            while (true) {
+                skipSpace();
+                std::string key = parseString();
+                expect(':');
+                members[key] = parseValue();
+                skipSpace();
+                if (pos < text.size() && text[pos] == ',') {
+                    ++pos;
+                    continue;
+                }
+                expect('}');
+                break;
+            }
+        }
+        std::unordered_map<Value, Value> data;
+        for (auto& [key, value] : members) data[key] = std::move(value);
+        return std::make_shared<Map>(Map{data});
+    }
+};
+
+inline void writeJsonString(std::string& out, const std::string& text) {
+    static const char hex[] = "0123456789abcdef";
+    out += '"';
+    for (char ch : text) {
+        switch (ch) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\b': out += "\\b"; break;
+            case '\f': out += "\\f"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(ch) < 0x20) {
+                    out += "\\u00";
+                    out += hex[(ch >> 4) & 0xF];
+                    out += hex[ch & 0xF];
+                } else {
+                    out += ch;
+                }
+        }
+    }
+    out += '"';
+}
+
+inline void writeJson(std::string& out, const Value& value) {
+    switch (value.index()) {
+        case 0: {
+            double d = std::get<double>(value);
+            if (!std::isfinite(d)) {
+                out += "null";
+                break;
+            }
+            char buffer[32];
+            auto [end, ec] = std::to_chars(buffer, buffer + sizeof buffer, d);
+            std::string digits(buffer, end);
+            if (digits.find_first_of(".e") == std::string::npos) digits += ".0";
+            out += digits;
+            break;
+        }
+        case 1: writeJsonString(out, std::get<std::string>(value)); break;
+        case 2: out += "null"; break;
+        case 3: out += std::get<bool>(value) ? "true" : "false"; break;
+        case 4: fail(0, "cannot serialize function to JSON");
+        case 5: {
+            out += '[';
+            bool first = true;
+            for (const auto& element : std::get<std::shared_ptr<Array>>(value)->data) {
+                if (!first) out += ',';
+                first = false;
+                writeJson(out, element);
+            }
+            out += ']';
+            break;
+        }
+        case 6: {
+            std::map<std::string, const Value*> members; // keys must be strings, sorted
+            for (const auto& [key, element] : std::get<std::shared_ptr<Map>>(value)->data) {
+                std::string name;
+                if (const auto* s = std::get_if<std::string>(&key)) {
+                    name = *s;
+                } else if (const auto* d = std::get_if<double>(&key)) {
+                    name = isInteger(*d) ? std::to_string(static_cast<long long>(*d)) : std::to_string(*d);
+                } else if (const auto* b = std::get_if<bool>(&key)) {
+                    name = *b ? "true" : "false";
+                } else if (std::holds_alternative<std::nullptr_t>(key)) {
+                    name = "nil";
+                } else {
+                    fail(0, "unsupported map key type for JSON serialization");
+                }
+                members[name] = &element;
+            }
+            out += '{';
+            bool first = true;
+            for (const auto& [name, element] : members) {
+                if (!first) out += ',';
+                first = false;
+                writeJsonString(out, name);
+                out += ':';
+                writeJson(out, *element);
+            }
+            out += '}';
+            break;
+        }
+    }
+}
+
+inline Value n_from_json(const Value* args, size_t) {
+    const auto* text = std::get_if<std::string>(&args[0]);
+    if (!text) fail(0, "from_json() requires string argument");
+    return JsonReader(*text).read();
+}
+
+inline Value n_to_json(const Value* args, size_t) {
+    std::string out;
+    writeJson(out, args[0]);
+    return out;
+}
+
+// runs the program, reporting a runtime error the way the other backends do
+inline int runProgram(void (*program)()) {
+    std::ios::sync_with_stdio(false);
+    try {
+        program();
+    } catch (const std::exception& error) {
+        std::cout.flush();
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+    std::cout.flush();
+    return 0;
+}
+
+// Rhythm code recurses where C++ would loop (all of it, under --no-loop), so
+// the program runs on a thread with a far larger stack than the default.
+inline int run(void (*program)()) {
+#if defined(__unix__) || defined(__APPLE__)
+    struct Run {
+        void (*program)();
+        int status;
+    } state{program, 0};
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setstacksize(&attributes, size_t{1} << 30);
+    pthread_t thread;
+    auto body = [](void* argument) -> void* {
+        auto* state = static_cast<Run*>(argument);
+        state->status = runProgram(state->program);
+        return nullptr;
+    };
+    if (pthread_create(&thread, &attributes, body, &state) == 0) {
+        pthread_join(thread, nullptr);
+        return state.status;
+    }
+#endif
+    return runProgram(program);
+}
+
+}  // namespace rhythm
+)CPP",
+    };
+    std::string prelude;
+    for (const char* part : parts) {
+        prelude.append(part);
+    }
+    return prelude;
+}
+
+}  // namespace transpose
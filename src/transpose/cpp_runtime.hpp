@@ -0,0 +1,12 @@
+#pragma once
+
+#include <string>
+
+namespace transpose {
+
+// The runtime every program from transpose --emit-cpp starts with: values,
+// arrays, maps and functions with the interpreter's semantics, the operators
+// the generated code calls and the native functions.
+std::string cppRuntimePrelude();
+
+}  // namespace transpose
@@ -0,0 +1,23 @@
+#include "transpose/cpp_transpiler.hpp"
+
+#include "transpose/cpp_generator.hpp"
+#include "transpose/frontend.hpp"
+#include "type_inference.hpp"
+
+namespace transpose {
+
+std::string transpileToCpp(const std::string& source) {
+    if (source.empty()) {
+        return {};
+    }
+
+    auto statements = parseWithCoreLibrary(source);
+
+    TypeInference types;
+    types.infer(statements);
+
+    CppGenerator generator(types);
+    return generator.generate(statements);
+}
+
+}  // namespace transpose
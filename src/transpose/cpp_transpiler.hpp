@@ -0,0 +1,12 @@
+#pragma once
+
+#include <string>
+
+namespace transpose {
+
+// Transpile Rhythm source code (including the core library) into a complete
+// C++ program: the runtime followed by the user's code, ready for a C++20
+// compiler.
+std::string transpileToCpp(const std::string& source);
+
+}  // namespace transpose
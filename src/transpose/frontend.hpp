@@ -0,0 +1,27 @@
+#pragma once
+
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "expr.hpp"
+#include "statement.hpp"
+
+// Parsing shared by the transpiler's backends (see transpiler.cpp).
+namespace transpose {
+
+// Parses source and runs the AST and SSA optimizations shared with beat.
+// line is where source starts in the file.
+std::vector<std::unique_ptr<Stmt>> parseOptimized(const std::string& source, std::ostream* irDump = nullptr,
+                                                  int line = 1);
+
+// The whole core library, parsed like a program but with loops allowed
+// under --no-loop.
+std::vector<std::unique_ptr<Stmt>> parseCoreLibrary();
+
+// The core library followed by the program in source, resolved, for the
+// backends that compile both into one unit.
+std::vector<std::unique_ptr<Stmt>> parseWithCoreLibrary(const std::string& source);
+
+}  // namespace transpose
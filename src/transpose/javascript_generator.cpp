@@ -1,87 +1,489 @@
 #include "transpose/javascript_generator.hpp"
 
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cmath>
 #include <iomanip>
+#include <set>
 #include <utility>
 #include <stdexcept>
+#include <string_view>
 
+#include "ast_walker.hpp"
+#include "parser.hpp"
 #include "token.hpp"
+#include "transpose/program_analysis.hpp"
 #include "transpose/runtime.hpp"
 
 namespace transpose {
 
-JavascriptGenerator::JavascriptGenerator() : current_(&builder_) {}
+namespace {
 
-std::string JavascriptGenerator::generate(const std::vector<std::unique_ptr<Stmt>>& statements) {
-    builder_.str("");
-    builder_.clear();
-    indent_ = 0;
-    scopeStack_.clear();
-    beginScope(true);
-    builder_ << runtimePrelude() << "\n\n";
+// Whether expr evaluates to a number whenever it evaluates at all: besides
+// what TypeInference proves, the arithmetic operators either produce one or
+// raise an error. element decides for subscripts.
+template <typename Element>
+bool alwaysNumber(const Expr& expr, const TypeInference& types, const Element& element) {
+    if (types.typeOf(expr) == InferredType::NUMBER) return true;
+    if (const auto* grouping = dynamic_cast<const Grouping*>(&expr)) {
+        return alwaysNumber(*grouping->expression, types, element);
+    }
+    if (const auto* binary = dynamic_cast<const Binary*>(&expr)) {
+        switch (binary->op.type) {
+            case TokenType::MINUS:
+            case TokenType::STAR:
+            case TokenType::SLASH:
+            case TokenType::PERCENT:
+                return true;
+            case TokenType::PLUS:
+                return alwaysNumber(*binary->left, types, element) && alwaysNumber(*binary->right, types, element);
+            default:
+                return false;
+        }
+    }
+    if (const auto* unary = dynamic_cast<const Unary*>(&expr)) {
+        return unary->op.type == TokenType::MINUS;
+    }
+    if (dynamic_cast<const Postfix*>(&expr)) {
+        return true;
+    }
+    if (const auto* assignment = dynamic_cast<const Assignment*>(&expr)) {
+        return alwaysNumber(*assignment->right, types, element);
+    }
+    if (const auto* subscript = dynamic_cast<const Subscript*>(&expr)) {
+        return element(*subscript);
+    }
+    return false;
+}
 
-    const std::vector<std::string> builtins = {
-        "clock",      "printf",    "sprintf",  "len",        "push",      "pop",
-        "readline",   "split",     "assert",   "for_each",   "tonumber",  "slurp",
-        "keys",       "floor",     "ceil",     "sin",        "cos",       "tan",
-        "asin",       "acos",      "atan",     "log",        "log10",     "sqrt",
-        "exp",        "fabs",      "pow",      "atan2",      "fmod",      "from_json",
-        "to_json",    "inf",       "substring", "random_int"};
+// Finds the arrays that can be Float64Arrays: variables initialized with a
+// literal of numbers and only ever subscripted (storing numbers) or passed
+// to len(). Anything else -- reassignment, push, passing or printing the
+// array -- could observe the difference, and disqualifies it.
+class NumericArrays : public AstWalker {
+public:
+    explicit NumericArrays(const TypeInference& types) : types(types) {}
 
-    for (const auto& name : builtins) {
-        builder_ << "let " << name << " = __rt.globals." << name << ";\n";
-        declareInCurrentScope(name);
+    std::unordered_set<const Expr*> uses;     // the variables naming one
+    std::unordered_set<const Expr*> literals; // their initializers
+    std::unordered_set<const Expr*> lengths;  // len() of one
+
+    // parts are consecutive top-level statements of one program
+    void analyze(const std::vector<const std::vector<std::unique_ptr<Stmt>>*>& parts) {
+        scopes.emplace_back();
+        for (const auto* statements : parts) {
+            walk(*statements);
+        }
+        // a global can be used before its declaration is seen
+        for (const auto& name : unresolved) {
+            auto it = scopes.front().find(name);
+            if (it != scopes.front().end() && it->second) disqualify(it->second);
+        }
+        // storing an element of an array that is not numeric after all
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (auto& [declaration, candidate] : candidates) {
+                for (const auto* need : candidate.needs) {
+                    if (candidate.viable && !candidates[need].viable) {
+                        candidate.viable = false;
+                        changed = true;
+                    }
+                }
+            }
+        }
+        for (const auto& [declaration, candidate] : candidates) {
+            if (!candidate.viable) continue;
+            literals.insert(declaration->initializer.get());
+            uses.insert(candidate.uses.begin(), candidate.uses.end());
+            lengths.insert(candidate.lengths.begin(), candidate.lengths.end());
+        }
     }
-    builder_ << "\n";
 
-    emitLine("try {");
-    indent_++;
+    using AstWalker::visit;
+    void visit(const Variable& expr) override {
+        if (auto* candidate = find(expr.name.lexeme)) candidate->viable = false;
+    }
+    void visit(const Assignment& expr) override {
+        expr.right->accept(*this);
+        if (auto* candidate = find(expr.name.lexeme)) candidate->viable = false;
+    }
+    void visit(const Subscript& expr) override {
+        if (!use(*expr.object)) expr.object->accept(*this);
+        expr.index->accept(*this);
+    }
+    void visit(const SubscriptAssignment& expr) override {
+        std::vector<const VarStmt*> needs;
+        if (number(*expr.value, needs)) {
+            if (auto* candidate = use(*expr.object)) {
+                candidate->needs.insert(candidate->needs.end(), needs.begin(), needs.end());
+            } else {
+                expr.object->accept(*this);
+            }
+        } else {
+            expr.object->accept(*this);
+        }
+        expr.index->accept(*this);
+        expr.value->accept(*this);
+    }
+    void visit(const Postfix& expr) override {
+        if (const auto* subscript = dynamic_cast<const Subscript*>(expr.operand.get())) {
+            if (!use(*subscript->object)) subscript->object->accept(*this);
+            subscript->index->accept(*this);
+            return;
+        }
+        expr.operand->accept(*this);
+    }
+    void visit(const Call& expr) override {
+        const auto* callee = dynamic_cast<const Variable*>(expr.callee.get());
+        if (callee && callee->name.lexeme == "len" && expr.arguments.size() == 1 && !types.redefines("len") &&
+            !resolves("len")) {
+            if (auto* candidate = use(*expr.arguments[0])) {
+                candidate->lengths.push_back(&expr);
+                return;
+            }
+        }
+        AstWalker::visit(expr);
+    }
+    void visit(const FunctionExpr& expr) override { function(expr.params, *expr.body); }
+    void visit(const VarStmt& stmt) override {
+        if (stmt.initializer) stmt.initializer->accept(*this);
+        const VarStmt* declaration = nullptr;
+        if (const auto* literal = dynamic_cast<const ArrayLiteral*>(stmt.initializer.get())) {
+            std::vector<const VarStmt*> needs;
+            bool numbers = true;
+            for (const auto& element : literal->elements) {
+                numbers = numbers && number(*element, needs);
+            }
+            if (numbers) {
+                declaration = &stmt;
+                candidates[&stmt].needs = std::move(needs);
+            }
+        }
+        // a redeclaration assigns to the same JavaScript variable
+        auto& scope = scopes.back();
+        auto previous = scope.find(stmt.name.lexeme);
+        if (previous != scope.end()) {
+            if (previous->second) disqualify(previous->second);
+            if (declaration) disqualify(declaration);
+        }
+        scope[stmt.name.lexeme] = declaration;
+    }
+    void visit(const BlockStmt& stmt) override {
+        scopes.emplace_back();
+        walk(stmt.statements);
+        scopes.pop_back();
+    }
+    void visit(const FunctionStmt& stmt) override {
+        scopes.back()[stmt.name.lexeme] = nullptr;
+        function(stmt.params, *stmt.body);
+    }
+
+private:
+    struct Candidate {
+        bool viable = true;
+        std::vector<const Expr*> uses;
+        std::vector<const Expr*> lengths;
+        std::vector<const VarStmt*> needs; // the candidates its elements come from
+    };
+    const TypeInference& types;
+    // null for names that are not candidates
+    std::vector<std::unordered_map<std::string, const VarStmt*>> scopes;
+    std::unordered_map<const VarStmt*, Candidate> candidates;
+    std::unordered_set<std::string> unresolved;
+
+    void function(const std::vector<Token>& params, const BlockStmt& body) {
+        scopes.emplace_back();
+        for (const auto& param : params) {
+            scopes.back()[param.lexeme] = nullptr;
+        }
+        walk(body.statements);
+        scopes.pop_back();
+    }
+
+    bool resolves(const std::string& name) {
+        for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+            if (scope->contains(name)) return true;
+        }
+        unresolved.insert(name);
+        return false;
+    }
+
+    Candidate* find(const std::string& name) {
+        for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+            auto it = scope->find(name);
+            if (it != scope->end()) return it->second ? &candidates[it->second] : nullptr;
+        }
+        unresolved.insert(name);
+        return nullptr;
+    }
+
+    // records expr as a use of a candidate array, if it names one
+    Candidate* use(const Expr& expr) {
+        const auto* variable = dynamic_cast<const Variable*>(&expr);
+        if (!variable) return nullptr;
+        auto* candidate = find(variable->name.lexeme);
+        if (candidate) candidate->uses.push_back(variable);
+        return candidate;
+    }
+
+    void disqualify(const VarStmt* declaration) { candidates[declaration].viable = false; }
+
+    // whether expr is a number, provided the candidates it adds to needs are
+    bool number(const Expr& expr, std::vector<const VarStmt*>& needs) {
+        return alwaysNumber(expr, types, [&](const Subscript& subscript) {
+            const auto* variable = dynamic_cast<const Variable*>(subscript.object.get());
+            if (!variable) return false;
+            for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope) {
+                auto it = scope->find(variable->name.lexeme);
+                if (it == scope->end()) continue;
+                if (!it->second) return false;
+                needs.push_back(it->second);
+                return true;
+            }
+            return false;
+        });
+    }
+};
+
+const std::vector<std::string> builtins = {
+    "clock",      "printf",    "sprintf",  "len",        "push",      "pop",
+    "readline",   "split",     "assert",   "for_each",   "tonumber",  "slurp",
+    "keys",       "floor",     "ceil",     "sin",        "cos",       "tan",
+    "asin",       "acos",      "atan",     "log",        "log10",     "sqrt",
+    "exp",        "fabs",      "pow",      "atan2",      "fmod",      "from_json",
+    "to_json",    "inf",       "substring", "random_int"};
+
+// The builtins code names, as whole identifiers and not as properties.
+std::set<std::string> mentionedBuiltins(const std::string& code) {
+    static const std::unordered_set<std::string_view> names(builtins.begin(), builtins.end());
+    static const auto identifierChars = [] {
+        std::array<bool, 256> chars{};
+        for (int ch = 0; ch < 256; ++ch) chars[ch] = std::isalnum(ch) || ch == '_' || ch == '$';
+        return chars;
+    }();
+    // most identifiers can be ruled out without hashing them
+    static const auto initials = [] {
+        std::array<bool, 256> chars{};
+        for (const auto& name : builtins) chars[static_cast<unsigned char>(name.front())] = true;
+        return chars;
+    }();
+    auto isPart = [](char ch) { return identifierChars[static_cast<unsigned char>(ch)]; };
+    std::set<std::string> found;
+    for (size_t at = 0; at < code.size();) {
+        if (!isPart(code[at])) {
+            ++at;
+            continue;
+        }
+        size_t end = at;
+        while (end < code.size() && isPart(code[end])) ++end;
+        std::string_view name(code.data() + at, end - at);
+        if (initials[static_cast<unsigned char>(code[at])] && (at == 0 || code[at - 1] != '.') && names.contains(name)) {
+            found.emplace(name);
+        }
+        at = end;
+    }
+    return found;
+}
+
+}  // namespace
+
+JavascriptGenerator::JavascriptGenerator(const TypeInference& types) : current_(&builder_), types_(types) {}
+
+void JavascriptGenerator::analyze(const Statements& statements) {
+    NumericArrays arrays(types_);
+    arrays.analyze({&statements});
+    numericArrays_ = std::move(arrays.uses);
+    numericLiterals_ = std::move(arrays.literals);
+    numericLengths_ = std::move(arrays.lengths);
+
+    AssignedNames assigned;
+    assigned.walk(statements);
+    std::vector<std::pair<std::string, int>> declarations;
     for (const auto& stmt : statements) {
-        emitStatement(*stmt);
+        if (const auto* var = dynamic_cast<const VarStmt*>(stmt.get())) {
+            declarations.emplace_back(var->name.lexeme, -1);
+        } else if (const auto* function = dynamic_cast<const FunctionStmt*>(stmt.get())) {
+            declarations.emplace_back(function->name.lexeme, static_cast<int>(function->params.size()));
+        }
     }
-    indent_--;
-    emitLine("} catch (err) {");
-    indent_++;
-    emitLine("if (err && err.__isRhythmError) {");
-    indent_++;
-    emitLine("__rt.handleError(err);");
-    indent_--;
-    emitLine("}");
-    emitLine("throw err;");
-    indent_--;
-    emitLine("}");
+    directFunctions_ = directFunctions(declarations, assigned.names, library_);
+}
 
-    return builder_.str();
+std::unordered_map<std::string, size_t> JavascriptGenerator::directFunctions(
+    const std::vector<std::pair<std::string, int>>& declarations, const std::set<std::string>& assigned,
+    const Fragment* library) {
+    // a global function defined once and never assigned is always the same
+    // function, so calls to it with its arity need no checks
+    std::unordered_map<std::string, int> definitions;
+    for (const auto& [name, arity] : declarations) {
+        definitions[name] += arity < 0 ? 2 : 1;
+    }
+    std::unordered_map<std::string, size_t> direct;
+    for (const auto& [name, arity] : declarations) {
+        if (arity < 0 || definitions[name] != 1 || assigned.contains(name)) continue;
+        if (std::find(builtins.begin(), builtins.end(), name) != builtins.end()) continue;
+        if (library && std::find(library->globals.begin(), library->globals.end(), name) != library->globals.end()) {
+            continue;
+        }
+        direct[name] = arity;
+    }
+    return direct;
 }
 
-std::string JavascriptGenerator::generateUserCodeOnly(const std::vector<std::unique_ptr<Stmt>>& statements, size_t skipCoreLibStatements) {
+void JavascriptGenerator::reset(const Fragment* library) {
     builder_.str("");
     builder_.clear();
     indent_ = 0;
+    usesLogicalTemp_ = false;
+    trampolines_ = noLoop;
+    deep_ = false;
+    library_ = library;
     scopeStack_.clear();
     beginScope(true);
+    for (const auto& name : builtins) {
+        declareInCurrentScope(name);
+    }
+    if (library) {
+        for (const auto& name : library->globals) {
+            declareInCurrentScope(name);
+        }
+    }
+}
+
+std::string JavascriptGenerator::generate(const Statements& statements, const Fragment* library) {
+    reset(library);
+    analyze(statements);
+
+    indent_ = 1;
+    if (library) {
+        builder_ << library->code;
+        usesLogicalTemp_ = library->usesLogicalTemp;
+    }
+    for (const auto& stmt : statements) {
+        emitStatement(*stmt);
+    }
+    return program(builder_.str(), usesLogicalTemp_);
+}
 
-    // Declare builtins as if they exist (for scoping)
-    const std::vector<std::string> builtins = {
-        "clock",      "printf",    "sprintf",  "len",        "push",      "pop",
-        "readline",   "split",     "assert",   "for_each",   "tonumber",  "slurp",
-        "keys",       "floor",     "ceil",     "sin",        "cos",       "tan",
-        "asin",       "acos",      "atan",     "log",        "log10",     "sqrt",
-        "exp",        "fabs",      "pow",      "atan2",      "fmod",      "from_json",
-        "to_json",    "inf",       "substring", "random_int"};
+std::string JavascriptGenerator::program(const std::string& statements, bool usesLogicalTemp) {
+    std::string body = "try {\n";
+    body += statements;
+    body += "} catch (err) {\n"
+            "  if (err && err.__isRhythmError) {\n"
+            "    __rt.handleError(err);\n"
+            "  }\n"
+            "  throw err;\n"
+            "}\n";
 
+    // the program only pays for the runtime and natives it refers to
+    const auto natives = mentionedBuiltins(body);
+    std::string program = runtimePrelude(body, natives) + "\n\n";
     for (const auto& name : builtins) {
-        declareInCurrentScope(name);
+        if (natives.contains(name)) program += "let " + name + " = __rt.globals." + name + ";\n";
+    }
+    if (usesLogicalTemp) {
+        program += "let __logical;\n";
+    }
+    return program + "\n" + body;
+}
+
+JavascriptGenerator::Fragment JavascriptGenerator::generateFragment(const Statements& statements) {
+    reset(nullptr);
+    analyze(statements);
+    indent_ = 1;
+    for (const auto& stmt : statements) {
+        emitStatement(*stmt);
+    }
+    Fragment fragment{builder_.str(), {}, usesLogicalTemp_};
+    for (const auto& name : scopeStack_.front().names) {
+        if (std::find(builtins.begin(), builtins.end(), name) == builtins.end()) {
+            fragment.globals.push_back(name);
+        }
+    }
+    return fragment;
+}
+
+std::string JavascriptGenerator::generateUserCodeOnly(const Statements& statements, const Fragment* library) {
+    reset(library);
+    analyze(statements);
+    for (const auto& stmt : statements) {
+        emitStatement(*stmt);
     }
+    return userCode(builder_.str(), usesLogicalTemp_);
+}
 
-    // Only emit user statements (skip core library)
-    for (size_t i = skipCoreLibStatements; i < statements.size(); ++i) {
-        emitStatement(*statements[i]);
+std::string JavascriptGenerator::userCode(const std::string& statements, bool usesLogicalTemp) {
+    return usesLogicalTemp ? "let __logical;\n" + statements : statements;
+}
+
+std::vector<JavascriptGenerator::Piece> JavascriptGenerator::generatePieces(
+    const std::vector<const Statements*>& chunks, const std::vector<bool>& regenerate, const Fragment* library,
+    const std::unordered_map<std::string, size_t>& directFunctions) {
+    reset(library);
+    directFunctions_ = directFunctions;
+    std::vector<const Statements*> generated;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        if (regenerate[i]) generated.push_back(chunks[i]);
+    }
+    NumericArrays arrays(types_);
+    arrays.analyze(generated);
+    numericArrays_ = std::move(arrays.uses);
+    numericLiterals_ = std::move(arrays.literals);
+    numericLengths_ = std::move(arrays.lengths);
+
+    markLines_ = true;
+    std::vector<Piece> pieces(chunks.size());
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        if (!regenerate[i]) {
+            // what the chunk declares still makes later declarations assignments
+            for (const auto& stmt : *chunks[i]) {
+                if (const auto* var = dynamic_cast<const VarStmt*>(stmt.get())) {
+                    declareInCurrentScope(var->name.lexeme);
+                } else if (const auto* function = dynamic_cast<const FunctionStmt*>(stmt.get())) {
+                    declareInCurrentScope(function->name.lexeme);
+                }
+            }
+            continue;
+        }
+        builder_.str("");
+        usesLogicalTemp_ = false;
+        for (const auto& stmt : *chunks[i]) {
+            emitStatement(*stmt);
+        }
+        // take out the marks lineNumber() and emitLine() left
+        auto& piece = pieces[i];
+        const auto marked = builder_.str();
+        piece.code.reserve(marked.size());
+        for (size_t at = 0; at < marked.size(); ++at) {
+            if (marked[at] == '\x02') {
+                piece.statementLines.push_back(piece.code.size());
+                continue;
+            }
+            if (marked[at] != '\x01') {
+                piece.code += marked[at];
+                continue;
+            }
+            size_t end = at + 1;
+            while (end < marked.size() && std::isdigit(static_cast<unsigned char>(marked[end]))) ++end;
+            piece.lines.emplace_back(piece.code.size(), std::stoi(marked.substr(at + 1, end - at - 1)));
+            piece.code.append(marked, at + 1, end - at - 1);
+            at = end - 1;
+        }
+        piece.usesLogicalTemp = usesLogicalTemp_;
     }
+    markLines_ = false;
+    return pieces;
+}
 
-    return builder_.str();
+// Line numbers for a Piece start with a \x01 mark, and its statements' lines
+// with a \x02 mark; escapeString keeps both out of string literals.
+std::string JavascriptGenerator::lineNumber(int line) const {
+    return markLines_ ? '\x01' + std::to_string(line) : std::to_string(line);
 }
 
 void JavascriptGenerator::emitLine(const std::string& line) {
+    if (markLines_ && current_ == &builder_) (*current_) << '\x02';
     (*current_) << std::string(indent_ * 2, ' ') << line << '\n';
 }
 
@@ -108,15 +510,112 @@ std::string JavascriptGenerator::generateExpression(const Expr& expr) {
     return std::exchange(exprResult_, std::string{});
 }
 
-std::string JavascriptGenerator::renderFunctionBody(const BlockStmt& block, const std::vector<Token>& params) {
+bool JavascriptGenerator::isNumber(const Expr& expr) const {
+    // every element of a Float64Array is a number
+    return alwaysNumber(expr, types_, [&](const Subscript& subscript) {
+        return numericArrays_.contains(subscript.object.get());
+    });
+}
+
+// Whether expr evaluates to true or false, which JavaScript tests as is.
+bool JavascriptGenerator::isBool(const Expr& expr) const {
+    if (const auto* grouping = dynamic_cast<const Grouping*>(&expr)) {
+        return isBool(*grouping->expression);
+    }
+    if (const auto* binary = dynamic_cast<const Binary*>(&expr)) {
+        switch (binary->op.type) {
+            case TokenType::EQUAL_EQUAL:
+            case TokenType::BANG_EQUAL:
+            case TokenType::GREATER:
+            case TokenType::GREATER_EQUAL:
+            case TokenType::LESS:
+            case TokenType::LESS_EQUAL:
+                return true;
+            default:
+                return false;
+        }
+    }
+    if (const auto* unary = dynamic_cast<const Unary*>(&expr)) {
+        return unary->op.type == TokenType::BANG;
+    }
+    if (const auto* logical = dynamic_cast<const Logical*>(&expr)) {
+        return isBool(*logical->left) && isBool(*logical->right);
+    }
+    return types_.typeOf(expr) == InferredType::BOOL;
+}
+
+bool JavascriptGenerator::isArray(const Expr& expr) const {
+    return types_.typeOf(expr) == InferredType::ARRAY || numericArrays_.contains(&expr);
+}
+
+// Whether expr can be evaluated twice: a variable, or a literal.
+bool JavascriptGenerator::isSimple(const Expr& expr) const {
+    return dynamic_cast<const Variable*>(&expr) != nullptr || dynamic_cast<const Literal*>(&expr) != nullptr;
+}
+
+// Whether name, used where the generator is now, refers to a global.
+bool JavascriptGenerator::isGlobal(const std::string& name) const {
+    for (size_t i = scopeStack_.size() - 1; i > 0; --i) {
+        if (scopeStack_[i].names.contains(name)) return false;
+    }
+    return true;
+}
+
+std::string JavascriptGenerator::generateCondition(const Expr& expr) {
+    if (const auto* grouping = dynamic_cast<const Grouping*>(&expr)) {
+        return generateCondition(*grouping->expression);
+    }
+    // only the truth of the result matters, so each side can be tested alone
+    if (const auto* logical = dynamic_cast<const Logical*>(&expr)) {
+        auto left = generateCondition(*logical->left);
+        auto right = generateCondition(*logical->right);
+        return "(" + left + (logical->op.type == TokenType::AND ? " && " : " || ") + right + ")";
+    }
+    auto condition = generateExpression(expr);
+    if (isBool(expr)) {
+        return condition;
+    }
+    return "__rt.isTruthy(" + condition + ")";
+}
+
+// The test that index is in bounds for array, both simple expressions; what
+// fails it is left to the runtime helper to report.
+std::string JavascriptGenerator::inBounds(const std::string& array, const Expr& index, const std::string& rendered) {
+    if (const auto* literal = dynamic_cast<const Literal*>(&index)) {
+        const auto* number = std::get_if<double>(&literal->value);
+        if (number && *number >= 0 && std::floor(*number) == *number) {
+            return "(" + rendered + " < " + array + ".length)";
+        }
+    }
+    return "((" + rendered + " >>> 0) === " + rendered + " && " + rendered + " < " + array + ".length)";
+}
+
+std::string JavascriptGenerator::renderFunctionBody(const BlockStmt& block, const std::vector<Token>& params,
+                                                    const std::string& self, bool deep) {
     std::ostringstream body;
     auto* previous = current_;
     int previousIndent = indent_;
     size_t previousScopeDepth = scopeStack_.size();
 
+    bool previousUsesTemp = std::exchange(usesLogicalTemp_, false);
+    bool previousDeep = std::exchange(deep_, deep);
+
     current_ = &body;
     body << "{\n";
     indent_ = 1;
+    // past the recursion limit, the call goes on the heap
+    bool counted = trampolines_ && !deep;
+    if (counted) {
+        std::string args;
+        for (const auto& param : params) {
+            if (!args.empty()) args += ", ";
+            args += param.lexeme;
+        }
+        emitLine("if (__rt.recursion.depth >= __rt.recursion.limit) return __rt.runOnHeap(" + self + ", [" + args + "]);");
+        emitLine("__rt.recursion.depth++;");
+        emitLine("try {");
+        indent_ = 2;
+    }
     beginScope(false);
     for (const auto& param : params) {
         declareInCurrentScope(param.lexeme);
@@ -125,15 +624,26 @@ std::string JavascriptGenerator::renderFunctionBody(const BlockStmt& block, cons
         emitStatement(*stmt);
     }
     endScope();
+    if (counted) {
+        indent_ = 1;
+        emitLine("} finally {");
+        emitLine("  __rt.recursion.depth--;");
+        emitLine("}");
+    }
     indent_ = 0;
     body << "}";
 
     current_ = previous;
     indent_ = previousIndent;
+    deep_ = previousDeep;
     if (scopeStack_.size() != previousScopeDepth) {
         scopeStack_.resize(previousScopeDepth);
     }
-    return body.str();
+    auto text = body.str();
+    if (std::exchange(usesLogicalTemp_, previousUsesTemp)) {
+        text.insert(2, "  let __logical;\n");
+    }
+    return text;
 }
 
 std::string JavascriptGenerator::escapeString(const std::string& value) const {
@@ -156,7 +666,14 @@ std::string JavascriptGenerator::escapeString(const std::string& value) const {
                 escaped += "\\t";
                 break;
             default:
-                escaped += ch;
+                if (static_cast<unsigned char>(ch) < 0x20) {
+                    static const char digits[] = "0123456789abcdef";
+                    escaped += "\\x";
+                    escaped += digits[ch >> 4];
+                    escaped += digits[ch & 15];
+                } else {
+                    escaped += ch;
+                }
                 break;
         }
     }
@@ -192,41 +709,56 @@ void JavascriptGenerator::declareInCurrentScope(const std::string& name) {
 void JavascriptGenerator::visit(const Binary& expr) {
     auto left = generateExpression(*expr.left);
     auto right = generateExpression(*expr.right);
-    const auto line = std::to_string(expr.op.line);
+    const auto line = lineNumber(expr.op.line);
+    // proven operands need no checks, and V8 optimizes the bare operator
+    const bool numbers = isNumber(*expr.left) && isNumber(*expr.right);
+    const bool strings = types_.typeOf(*expr.left) == InferredType::STRING &&
+                         types_.typeOf(*expr.right) == InferredType::STRING;
+    auto raw = [&](const char* op) { exprResult_ = "(" + left + " " + op + " " + right + ")"; };
 
     switch (expr.op.type) {
         case TokenType::MINUS:
+            if (numbers) return raw("-");
             exprResult_ = "__rt.binaryMinus(" + left + ", " + right + ", " + line + ")";
             break;
         case TokenType::SLASH:
+            if (numbers) return raw("/");
             exprResult_ = "__rt.binaryDivide(" + left + ", " + right + ", " + line + ")";
             break;
         case TokenType::STAR:
+            if (numbers) return raw("*");
             exprResult_ = "__rt.binaryMultiply(" + left + ", " + right + ", " + line + ")";
             break;
         case TokenType::PLUS:
+            if (numbers || strings) return raw("+");
             exprResult_ = "__rt.binaryPlus(" + left + ", " + right + ", " + line + ")";
             break;
         case TokenType::PERCENT:
+            // still checked: % is only defined between integers
             exprResult_ = "__rt.binaryMod(" + left + ", " + right + ", " + line + ")";
             break;
         case TokenType::GREATER:
+            if (numbers) return raw(">");
             exprResult_ = "__rt.greaterThan(" + left + ", " + right + ", " + line + ")";
             break;
         case TokenType::GREATER_EQUAL:
+            if (numbers) return raw(">=");
             exprResult_ = "__rt.greaterEqual(" + left + ", " + right + ", " + line + ")";
             break;
         case TokenType::LESS:
+            if (numbers) return raw("<");
             exprResult_ = "__rt.lessThan(" + left + ", " + right + ", " + line + ")";
             break;
         case TokenType::LESS_EQUAL:
+            if (numbers) return raw("<=");
             exprResult_ = "__rt.lessEqual(" + left + ", " + right + ", " + line + ")";
             break;
         case TokenType::BANG_EQUAL:
-            exprResult_ = "__rt.notEquals(" + left + ", " + right + ")";
+            // equality is identity for every type
+            raw("!==");
             break;
         case TokenType::EQUAL_EQUAL:
-            exprResult_ = "__rt.equals(" + left + ", " + right + ")";
+            raw("===");
             break;
         default:
             exprResult_ = "null";
@@ -237,19 +769,47 @@ void JavascriptGenerator::visit(const Binary& expr) {
 void JavascriptGenerator::visit(const Logical& expr) {
     auto left = generateExpression(*expr.left);
     auto right = generateExpression(*expr.right);
-    if (expr.op.type == TokenType::AND) {
-        exprResult_ = "__rt.logicalAnd(() => " + left + ", () => " + right + ")";
+    const bool isAnd = expr.op.type == TokenType::AND;
+    if (isBool(*expr.left)) {
+        // JavaScript's operators agree with ours once the left side is a bool
+        exprResult_ = "(" + left + (isAnd ? " && " : " || ") + right + ")";
+        return;
+    }
+    // Nothing runs between storing the left side and reading it back, so one
+    // temporary per function serves every nested operator.
+    usesLogicalTemp_ = true;
+    auto test = "__rt.isTruthy(__logical = " + left + ")";
+    if (isAnd) {
+        exprResult_ = "(" + test + " ? " + right + " : __logical)";
     } else {
-        exprResult_ = "__rt.logicalOr(() => " + left + ", () => " + right + ")";
+        exprResult_ = "(" + test + " ? __logical : " + right + ")";
     }
 }
 
 void JavascriptGenerator::visit(const Ternary& expr) {
-    auto condition = generateExpression(*expr.condition);
+    auto condition = generateCondition(*expr.condition);
     auto thenBranch = generateExpression(*expr.thenBranch);
     auto elseBranch = generateExpression(*expr.elseBranch);
-    // JavaScript's ternary operator has the same syntax, but we need to wrap condition in isTruthy
-    exprResult_ = "__rt.isTruthy(" + condition + ") ? " + thenBranch + " : " + elseBranch;
+    exprResult_ = condition + " ? " + thenBranch + " : " + elseBranch;
+}
+
+// Under --no-loop, a call in tail position is returned for the caller to
+// make, so that a chain of them does not grow the stack.
+std::string JavascriptGenerator::generateReturnValue(const Expr& expr) {
+    if (!trampolines_) return generateExpression(expr);
+    if (const auto* grouping = dynamic_cast<const Grouping*>(&expr)) {
+        return "(" + generateReturnValue(*grouping->expression) + ")";
+    }
+    if (const auto* ternary = dynamic_cast<const Ternary*>(&expr)) {
+        auto condition = generateCondition(*ternary->condition);
+        auto thenBranch = generateReturnValue(*ternary->thenBranch);
+        auto elseBranch = generateReturnValue(*ternary->elseBranch);
+        return condition + " ? " + thenBranch + " : " + elseBranch;
+    }
+    const auto* call = dynamic_cast<const Call*>(&expr);
+    if (!call || numericLengths_.contains(call)) return generateExpression(expr);
+    auto [callee, args] = generateCall(*call);
+    return "new __rt.PendingCall(" + callee + ", [" + args + "])";
 }
 
 void JavascriptGenerator::visit(const Grouping& expr) {
@@ -258,8 +818,18 @@ void JavascriptGenerator::visit(const Grouping& expr) {
 
 void JavascriptGenerator::visit(const Literal& expr) {
     if (std::holds_alternative<double>(expr.value)) {
+        double number = std::get<double>(expr.value);
+        // folded constants can be non-finite, which have no literal syntax
+        if (std::isnan(number)) {
+            exprResult_ = "NaN";
+            return;
+        }
+        if (std::isinf(number)) {
+            exprResult_ = number > 0 ? "Infinity" : "(-Infinity)";
+            return;
+        }
         std::ostringstream oss;
-        oss << std::setprecision(17) << std::get<double>(expr.value);
+        oss << std::setprecision(17) << number;
         exprResult_ = oss.str();
         return;
     }
@@ -279,21 +849,25 @@ void JavascriptGenerator::visit(const Literal& expr) {
 }
 
 void JavascriptGenerator::visit(const Unary& expr) {
-    auto right = generateExpression(*expr.right);
-    const auto line = std::to_string(expr.op.line);
-    if (expr.op.type == TokenType::MINUS) {
-        exprResult_ = "__rt.unaryMinus(" + right + ", " + line + ")";
-    } else {
-        exprResult_ = "__rt.unaryNot(" + right + ")";
+    if (expr.op.type == TokenType::BANG) {
+        exprResult_ = "(!" + generateCondition(*expr.right) + ")";
+        return;
     }
+    auto right = generateExpression(*expr.right);
+    const auto line = lineNumber(expr.op.line);
+    exprResult_ = isNumber(*expr.right) ? "(-" + right + ")" : "__rt.unaryMinus(" + right + ", " + line + ")";
 }
 
 void JavascriptGenerator::visit(const Postfix& expr) {
     const std::string delta = expr.op.type == TokenType::PLUS_PLUS ? "1" : "-1";
-    const auto line = std::to_string(expr.op.line);
+    const auto line = lineNumber(expr.op.line);
 
     if (const auto* variable = dynamic_cast<const Variable*>(expr.operand.get())) {
         const auto& name = variable->name.lexeme;
+        if (types_.variableType(expr) == InferredType::NUMBER) {
+            exprResult_ = "(" + name + (delta == "1" ? "++" : "--") + ")";
+            return;
+        }
         exprResult_ = "__rt.postfixAdjustVariable(() => " + name +
                       ", value => (" + name + " = value), " + line + ", " + delta + ")";
         return;
@@ -303,7 +877,7 @@ void JavascriptGenerator::visit(const Postfix& expr) {
         auto object = generateExpression(*subscript->object);
         auto index = generateExpression(*subscript->index);
         exprResult_ = "__rt.postfixAdjustIndex(" + object + ", " + index + ", " +
-                      std::to_string(subscript->bracket.line) + ", " + delta + ")";
+                      lineNumber(subscript->bracket.line) + ", " + delta + ")";
         return;
     }
 
@@ -311,7 +885,7 @@ void JavascriptGenerator::visit(const Postfix& expr) {
         auto object = generateExpression(*property->object);
         auto key = escapeString(property->name.lexeme);
         exprResult_ = "__rt.postfixAdjustIndex(" + object + ", " + key + ", " +
-                      std::to_string(property->name.line) + ", " + delta + ")";
+                      lineNumber(property->name.line) + ", " + delta + ")";
         return;
     }
 
@@ -331,10 +905,19 @@ void JavascriptGenerator::visit(const SubscriptAssignment& expr) {
     auto object = generateExpression(*expr.object);
     auto index = generateExpression(*expr.index);
     auto value = generateExpression(*expr.value);
-    exprResult_ = "__rt.setIndex(" + object + ", " + index + ", " + value + ", " + std::to_string(expr.bracket.line) + ")";
+    // the bounds are checked before value is evaluated, so value must not be
+    // able to shrink the array or rebind what names it
+    if (isArray(*expr.object) && isNumber(*expr.index) && isSimple(*expr.object) && isSimple(*expr.index) &&
+        !hasSideEffects(*expr.value)) {
+        exprResult_ = "(" + inBounds(object, *expr.index, index) + " ? (" + object + "[" + index + "] = " + value +
+                      ") : __rt.setIndex(" + object + ", " + index + ", " + value + ", " +
+                      lineNumber(expr.bracket.line) + "))";
+        return;
+    }
+    exprResult_ = "__rt.setIndex(" + object + ", " + index + ", " + value + ", " + lineNumber(expr.bracket.line) + ")";
 }
 
-void JavascriptGenerator::visit(const Call& expr) {
+std::pair<std::string, std::string> JavascriptGenerator::generateCall(const Call& expr) {
     auto callee = generateExpression(*expr.callee);
     std::vector<std::string> args;
     args.reserve(expr.arguments.size());
@@ -346,7 +929,32 @@ void JavascriptGenerator::visit(const Call& expr) {
         if (i != 0) joined += ", ";
         joined += args[i];
     }
-    exprResult_ = "__rt.callFunction(" + callee + ", [" + joined + "], " + std::to_string(expr.paren.line) + ")";
+    if (const auto* variable = dynamic_cast<const Variable*>(expr.callee.get())) {
+        auto direct = directFunctions_.find(variable->name.lexeme);
+        if (direct != directFunctions_.end() && direct->second == args.size() && isGlobal(variable->name.lexeme)) {
+            return {callee, joined};
+        }
+    }
+    // the callee is checked before the arguments are evaluated, but any
+    // error is raised by the function it returns, after them
+    return {"__rt.checkCallee(" + callee + ", " + std::to_string(args.size()) + ", " + lineNumber(expr.paren.line) + ")",
+            joined};
+}
+
+void JavascriptGenerator::visit(const Call& expr) {
+    if (numericLengths_.contains(&expr)) {
+        exprResult_ = generateExpression(*expr.arguments[0]) + ".length";
+        return;
+    }
+    auto [callee, args] = generateCall(expr);
+    if (!trampolines_) {
+        exprResult_ = callee + "(" + args + ")";
+    } else if (deep_) {
+        exprResult_ = "(yield new __rt.PendingCall(" + callee + ", [" + args + "]))";
+    } else {
+        // the function may return a call it made in tail position
+        exprResult_ = "__rt.settle(" + callee + "(" + args + "))";
+    }
 }
 
 void JavascriptGenerator::visit(const ArrayLiteral& expr) {
@@ -360,6 +968,10 @@ void JavascriptGenerator::visit(const ArrayLiteral& expr) {
         if (i != 0) joined += ", ";
         joined += elements[i];
     }
+    if (numericLiterals_.contains(&expr)) {
+        exprResult_ = "new Float64Array([" + joined + "])";
+        return;
+    }
     exprResult_ = "__rt.makeArray([" + joined + "])";
 }
 
@@ -382,12 +994,17 @@ void JavascriptGenerator::visit(const MapLiteral& expr) {
 void JavascriptGenerator::visit(const Subscript& expr) {
     auto object = generateExpression(*expr.object);
     auto index = generateExpression(*expr.index);
-    exprResult_ = "__rt.getIndex(" + object + ", " + index + ", " + std::to_string(expr.bracket.line) + ")";
+    if (isArray(*expr.object) && isNumber(*expr.index) && isSimple(*expr.object) && isSimple(*expr.index)) {
+        exprResult_ = "(" + inBounds(object, *expr.index, index) + " ? " + object + "[" + index +
+                      "] : __rt.getIndex(" + object + ", " + index + ", " + lineNumber(expr.bracket.line) + "))";
+        return;
+    }
+    exprResult_ = "__rt.getIndex(" + object + ", " + index + ", " + lineNumber(expr.bracket.line) + ")";
 }
 
 void JavascriptGenerator::visit(const PropertyAccess& expr) {
     auto object = generateExpression(*expr.object);
-    exprResult_ = "__rt.getProperty(" + object + ", " + escapeString(expr.name.lexeme) + ", " + std::to_string(expr.name.line) + ")";
+    exprResult_ = "__rt.getProperty(" + object + ", " + escapeString(expr.name.lexeme) + ", " + lineNumber(expr.name.line) + ")";
 }
 
 void JavascriptGenerator::visit(const FunctionExpr& expr) {
@@ -396,8 +1013,16 @@ void JavascriptGenerator::visit(const FunctionExpr& expr) {
         if (i != 0) params += ", ";
         params += expr.params[i].lexeme;
     }
-    auto body = renderFunctionBody(*expr.body, expr.params);
-    exprResult_ = "__rt.makeAnonFunction(function(" + params + ") " + body + ", " + std::to_string(expr.params.size()) + ")";
+    auto arity = std::to_string(expr.params.size());
+    if (!trampolines_) {
+        auto body = renderFunctionBody(*expr.body, expr.params);
+        exprResult_ = "__rt.makeAnonFunction(function(" + params + ") " + body + ", " + arity + ")";
+        return;
+    }
+    auto body = renderFunctionBody(*expr.body, expr.params, "__fn");
+    auto deep = renderFunctionBody(*expr.body, expr.params, {}, true);
+    exprResult_ = "__rt.makeAnonFunction(function __fn(" + params + ") " + body + ", " + arity + ", function* (" + params +
+                  ") " + deep + ")";
 }
 
 void JavascriptGenerator::visit(const ExpressionStmt& stmt) {
@@ -435,7 +1060,7 @@ void JavascriptGenerator::visit(const BlockStmt& stmt) {
 }
 
 void JavascriptGenerator::visit(const IfStmt& stmt) {
-    auto condition = "__rt.isTruthy(" + generateExpression(*stmt.condition) + ")";
+    auto condition = generateCondition(*stmt.condition);
     emitLine("if (" + condition + ") {");
     emitStatementBody(*stmt.thenBlock);
     emitLine("}");
@@ -447,7 +1072,7 @@ void JavascriptGenerator::visit(const IfStmt& stmt) {
 }
 
 void JavascriptGenerator::visit(const WhileStmt& stmt) {
-    auto condition = "__rt.isTruthy(" + generateExpression(*stmt.condition) + ")";
+    auto condition = generateCondition(*stmt.condition);
     if (stmt.increment) {
         auto increment = generateExpression(*stmt.increment);
         emitLine("for (; " + condition + "; " + increment + ") {");
@@ -466,10 +1091,14 @@ void JavascriptGenerator::visit(const FunctionStmt& stmt) {
         if (i != 0) params += ", ";
         params += stmt.params[i].lexeme;
     }
-    auto body = renderFunctionBody(*stmt.body, stmt.params);
+    auto body = renderFunctionBody(*stmt.body, stmt.params, stmt.name.lexeme);
+    std::string deep;
+    if (trampolines_) {
+        deep = ", function* (" + params + ") " + renderFunctionBody(*stmt.body, stmt.params, {}, true);
+    }
     bool redeclaration = isRedeclarationOfCurrentScope(stmt.name.lexeme);
     declareInCurrentScope(stmt.name.lexeme);
-    std::string rhs = "__rt.makeFunction(" + escapeString(stmt.name.lexeme) + ", function " + stmt.name.lexeme + "(" + params + ") " + body + ", " + std::to_string(stmt.params.size()) + ")";
+    std::string rhs = "__rt.makeFunction(" + escapeString(stmt.name.lexeme) + ", function " + stmt.name.lexeme + "(" + params + ") " + body + ", " + std::to_string(stmt.params.size()) + deep + ")";
     if (redeclaration) {
         emitLine(stmt.name.lexeme + " = " + rhs + ";");
     } else {
@@ -479,7 +1108,7 @@ void JavascriptGenerator::visit(const FunctionStmt& stmt) {
 
 void JavascriptGenerator::visit(const ReturnStmt& stmt) {
     if (stmt.value) {
-        emitLine("return " + generateExpression(*stmt.value) + ";");
+        emitLine("return " + generateReturnValue(*stmt.value) + ";");
     } else {
         emitLine("return null;");
     }
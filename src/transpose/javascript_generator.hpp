@@ -1,20 +1,73 @@
 #pragma once
 
+#include <set>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include "expr.hpp"
 #include "statement.hpp"
+#include "type_inference.hpp"
 
 namespace transpose {
 
+// Translates a resolved program into JavaScript running against the runtime
+// prelude. Operations on values whose types TypeInference proves are emitted
+// as bare JavaScript operators; the rest call the prelude's checked helpers.
+// Under the parser's `noLoop`, where recursion is the only way to repeat,
+// calls in tail position are returned for the caller to make, and every
+// function also gets a generator version to run on the heap once calls nest
+// too deep for the JavaScript stack.
 class JavascriptGenerator : public ExprVisitor, public StmtVisitor {
 public:
-    JavascriptGenerator();
-    std::string generate(const std::vector<std::unique_ptr<Stmt>>& statements);
-    std::string generateUserCodeOnly(const std::vector<std::unique_ptr<Stmt>>& statements, size_t skipCoreLibStatements);
+    // JavaScript for statements every program starts with (the core
+    // library), generated once and spliced in ahead of each program's own.
+    struct Fragment {
+        std::string code;
+        std::vector<std::string> globals; // what it declares at the top level
+        bool usesLogicalTemp = false;
+    };
+
+    // The JavaScript for one chunk of a program's top-level statements,
+    // which can be moved to other lines of the program without generating
+    // it again: lines says where each line number in it is. It is indented
+    // as by generateUserCodeOnly; a program indents each of its
+    // statements' lines, which start at the offsets in statementLines.
+    struct Piece {
+        std::string code;
+        std::vector<std::pair<size_t, int>> lines; // offset in code, line number
+        std::vector<size_t> statementLines;
+        bool usesLogicalTemp = false;
+    };
+    using Statements = std::vector<std::unique_ptr<Stmt>>;
+
+    explicit JavascriptGenerator(const TypeInference& types);
+    std::string generate(const Statements& statements, const Fragment* library = nullptr);
+    Fragment generateFragment(const Statements& statements);
+    std::string generateUserCodeOnly(const Statements& statements, const Fragment* library);
+    // Pieces for the chunks marked in regenerate, in a program cut into
+    // chunks; types need only cover those. Every chunk naming an array
+    // that one of them names must be among them, as the arrays that can be
+    // Float64Arrays are found from all their uses.
+    std::vector<Piece> generatePieces(const std::vector<const Statements*>& chunks, const std::vector<bool>& regenerate,
+                                      const Fragment* library,
+                                      const std::unordered_map<std::string, size_t>& directFunctions);
+
+    // The global functions that are always the same function, by arity, so
+    // that calls to them need no checks: declared once at the top level and
+    // never assigned. declarations lists the program's top-level `var`s
+    // (with arity -1) and `fun`s.
+    static std::unordered_map<std::string, size_t> directFunctions(
+        const std::vector<std::pair<std::string, int>>& declarations, const std::set<std::string>& assigned,
+        const Fragment* library);
+    // The complete program for the JavaScript of its top-level statements
+    // (and the library's), indented a level.
+    static std::string program(const std::string& statements, bool usesLogicalTemp);
+    // The user's statements alone, as generateUserCodeOnly returns them.
+    static std::string userCode(const std::string& statements, bool usesLogicalTemp);
 
 private:
     std::ostringstream builder_;
@@ -26,12 +79,36 @@ private:
         std::unordered_set<std::string> names;
     };
     std::vector<Scope> scopeStack_;
+    const TypeInference& types_;
+    std::unordered_set<const Expr*> numericArrays_;   // variables holding a Float64Array
+    std::unordered_set<const Expr*> numericLiterals_; // array literals made Float64Arrays
+    std::unordered_set<const Expr*> numericLengths_;  // len() of a Float64Array
+    std::unordered_map<std::string, size_t> directFunctions_; // globals never rebound, by arity
+    bool usesLogicalTemp_ = false; // the function being rendered needs __logical
+    const Fragment* library_ = nullptr;
+    bool markLines_ = false; // line numbers and statements are marked for a Piece
+    bool trampolines_ = false; // --no-loop: tail calls are returned, deep calls go on the heap
+    bool deep_ = false;        // rendering a function's generator version, for runOnHeap
 
+    void reset(const Fragment* library);
     void emitLine(const std::string& line);
     void emitStatement(const Stmt& stmt);
     void emitStatementBody(const Stmt& stmt);
+    void analyze(const Statements& statements);
+    std::string lineNumber(int line) const;
     std::string generateExpression(const Expr& expr);
-    std::string renderFunctionBody(const BlockStmt& block, const std::vector<Token>& params);
+    std::string generateCondition(const Expr& expr);
+    bool isNumber(const Expr& expr) const;
+    bool isBool(const Expr& expr) const;
+    bool isArray(const Expr& expr) const;
+    bool isSimple(const Expr& expr) const;
+    bool isGlobal(const std::string& name) const;
+    std::string inBounds(const std::string& array, const Expr& index, const std::string& rendered);
+    std::pair<std::string, std::string> generateCall(const Call& expr); // callee, arguments
+    std::string generateReturnValue(const Expr& expr);
+    // self names the function within its body
+    std::string renderFunctionBody(const BlockStmt& block, const std::vector<Token>& params,
+                                   const std::string& self = {}, bool deep = false);
     std::string escapeString(const std::string& value) const;
     void beginScope(bool allowRedeclare);
     void endScope();
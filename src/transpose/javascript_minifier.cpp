@@ -0,0 +1,289 @@
+#include "transpose/javascript_minifier.hpp"
+
+#include <array>
+#include <cctype>
+#include <map>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+namespace transpose {
+
+namespace {
+
+enum class Kind { WORD, NUMBER, STRING, TEMPLATE, REGEX, PUNCTUATOR };
+
+struct JsToken {
+    Kind kind;
+    std::string text;
+    bool lineBreakBefore;
+};
+
+bool isWordChar(char ch) {
+    return std::isalnum(static_cast<unsigned char>(ch)) || ch == '_' || ch == '$';
+}
+
+// Longest first, so that the first match is the whole operator.
+constexpr std::array<std::string_view, 33> punctuators = {
+    ">>>=", "...", "===", "!==", "**=", "<<=", ">>=", ">>>", "&&=", "||=", "?\?=", "=>", "==", "!=", "<=", ">=", "&&",
+    "||",   "??",  "++",  "--",  "+=",  "-=",  "*=",  "/=",  "%=",  "&=",  "|=",  "^=", "**", "<<", ">>", "?."};
+
+class Lexer {
+public:
+    explicit Lexer(const std::string& source) : source_(source) {}
+
+    std::vector<JsToken> lex() {
+        while (true) {
+            skipSpace();
+            if (pos_ >= source_.size()) break;
+            char ch = source_[pos_];
+            if (ch == '`') {
+                add(Kind::TEMPLATE, templatePart(pos_ + 1));
+            } else if (ch == '}' && !templates_.empty() && templates_.back() == 0) {
+                templates_.pop_back();
+                add(Kind::TEMPLATE, templatePart(pos_ + 1));
+            } else if (ch == '\'' || ch == '"') {
+                add(Kind::STRING, quoted(ch));
+            } else if (std::isdigit(static_cast<unsigned char>(ch)) ||
+                       (ch == '.' && pos_ + 1 < source_.size() && std::isdigit(static_cast<unsigned char>(source_[pos_ + 1])))) {
+                add(Kind::NUMBER, number());
+            } else if (isWordChar(ch)) {
+                size_t start = pos_;
+                while (pos_ < source_.size() && isWordChar(source_[pos_])) ++pos_;
+                add(Kind::WORD, source_.substr(start, pos_ - start));
+            } else if (ch == '/' && regexAllowed()) {
+                add(Kind::REGEX, regex());
+            } else {
+                punctuator();
+            }
+        }
+        return std::move(tokens_);
+    }
+
+private:
+    const std::string& source_;
+    size_t pos_ = 0;
+    bool lineBreak_ = false;
+    std::vector<JsToken> tokens_;
+    std::vector<int> templates_; // braces open in each enclosing ${ }
+
+    void add(Kind kind, std::string text) {
+        tokens_.push_back({kind, std::move(text), lineBreak_});
+        lineBreak_ = false;
+    }
+
+    void skipSpace() {
+        while (pos_ < source_.size()) {
+            char ch = source_[pos_];
+            if (ch == '\n') {
+                lineBreak_ = true;
+                ++pos_;
+            } else if (std::isspace(static_cast<unsigned char>(ch))) {
+                ++pos_;
+            } else if (source_.compare(pos_, 2, "//") == 0) {
+                while (pos_ < source_.size() && source_[pos_] != '\n') ++pos_;
+            } else if (source_.compare(pos_, 2, "/*") == 0) {
+                size_t end = source_.find("*/", pos_ + 2);
+                if (end == std::string::npos) throw std::runtime_error("unterminated comment in JavaScript");
+                if (source_.find('\n', pos_) < end) lineBreak_ = true;
+                pos_ = end + 2;
+            } else {
+                break;
+            }
+        }
+    }
+
+    // From the opening quote through the closing one.
+    std::string quoted(char quote) {
+        size_t start = pos_++;
+        while (pos_ < source_.size() && source_[pos_] != quote) {
+            if (source_[pos_] == '\\') ++pos_;
+            ++pos_;
+        }
+        if (pos_ >= source_.size()) throw std::runtime_error("unterminated string in JavaScript");
+        ++pos_;
+        return source_.substr(start, pos_ - start);
+    }
+
+    // Template text starting at from, through its closing backquote or the
+    // `${` that interrupts it.
+    std::string templatePart(size_t from) {
+        size_t start = pos_;
+        pos_ = from;
+        while (pos_ < source_.size()) {
+            char ch = source_[pos_];
+            if (ch == '\\') {
+                pos_ += 2;
+            } else if (ch == '`') {
+                ++pos_;
+                return source_.substr(start, pos_ - start);
+            } else if (ch == '$' && pos_ + 1 < source_.size() && source_[pos_ + 1] == '{') {
+                pos_ += 2;
+                templates_.push_back(0);
+                return source_.substr(start, pos_ - start);
+            } else {
+                ++pos_;
+            }
+        }
+        throw std::runtime_error("unterminated template in JavaScript");
+    }
+
+    std::string number() {
+        size_t start = pos_;
+        while (pos_ < source_.size()) {
+            char ch = source_[pos_];
+            char previous = source_[pos_ - 1];
+            bool hex = source_.compare(start, 2, "0x") == 0 || source_.compare(start, 2, "0X") == 0;
+            bool exponentSign = (ch == '+' || ch == '-') && (previous == 'e' || previous == 'E') && !hex;
+            if (!isWordChar(ch) && ch != '.' && !exponentSign) break;
+            ++pos_;
+        }
+        return source_.substr(start, pos_ - start);
+    }
+
+    // A slash starts a regular expression where an operand is expected.
+    bool regexAllowed() const {
+        if (tokens_.empty()) return true;
+        const auto& previous = tokens_.back();
+        switch (previous.kind) {
+            case Kind::PUNCTUATOR:
+                return previous.text != ")" && previous.text != "]" && previous.text != "}";
+            case Kind::TEMPLATE:
+                return previous.text.ends_with("${");
+            case Kind::WORD:
+                for (std::string_view keyword : {"return", "typeof", "instanceof", "in", "of", "new", "delete", "void",
+                                                 "throw", "case", "do", "else"}) {
+                    if (previous.text == keyword) return true;
+                }
+                return false;
+            default:
+                return false;
+        }
+    }
+
+    std::string regex() {
+        size_t start = pos_++;
+        bool inClass = false;
+        while (pos_ < source_.size() && (inClass || source_[pos_] != '/')) {
+            char ch = source_[pos_];
+            if (ch == '\\') ++pos_;
+            else if (ch == '[') inClass = true;
+            else if (ch == ']') inClass = false;
+            else if (ch == '\n') throw std::runtime_error("unterminated regular expression in JavaScript");
+            ++pos_;
+        }
+        ++pos_;
+        while (pos_ < source_.size() && isWordChar(source_[pos_])) ++pos_;
+        return source_.substr(start, pos_ - start);
+    }
+
+    void punctuator() {
+        char ch = source_[pos_];
+        if (!templates_.empty()) {
+            if (ch == '{') ++templates_.back();
+            if (ch == '}') --templates_.back();
+        }
+        for (auto candidate : punctuators) {
+            if (source_.compare(pos_, candidate.size(), candidate) != 0) continue;
+            // `a ?.5 : b` is a conditional
+            if (candidate == "?." && pos_ + 2 < source_.size() && std::isdigit(static_cast<unsigned char>(source_[pos_ + 2]))) {
+                continue;
+            }
+            pos_ += candidate.size();
+            add(Kind::PUNCTUATOR, std::string(candidate));
+            return;
+        }
+        ++pos_;
+        add(Kind::PUNCTUATOR, std::string(1, ch));
+    }
+};
+
+// Whether the two tokens would run together into something else.
+bool needsSpace(const JsToken& previous, const JsToken& next) {
+    char last = previous.text.back();
+    char first = next.text.front();
+    if (isWordChar(last) && isWordChar(first)) return true;
+    if ((last == '+' || last == '-') && first == last) return true;
+    if (last == '/' && (first == '/' || first == '*')) return true;
+    return previous.kind == Kind::NUMBER && first == '.';
+}
+
+// A line break can go where neither side could end a statement, so that
+// automatic semicolon insertion never depended on it.
+bool needsLineBreak(const JsToken& previous, const JsToken& next) {
+    if (previous.kind == Kind::PUNCTUATOR && previous.text != "++" && previous.text != "--" &&
+        previous.text != ")" && previous.text != "]" && previous.text != "}") {
+        return false;
+    }
+    if (previous.kind == Kind::TEMPLATE && previous.text.ends_with("${")) return false;
+    if (next.kind == Kind::PUNCTUATOR) {
+        for (std::string_view text : {"}", ")", "]", ",", ";", ".", ":", "?", "=", "==", "===", "!=", "!==", "&&", "||",
+                                      "=>", "*", "<", ">", "<=", ">=", "?."}) {
+            if (next.text == text) return false;
+        }
+    }
+    return !(next.kind == Kind::TEMPLATE && next.text.front() == '}');
+}
+
+// $a, $b, ... $Z, $aa, ...
+std::string shortName(size_t index) {
+    static const char letters[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    std::string name;
+    do {
+        name.insert(name.begin(), letters[index % 52]);
+        index /= 52;
+    } while (index-- > 0);
+    return "$" + name;
+}
+
+}  // namespace
+
+std::string minifyJavascript(const std::string& code, const std::set<std::string>& renames, const std::string& object) {
+    auto tokens = Lexer(code).lex();
+
+    bool usesDollar = false;
+    for (const auto& token : tokens) {
+        if (token.kind == Kind::WORD && token.text.find('$') != std::string::npos) usesDollar = true;
+    }
+    std::map<std::string, std::string> names;
+    if (!usesDollar) {
+        names[object] = "$";
+        for (size_t i = 0; i < tokens.size(); ++i) {
+            const auto& token = tokens[i];
+            if (token.kind != Kind::WORD || !renames.contains(token.text) || names.contains(token.text)) continue;
+            names[token.text] = shortName(names.size() - 1);
+        }
+    }
+
+    std::string out;
+    out.reserve(code.size() / 2);
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        auto token = tokens[i];
+        auto renamed = names.find(token.text);
+        if (token.kind == Kind::WORD && renamed != names.end()) {
+            bool property = i > 0 && (tokens[i - 1].text == "." || tokens[i - 1].text == "?.");
+            bool key = i > 0 && i + 1 < tokens.size() && tokens[i + 1].text == ":" &&
+                       (tokens[i - 1].text == "{" || tokens[i - 1].text == ",");
+            if (property) {
+                // only the runtime object's own properties
+                if (i > 1 && tokens[i - 2].text == object) token.text = renamed->second;
+            } else if (!key) {
+                token.text = renamed->second;
+            }
+        }
+        if (i > 0) {
+            const auto& previous = tokens[i - 1];
+            JsToken before{previous.kind, out.empty() ? previous.text : std::string(1, out.back()), false};
+            if (token.lineBreakBefore && needsLineBreak(previous, token)) {
+                out += '\n';
+            } else if (needsSpace(before, token)) {
+                out += ' ';
+            }
+        }
+        out += token.text;
+    }
+    out += '\n';
+    return out;
+}
+
+}  // namespace transpose
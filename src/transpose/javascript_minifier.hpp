@@ -0,0 +1,15 @@
+#pragma once
+
+#include <set>
+#include <string>
+
+namespace transpose {
+
+// Shrinks JavaScript without changing what it does: comments, indentation and
+// the spaces between tokens go, and a line break stays wherever a statement
+// could be relying on it. Each name in renames, used bare or as a property of
+// object, becomes a short name starting with `$`, as does object itself; the
+// names are left alone if the code already uses `$`.
+std::string minifyJavascript(const std::string& code, const std::set<std::string>& renames, const std::string& object);
+
+}  // namespace transpose
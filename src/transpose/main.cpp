@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
 #include <filesystem>
 #include <fstream>
@@ -7,6 +9,7 @@
 #include <sstream>
 #include <string>
 #include <system_error>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -14,13 +17,20 @@
 #include <sys/wait.h>
 #endif
 
+#include "transpose/batch.hpp"
+#include "transpose/cpp_transpiler.hpp"
 #include "transpose/transpiler.hpp"
+#include "transpose/wasm_transpiler.hpp"
 #include "version.hpp"
 
 #ifndef TRANSPOSE_NODE_COMMAND
 #define TRANSPOSE_NODE_COMMAND "node"
 #endif
 
+#ifndef TRANSPOSE_CXX_COMMAND
+#define TRANSPOSE_CXX_COMMAND "c++"
+#endif
+
 bool noLoop = false;
 
 namespace {
@@ -32,6 +42,19 @@ void printUsage() {
     std::cout << "  -v, --version    Show version information" << std::endl;
     std::cout << "  -n, --no-loop    Disable loop constructs (forces recursion)" << std::endl;
     std::cout << "      --emit-js    Print generated JavaScript and exit" << std::endl;
+    std::cout << "      --minify     Minify the generated JavaScript" << std::endl;
+    std::cout << "      --emit-ir    Print the optimized SSA IR and exit" << std::endl;
+    std::cout << "      --emit-cpp   Print the generated C++ program and exit" << std::endl;
+    std::cout << "      --build      Compile the generated C++ into an executable and exit" << std::endl;
+    std::cout << "      --wasm       Run the script as WebAssembly instead of JavaScript" << std::endl;
+    std::cout << "      --emit-wasm  Write the WebAssembly module and exit" << std::endl;
+    std::cout << "  -o FILE          Output of --build or --emit-wasm (default: the script's name)" << std::endl;
+    std::cout << "      --serve      Transpile programs read from stdin one after another, reusing" << std::endl;
+    std::cout << "                   what did not change since the one before" << std::endl;
+    std::cout << "      --batch FILE Run the scripts FILE lists (each optionally followed by a file for" << std::endl;
+    std::cout << "                   its stdin) on a pool of Node processes, reporting each one's" << std::endl;
+    std::cout << "                   exit status, stdout and stderr in order" << std::endl;
+    std::cout << "  -j N             Number of Node processes for --batch (default: one per core)" << std::endl;
 }
 
 void printVersion() {
@@ -41,18 +64,18 @@ void printVersion() {
     std::cout << "Built: " << BUILD_DATE << std::endl;
 }
 
-std::filesystem::path makeTemporaryScriptPath() {
+std::filesystem::path makeTemporaryScriptPath(const std::string& extension = ".cjs") {
     auto dir = std::filesystem::temp_directory_path();
     std::random_device rd;
     std::mt19937_64 gen(rd());
     std::uniform_int_distribution<long long> dist;
     for (int attempt = 0; attempt < 8; ++attempt) {
-        auto candidate = dir / ("rhythm-transpose-" + std::to_string(dist(gen)) + ".cjs");
+        auto candidate = dir / ("rhythm-transpose-" + std::to_string(dist(gen)) + extension);
         if (!std::filesystem::exists(candidate)) {
             return candidate;
         }
     }
-    return dir / "rhythm-transpose.cjs";
+    return dir / ("rhythm-transpose" + extension);
 }
 
 std::string quoteArgument(const std::string& argument) {
@@ -117,8 +140,77 @@ bool ensureNodeAvailable() {
     return available;
 }
 
-int executeSource(const std::string& source, bool emitJs) {
-    auto js = transpose::transpileToJavascript(source);
+int exitCodeOf(int status) {
+#ifndef _WIN32
+    if (WIFEXITED(status)) {
+        return WEXITSTATUS(status);
+    }
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return 1;
+#else
+    return status;
+#endif
+}
+
+// Compiles the C++ program for source with the compiler transpose was built
+// with.
+int buildExecutable(const std::string& source, const std::string& output) {
+    auto cpp = transpose::transpileToCpp(source);
+    auto tempPath = makeTemporaryScriptPath(".cpp");
+
+    {
+        std::ofstream out(tempPath);
+        if (!out.is_open()) {
+            throw std::runtime_error("Unable to create temporary file for C++ output");
+        }
+        out << cpp;
+    }
+
+    std::string command = quoteArgument(TRANSPOSE_CXX_COMMAND);
+    command += " -std=c++20 -O2";
+#ifndef _WIN32
+    command += " -pthread";
+#endif
+    command += " -o ";
+    command += quoteArgument(output);
+    command += ' ';
+    command += quoteArgument(tempPath.string());
+    int status = std::system(command.c_str());
+
+    std::error_code ec;
+    std::filesystem::remove(tempPath, ec);
+
+    if (status == -1) {
+        throw std::runtime_error("Failed to invoke the C++ compiler");
+    }
+    return exitCodeOf(status);
+}
+
+// Writes the WebAssembly module for source. It imports the JavaScript
+// runtime, so on its own it is for inspection; --wasm runs it.
+int writeWasm(const std::string& source, const std::string& output) {
+    std::ofstream out(output, std::ios::binary);
+    if (!out.is_open()) {
+        throw std::runtime_error("Unable to create " + output);
+    }
+    out << transpose::transpileToWasm(source);
+    return 0;
+}
+
+int executeSource(const std::string& source, bool emitJs, bool emitIr, bool emitCpp, bool wasm, bool minify) {
+    if (emitIr) {
+        std::cout << transpose::transpileToIr(source);
+        return 0;
+    }
+
+    if (emitCpp) {
+        std::cout << transpose::transpileToCpp(source);
+        return 0;
+    }
+
+    auto js = wasm ? transpose::transpileToWasmJavascript(source) : transpose::transpileToJavascript(source, minify);
 
     if (emitJs) {
         std::cout << js;
@@ -143,7 +235,6 @@ int executeSource(const std::string& source, bool emitJs) {
         out << js;
     }
 
-    int exitCode = 0;
     std::string command = buildNodeCommand(tempPath);
     int status = std::system(command.c_str());
 
@@ -152,17 +243,7 @@ int executeSource(const std::string& source, bool emitJs) {
         throw std::runtime_error("Failed to invoke Node.js runtime");
     }
 
-#ifndef _WIN32
-    if (WIFEXITED(status)) {
-        exitCode = WEXITSTATUS(status);
-    } else if (WIFSIGNALED(status)) {
-        exitCode = 128 + WTERMSIG(status);
-    } else {
-        exitCode = 1;
-    }
-#else
-    exitCode = status;
-#endif
+    int exitCode = exitCodeOf(status);
 
     std::error_code ec;
     std::filesystem::remove(tempPath, ec);
@@ -170,10 +251,54 @@ int executeSource(const std::string& source, bool emitJs) {
     return exitCode;
 }
 
+// Reads programs from stdin, each as its length in bytes on a line followed
+// by its text, and replies to each with `ok <length> <microseconds>` or
+// `error <length>` on a line followed by the JavaScript or the message.
+int serve() {
+    transpose::IncrementalTranspiler session;
+    std::string header;
+    while (std::getline(std::cin, header)) {
+        if (header.empty()) continue;
+        std::string source(std::stoul(header), '\0');
+        if (!std::cin.read(source.data(), static_cast<std::streamsize>(source.size()))) {
+            throw std::runtime_error("Program ended before its stated length");
+        }
+        // the scanner reports to stdout, which carries the replies here
+        std::ostringstream diagnostics;
+        auto* replies = std::cout.rdbuf(diagnostics.rdbuf());
+        std::string reply;
+        try {
+            auto start = std::chrono::steady_clock::now();
+            auto js = session.transpile(source);
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            reply = "ok " + std::to_string(js.size()) + ' ' +
+                    std::to_string(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()) + '\n' +
+                    js;
+        } catch (const std::exception& ex) {
+            std::string message = ex.what();
+            reply = "error " + std::to_string(message.size()) + '\n' + message;
+        }
+        std::cout.rdbuf(replies);
+        std::cerr << diagnostics.str();
+        std::cout << reply << std::flush;
+    }
+    return 0;
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
     bool emitJs = false;
+    bool emitIr = false;
+    bool emitCpp = false;
+    bool build = false;
+    bool wasm = false;
+    bool emitWasm = false;
+    bool serveMode = false;
+    bool minify = false;
+    std::string manifest;
+    unsigned workers = std::max(1u, std::thread::hardware_concurrency());
+    std::string output;
     std::string scriptFile;
 
     for (int i = 1; i < argc; ++i) {
@@ -194,6 +319,61 @@ int main(int argc, char** argv) {
             emitJs = true;
             continue;
         }
+        if (arg == "--minify") {
+            minify = true;
+            continue;
+        }
+        if (arg == "--emit-ir") {
+            emitIr = true;
+            continue;
+        }
+        if (arg == "--emit-cpp") {
+            emitCpp = true;
+            continue;
+        }
+        if (arg == "--build") {
+            build = true;
+            continue;
+        }
+        if (arg == "--wasm") {
+            wasm = true;
+            continue;
+        }
+        if (arg == "--emit-wasm") {
+            emitWasm = true;
+            continue;
+        }
+        if (arg == "--serve") {
+            serveMode = true;
+            continue;
+        }
+        if (arg == "--batch" || arg == "-j") {
+            if (i + 1 >= argc) {
+                std::cerr << arg << " requires an argument." << std::endl;
+                printUsage();
+                return 1;
+            }
+            std::string value = argv[++i];
+            if (arg == "--batch") {
+                manifest = std::move(value);
+            } else if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos ||
+                       std::stoul(value) == 0) {
+                std::cerr << "-j requires a positive number." << std::endl;
+                return 1;
+            } else {
+                workers = static_cast<unsigned>(std::stoul(value));
+            }
+            continue;
+        }
+        if (arg == "-o") {
+            if (i + 1 >= argc) {
+                std::cerr << "-o requires a file name." << std::endl;
+                printUsage();
+                return 1;
+            }
+            output = argv[++i];
+            continue;
+        }
         if (!arg.empty() && arg.front() == '-') {
             std::cerr << "Unknown option: " << arg << std::endl;
             printUsage();
@@ -207,6 +387,27 @@ int main(int argc, char** argv) {
         scriptFile = std::move(arg);
     }
 
+    if (serveMode) {
+        try {
+            return serve();
+        } catch (const std::exception& ex) {
+            std::cerr << ex.what() << std::endl;
+            return 1;
+        }
+    }
+
+    if (!manifest.empty()) {
+        try {
+            if (!ensureNodeAvailable()) {
+                throw std::runtime_error("Node.js runtime not found. Install Node.js to run --batch.");
+            }
+            return transpose::runBatch(manifest, workers, nodeExecutable());
+        } catch (const std::exception& ex) {
+            std::cerr << ex.what() << std::endl;
+            return 1;
+        }
+    }
+
     std::string source;
     try {
         if (!scriptFile.empty()) {
@@ -229,7 +430,20 @@ int main(int argc, char** argv) {
     }
 
     try {
-        return executeSource(source, emitJs);
+        if (build) {
+            if (output.empty()) {
+                output = scriptFile.empty() ? "a.out" : std::filesystem::path(scriptFile).stem().string();
+            }
+            return buildExecutable(source, output);
+        }
+        if (emitWasm) {
+            if (output.empty()) {
+                output = scriptFile.empty() ? "a.wasm"
+                                            : std::filesystem::path(scriptFile).stem().string() + ".wasm";
+            }
+            return writeWasm(source, output);
+        }
+        return executeSource(source, emitJs, emitIr, emitCpp, wasm, minify);
     } catch (const std::exception& ex) {
         std::cerr << ex.what() << std::endl;
         return 1;
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "ast_walker.hpp"
+
+namespace transpose {
+
+// Finds the local declarations a closure refers to from an enclosing
+// function; the generators keep those in a shared cell instead of a local.
+// Scopes follow the generators': a function's parameters and body share one.
+class CaptureAnalysis : public AstWalker {
+public:
+    std::unordered_set<const void*> captured;
+
+    void analyze(const std::vector<std::unique_ptr<Stmt>>& statements) {
+        scopes.push_back({0, {}}); // globals are never boxed
+        walk(statements);
+        scopes.clear();
+    }
+
+    using AstWalker::visit;
+    void visit(const Variable& expr) override { use(expr.name.lexeme); }
+    void visit(const Assignment& expr) override {
+        expr.right->accept(*this);
+        use(expr.name.lexeme);
+    }
+    void visit(const FunctionExpr& expr) override { function(expr.params, *expr.body); }
+    void visit(const VarStmt& stmt) override {
+        // in scope in its own initializer, where a function may refer to it
+        scopes.back().names[stmt.name.lexeme] = &stmt;
+        if (stmt.initializer) stmt.initializer->accept(*this);
+    }
+    void visit(const BlockStmt& stmt) override {
+        scopes.push_back({depth, {}});
+        walk(stmt.statements);
+        scopes.pop_back();
+    }
+    void visit(const FunctionStmt& stmt) override {
+        scopes.back().names[stmt.name.lexeme] = &stmt;
+        function(stmt.params, *stmt.body);
+    }
+
+private:
+    struct Scope {
+        int depth; // of the function it belongs to
+        std::unordered_map<std::string, const void*> names;
+    };
+    std::vector<Scope> scopes;
+    int depth = 0;
+
+    void function(const std::vector<Token>& params, const BlockStmt& body) {
+        scopes.push_back({++depth, {}});
+        for (const auto& param : params) {
+            scopes.back().names[param.lexeme] = &param;
+        }
+        walk(body.statements);
+        scopes.pop_back();
+        --depth;
+    }
+
+    void use(const std::string& name) {
+        for (size_t i = scopes.size() - 1; i > 0; --i) {
+            auto it = scopes[i].names.find(name);
+            if (it != scopes[i].names.end()) {
+                if (scopes[i].depth < depth) captured.insert(it->second);
+                return;
+            }
+        }
+    }
+};
+
+// Finds whether evaluating an expression can change a variable or an array:
+// whether it calls anything or assigns anything. Raising an error does not
+// count. The body of a function expression is not evaluated there: creating
+// a closure has no effect.
+class SideEffects : public AstWalker {
+public:
+    bool found = false;
+
+    using AstWalker::visit;
+    void visit(const Call&) override { found = true; }
+    void visit(const Assignment&) override { found = true; }
+    void visit(const SubscriptAssignment&) override { found = true; }
+    void visit(const Postfix&) override { found = true; }
+    void visit(const FunctionExpr&) override {}
+};
+
+inline bool hasSideEffects(const Expr& expr) {
+    SideEffects effects;
+    expr.accept(effects);
+    return effects.found;
+}
+
+}  // namespace transpose
@@ -1,5 +1,13 @@
 #include "transpose/runtime.hpp"
 
+#include <algorithm>
+#include <cctype>
+#include <map>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
 namespace transpose {
 
 std::string runtimePrelude() {
@@ -28,32 +36,89 @@ const __rt = (() => {
     return fresh;
   })();
 
+  // how much Node reads from stdin or writes to stdout at a time
+  const IO_CHUNK = 1 << 16;
+
+  // Node reads stdin a chunk at a time; lines are cut out of the current
+  // chunk at a cursor instead of copying what is left after each one.
   const STDIN_FD = 0;
+  const stdinDecoder = isNode ? new (require('string_decoder').StringDecoder)('utf8') : null;
+  let stdinBytes = null;
   let stdinBuffer = '';
+  let stdinPos = 0;
   let stdinEOF = false;
 
+  // Replaces stdinBuffer with the next chunk; the caller has taken what it
+  // needs from the old one.
   function readChunk() {
     if (!isNode) {
       return 0;
     }
-    const chunk = Buffer.alloc(4096);
+    if (stdinBytes === null) {
+      stdinBytes = Buffer.allocUnsafe(IO_CHUNK);
+    }
     let bytesRead = 0;
     try {
-      bytesRead = fs.readSync(STDIN_FD, chunk, 0, chunk.length, null);
+      bytesRead = fs.readSync(STDIN_FD, stdinBytes, 0, stdinBytes.length, null);
     } catch (err) {
       if (err && err.code === 'EAGAIN') {
         return 0;
       }
-      throw err;
+      if (err && err.code === 'EOF') {
+        bytesRead = 0;
+      } else {
+        throw err;
+      }
     }
     if (bytesRead === 0) {
       stdinEOF = true;
-      return 0;
+      stdinBuffer = stdinDecoder.end();
+    } else {
+      // the decoder holds back a character split across chunks
+      stdinBuffer = stdinDecoder.write(stdinBytes.subarray(0, bytesRead));
     }
-    stdinBuffer += chunk.toString('utf8', 0, bytesRead);
+    stdinPos = 0;
     return bytesRead;
   }
 
+  // Node's stdout is written in large blocks: when enough has collected,
+  // before reading input (so prompts show), on errors and at exit.
+  const STDOUT_FD = 1;
+  let stdoutBuffer = '';
+  let stdoutClosed = false;
+
+  function flushStdout() {
+    if (stdoutBuffer.length === 0) {
+      return;
+    }
+    const bytes = Buffer.from(stdoutBuffer, 'utf8');
+    stdoutBuffer = '';
+    let offset = 0;
+    while (offset < bytes.length && !stdoutClosed) {
+      try {
+        offset += fs.writeSync(STDOUT_FD, bytes, offset, bytes.length - offset);
+      } catch (err) {
+        if (err && err.code === 'EPIPE') {
+          // the reader went away (say, `| head`); like console.log, carry on
+          stdoutClosed = true;
+        } else if (!err || err.code !== 'EAGAIN') {
+          throw err;
+        }
+      }
+    }
+  }
+
+  function writeStdout(text) {
+    stdoutBuffer += text;
+    if (stdoutBuffer.length >= IO_CHUNK) {
+      flushStdout();
+    }
+  }
+
+  if (isNode) {
+    process.on('exit', flushStdout);
+  }
+
   function normalizeBrowserInput() {
     if (!io) {
       return;
@@ -84,32 +149,35 @@ const __rt = (() => {
       }
       return String(value);
     }
+    flushStdout();
+    // pieces of a line that runs past the end of a chunk
+    let pending = null;
     while (true) {
-      const newlineIndex = stdinBuffer.indexOf('\n');
+      const newlineIndex = stdinBuffer.indexOf('\n', stdinPos);
       if (newlineIndex !== -1) {
-        let line = stdinBuffer.slice(0, newlineIndex);
-        stdinBuffer = stdinBuffer.slice(newlineIndex + 1);
+        let line = stdinBuffer.slice(stdinPos, newlineIndex);
+        stdinPos = newlineIndex + 1;
+        if (pending !== null) {
+          pending.push(line);
+          line = pending.join('');
+        }
         if (line.endsWith('\r')) {
           line = line.slice(0, -1);
         }
         return line;
       }
-      if (stdinEOF) {
-        if (stdinBuffer.length === 0) {
-          return false;
+      if (stdinPos < stdinBuffer.length) {
+        if (pending === null) {
+          pending = [];
         }
-        const line = stdinBuffer;
-        stdinBuffer = '';
-        return line;
+        pending.push(stdinBuffer.slice(stdinPos));
       }
-      if (readChunk() === 0 && stdinEOF) {
-        if (stdinBuffer.length === 0) {
-          return false;
-        }
-        const line = stdinBuffer;
-        stdinBuffer = '';
-        return line;
+      stdinBuffer = '';
+      stdinPos = 0;
+      if (stdinEOF) {
+        return pending === null ? false : pending.join('');
       }
+      readChunk();
     }
   }
 
@@ -123,19 +191,16 @@ const __rt = (() => {
       io.stdin.length = 0;
       return remaining;
     }
-    let result = '';
-    if (stdinBuffer.length > 0) {
-      result += stdinBuffer;
-      stdinBuffer = '';
-    }
+    flushStdout();
+    const parts = [stdinBuffer.slice(stdinPos)];
+    stdinBuffer = '';
+    stdinPos = 0;
     while (!stdinEOF) {
-      if (readChunk() === 0) {
-        break;
-      }
-      result += stdinBuffer;
+      readChunk();
+      parts.push(stdinBuffer);
       stdinBuffer = '';
     }
-    return result;
+    return parts.join('');
   }
 
   function runtimeError(line, message) {
@@ -176,6 +241,7 @@ const __rt = (() => {
   function handleError(err) {
     const message = err && err.message ? err.message : String(err);
     if (isNode) {
+      flushStdout();
       if (typeof console !== 'undefined' && console.error) {
         console.error(message);
       }
@@ -198,6 +264,16 @@ const __rt = (() => {
     return value;
   }
 
+  // An operand of arithmetic, comparison or ++/--. NaN is a number here, as
+  // it is in beat and for the bare operators emitted on proven numbers, so
+  // whether it raises an error does not depend on what inference proved.
+  function ensureOperand(value, line, message) {
+    if (typeof value !== 'number') {
+      throw runtimeError(line, message);
+    }
+    return value;
+  }
+
   function ensureInteger(value, line, message) {
     ensureNumber(value, line, message);
     if (!Number.isInteger(value)) {
@@ -213,14 +289,21 @@ const __rt = (() => {
     return fn;
   }
 
-  function makeFunction(name, fn, arity) {
+  // deep, under --no-loop, is the function as a generator, to run on the heap
+  function makeFunction(name, fn, arity, deep) {
     attachCallableMetadata(fn, arity, `<fn ${name}>`);
     Object.defineProperty(fn, '__loxName', { value: name, configurable: true });
+    if (deep) {
+      Object.defineProperty(fn, '__loxDeep', { value: deep, configurable: true });
+    }
     return fn;
   }
 
-  function makeAnonFunction(fn, arity) {
+  function makeAnonFunction(fn, arity, deep) {
     attachCallableMetadata(fn, arity, '<anonymous fn>');
+    if (deep) {
+      Object.defineProperty(fn, '__loxDeep', { value: deep, configurable: true });
+    }
     return fn;
   }
 
@@ -230,6 +313,11 @@ const __rt = (() => {
     return fn;
   }
 
+  // numeric arrays the generator proves fixed are Float64Arrays
+  function isArray(value) {
+    return Array.isArray(value) || value instanceof Float64Array;
+  }
+
   function makeArray(elements) {
     return [...elements];
   }
@@ -257,7 +345,7 @@ const __rt = (() => {
   }
 
   function getIndex(target, index, line) {
-    if (Array.isArray(target)) {
+    if (isArray(target)) {
       ensureNumber(index, line, 'array index must be a number');
       ensureInteger(index, line, 'index must be an integer');
       const idx = index;
@@ -273,7 +361,7 @@ const __rt = (() => {
   }
 
   function setIndex(target, index, value, line) {
-    if (Array.isArray(target)) {
+    if (isArray(target)) {
       ensureNumber(index, line, 'array index must be a number');
       ensureInteger(index, line, 'index must be an integer');
       const idx = index;
@@ -296,14 +384,14 @@ const __rt = (() => {
 
   function postfixAdjustVariable(getter, setter, line, delta) {
     const current = getter();
-    const numeric = ensureNumber(current, line, 'Postfix operator requires a number');
+    const numeric = ensureOperand(current, line, 'Postfix operator requires a number');
     const next = numeric + delta;
     setter(next);
     return current;
   }
 
   function postfixAdjustIndex(target, index, line, delta) {
-    if (Array.isArray(target)) {
+    if (isArray(target)) {
       ensureNumber(index, line, 'array index must be a number');
       ensureInteger(index, line, 'index must be an integer');
       const idx = index;
@@ -311,7 +399,7 @@ const __rt = (() => {
         throw runtimeError(line, `Index out of bounds: ${idx} (size: ${target.length})`);
       }
       const current = target[idx];
-      const numeric = ensureNumber(current, line, 'Postfix operator requires a number');
+      const numeric = ensureOperand(current, line, 'Postfix operator requires a number');
       const next = numeric + delta;
       target[idx] = next;
       return current;
@@ -321,7 +409,7 @@ const __rt = (() => {
         throw runtimeError(line, 'Postfix operator requires an existing numeric value');
       }
       const current = target.get(index);
-      const numeric = ensureNumber(current, line, 'Postfix operator requires a number');
+      const numeric = ensureOperand(current, line, 'Postfix operator requires a number');
       const next = numeric + delta;
       target.set(index, next);
       return current;
@@ -344,12 +432,91 @@ const __rt = (() => {
     return fn(...args);
   }
 
-  function unaryMinus(value, line) {
-    return -ensureNumber(value, line, 'operand must be a number');
+  // fn itself when it can be called with argc arguments, or else a function
+  // that raises the error callFunction would
+  function checkCallee(fn, argc, line) {
+    if (isCallable(fn) && (fn.__loxArity === argc || fn.__loxArity === -1)) {
+      return fn;
+    }
+    return () => callFunction(fn, new Array(argc), line);
+  }
+
+)JS",
+        R"JS(  // Under --no-loop, a function returns a call it makes in tail position
+  // instead of making it, and whoever called the function makes it. Long
+  // chains of tail calls then run in a loop instead of on the JavaScript
+  // stack.
+  function PendingCall(fn, args) {
+    this.fn = fn;
+    this.args = args;
+  }
+
+  function settle(value) {
+    // instanceof is slow on numbers, which most calls return
+    if (typeof value !== 'object' || value === null) {
+      return value;
+    }
+    while (value instanceof PendingCall) {
+      value = value.fn(...value.args);
+    }
+    return value;
+  }
+
+  // How deep --no-loop calls are nested on the JavaScript stack. Past the
+  // limit, a call runs the generator version of its function (its
+  // __loxDeep) on runOnHeap's stack instead, which holds up to heapLimit
+  // frames. RHYTHM_RECURSION_LIMIT (or __rhythmRecursionLimit in a page)
+  // sets the limit, and Infinity turns the fallback off.
+  const recursion = {
+    depth: 0,
+    limit: (() => {
+      const configured = isNode ? process.env.RHYTHM_RECURSION_LIMIT : globalScope.__rhythmRecursionLimit;
+      const limit = configured === undefined || configured === '' ? NaN : Number(configured);
+      return limit >= 0 ? limit : 1000;
+    })(),
+    heapLimit: 2000000,
+  };
+
+  // Each frame is a running generator. It yields the calls it waits for and
+  // returns its result, or a PendingCall for a call in tail position, which
+  // takes its place.
+  function runOnHeap(fn, args) {
+    const frames = [fn.__loxDeep(...args)];
+    let sent;
+    while (true) {
+      const step = frames[frames.length - 1].next(sent);
+      let value = step.value;
+      sent = undefined;
+      if (value instanceof PendingCall) {
+        const deep = value.fn.__loxDeep;
+        if (deep) {
+          const frame = deep(...value.args);
+          if (step.done) {
+            frames[frames.length - 1] = frame;
+          } else if (frames.push(frame) > recursion.heapLimit) {
+            throw runtimeError(null, `stack overflow: calls nested more than ${recursion.heapLimit} deep`);
+          }
+          continue;
+        }
+        value = settle(value.fn(...value.args));
+      }
+      if (!step.done) {
+        sent = value;
+        continue;
+      }
+      frames.pop();
+      if (frames.length === 0) {
+        return value;
+      }
+      sent = value;
+    }
   }
 
-  function unaryNot(value) {
-    return !isTruthy(value);
+  function unaryMinus(value, line) {
+    if (typeof value === 'number') {
+      return -value;
+    }
+    throw runtimeError(line, 'operand must be a number');
   }
 
   function binaryPlus(left, right, line) {
@@ -363,67 +530,67 @@ const __rt = (() => {
   }
 
 )JS",
-        R"JS(  function binaryNumberOp(left, right, line, op, message) {
-    return op(ensureNumber(left, line, message), ensureNumber(right, line, message));
-  }
+        R"JS(  // Each operator has a helper of its own, so V8 sees one shape at every
+  // call site and can inline the number fast path into the caller. NaN
+  // passes, as in ensureOperand.
 
   function binaryMinus(left, right, line) {
-    return binaryNumberOp(left, right, line, (a, b) => a - b, 'operands must be numbers');
+    if (typeof left === 'number' && typeof right === 'number') {
+      return left - right;
+    }
+    throw runtimeError(line, 'operands must be numbers');
   }
 
   function binaryDivide(left, right, line) {
-    return binaryNumberOp(left, right, line, (a, b) => a / b, 'operands must be numbers');
+    if (typeof left === 'number' && typeof right === 'number') {
+      return left / right;
+    }
+    throw runtimeError(line, 'operands must be numbers');
   }
 
   function binaryMultiply(left, right, line) {
-    return binaryNumberOp(left, right, line, (a, b) => a * b, 'operands must be numbers');
+    if (typeof left === 'number' && typeof right === 'number') {
+      return left * right;
+    }
+    throw runtimeError(line, 'operands must be numbers');
   }
 
   function binaryMod(left, right, line) {
-    const a = ensureNumber(left, line, '% operation is between numbers');
-    const b = ensureNumber(right, line, '% operation is between numbers');
-    if (!Number.isInteger(a) || !Number.isInteger(b)) {
+    if (typeof left !== 'number' || typeof right !== 'number') {
+      throw runtimeError(line, '% operation is between numbers');
+    }
+    if (!Number.isInteger(left) || !Number.isInteger(right)) {
       throw runtimeError(line, '% operation is between integers');
     }
-    return a % b;
-  }
-
-  function compareOp(left, right, line, comparator) {
-    const l = ensureNumber(left, line, 'operands must be numbers');
-    const r = ensureNumber(right, line, 'operands must be numbers');
-    return comparator(l, r);
+    return left % right;
   }
 
   function greaterThan(left, right, line) {
-    return compareOp(left, right, line, (a, b) => a > b);
+    if (typeof left === 'number' && typeof right === 'number') {
+      return left > right;
+    }
+    throw runtimeError(line, 'operands must be numbers');
   }
 
   function greaterEqual(left, right, line) {
-    return compareOp(left, right, line, (a, b) => a >= b);
+    if (typeof left === 'number' && typeof right === 'number') {
+      return left >= right;
+    }
+    throw runtimeError(line, 'operands must be numbers');
   }
 
   function lessThan(left, right, line) {
-    return compareOp(left, right, line, (a, b) => a < b);
-  }
-
-  function lessEqual(left, right, line) {
-    return compareOp(left, right, line, (a, b) => a <= b);
-  }
-
-  function logicalAnd(leftThunk, rightThunk) {
-    const left = leftThunk();
-    if (!isTruthy(left)) {
-      return left;
+    if (typeof left === 'number' && typeof right === 'number') {
+      return left < right;
     }
-    return rightThunk();
+    throw runtimeError(line, 'operands must be numbers');
   }
 
-  function logicalOr(leftThunk, rightThunk) {
-    const left = leftThunk();
-    if (isTruthy(left)) {
-      return left;
+  function lessEqual(left, right, line) {
+    if (typeof left === 'number' && typeof right === 'number') {
+      return left <= right;
     }
-    return rightThunk();
+    throw runtimeError(line, 'operands must be numbers');
   }
 
   function equals(left, right) {
@@ -476,7 +643,7 @@ const __rt = (() => {
   function print(value) {
     const text = formatValue(value);
     if (isNode) {
-      console.log(text);
+      writeStdout(text + '\n');
     } else {
       emitBrowserStdout(text, { appendNewline: true });
     }
@@ -593,6 +760,13 @@ const __rt = (() => {
     return out;
   }
 
+  // A native applying fn, a one-argument Math function, to a number.
+  function mathNative(name, fn) {
+    return makeNative(name, (value) => {
+      return fn(ensureNumber(value, null, `${name}() argument must be a number`));
+    }, 1);
+  }
+
   function createGlobals() {
     const globals = Object.create(null);
 
@@ -607,8 +781,8 @@ const __rt = (() => {
         throw runtimeError(null, 'first printf argument must be a string');
       }
       const formatted = formatPrintf(args[0], args.slice(1));
-      if (isNode && typeof process !== 'undefined' && process.stdout && typeof process.stdout.write === 'function') {
-        process.stdout.write(formatted);
+      if (isNode) {
+        writeStdout(formatted);
       } else {
         emitBrowserStdout(formatted);
       }
@@ -691,7 +865,7 @@ const __rt = (() => {
         throw runtimeError(null, 'for_each(m, f), f must take 2 arguments (k,v)');
       }
       for (const [key, value] of map) {
-        callFunction(fn, [key, value], null);
+        settle(callFunction(fn, [key, value], null));
       }
       return null;
     }, 2);
@@ -720,26 +894,19 @@ const __rt = (() => {
       return makeArray(Array.from(map.keys()));
     }, 1);
 
-    const math1 = [
-      ['floor', Math.floor],
-      ['ceil', Math.ceil],
-      ['sin', Math.sin],
-      ['cos', Math.cos],
-      ['tan', Math.tan],
-      ['asin', Math.asin],
-      ['acos', Math.acos],
-      ['atan', Math.atan],
-      ['log', Math.log],
-      ['log10', Math.log10 || ((x) => Math.log(x) / Math.LN10)],
-      ['sqrt', Math.sqrt],
-      ['exp', Math.exp],
-      ['fabs', Math.abs],
-    ];
-    for (const [name, fn] of math1) {
-      globals[name] = makeNative(name, (value) => {
-        return fn(ensureNumber(value, null, `${name}() argument must be a number`));
-      }, 1);
-    }
+    globals.floor = mathNative('floor', Math.floor);
+    globals.ceil = mathNative('ceil', Math.ceil);
+    globals.sin = mathNative('sin', Math.sin);
+    globals.cos = mathNative('cos', Math.cos);
+    globals.tan = mathNative('tan', Math.tan);
+    globals.asin = mathNative('asin', Math.asin);
+    globals.acos = mathNative('acos', Math.acos);
+    globals.atan = mathNative('atan', Math.atan);
+    globals.log = mathNative('log', Math.log);
+    globals.log10 = mathNative('log10', Math.log10 || ((x) => Math.log(x) / Math.LN10));
+    globals.sqrt = mathNative('sqrt', Math.sqrt);
+    globals.exp = mathNative('exp', Math.exp);
+    globals.fabs = mathNative('fabs', Math.abs);
 
     globals.pow = makeNative('pow', (a, b) => {
       return Math.pow(ensureNumber(a, null, 'pow() arguments must be numbers'), ensureNumber(b, null, 'pow() arguments must be numbers'));
@@ -855,20 +1022,15 @@ const __rt = (() => {
     runtimeError,
     isTruthy,
     unaryMinus,
-    unaryNot,
     binaryPlus,
-    binaryNumberOp,
     binaryMinus,
     binaryDivide,
     binaryMultiply,
     binaryMod,
-    compareOp,
     greaterThan,
     greaterEqual,
     lessThan,
     lessEqual,
-    logicalAnd,
-    logicalOr,
     equals,
     notEquals,
     makeFunction,
@@ -882,6 +1044,11 @@ const __rt = (() => {
     postfixAdjustIndex,
     getProperty,
     callFunction,
+    checkCallee,
+    PendingCall,
+    settle,
+    recursion,
+    runOnHeap,
     print,
     formatValue,
     handleError,
@@ -893,7 +1060,7 @@ const __rt = (() => {
 )JS",
     };
     std::string prelude;
-    prelude.reserve(20936);
+    prelude.reserve(28383);
     for (const char* part : parts) {
         prelude.append(part);
     }
@@ -901,4 +1068,234 @@ const __rt = (() => {
 
 }
 
+namespace {
+
+// The prelude is cut into units by its layout: a unit is a paragraph at
+// the top of the IIFE (or one native inside createGlobals) together with
+// the names it declares. Everything else in it is kept as is.
+struct Unit {
+    std::vector<std::string_view> lines;
+    std::vector<std::string> declares;
+    std::string text;
+    std::vector<size_t> uses; // the helpers declaring names it refers to
+};
+
+std::vector<std::string_view> splitLines(std::string_view text) {
+    std::vector<std::string_view> lines;
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t end = text.find('\n', start);
+        if (end == std::string_view::npos) end = text.size();
+        lines.push_back(text.substr(start, end - start));
+        start = end + 1;
+    }
+    return lines;
+}
+
+size_t indentation(std::string_view line) {
+    size_t spaces = line.find_first_not_of(' ');
+    return spaces == std::string_view::npos ? line.size() : spaces;
+}
+
+bool isIdentifierChar(char ch) {
+    return std::isalnum(static_cast<unsigned char>(ch)) || ch == '_' || ch == '$';
+}
+
+std::string identifierAt(std::string_view text, size_t at) {
+    size_t end = at;
+    while (end < text.size() && isIdentifierChar(text[end])) ++end;
+    return std::string(text.substr(at, end - at));
+}
+
+// The names text refers to, not counting properties after a dot.
+std::set<std::string> references(std::string_view text) {
+    std::set<std::string> names;
+    for (size_t i = 0; i < text.size();) {
+        if (!isIdentifierChar(text[i]) || std::isdigit(static_cast<unsigned char>(text[i]))) {
+            ++i;
+            continue;
+        }
+        auto name = identifierAt(text, i);
+        bool property = i > 0 && text[i - 1] == '.' && !(i > 1 && text[i - 2] == '.');
+        if (!property) names.insert(name);
+        i += name.size();
+    }
+    return names;
+}
+
+// What a unit's line at the unit's own indentation declares, if anything.
+std::string declaration(std::string_view line, size_t level) {
+    auto text = line.substr(level);
+    for (std::string_view keyword : {"function ", "const ", "let ", "globals."}) {
+        if (text.starts_with(keyword)) return identifierAt(text, keyword.size());
+    }
+    return {};
+}
+
+// Cuts lines [begin, end) into units at blank lines followed by a line at
+// level; inside createGlobals, every native starts a unit of its own.
+std::vector<Unit> splitUnits(const std::vector<std::string_view>& lines, size_t begin, size_t end, size_t level) {
+    std::vector<Unit> units;
+    bool blank = true;
+    for (size_t i = begin; i < end; ++i) {
+        auto line = lines[i];
+        if (line.find_first_not_of(' ') == std::string_view::npos) {
+            blank = true;
+            if (!units.empty()) units.back().lines.push_back(line);
+            continue;
+        }
+        bool atLevel = indentation(line) == level;
+        bool native = level == 4 && line.substr(level).starts_with("globals.");
+        bool commentsOnly = !units.empty() && !units.back().lines.empty();
+        if (commentsOnly) {
+            for (auto previous : units.back().lines) {
+                if (!previous.substr(indentation(previous)).starts_with("//")) commentsOnly = false;
+            }
+        }
+        if (units.empty() || (atLevel && blank) || (native && !commentsOnly && !blank)) {
+            units.emplace_back();
+        }
+        blank = false;
+        units.back().lines.push_back(line);
+        if (atLevel) {
+            auto name = declaration(line, level);
+            if (!name.empty() && (level == 2 || line.substr(level).starts_with("globals."))) {
+                units.back().declares.push_back(name);
+            }
+        }
+    }
+    // blank lines belong between units, not to them
+    for (auto& unit : units) {
+        while (!unit.lines.empty() && unit.lines.back().find_first_not_of(' ') == std::string_view::npos) {
+            unit.lines.pop_back();
+        }
+    }
+    return units;
+}
+
+std::string joinUnit(const Unit& unit) {
+    std::string text;
+    for (auto line : unit.lines) {
+        text.append(line);
+        text += '\n';
+    }
+    return text;
+}
+
+size_t findLine(const std::vector<std::string_view>& lines, std::string_view wanted, size_t from = 0) {
+    for (size_t i = from; i < lines.size(); ++i) {
+        if (lines[i] == wanted) return i;
+    }
+    throw std::logic_error("runtime prelude has no line " + std::string(wanted));
+}
+
+// The prelude cut into units, which is the same for every program.
+struct Layout {
+    std::string full = runtimePrelude();
+    std::vector<std::string_view> lines = splitLines(full);
+    size_t helpersBegin = findLine(lines, "const __rt = (() => {") + 1;
+    size_t globalsBegin = findLine(lines, "  function createGlobals() {", helpersBegin);
+    size_t nativesBegin = findLine(lines, "    const globals = Object.create(null);", globalsBegin) + 1;
+    size_t nativesEnd = findLine(lines, "    return globals;", nativesBegin);
+    size_t exportsBegin = findLine(lines, "  return {", nativesEnd);
+    size_t exportsEnd = findLine(lines, "  };", exportsBegin);
+    std::vector<Unit> helpers = splitUnits(lines, helpersBegin, globalsBegin, 2);
+    std::vector<Unit> natives = splitUnits(lines, nativesBegin, nativesEnd, 4);
+    std::map<std::string, size_t, std::less<>> declaredBy; // index into helpers
+
+    Layout() {
+        for (size_t i = 0; i < helpers.size(); ++i) {
+            for (const auto& name : helpers[i].declares) declaredBy[name] = i;
+        }
+        for (auto* units : {&helpers, &natives}) {
+            for (auto& unit : *units) {
+                unit.text = joinUnit(unit);
+                for (const auto& name : references(unit.text)) {
+                    if (auto it = declaredBy.find(name); it != declaredBy.end()) unit.uses.push_back(it->second);
+                }
+            }
+        }
+    }
+
+    static const Layout& instance() {
+        static const Layout layout;
+        return layout;
+    }
+};
+
+}  // namespace
+
+std::set<std::string> runtimeNames() {
+    std::set<std::string> names{"createGlobals"};
+    for (const auto& [name, unit] : Layout::instance().declaredBy) names.insert(name);
+    return names;
+}
+
+std::string runtimePrelude(const std::string& code, const std::set<std::string>& natives) {
+    const auto& layout = Layout::instance();
+    const auto& lines = layout.lines;
+    std::vector<bool> keepHelper(layout.helpers.size());
+    std::vector<bool> keepNative(layout.natives.size());
+
+    // what the code reaches through __rt, and the natives it names
+    std::vector<size_t> pending;
+    std::unordered_set<std::string_view> accessed;
+    const std::string_view access = "__rt.";
+    for (size_t at = code.find(access); at != std::string::npos; at = code.find(access, at + 1)) {
+        size_t end = at + access.size();
+        while (end < code.size() && isIdentifierChar(code[end])) ++end;
+        auto name = std::string_view(code).substr(at + access.size(), end - at - access.size());
+        if (!accessed.insert(name).second) continue;
+        if (auto it = layout.declaredBy.find(name); it != layout.declaredBy.end()) pending.push_back(it->second);
+    }
+    for (size_t i = 0; i < layout.natives.size(); ++i) {
+        const auto& unit = layout.natives[i];
+        for (const auto& name : unit.declares) {
+            if (natives.contains(name)) keepNative[i] = true;
+        }
+        if (keepNative[i]) pending.insert(pending.end(), unit.uses.begin(), unit.uses.end());
+    }
+    while (!pending.empty()) {
+        size_t helper = pending.back();
+        pending.pop_back();
+        if (keepHelper[helper]) continue;
+        keepHelper[helper] = true;
+        const auto& uses = layout.helpers[helper].uses;
+        pending.insert(pending.end(), uses.begin(), uses.end());
+    }
+    // a statement declaring nothing stays when everything it uses does
+    for (size_t i = 0; i < layout.helpers.size(); ++i) {
+        if (!layout.helpers[i].declares.empty()) continue;
+        const auto& uses = layout.helpers[i].uses;
+        keepHelper[i] = !uses.empty() && std::all_of(uses.begin(), uses.end(), [&](size_t used) { return keepHelper[used]; });
+    }
+
+    std::string prelude;
+    prelude.reserve(layout.full.size());
+    auto append = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            prelude.append(lines[i]);
+            prelude += '\n';
+        }
+    };
+    append(0, layout.helpersBegin);
+    for (size_t i = 0; i < layout.helpers.size(); ++i) {
+        if (keepHelper[i]) prelude += layout.helpers[i].text + "\n";
+    }
+    append(layout.globalsBegin, layout.nativesBegin);
+    for (size_t i = 0; i < layout.natives.size(); ++i) {
+        if (keepNative[i]) prelude += layout.natives[i].text + "\n";
+    }
+    append(layout.nativesEnd, layout.exportsBegin + 1);
+    for (size_t i = layout.exportsBegin + 1; i < layout.exportsEnd; ++i) {
+        auto name = identifierAt(lines[i], indentation(lines[i]));
+        auto it = layout.declaredBy.find(name);
+        if (it != layout.declaredBy.end() && !keepHelper[it->second]) continue;
+        append(i, i + 1);
+    }
+    append(layout.exportsEnd, lines.size() - 1);
+    prelude.append(lines.back());
+    return prelude;
+}
+
 }  // namespace transpose
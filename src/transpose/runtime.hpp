@@ -1,9 +1,18 @@
 #pragma once
 
+#include <set>
 #include <string>
 
 namespace transpose {
 
+// The JavaScript runtime every transpiled program starts with, defining __rt.
 std::string runtimePrelude();
 
+// Only the parts of the runtime that code reaches through __rt and the
+// natives named in natives, with whatever those depend on.
+std::string runtimePrelude(const std::string& code, const std::set<std::string>& natives);
+
+// The names the runtime declares for itself, which are free to rename.
+std::set<std::string> runtimeNames();
+
 }  // namespace transpose
@@ -1,40 +1,255 @@
 #include "transpose/transpiler.hpp"
 
+#include <algorithm>
+#include <cctype>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
+#include "ast_walker.hpp"
+#include "constant_folder.hpp"
 #include "core/core_lib.hpp"
-#include "interpreter.hpp"
+#include "ir/ir_optimizer.hpp"
 #include "parser.hpp"
 #include "resolver.hpp"
 #include "scanner.hpp"
 #include "statement.hpp"
+#include "transpose/frontend.hpp"
 #include "transpose/javascript_generator.hpp"
+#include "transpose/javascript_minifier.hpp"
+#include "transpose/program_analysis.hpp"
+#include "transpose/runtime.hpp"
+#include "type_inference.hpp"
 
 namespace transpose {
 
 namespace {
 
-std::vector<Token> scanSource(const std::string& source) {
-    Scanner scanner(source);
+std::vector<Token> scanSource(const std::string& source, int line = 1) {
+    Scanner scanner(source, line);
     return scanner.scanTokens();
 }
 
-}  // namespace
+// --no-loop restricts only the user's code: the core library is written with
+// loops, and its JavaScript is shared by programs in either mode.
+class LoopsAllowed {
+public:
+    LoopsAllowed() : restricted_(std::exchange(noLoop, false)) {}
+    ~LoopsAllowed() { noLoop = restricted_; }
+    LoopsAllowed(const LoopsAllowed&) = delete;
+    LoopsAllowed& operator=(const LoopsAllowed&) = delete;
 
-std::string transpileToJavascript(const std::string& source) {
-    if (source.empty()) {
-        return {};
+private:
+    bool restricted_;
+};
+
+
+// Which members of the core library's `core` map a program uses: those it
+// names as core.name or core["name"]. Any other use of core needs them all.
+class CoreMembers : public AstWalker {
+public:
+    std::set<std::string> used;
+    bool all = false;
+
+    using AstWalker::visit;
+    void visit(const Variable& expr) override {
+        if (expr.name.lexeme == "core") all = true;
+    }
+    void visit(const PropertyAccess& expr) override {
+        if (isCore(*expr.object)) {
+            used.insert(expr.name.lexeme);
+            return;
+        }
+        AstWalker::visit(expr);
+    }
+    void visit(const Subscript& expr) override {
+        const auto* literal = dynamic_cast<const Literal*>(expr.index.get());
+        if (isCore(*expr.object) && literal && std::holds_alternative<std::string>(literal->value)) {
+            used.insert(std::get<std::string>(literal->value));
+            return;
+        }
+        AstWalker::visit(expr);
+    }
+
+private:
+    static bool isCore(const Expr& expr) {
+        const auto* variable = dynamic_cast<const Variable*>(&expr);
+        return variable && variable->name.lexeme == "core";
+    }
+};
+
+// The names of the members of `core` that the program (whose uses of core
+// are given) or the members it uses refer to; all of them when core is used
+// in some other way.
+std::set<std::string> usedCoreMembers(const std::vector<std::unique_ptr<Stmt>>& coreStatements, CoreMembers uses) {
+    const MapLiteral* members = nullptr;
+    for (const auto& stmt : coreStatements) {
+        const auto* var = dynamic_cast<const VarStmt*>(stmt.get());
+        if (var && var->name.lexeme == "core" && !members) {
+            members = dynamic_cast<const MapLiteral*>(var->initializer.get());
+        } else {
+            stmt->accept(uses);
+        }
+    }
+    if (!members) return {};
+
+    std::set<std::string> names;
+    for (const auto& [key, value] : members->pairs) {
+        const auto* literal = dynamic_cast<const Literal*>(key.get());
+        if (!literal || !std::holds_alternative<std::string>(literal->value)) {
+            uses.all = true;
+            continue;
+        }
+        names.insert(std::get<std::string>(literal->value));
+    }
+    // members may use one another
+    std::set<std::string> walked;
+    bool grew = true;
+    while (grew && !uses.all) {
+        grew = false;
+        for (const auto& [key, value] : members->pairs) {
+            const auto& name = std::get<std::string>(static_cast<const Literal&>(*key).value);
+            if (uses.used.contains(name) && walked.insert(name).second) {
+                value->accept(uses);
+                grew = true;
+            }
+        }
+    }
+    if (uses.all) return names;
+    std::erase_if(names, [&](const auto& name) { return !uses.used.contains(name); });
+    return names;
+}
+
+std::set<std::string> usedCoreMembers(const std::vector<std::unique_ptr<Stmt>>& coreStatements,
+                                      const std::vector<std::unique_ptr<Stmt>>& userStatements) {
+    CoreMembers uses;
+    uses.walk(userStatements);
+    return usedCoreMembers(coreStatements, std::move(uses));
+}
+
+// Drops the members of `core` not in keep, so a program does not carry (and
+// its JavaScript engine does not compile) the whole library.
+void pruneCoreLibrary(std::vector<std::unique_ptr<Stmt>>& coreStatements, const std::set<std::string>& keep) {
+    for (auto& stmt : coreStatements) {
+        auto* var = dynamic_cast<VarStmt*>(stmt.get());
+        auto* members = var && var->name.lexeme == "core" ? dynamic_cast<MapLiteral*>(var->initializer.get()) : nullptr;
+        if (!members) continue;
+        std::erase_if(members->pairs, [&](const auto& pair) {
+            const auto* literal = dynamic_cast<const Literal*>(pair.first.get());
+            return literal && std::holds_alternative<std::string>(literal->value) &&
+                   !keep.contains(std::get<std::string>(literal->value));
+        });
+        return;
+    }
+}
+
+// The globals a tree refers to without declaring them itself.
+class FreeNames : public AstWalker {
+public:
+    std::set<std::string> used;
+    std::set<std::string> declared;
+
+    using AstWalker::visit;
+    void visit(const Variable& expr) override { used.insert(expr.name.lexeme); }
+    void visit(const Assignment& expr) override {
+        used.insert(expr.name.lexeme);
+        AstWalker::visit(expr);
+    }
+    void visit(const FunctionExpr& expr) override {
+        for (const auto& param : expr.params) declared.insert(param.lexeme);
+        AstWalker::visit(expr);
+    }
+    void visit(const FunctionStmt& stmt) override {
+        declared.insert(stmt.name.lexeme);
+        for (const auto& param : stmt.params) declared.insert(param.lexeme);
+        AstWalker::visit(stmt);
+    }
+    void visit(const VarStmt& stmt) override {
+        declared.insert(stmt.name.lexeme);
+        AstWalker::visit(stmt);
+    }
+
+    std::set<std::string> free() const {
+        std::set<std::string> names;
+        for (const auto& name : used) {
+            if (!declared.contains(name)) names.insert(name);
+        }
+        return names;
+    }
+};
+
+// The core library, parsed and checked once per process (or playground
+// module), and its JavaScript for each set of members programs have used:
+// transpiling a program then only costs what the program's own code does.
+class CoreLibrary {
+public:
+    static CoreLibrary& instance() {
+        static CoreLibrary library;
+        return library;
     }
 
-    auto coreTokens = scanSource(std::string(CORE_LIB_SOURCE));
-    Parser coreParser(coreTokens);
-    auto coreStatements = coreParser.parse();
+    const std::vector<std::unique_ptr<Stmt>>& statements() const { return statements_; }
 
-    auto userTokens = scanSource(source);
-    Parser userParser(userTokens);
-    auto userStatements = userParser.parse();
+    // Whether program gives a global the library uses a value of its own,
+    // which the library's JavaScript, generated without the program, would
+    // not have been typed against.
+    bool reboundBy(const std::vector<std::unique_ptr<Stmt>>& program) const {
+        AssignedNames assigned;
+        assigned.walk(program);
+        for (const auto& stmt : program) {
+            if (const auto* var = dynamic_cast<const VarStmt*>(stmt.get())) {
+                assigned.names.insert(var->name.lexeme);
+            } else if (const auto* function = dynamic_cast<const FunctionStmt*>(stmt.get())) {
+                assigned.names.insert(function->name.lexeme);
+            }
+        }
+        for (const auto& name : assigned.names) {
+            if (globals_.contains(name)) return true;
+        }
+        return false;
+    }
+
+    const JavascriptGenerator::Fragment& javascript(const std::set<std::string>& members) {
+        std::lock_guard lock(mutex_);
+        auto it = javascript_.find(members);
+        if (it == javascript_.end()) {
+            LoopsAllowed allowed;
+            auto statements = parseOptimized(std::string(CORE_LIB_SOURCE));
+            pruneCoreLibrary(statements, members);
+            TypeInference types;
+            types.infer(statements);
+            it = javascript_.emplace(members, JavascriptGenerator(types).generateFragment(statements)).first;
+        }
+        return it->second;
+    }
+
+private:
+    std::vector<std::unique_ptr<Stmt>> statements_;
+    std::set<std::string> globals_; // that the library's code refers to
+    std::map<std::set<std::string>, JavascriptGenerator::Fragment> javascript_;
+    std::mutex mutex_;
+
+    CoreLibrary() : statements_(parseCoreLibrary()) {
+        Resolver().resolve(statements_);
+        FreeNames names;
+        names.walk(statements_);
+        globals_ = names.free();
+    }
+};
+
+// Transpiles the core library along with the program, for a program that
+// rebinds a global the library uses.
+std::string transpileWithCoreLibrary(std::vector<std::unique_ptr<Stmt>> userStatements) {
+    auto coreStatements = parseCoreLibrary();
+    pruneCoreLibrary(coreStatements, usedCoreMembers(coreStatements, userStatements));
 
     std::vector<std::unique_ptr<Stmt>> statements;
     statements.reserve(coreStatements.size() + userStatements.size());
@@ -46,27 +261,36 @@ std::string transpileToJavascript(const std::string& source) {
         statements.push_back(std::move(stmt));
     }
 
-    Interpreter interpreter;
-    Resolver resolver(&interpreter);
-    resolver.resolve(statements);
+    Resolver().resolve(statements);
+
+    TypeInference types;
+    types.infer(statements);
 
-    JavascriptGenerator generator;
+    JavascriptGenerator generator(types);
     return generator.generate(statements);
 }
 
-std::string transpileToJavascriptUserCodeOnly(const std::string& source) {
-    if (source.empty()) {
-        return {};
-    }
+}  // namespace
+
+std::vector<std::unique_ptr<Stmt>> parseOptimized(const std::string& source, std::ostream* irDump, int line) {
+    auto tokens = scanSource(source, line);
+    Parser parser(tokens);
+    auto statements = parser.parse();
+    ConstantFolder().fold(statements);
+    IrOptimizer().optimize(statements, irDump);
+    ConstantFolder().fold(statements);
+    return statements;
+}
+
+std::vector<std::unique_ptr<Stmt>> parseCoreLibrary() {
+    LoopsAllowed allowed;
+    return parseOptimized(std::string(CORE_LIB_SOURCE));
+}
 
-    auto coreTokens = scanSource(std::string(CORE_LIB_SOURCE));
-    Parser coreParser(coreTokens);
-    auto coreStatements = coreParser.parse();
-    size_t coreLibStatementCount = coreStatements.size();
+std::vector<std::unique_ptr<Stmt>> parseWithCoreLibrary(const std::string& source) {
+    auto coreStatements = parseCoreLibrary();
 
-    auto userTokens = scanSource(source);
-    Parser userParser(userTokens);
-    auto userStatements = userParser.parse();
+    auto userStatements = parseOptimized(source);
 
     std::vector<std::unique_ptr<Stmt>> statements;
     statements.reserve(coreStatements.size() + userStatements.size());
@@ -78,13 +302,387 @@ std::string transpileToJavascriptUserCodeOnly(const std::string& source) {
         statements.push_back(std::move(stmt));
     }
 
-    Interpreter interpreter;
-    Resolver resolver(&interpreter);
-    resolver.resolve(statements);
+    Resolver().resolve(statements);
+    return statements;
+}
+
+std::string transpileToJavascript(const std::string& source, bool minify) {
+    if (source.empty()) {
+        return {};
+    }
+
+    auto userStatements = parseOptimized(source);
+    auto& core = CoreLibrary::instance();
+    std::string javascript;
+    if (core.reboundBy(userStatements)) {
+        javascript = transpileWithCoreLibrary(std::move(userStatements));
+    } else {
+        Resolver().resolve(userStatements);
+
+        TypeInference types;
+        types.infer(userStatements);
 
-    JavascriptGenerator generator;
-    return generator.generateUserCodeOnly(statements, coreLibStatementCount);
+        const auto& library = core.javascript(usedCoreMembers(core.statements(), userStatements));
+        JavascriptGenerator generator(types);
+        javascript = generator.generate(userStatements, &library);
+    }
+    return minify ? minifyJavascript(javascript, runtimeNames(), "__rt") : javascript;
 }
 
-}  // namespace transpose
+std::string transpileToJavascriptWithoutRuntime(const std::string& source) {
+    auto javascript = transpileToJavascript(source);
+    // the prelude is the first statement, an IIFE, and the only one ending
+    // unindented
+    const std::string_view end = "\n})();\n";
+    auto at = javascript.find(end);
+    return at == std::string::npos ? javascript : javascript.substr(at + end.size());
+}
+
+std::string transpileToJavascriptUserCodeOnly(const std::string& source) {
+    if (source.empty()) {
+        return {};
+    }
 
+    auto userStatements = parseOptimized(source);
+    Resolver().resolve(userStatements);
+
+    TypeInference types;
+    types.infer(userStatements);
+
+    // only the library's names are needed, to tell redeclarations apart
+    auto& core = CoreLibrary::instance();
+    const auto& library = core.javascript(usedCoreMembers(core.statements(), userStatements));
+    JavascriptGenerator generator(types);
+    return generator.generateUserCodeOnly(userStatements, &library);
+}
+
+std::string transpileToIr(const std::string& source) {
+    std::ostringstream ir;
+    parseOptimized(source, &ir);
+    return ir.str();
+}
+
+namespace {
+
+struct Span {
+    size_t begin;
+    size_t end;
+    int line;
+};
+
+bool startsWord(const std::string& source, size_t at, std::string_view word) {
+    if (source.compare(at, word.size(), word) != 0) return false;
+    size_t end = at + word.size();
+    return end >= source.size() || !(std::isalnum(static_cast<unsigned char>(source[end])) || source[end] == '_');
+}
+
+// Where the next token after at starts, past spaces and comments.
+size_t skipSpace(const std::string& source, size_t at) {
+    while (at < source.size()) {
+        if (source.compare(at, 2, "//") == 0) {
+            at = source.find('\n', at);
+            if (at == std::string::npos) return source.size();
+        } else if (!std::isspace(static_cast<unsigned char>(source[at]))) {
+            break;
+        }
+        ++at;
+    }
+    return at;
+}
+
+// Cuts source into its top-level statements by their brackets alone: one
+// ends at a `;` or, if it starts with a keyword taking a block, at a `}`
+// back at the top level, unless `else` follows. Nothing if the brackets or
+// strings do not close, which the parser then reports.
+std::optional<std::vector<Span>> splitStatements(const std::string& source) {
+    std::vector<Span> spans;
+    int line = 1;
+    int depth = 0;
+    bool inStatement = false;
+    bool takesBlock = false;
+    for (size_t at = 0; at < source.size(); ++at) {
+        char ch = source[at];
+        if (ch == '\n') {
+            ++line;
+            continue;
+        }
+        if (ch == ' ' || ch == '\t' || ch == '\r' || std::isspace(static_cast<unsigned char>(ch))) continue;
+        if (ch == '/' && at + 1 < source.size() && source[at + 1] == '/') {
+            size_t end = source.find('\n', at);
+            if (end == std::string::npos) break;
+            at = end - 1;
+            continue;
+        }
+        if (!inStatement) {
+            spans.push_back({at, 0, line});
+            inStatement = true;
+            takesBlock = ch == '{';
+            for (std::string_view keyword : {"fun", "if", "while", "for"}) {
+                takesBlock = takesBlock || startsWord(source, at, keyword);
+            }
+        }
+        if (ch == '"') {
+            size_t close = source.find('"', at + 1);
+            if (close == std::string::npos) return std::nullopt;
+            line += static_cast<int>(std::count(source.begin() + at, source.begin() + close, '\n'));
+            at = close;
+            continue;
+        }
+        if (ch == '(' || ch == '[' || ch == '{') {
+            ++depth;
+        } else if ((ch == ')' || ch == ']' || ch == '}') && --depth < 0) {
+            return std::nullopt;
+        }
+        if (depth == 0 && (ch == ';' || (ch == '}' && takesBlock)) && !startsWord(source, skipSpace(source, at + 1), "else")) {
+            spans.back().end = at + 1;
+            inStatement = false;
+        }
+    }
+    if (inStatement) return std::nullopt;
+    return spans;
+}
+
+// Appends piece with its line numbers moved by shift, and its statements
+// indented if indent.
+void appendPiece(std::string& out, const JavascriptGenerator::Piece& piece, int shift, bool indent) {
+    if (shift == 0 && !indent) {
+        out += piece.code;
+        return;
+    }
+    size_t from = 0;
+    auto line = piece.lines.begin();
+    auto statement = piece.statementLines.begin();
+    while (true) {
+        bool lines = line != piece.lines.end() && shift != 0;
+        bool statements = statement != piece.statementLines.end() && indent;
+        if (!lines && !statements) break;
+        if (statements && (!lines || *statement <= line->first)) {
+            out.append(piece.code, from, *statement - from);
+            out += "  ";
+            from = *statement++;
+            continue;
+        }
+        out.append(piece.code, from, line->first - from);
+        out += std::to_string(line->second + shift);
+        from = line->first;
+        while (from < piece.code.size() && std::isdigit(static_cast<unsigned char>(piece.code[from]))) ++from;
+        ++line;
+    }
+    out.append(piece.code, from);
+}
+
+}  // namespace
+
+// A top-level statement (or a few the splitter could not tell apart) as it
+// was last parsed, what it tells about the program's globals, and its
+// JavaScript.
+struct IncrementalTranspiler::Chunk {
+    std::string text;
+    int line = 0;       // where it starts now
+    int parsedLine = 0; // where it started when parsed, which its line numbers are from
+    std::vector<std::unique_ptr<Stmt>> statements;
+
+    std::set<std::string> names;                           // every name it refers to or declares
+    std::vector<std::pair<std::string, int>> declarations; // top-level vars (arity -1) and funs
+    std::vector<std::string> arrays;                       // top-level vars initialized with an array
+    std::set<std::string> assigned;
+    std::unordered_set<std::string> globals; // see TypeInference::definedGlobals
+    CoreMembers core;
+    bool rebindsCore = false;
+
+    JavascriptGenerator::Piece piece;
+    std::string context; // the facts about names the piece was generated with
+    bool generated = false;
+
+    Chunk(std::string source, int firstLine) : text(std::move(source)), line(firstLine), parsedLine(firstLine) {
+        statements = parseOptimized(text, nullptr, line);
+        Resolver().resolve(statements);
+
+        FreeNames free;
+        free.walk(statements);
+        names = std::move(free.used);
+        names.insert(free.declared.begin(), free.declared.end());
+        for (const auto& stmt : statements) {
+            if (const auto* var = dynamic_cast<const VarStmt*>(stmt.get())) {
+                declarations.emplace_back(var->name.lexeme, -1);
+                if (dynamic_cast<const ArrayLiteral*>(var->initializer.get())) arrays.push_back(var->name.lexeme);
+            } else if (const auto* function = dynamic_cast<const FunctionStmt*>(stmt.get())) {
+                declarations.emplace_back(function->name.lexeme, static_cast<int>(function->params.size()));
+            }
+        }
+        AssignedNames assignments;
+        assignments.walk(statements);
+        assigned = std::move(assignments.names);
+        globals = TypeInference::definedGlobals(statements);
+        core.walk(statements);
+        rebindsCore = CoreLibrary::instance().reboundBy(statements);
+    }
+};
+
+IncrementalTranspiler::IncrementalTranspiler() = default;
+IncrementalTranspiler::~IncrementalTranspiler() = default;
+
+bool IncrementalTranspiler::update(const std::string& source) {
+    if (source == source_ && noLoop == noLoop_) return true;
+    if (noLoop != noLoop_) {
+        chunks_.clear();
+        noLoop_ = noLoop;
+    }
+    auto spans = splitStatements(source);
+    if (!spans) return false;
+
+    // keep the chunks whose text is unchanged
+    std::unordered_multimap<std::string_view, size_t> previous;
+    for (size_t i = 0; i < chunks_.size(); ++i) {
+        previous.emplace(chunks_[i]->text, i);
+    }
+    std::vector<std::unique_ptr<Chunk>> chunks;
+    // the whole program will report what is wrong; keep what was parsed
+    auto fail = [&] {
+        for (auto& chunk : chunks_) {
+            if (chunk) chunks.push_back(std::move(chunk));
+        }
+        chunks_ = std::move(chunks);
+        source_.clear();
+        return false;
+    };
+    for (const auto& span : *spans) {
+        auto text = std::string_view(source).substr(span.begin, span.end - span.begin);
+        auto it = previous.find(text);
+        if (it != previous.end()) {
+            chunks.push_back(std::move(chunks_[it->second]));
+            previous.erase(it);
+            chunks.back()->line = span.line;
+            continue;
+        }
+        try {
+            chunks.push_back(std::make_unique<Chunk>(std::string(text), span.line));
+        } catch (const std::exception&) {
+            return fail();
+        }
+    }
+
+    // facts about the program's globals
+    CoreMembers coreUses;
+    std::set<std::string> assigned;
+    std::vector<std::pair<std::string, int>> declarations;
+    std::unordered_set<std::string> globals;
+    std::vector<std::string> programArrays;
+    for (const auto& chunk : chunks) {
+        if (chunk->rebindsCore) return fail();
+        coreUses.used.insert(chunk->core.used.begin(), chunk->core.used.end());
+        coreUses.all = coreUses.all || chunk->core.all;
+        assigned.insert(chunk->assigned.begin(), chunk->assigned.end());
+        declarations.insert(declarations.end(), chunk->declarations.begin(), chunk->declarations.end());
+        globals.insert(chunk->globals.begin(), chunk->globals.end());
+        programArrays.insert(programArrays.end(), chunk->arrays.begin(), chunk->arrays.end());
+    }
+    auto& core = CoreLibrary::instance();
+    const auto& library = core.javascript(usedCoreMembers(core.statements(), std::move(coreUses)));
+    auto direct = JavascriptGenerator::directFunctions(declarations, assigned, &library);
+
+    // a chunk is generated again when it is new or the facts about a name in
+    // it changed
+    std::vector<bool> regenerate(chunks.size());
+    std::vector<std::string> contexts(chunks.size());
+    std::set<std::string> declared(library.globals.begin(), library.globals.end());
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        auto& context = contexts[i];
+        for (const auto& name : chunks[i]->names) {
+            context += name;
+            if (auto it = direct.find(name); it != direct.end()) context += "=" + std::to_string(it->second);
+            if (globals.contains(name)) context += '!';
+            if (declared.contains(name)) context += '^';
+            context += ' ';
+        }
+        for (const auto& [name, arity] : chunks[i]->declarations) {
+            declared.insert(name);
+        }
+        regenerate[i] = !chunks[i]->generated || chunks[i]->context != context;
+    }
+    // whether an array can be a Float64Array depends on every use of it
+    std::set<std::string> arrays(arrays_.begin(), arrays_.end());
+    arrays.insert(programArrays.begin(), programArrays.end());
+    std::set<std::string> touched;
+    auto touch = [&](const Chunk& chunk) {
+        bool any = false;
+        for (const auto& name : chunk.names) {
+            if (arrays.contains(name)) any = touched.insert(name).second || any;
+        }
+        return any;
+    };
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        if (regenerate[i]) touch(*chunks[i]);
+    }
+    for (const auto& chunk : chunks_) {
+        if (chunk) touch(*chunk); // no longer in the program
+    }
+    for (bool grew = !touched.empty(); grew;) {
+        grew = false;
+        for (size_t i = 0; i < chunks.size(); ++i) {
+            if (regenerate[i]) continue;
+            for (const auto& name : chunks[i]->names) {
+                if (!touched.contains(name)) continue;
+                regenerate[i] = true;
+                touch(*chunks[i]);
+                grew = true;
+                break;
+            }
+        }
+    }
+
+    TypeInference types;
+    std::vector<const JavascriptGenerator::Statements*> statements;
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        statements.push_back(&chunks[i]->statements);
+        if (regenerate[i]) types.infer(chunks[i]->statements, globals);
+    }
+    auto pieces = JavascriptGenerator(types).generatePieces(statements, regenerate, &library, direct);
+
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        if (!regenerate[i]) continue;
+        chunks[i]->piece = std::move(pieces[i]);
+        chunks[i]->context = std::move(contexts[i]);
+        chunks[i]->generated = true;
+    }
+    arrays_ = std::move(programArrays);
+    libraryCode_ = &library.code;
+    libraryUsesLogicalTemp_ = library.usesLogicalTemp;
+    chunks_ = std::move(chunks);
+    source_ = source;
+    return true;
+}
+
+std::pair<std::string, bool> IncrementalTranspiler::statements(bool indent) const {
+    std::string code;
+    bool usesLogicalTemp = false;
+    for (const auto& chunk : chunks_) {
+        appendPiece(code, chunk->piece, chunk->line - chunk->parsedLine, indent);
+        usesLogicalTemp = usesLogicalTemp || chunk->piece.usesLogicalTemp;
+    }
+    return {std::move(code), usesLogicalTemp};
+}
+
+std::string IncrementalTranspiler::transpile(const std::string& source) {
+    if (source.empty()) {
+        return {};
+    }
+    if (!update(source)) {
+        return transpileToJavascript(source);
+    }
+    auto [code, usesLogicalTemp] = statements(true);
+    return JavascriptGenerator::program(*libraryCode_ + code, libraryUsesLogicalTemp_ || usesLogicalTemp);
+}
+
+std::string IncrementalTranspiler::transpileUserCodeOnly(const std::string& source) {
+    if (source.empty()) {
+        return {};
+    }
+    if (!update(source)) {
+        return transpileToJavascriptUserCodeOnly(source);
+    }
+    auto [code, usesLogicalTemp] = statements(false);
+    return JavascriptGenerator::userCode(code, usesLogicalTemp);
+}
+
+}  // namespace transpose
@@ -1,18 +1,63 @@
 #pragma once
 
+#include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace transpose {
 
 // Transpile Rhythm source code (including the standard core library) into
-// executable JavaScript. The global parser option `noLoop` controls whether
-// loop constructs are permitted.
-std::string transpileToJavascript(const std::string& source);
+// executable JavaScript. Only the parts of the runtime and core library the
+// program uses are included; minify also strips comments and indentation and
+// shortens the runtime's names. The global parser option `noLoop` controls
+// whether loop constructs are permitted.
+std::string transpileToJavascript(const std::string& source, bool minify = false);
+
+// The program from transpileToJavascript without the runtime prelude it
+// starts with, to run where the whole of runtimePrelude() defines `__rt`.
+std::string transpileToJavascriptWithoutRuntime(const std::string& source);
 
 // Transpile Rhythm source code to JavaScript, but return only the user's code
 // without the runtime and core library. This is useful for displaying transpiled
 // code in a readable format.
 std::string transpileToJavascriptUserCodeOnly(const std::string& source);
 
+// Transpiles successive versions of a program as it is edited, the way the
+// web playground does on every change. The AST and JavaScript of each
+// top-level statement are kept, and only statements whose text changed (or
+// that refer to a global whose meaning changed) are parsed and generated
+// again; the results are those of transpileToJavascript (apart from the
+// numbering of temporaries) and transpileToJavascriptUserCodeOnly.
+class IncrementalTranspiler {
+public:
+    IncrementalTranspiler();
+    ~IncrementalTranspiler();
+
+    std::string transpile(const std::string& source);
+    std::string transpileUserCodeOnly(const std::string& source);
+
+private:
+    struct Chunk;
+    std::vector<std::unique_ptr<Chunk>> chunks_; // the last program's, in order
+    std::string source_;                         // what chunks_ are for
+    bool noLoop_ = false;                        // what they were parsed with
+    std::vector<std::string> arrays_;            // top-level vars initialized with arrays
+    const std::string* libraryCode_ = nullptr; // the core library's JavaScript they need
+    bool libraryUsesLogicalTemp_ = false;
+
+    // whether source could be transpiled a statement at a time
+    bool update(const std::string& source);
+    // the JavaScript for chunks_, indented if it is for the whole program,
+    // and whether it uses __logical
+    std::pair<std::string, bool> statements(bool indent) const;
+};
+
+// The C++ and WebAssembly backends are declared in cpp_transpiler.hpp and
+// wasm_transpiler.hpp, so that a build can leave out their generators.
+
+// The optimized SSA IR of the user's code, as printed by `--emit-ir`.
+std::string transpileToIr(const std::string& source);
+
 }  // namespace transpose
 
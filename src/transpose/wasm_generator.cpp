@@ -0,0 +1,1088 @@
+#include "transpose/wasm_generator.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+#include "token.hpp"
+#include "transpose/program_analysis.hpp"
+
+namespace transpose {
+
+using namespace wasm;
+
+namespace {
+
+constexpr ValType I32 = ValType::I32;
+constexpr ValType I64 = ValType::I64;
+constexpr ValType F64 = ValType::F64;
+
+// natives compiled to single instructions, and those imported from Math
+const char* const inlineMath[] = {"floor", "ceil", "sqrt", "fabs"};
+const char* const importedMath[] = {"sin", "cos", "tan", "asin", "acos", "atan", "log", "log10", "exp"};
+const char* const importedMath2[] = {"pow", "atan2", "fmod"};
+
+template <size_t N>
+bool contains(const char* const (&names)[N], const std::string& name) {
+    return std::find(std::begin(names), std::end(names), name) != std::end(names);
+}
+
+Op inlineMathOp(const std::string& name) {
+    if (name == "floor") return F64Floor;
+    if (name == "ceil") return F64Ceil;
+    if (name == "sqrt") return F64Sqrt;
+    return F64Abs;
+}
+
+}  // namespace
+
+WasmGenerator::WasmGenerator(const TypeInference& types) : types_(types) {}
+
+std::string WasmGenerator::generate(const std::vector<std::unique_ptr<Stmt>>& statements) {
+    module_ = std::make_unique<Module>();
+    runtime_ = std::make_unique<Runtime>(*module_);
+    CaptureAnalysis capture;
+    capture.analyze(statements);
+    captured_ = std::move(capture.captured);
+    AssignedNames assigned;
+    assigned.walk(statements);
+    assigned_ = std::move(assigned.names);
+
+    // every global gets a wasm global up front: functions refer to globals
+    // defined after them. Those named after natives start out holding the
+    // native and are only made once something uses them.
+    scopes_.assign(1, {});
+    functions_.clear();
+    functions_.push_back(std::make_unique<Function>(FuncType{}));
+    auto declareGlobal = [&](const std::string& name) {
+        if (scopes_[0].contains(name)) return;
+        Binding binding;
+        binding.storage = Binding::Storage::GLOBAL;
+        if (isNative(name)) {
+            binding.native = name;
+        } else {
+            binding.index = module_->addGlobal(I64, NIL);
+        }
+        scopes_[0][name] = binding;
+    };
+    for (const auto& name : nativeNames()) {
+        declareGlobal(name);
+    }
+    std::unordered_map<std::string, int> definitions;
+    for (const auto& stmt : statements) {
+        if (const auto* var = dynamic_cast<const VarStmt*>(stmt.get())) {
+            definitions[var->name.lexeme] += 2; // a var is never a direct function
+            declareGlobal(var->name.lexeme);
+        } else if (const auto* function = dynamic_cast<const FunctionStmt*>(stmt.get())) {
+            definitions[function->name.lexeme]++;
+            declareGlobal(function->name.lexeme);
+        }
+    }
+    // assigning to a name nothing declares defines a global
+    for (const auto& name : assigned_) {
+        declareGlobal(name);
+    }
+    for (const auto& name : nativeNames()) {
+        if (!definitions.contains(name) && !assigned_.contains(name)) {
+            directNatives_.insert(name);
+        }
+    }
+    for (const auto& stmt : statements) {
+        if (const auto* function = dynamic_cast<const FunctionStmt*>(stmt.get())) {
+            const auto& name = function->name.lexeme;
+            if (definitions[name] == 1 && !isNative(name) && !assigned_.contains(name)) {
+                FuncType type{std::vector<ValType>(function->params.size(), I64), {I64}};
+                directFunctions_[name] = DirectFunction{module_->declareFunction(type), function->params.size()};
+            }
+        }
+    }
+
+    for (const auto& stmt : statements) {
+        emitStatement(*stmt);
+    }
+    auto run = module_->declareFunction(FuncType{});
+    module_->defineFunction(run, code());
+    module_->exportFunction("run", run);
+    runtime_->finish(scratchSlots_);
+    return module_->encode();
+}
+
+ValType WasmGenerator::typeOf(Kind kind) {
+    switch (kind) {
+        case Kind::NUMBER: return F64;
+        case Kind::BOOL: return I32;
+        case Kind::VALUE: break;
+    }
+    return I64;
+}
+
+// Temporaries only live within one statement, so each statement reuses
+// those of the one before.
+uint32_t WasmGenerator::temporary(ValType type) {
+    auto& current = function();
+    auto key = static_cast<uint8_t>(type);
+    auto& pool = current.temporaries[key];
+    auto& used = current.temporariesUsed[key];
+    if (used == pool.size()) {
+        pool.push_back(current.code.addLocal(type));
+    }
+    return pool[used++];
+}
+
+void WasmGenerator::open(Op opcode) {
+    code().block(opcode);
+    function().blocks++;
+}
+
+void WasmGenerator::open(Op opcode, ValType result) {
+    code().block(opcode, result);
+    function().blocks++;
+}
+
+void WasmGenerator::close() {
+    code().op(End);
+    function().blocks--;
+}
+
+void WasmGenerator::emitStatement(const Stmt& stmt) {
+    stmt.accept(*this);
+    function().temporariesUsed.clear();
+}
+
+WasmGenerator::Kind WasmGenerator::expression(const Expr& expr) {
+    expr.accept(*this);
+    return std::exchange(result_, Kind::VALUE);
+}
+
+void WasmGenerator::value(const Expr& expr) {
+    toValue(expression(expr));
+}
+
+void WasmGenerator::toValue(Kind kind) {
+    if (kind == Kind::NUMBER) {
+        code().op(I64ReinterpretF64);
+    } else if (kind == Kind::BOOL) {
+        emitBool(code());
+    }
+}
+
+void WasmGenerator::toNumber(Kind kind, int line, const std::string& message) {
+    if (kind == Kind::NUMBER) return;
+    toValue(kind);
+    code().i32(line);
+    code().i32(static_cast<int32_t>(runtime_->string(message)));
+    code().call(runtime_->number);
+}
+
+void WasmGenerator::number(const Expr& expr, int line, const std::string& message) {
+    toNumber(expression(expr), line, message);
+}
+
+// Brings two operands on the stack to one kind. The left one is under the
+// right, so converting it goes through a temporary.
+void WasmGenerator::reconcile(Kind left, Kind right, Kind target, int line, const std::string& message) {
+    auto convert = [&](Kind kind) {
+        if (target == Kind::VALUE) {
+            toValue(kind);
+        } else {
+            toNumber(kind, line, message);
+        }
+    };
+    if (right != target) convert(right);
+    if (left != target) {
+        auto top = temporary(typeOf(target));
+        code().localSet(top);
+        convert(left);
+        code().localGet(top);
+    }
+}
+
+// an i32 telling whether expr is truthy
+void WasmGenerator::condition(const Expr& expr) {
+    if (const auto* grouping = dynamic_cast<const Grouping*>(&expr)) {
+        condition(*grouping->expression);
+        return;
+    }
+    if (const auto* logical = dynamic_cast<const Logical*>(&expr)) {
+        condition(*logical->left);
+        open(If, I32);
+        if (logical->op.type == TokenType::AND) {
+            condition(*logical->right);
+            code().op(Else);
+            code().i32(0);
+        } else {
+            code().i32(1);
+            code().op(Else);
+            condition(*logical->right);
+        }
+        close();
+        return;
+    }
+    if (const auto* unary = dynamic_cast<const Unary*>(&expr); unary && unary->op.type == TokenType::BANG) {
+        condition(*unary->right);
+        code().op(I32Eqz);
+        return;
+    }
+    switch (expression(expr)) {
+        case Kind::BOOL:
+            break;
+        case Kind::NUMBER:
+            code().op(Drop);
+            code().i32(1);
+            break;
+        case Kind::VALUE:
+            emitTruthy(code());
+            break;
+    }
+}
+
+// The kind expression() will give expr, where that is known before
+// generating it: if blocks declare their type up front.
+WasmGenerator::Kind WasmGenerator::predict(const Expr& expr) {
+    if (const auto* grouping = dynamic_cast<const Grouping*>(&expr)) {
+        return predict(*grouping->expression);
+    }
+    if (const auto* literal = dynamic_cast<const Literal*>(&expr)) {
+        if (std::holds_alternative<double>(literal->value)) return Kind::NUMBER;
+        if (std::holds_alternative<bool>(literal->value)) return Kind::BOOL;
+        return Kind::VALUE;
+    }
+    if (const auto* unary = dynamic_cast<const Unary*>(&expr)) {
+        return unary->op.type == TokenType::BANG ? Kind::BOOL : Kind::NUMBER;
+    }
+    if (dynamic_cast<const Postfix*>(&expr)) {
+        return Kind::NUMBER;
+    }
+    if (const auto* binary = dynamic_cast<const Binary*>(&expr)) {
+        switch (binary->op.type) {
+            case TokenType::PLUS:
+                return predict(*binary->left) == Kind::NUMBER || predict(*binary->right) == Kind::NUMBER
+                           ? Kind::NUMBER
+                           : Kind::VALUE;
+            case TokenType::MINUS:
+            case TokenType::STAR:
+            case TokenType::SLASH:
+            case TokenType::PERCENT:
+                return Kind::NUMBER;
+            default:
+                return Kind::BOOL;
+        }
+    }
+    if (const auto* logical = dynamic_cast<const Logical*>(&expr)) {
+        return predict(*logical->left) == Kind::BOOL && predict(*logical->right) == Kind::BOOL ? Kind::BOOL
+                                                                                               : Kind::VALUE;
+    }
+    if (const auto* ternary = dynamic_cast<const Ternary*>(&expr)) {
+        auto kind = predict(*ternary->thenBranch);
+        return kind == predict(*ternary->elseBranch) ? kind : Kind::VALUE;
+    }
+    const Token* name = nullptr;
+    if (const auto* variable = dynamic_cast<const Variable*>(&expr)) {
+        name = &variable->name;
+    } else if (const auto* assignment = dynamic_cast<const Assignment*>(&expr)) {
+        name = &assignment->name;
+    }
+    if (name) {
+        const auto* binding = resolve(name->lexeme);
+        return binding && binding->number ? Kind::NUMBER : Kind::VALUE;
+    }
+    return Kind::VALUE;
+}
+
+// expr, as the kind predict() gave it
+void WasmGenerator::expressionAs(const Expr& expr, Kind kind) {
+    auto actual = expression(expr);
+    if (actual == kind) return;
+    if (kind != Kind::VALUE) throw std::logic_error("mispredicted the kind of an expression");
+    toValue(actual);
+}
+
+void WasmGenerator::raise(int line, const std::string& message) {
+    code().i32(line);
+    code().i32(static_cast<int32_t>(runtime_->string(message)));
+    code().call(runtime_->fail);
+    code().op(Unreachable);
+}
+
+void WasmGenerator::stringValue(const std::string& text) {
+    code().i64(tagged(STRING_TAG, runtime_->string(text)));
+}
+
+WasmGenerator::Binding* WasmGenerator::resolve(const std::string& name) {
+    for (auto scope = scopes_.rbegin(); scope != scopes_.rend(); ++scope) {
+        auto it = scope->find(name);
+        if (it != scope->end()) return &it->second;
+    }
+    return nullptr;
+}
+
+WasmGenerator::Binding& WasmGenerator::declare(const Token& name, const void* node) {
+    Binding binding;
+    binding.function = functions_.size() - 1;
+    if (captured_.contains(node)) {
+        binding.storage = Binding::Storage::CELL;
+        binding.index = code().addLocal(I32);
+    } else {
+        binding.number = types_.declarationType(node) == InferredType::NUMBER;
+        binding.index = code().addLocal(binding.number ? F64 : I64);
+    }
+    return scopes_.back()[name.lexeme] = binding;
+}
+
+uint32_t WasmGenerator::global(Binding& binding) {
+    if (!binding.native.empty()) {
+        binding.index = module_->addGlobal(I64, runtime_->nativeValue(binding.native));
+        binding.native.clear();
+    }
+    return binding.index;
+}
+
+// the address of a captured variable's cell: a local of the function owning
+// it, and in the closures using it one of the cells they carry
+void WasmGenerator::cellAddress(const Binding& binding) {
+    if (binding.storage != Binding::Storage::CELL) {
+        throw std::logic_error("a variable captured by a closure has no cell");
+    }
+    if (binding.function == functions_.size() - 1) {
+        code().localGet(binding.index);
+        return;
+    }
+    auto& captured = function().captured;
+    auto it = std::find(captured.begin(), captured.end(), &binding);
+    auto index = static_cast<uint32_t>(it - captured.begin());
+    if (it == captured.end()) captured.push_back(&binding);
+    code().localGet(0); // the closure
+    code().memory(I32Load, layout::CLOSURE_CELL + 4 * index);
+}
+
+void WasmGenerator::load(Binding& binding) {
+    switch (binding.storage) {
+        case Binding::Storage::GLOBAL:
+            code().globalGet(global(binding));
+            result_ = Kind::VALUE;
+            break;
+        case Binding::Storage::LOCAL:
+            code().localGet(binding.index);
+            result_ = binding.number ? Kind::NUMBER : Kind::VALUE;
+            break;
+        case Binding::Storage::CELL:
+            cellAddress(binding);
+            code().memory(I64Load);
+            result_ = Kind::VALUE;
+            break;
+    }
+}
+
+// stores what is on the stack into the variable, leaving it there
+void WasmGenerator::store(Binding& binding, Kind kind) {
+    switch (binding.storage) {
+        case Binding::Storage::GLOBAL: {
+            auto index = global(binding);
+            toValue(kind);
+            code().globalSet(index);
+            code().globalGet(index);
+            result_ = Kind::VALUE;
+            break;
+        }
+        case Binding::Storage::LOCAL:
+            if (binding.number) {
+                // TypeInference proved whatever is assigned is a number
+                if (kind != Kind::NUMBER) {
+                    toValue(kind);
+                    code().op(F64ReinterpretI64);
+                }
+                result_ = Kind::NUMBER;
+            } else {
+                toValue(kind);
+                result_ = Kind::VALUE;
+            }
+            code().localTee(binding.index);
+            break;
+        case Binding::Storage::CELL: {
+            toValue(kind);
+            auto stored = temporary(I64);
+            code().localSet(stored);
+            cellAddress(binding);
+            code().localGet(stored);
+            code().memory(I64Store);
+            code().localGet(stored);
+            result_ = Kind::VALUE;
+            break;
+        }
+    }
+}
+
+// The body of the function on top of functions_. A direct function gets
+// its parameters as wasm parameters, a closure in the scratch area.
+void WasmGenerator::functionBody(const std::vector<Token>& params, const BlockStmt& body, bool direct) {
+    scopes_.emplace_back();
+    for (size_t i = 0; i < params.size(); ++i) {
+        auto index = static_cast<uint32_t>(i);
+        if (direct && !captured_.contains(&params[i])) {
+            Binding binding;
+            binding.index = index;
+            binding.function = functions_.size() - 1;
+            scopes_.back()[params[i].lexeme] = binding;
+            continue;
+        }
+        const auto& binding = declare(params[i], &params[i]);
+        if (direct) {
+            code().localGet(index);
+        } else {
+            code().localGet(2);
+            code().memory(I64Load, 8 * index);
+        }
+        if (binding.storage == Binding::Storage::CELL) {
+            code().call(runtime_->cell);
+        }
+        code().localSet(binding.index);
+    }
+    for (const auto& stmt : body.statements) {
+        emitStatement(*stmt);
+    }
+    code().i64(NIL);
+    scopes_.pop_back();
+}
+
+// A closure over params and body: static data when it captures nothing,
+// otherwise allocated with the cells it captures.
+void WasmGenerator::closure(const std::string& display, const std::vector<Token>& params, const BlockStmt& body) {
+    functions_.push_back(std::make_unique<Function>(Runtime::callType));
+    functionBody(params, body, false);
+    auto generated = std::move(functions_.back());
+    functions_.pop_back();
+    auto index = module_->declareFunction(Runtime::callType);
+    module_->defineFunction(index, generated->code);
+    auto arity = static_cast<int32_t>(params.size());
+
+    if (generated->captured.empty()) {
+        code().i64(runtime_->staticClosure(index, arity, display));
+        result_ = Kind::VALUE;
+        return;
+    }
+    auto cells = static_cast<int32_t>(generated->captured.size());
+    code().i32(static_cast<int32_t>(module_->tableEntry(index)));
+    code().i32(arity);
+    code().i32(static_cast<int32_t>(runtime_->string(display)));
+    code().i32(cells);
+    code().call(runtime_->closure);
+    auto address = temporary(I32);
+    code().localSet(address);
+    for (int32_t i = 0; i < cells; ++i) {
+        code().localGet(address);
+        cellAddress(*generated->captured[i]);
+        code().memory(I32Store, layout::CLOSURE_CELL + 4 * i);
+    }
+    code().localGet(address);
+    emitBox(code(), FUNCTION_TAG);
+    result_ = Kind::VALUE;
+}
+
+// Generates a direct function; returns it as a value, through a wrapper
+// taking the arguments from the scratch area.
+int64_t WasmGenerator::hoist(const FunctionStmt& stmt, const DirectFunction& direct) {
+    functions_.push_back(std::make_unique<Function>(module_->functionType(direct.function)));
+    functionBody(stmt.params, *stmt.body, true);
+    module_->defineFunction(direct.function, code());
+    functions_.pop_back();
+
+    auto entry = module_->declareFunction(Runtime::callType);
+    Code wrapper(Runtime::callType);
+    for (size_t i = 0; i < direct.arity; ++i) {
+        wrapper.localGet(2);
+        wrapper.memory(I64Load, static_cast<uint32_t>(8 * i));
+    }
+    wrapper.call(direct.function);
+    module_->defineFunction(entry, wrapper);
+    return runtime_->staticClosure(entry, static_cast<int>(direct.arity), "<fn " + stmt.name.lexeme + ">");
+}
+
+// a call of a native the program leaves alone, without going through the
+// table; false when it has to
+bool WasmGenerator::callNative(const std::string& name, const ::Call& expr) {
+    const auto& args = expr.arguments;
+    auto arity = nativeArity(name);
+    if (arity != -1 && static_cast<size_t>(arity) != args.size()) return false;
+
+    if (contains(inlineMath, name) || contains(importedMath, name)) {
+        number(*args[0], 0, name + "() argument must be a number");
+        if (contains(inlineMath, name)) {
+            code().op(inlineMathOp(name));
+        } else {
+            code().call(runtime_->math.at(name));
+        }
+        result_ = Kind::NUMBER;
+        return true;
+    }
+    if (contains(importedMath2, name)) {
+        number(*args[0], 0, name + "() arguments must be numbers");
+        number(*args[1], 0, name + "() arguments must be numbers");
+        code().call(runtime_->math.at(name));
+        result_ = Kind::NUMBER;
+        return true;
+    }
+    if (name == "len") {
+        value(*args[0]);
+        code().call(runtime_->len);
+        result_ = Kind::NUMBER;
+        return true;
+    }
+    if (name == "clock") {
+        code().call(runtime_->clock);
+        result_ = Kind::NUMBER;
+        return true;
+    }
+    if (name == "inf") {
+        code().f64(std::numeric_limits<double>::infinity());
+        result_ = Kind::NUMBER;
+        return true;
+    }
+
+    if (arity == -1) {
+        std::vector<uint32_t> values;
+        for (const auto& arg : args) {
+            value(*arg);
+            values.push_back(temporary(I64));
+            code().localSet(values.back());
+        }
+        for (size_t i = 0; i < values.size(); ++i) {
+            code().globalGet(runtime_->scratch);
+            code().localGet(values[i]);
+            code().memory(I64Store, static_cast<uint32_t>(8 * i));
+        }
+        scratchSlots_ = std::max(scratchSlots_, static_cast<uint32_t>(values.size()));
+        code().i32(static_cast<int32_t>(values.size()));
+        code().globalGet(runtime_->scratch);
+    } else {
+        for (const auto& arg : args) {
+            value(*arg);
+        }
+    }
+    code().call(runtime_->native(name));
+    result_ = Kind::VALUE;
+    return true;
+}
+
+// a call through the table: callee and arguments are evaluated first, then
+// checked, then the arguments copied to the scratch area
+void WasmGenerator::callValue(const ::Call& expr, bool tail) {
+    value(*expr.callee);
+    auto callee = temporary(I64);
+    code().localSet(callee);
+    std::vector<uint32_t> values;
+    for (const auto& arg : expr.arguments) {
+        value(*arg);
+        values.push_back(temporary(I64));
+        code().localSet(values.back());
+    }
+    auto argc = static_cast<int32_t>(values.size());
+    code().localGet(callee);
+    code().i32(argc);
+    code().i32(expr.paren.line);
+    code().call(runtime_->callee);
+    auto closure = temporary(I32);
+    code().localSet(closure);
+    for (size_t i = 0; i < values.size(); ++i) {
+        code().globalGet(runtime_->scratch);
+        code().localGet(values[i]);
+        code().memory(I64Store, static_cast<uint32_t>(8 * i));
+    }
+    scratchSlots_ = std::max(scratchSlots_, static_cast<uint32_t>(argc));
+    code().localGet(closure);
+    code().i32(argc);
+    code().globalGet(runtime_->scratch);
+    code().localGet(closure);
+    code().memory(I32Load, layout::CLOSURE_SLOT);
+    if (tail) {
+        code().returnCallIndirect(runtime_->callTypeIndex);
+    } else {
+        code().callIndirect(runtime_->callTypeIndex);
+    }
+    result_ = Kind::VALUE;
+}
+
+void WasmGenerator::visit(const Binary& expr) {
+    auto left = expression(*expr.left);
+    auto right = expression(*expr.right);
+    const int line = expr.op.line;
+    bool numbers = left == Kind::NUMBER && right == Kind::NUMBER;
+    auto arithmetic = [&](Op op) {
+        reconcile(left, right, Kind::NUMBER, line, "operands must be numbers");
+        code().op(op);
+        result_ = Kind::NUMBER;
+    };
+    auto comparison = [&](Op op, uint32_t helper) {
+        if (left == Kind::NUMBER || right == Kind::NUMBER) {
+            // with one number known, anything but another fails alike
+            reconcile(left, right, Kind::NUMBER, line, "operands must be numbers");
+            code().op(op);
+        } else {
+            reconcile(left, right, Kind::VALUE, line, "");
+            code().i32(line);
+            code().call(helper);
+        }
+        result_ = Kind::BOOL;
+    };
+
+    switch (expr.op.type) {
+        case TokenType::PLUS:
+            if (numbers) {
+                code().op(F64Add);
+                result_ = Kind::NUMBER;
+                break;
+            }
+            reconcile(left, right, Kind::VALUE, line, "");
+            code().i32(line);
+            code().call(runtime_->add);
+            // with one number known the result is one too
+            if (left == Kind::NUMBER || right == Kind::NUMBER) {
+                code().op(F64ReinterpretI64);
+                result_ = Kind::NUMBER;
+            } else {
+                result_ = Kind::VALUE;
+            }
+            break;
+        case TokenType::MINUS:
+            arithmetic(F64Sub);
+            break;
+        case TokenType::STAR:
+            arithmetic(F64Mul);
+            break;
+        case TokenType::SLASH:
+            arithmetic(F64Div);
+            break;
+        case TokenType::PERCENT:
+            reconcile(left, right, Kind::NUMBER, line, "% operation is between numbers");
+            code().i32(line);
+            code().call(runtime_->modulo);
+            result_ = Kind::NUMBER;
+            break;
+        case TokenType::LESS:
+            comparison(F64Lt, runtime_->less);
+            break;
+        case TokenType::LESS_EQUAL:
+            comparison(F64Le, runtime_->lessEqual);
+            break;
+        case TokenType::GREATER:
+            comparison(F64Gt, runtime_->greater);
+            break;
+        case TokenType::GREATER_EQUAL:
+            comparison(F64Ge, runtime_->greaterEqual);
+            break;
+        case TokenType::EQUAL_EQUAL:
+        case TokenType::BANG_EQUAL: {
+            bool equal = expr.op.type == TokenType::EQUAL_EQUAL;
+            if (numbers) {
+                code().op(equal ? F64Eq : F64Ne);
+            } else if (left == Kind::BOOL && right == Kind::BOOL) {
+                code().op(equal ? I32Eq : I32Ne);
+            } else {
+                reconcile(left, right, Kind::VALUE, line, "");
+                code().call(runtime_->equals);
+                if (!equal) code().op(I32Eqz);
+            }
+            result_ = Kind::BOOL;
+            break;
+        }
+        default:
+            throw std::runtime_error("Invalid binary operator");
+    }
+}
+
+void WasmGenerator::visit(const Logical& expr) {
+    bool isAnd = expr.op.type == TokenType::AND;
+    if (predict(*expr.left) == Kind::BOOL && predict(*expr.right) == Kind::BOOL) {
+        condition(expr);
+        result_ = Kind::BOOL;
+        return;
+    }
+    // the value of whichever operand decided
+    value(*expr.left);
+    auto left = temporary(I64);
+    code().localTee(left);
+    emitTruthy(code());
+    open(If, I64);
+    if (isAnd) {
+        value(*expr.right);
+        code().op(Else);
+        code().localGet(left);
+    } else {
+        code().localGet(left);
+        code().op(Else);
+        value(*expr.right);
+    }
+    close();
+    result_ = Kind::VALUE;
+}
+
+void WasmGenerator::visit(const Ternary& expr) {
+    auto kind = predict(*expr.thenBranch);
+    if (kind != predict(*expr.elseBranch)) kind = Kind::VALUE;
+    condition(*expr.condition);
+    open(If, typeOf(kind));
+    expressionAs(*expr.thenBranch, kind);
+    code().op(Else);
+    expressionAs(*expr.elseBranch, kind);
+    close();
+    result_ = kind;
+}
+
+void WasmGenerator::visit(const Grouping& expr) {
+    result_ = expression(*expr.expression);
+}
+
+void WasmGenerator::visit(const Literal& expr) {
+    if (const auto* number = std::get_if<double>(&expr.value)) {
+        code().f64(*number);
+        result_ = Kind::NUMBER;
+    } else if (const auto* text = std::get_if<std::string>(&expr.value)) {
+        stringValue(*text);
+        result_ = Kind::VALUE;
+    } else if (const auto* boolean = std::get_if<bool>(&expr.value)) {
+        code().i32(*boolean ? 1 : 0);
+        result_ = Kind::BOOL;
+    } else {
+        code().i64(NIL);
+        result_ = Kind::VALUE;
+    }
+}
+
+void WasmGenerator::visit(const Unary& expr) {
+    if (expr.op.type == TokenType::BANG) {
+        condition(*expr.right);
+        code().op(I32Eqz);
+        result_ = Kind::BOOL;
+        return;
+    }
+    number(*expr.right, expr.op.line, "operand must be a number");
+    code().op(F64Neg);
+    result_ = Kind::NUMBER;
+}
+
+void WasmGenerator::visit(const Postfix& expr) {
+    const double delta = expr.op.type == TokenType::PLUS_PLUS ? 1.0 : -1.0;
+    const int line = expr.op.line;
+
+    if (const auto* variable = dynamic_cast<const Variable*>(expr.operand.get())) {
+        auto* binding = resolve(variable->name.lexeme);
+        if (!binding) {
+            raise(variable->name.line, "Undefined global variable '" + variable->name.lexeme + "'.");
+        } else if (binding->number) {
+            code().localGet(binding->index);
+            code().localGet(binding->index);
+            code().f64(delta);
+            code().op(F64Add);
+            code().localSet(binding->index);
+        } else {
+            load(*binding);
+            toNumber(result_, line, "Postfix operator requires a number");
+            auto old = temporary(F64);
+            code().localTee(old);
+            code().f64(delta);
+            code().op(F64Add);
+            store(*binding, Kind::NUMBER);
+            code().op(Drop);
+            code().localGet(old);
+        }
+        result_ = Kind::NUMBER;
+        return;
+    }
+
+    if (const auto* subscript = dynamic_cast<const Subscript*>(expr.operand.get())) {
+        value(*subscript->object);
+        value(*subscript->index);
+        code().f64(delta);
+        code().i32(subscript->bracket.line);
+        code().call(runtime_->postfixIndex);
+        result_ = Kind::NUMBER;
+        return;
+    }
+
+    if (const auto* property = dynamic_cast<const PropertyAccess*>(expr.operand.get())) {
+        value(*property->object);
+        stringValue(property->name.lexeme);
+        code().f64(delta);
+        code().i32(property->name.line);
+        code().call(runtime_->postfixIndex);
+        result_ = Kind::NUMBER;
+        return;
+    }
+
+    throw std::runtime_error("Invalid postfix operand");
+}
+
+void WasmGenerator::visit(const Variable& expr) {
+    auto* binding = resolve(expr.name.lexeme);
+    if (!binding) {
+        raise(expr.name.line, "Undefined global variable '" + expr.name.lexeme + "'.");
+        result_ = Kind::VALUE;
+        return;
+    }
+    load(*binding);
+}
+
+void WasmGenerator::visit(const Assignment& expr) {
+    auto kind = expression(*expr.right);
+    auto* binding = resolve(expr.name.lexeme);
+    if (!binding) {
+        raise(expr.name.line, "Undefined global variable '" + expr.name.lexeme + "'.");
+        result_ = Kind::VALUE;
+        return;
+    }
+    store(*binding, kind);
+}
+
+void WasmGenerator::visit(const SubscriptAssignment& expr) {
+    value(*expr.object);
+    auto index = expression(*expr.index);
+    bool numbered = index == Kind::NUMBER;
+    if (!numbered) toValue(index);
+    value(*expr.value);
+    code().i32(expr.bracket.line);
+    code().call(numbered ? runtime_->setIndexNumber : runtime_->setIndex);
+    result_ = Kind::VALUE;
+}
+
+void WasmGenerator::visit(const ::Call& expr) {
+    bool tail = std::exchange(tailPosition_, false);
+    if (const auto* variable = dynamic_cast<const Variable*>(expr.callee.get())) {
+        const auto& name = variable->name.lexeme;
+        const auto* binding = resolve(name);
+        if (binding && binding->storage == Binding::Storage::GLOBAL) {
+            auto direct = directFunctions_.find(name);
+            if (direct != directFunctions_.end() && direct->second.arity == expr.arguments.size()) {
+                for (const auto& arg : expr.arguments) {
+                    value(*arg);
+                }
+                if (tail) {
+                    code().returnCall(direct->second.function);
+                } else {
+                    code().call(direct->second.function);
+                }
+                result_ = Kind::VALUE;
+                return;
+            }
+            if (directNatives_.contains(name) && callNative(name, expr)) return;
+        }
+    }
+    callValue(expr, tail);
+}
+
+void WasmGenerator::visit(const ArrayLiteral& expr) {
+    code().i32(static_cast<int32_t>(expr.elements.size()));
+    code().call(runtime_->newArray);
+    auto array = temporary(I32);
+    code().localSet(array);
+    for (const auto& element : expr.elements) {
+        code().localGet(array);
+        value(*element);
+        code().call(runtime_->arrayPush);
+    }
+    code().localGet(array);
+    emitBox(code(), ARRAY_TAG);
+    result_ = Kind::VALUE;
+}
+
+void WasmGenerator::visit(const MapLiteral& expr) {
+    code().call(runtime_->newMap);
+    auto map = temporary(I32);
+    code().localSet(map);
+    for (const auto& [key, element] : expr.pairs) {
+        code().localGet(map);
+        value(*key);
+        value(*element);
+        code().call(runtime_->mapSet);
+    }
+    code().localGet(map);
+    emitBox(code(), MAP_TAG);
+    result_ = Kind::VALUE;
+}
+
+void WasmGenerator::visit(const Subscript& expr) {
+    value(*expr.object);
+    auto index = expression(*expr.index);
+    bool numbered = index == Kind::NUMBER;
+    if (!numbered) toValue(index);
+    code().i32(expr.bracket.line);
+    code().call(numbered ? runtime_->getIndexNumber : runtime_->getIndex);
+    result_ = Kind::VALUE;
+}
+
+void WasmGenerator::visit(const PropertyAccess& expr) {
+    value(*expr.object);
+    code().i32(static_cast<int32_t>(runtime_->string(expr.name.lexeme)));
+    code().i32(expr.name.line);
+    code().call(runtime_->getProperty);
+    result_ = Kind::VALUE;
+}
+
+void WasmGenerator::visit(const FunctionExpr& expr) {
+    closure("<anonymous fn>", expr.params, *expr.body);
+}
+
+void WasmGenerator::visit(const ExpressionStmt& stmt) {
+    expression(*stmt.expr);
+    code().op(Drop);
+}
+
+void WasmGenerator::visit(const PrintStmt& stmt) {
+    value(*stmt.expr);
+    code().call(runtime_->print);
+}
+
+void WasmGenerator::visit(const VarStmt& stmt) {
+    auto initializer = [&] {
+        if (stmt.initializer) return expression(*stmt.initializer);
+        code().i64(NIL);
+        return Kind::VALUE;
+    };
+    const auto& name = stmt.name.lexeme;
+    if (scopes_.size() == 1 || scopes_.back().contains(name)) { // a global, or a redeclaration
+        auto kind = initializer();
+        store(scopes_.back().at(name), kind);
+        code().op(Drop);
+        return;
+    }
+    // declared first: a function in the initializer may refer to it, and
+    // then captures it, so the cell exists before the initializer runs
+    const auto binding = declare(stmt.name, &stmt);
+    if (binding.storage == Binding::Storage::CELL) {
+        code().i64(NIL);
+        code().call(runtime_->cell);
+        code().localSet(binding.index);
+        auto kind = initializer();
+        store(scopes_.back().at(name), kind);
+        code().op(Drop);
+        return;
+    }
+    auto kind = initializer();
+    if (binding.number) {
+        if (kind != Kind::NUMBER) {
+            toValue(kind);
+            code().op(F64ReinterpretI64);
+        }
+    } else {
+        toValue(kind);
+    }
+    code().localSet(binding.index);
+}
+
+void WasmGenerator::visit(const BlockStmt& stmt) {
+    scopes_.emplace_back();
+    for (const auto& inner : stmt.statements) {
+        emitStatement(*inner);
+    }
+    scopes_.pop_back();
+}
+
+void WasmGenerator::visit(const IfStmt& stmt) {
+    condition(*stmt.condition);
+    open(If);
+    emitStatement(*stmt.thenBlock);
+    if (stmt.elseBlock) {
+        code().op(Else);
+        emitStatement(*stmt.elseBlock);
+    }
+    close();
+}
+
+// block $break (loop $top (br_if $break !cond) (block $continue body) increment (br $top))
+void WasmGenerator::visit(const WhileStmt& stmt) {
+    open(Block);
+    int exit = function().blocks;
+    open(Loop);
+    condition(*stmt.condition);
+    code().op(I32Eqz);
+    code().brIf(function().blocks - exit);
+    open(Block);
+    function().loops.emplace_back(exit, function().blocks);
+    emitStatement(*stmt.body);
+    function().loops.pop_back();
+    close();
+    if (stmt.increment) {
+        expression(*stmt.increment);
+        code().op(Drop);
+    }
+    code().br(0);
+    close();
+    close();
+}
+
+void WasmGenerator::visit(const FunctionStmt& stmt) {
+    const auto& name = stmt.name.lexeme;
+    const auto display = "<fn " + name + ">";
+    if (scopes_.size() == 1) {
+        auto& binding = scopes_[0].at(name);
+        auto direct = directFunctions_.find(name);
+        if (direct != directFunctions_.end()) {
+            code().i64(hoist(stmt, direct->second));
+        } else {
+            closure(display, stmt.params, *stmt.body);
+        }
+        code().globalSet(global(binding));
+        return;
+    }
+
+    if (scopes_.back().contains(name)) { // a redeclaration
+        closure(display, stmt.params, *stmt.body);
+        store(scopes_.back().at(name), Kind::VALUE);
+        code().op(Drop);
+        return;
+    }
+    // declared first: the body may call it
+    const auto& binding = declare(stmt.name, &stmt);
+    if (binding.storage == Binding::Storage::CELL) {
+        code().i64(NIL);
+        code().call(runtime_->cell);
+        code().localSet(binding.index);
+        closure(display, stmt.params, *stmt.body);
+        store(scopes_.back().at(name), Kind::VALUE);
+        code().op(Drop);
+    } else {
+        closure(display, stmt.params, *stmt.body);
+        code().localSet(binding.index);
+    }
+}
+
+void WasmGenerator::visit(const ReturnStmt& stmt) {
+    if (stmt.value) {
+        returnValue(*stmt.value);
+        return;
+    }
+    code().i64(NIL);
+    code().op(Return);
+}
+
+// Returns the value of expr. A call in tail position, also in either arm of
+// a ternary, reuses the caller's frame (return_call), as in beat.
+void WasmGenerator::returnValue(const Expr& expr) {
+    if (const auto* grouping = dynamic_cast<const Grouping*>(&expr)) {
+        returnValue(*grouping->expression);
+        return;
+    }
+    if (const auto* ternary = dynamic_cast<const Ternary*>(&expr)) {
+        condition(*ternary->condition);
+        open(If);
+        returnValue(*ternary->thenBranch);
+        code().op(Else);
+        returnValue(*ternary->elseBranch);
+        close();
+        code().op(Unreachable); // both arms returned
+        return;
+    }
+    tailPosition_ = dynamic_cast<const ::Call*>(&expr) != nullptr;
+    value(expr);
+    tailPosition_ = false;
+    code().op(Return);
+}
+
+void WasmGenerator::visit(const BreakStmt&) {
+    code().br(function().blocks - function().loops.back().first);
+}
+
+void WasmGenerator::visit(const ContinueStmt&) {
+    code().br(function().blocks - function().loops.back().second);
+}
+
+}  // namespace transpose
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "expr.hpp"
+#include "statement.hpp"
+#include "transpose/wasm_module.hpp"
+#include "transpose/wasm_runtime.hpp"
+#include "type_inference.hpp"
+
+namespace transpose {
+
+// Translates a resolved program into a WebAssembly module exporting run().
+// Values are NaN-boxed i64s (see wasm_runtime.hpp); locals TypeInference
+// proves to be numbers are f64 locals, and locals a closure captures live in
+// cells in linear memory. Top-level functions that are never redefined
+// become WebAssembly functions called directly, with return_call for calls
+// in tail position; every other call goes through the function table.
+class WasmGenerator : public ExprVisitor, public StmtVisitor {
+public:
+    explicit WasmGenerator(const TypeInference& types);
+    std::string generate(const std::vector<std::unique_ptr<Stmt>>& statements);
+
+private:
+    // what an expression leaves on the stack: a value (i64), or an f64 or
+    // i32 boolean where the generator knows the type
+    enum class Kind { VALUE, NUMBER, BOOL };
+    struct Binding {
+        enum class Storage { GLOBAL, LOCAL, CELL };
+        Storage storage = Storage::LOCAL;
+        uint32_t index = 0;    // the wasm global, or the local of the function owning it
+        bool number = false;   // an f64 local
+        size_t function = 0;   // depth of the function owning a local
+        std::string native;    // a native whose global is not made yet
+    };
+    struct Function {
+        explicit Function(const wasm::FuncType& type) : code(type) {}
+        wasm::Code code;
+        std::vector<const Binding*> captured; // the cells its closure carries, in order
+        std::vector<std::pair<int, int>> loops; // block depths of break and continue
+        int blocks = 0;
+        std::unordered_map<uint8_t, std::vector<uint32_t>> temporaries;
+        std::unordered_map<uint8_t, size_t> temporariesUsed;
+    };
+    struct DirectFunction {
+        uint32_t function;
+        size_t arity;
+    };
+
+    const TypeInference& types_;
+    std::unique_ptr<wasm::Module> module_;
+    std::unique_ptr<wasm::Runtime> runtime_;
+    std::unordered_set<const void*> captured_;
+    std::set<std::string> assigned_;
+    std::vector<std::unordered_map<std::string, Binding>> scopes_; // [0] holds the globals
+    std::vector<std::unique_ptr<Function>> functions_; // [0] is run()
+    std::unordered_map<std::string, DirectFunction> directFunctions_;
+    std::unordered_set<std::string> directNatives_;
+    uint32_t scratchSlots_ = 0;
+    bool tailPosition_ = false;
+    Kind result_ = Kind::VALUE;
+
+    static wasm::ValType typeOf(Kind kind);
+    Function& function() { return *functions_.back(); }
+    wasm::Code& code() { return functions_.back()->code; }
+    uint32_t temporary(wasm::ValType type);
+    void open(wasm::Op opcode);
+    void open(wasm::Op opcode, wasm::ValType result);
+    void close();
+
+    void emitStatement(const Stmt& stmt);
+    Kind expression(const Expr& expr);
+    void value(const Expr& expr);
+    void toValue(Kind kind);
+    void toNumber(Kind kind, int line, const std::string& message);
+    void number(const Expr& expr, int line, const std::string& message);
+    void reconcile(Kind left, Kind right, Kind target, int line, const std::string& message);
+    void condition(const Expr& expr);
+    Kind predict(const Expr& expr);
+    void expressionAs(const Expr& expr, Kind kind);
+    void raise(int line, const std::string& message);
+    void stringValue(const std::string& text);
+
+    Binding* resolve(const std::string& name);
+    Binding& declare(const Token& name, const void* node);
+    uint32_t global(Binding& binding);
+    void cellAddress(const Binding& binding);
+    void load(Binding& binding);
+    void store(Binding& binding, Kind kind);
+    void functionBody(const std::vector<Token>& params, const BlockStmt& body, bool direct);
+    void closure(const std::string& display, const std::vector<Token>& params, const BlockStmt& body);
+    int64_t hoist(const FunctionStmt& stmt, const DirectFunction& direct);
+    bool callNative(const std::string& name, const Call& expr);
+    void callValue(const Call& expr, bool tail);
+    void returnValue(const Expr& expr);
+
+    // ExprVisitor overrides
+    void visit(const Binary& expr) override;
+    void visit(const Logical& expr) override;
+    void visit(const Ternary& expr) override;
+    void visit(const Grouping& expr) override;
+    void visit(const Literal& expr) override;
+    void visit(const Unary& expr) override;
+    void visit(const Postfix& expr) override;
+    void visit(const Variable& expr) override;
+    void visit(const Assignment& expr) override;
+    void visit(const SubscriptAssignment& expr) override;
+    void visit(const Call& expr) override;
+    void visit(const ArrayLiteral& expr) override;
+    void visit(const MapLiteral& expr) override;
+    void visit(const Subscript& expr) override;
+    void visit(const PropertyAccess& expr) override;
+    void visit(const FunctionExpr& expr) override;
+
+    // StmtVisitor overrides
+    void visit(const ExpressionStmt& stmt) override;
+    void visit(const PrintStmt& stmt) override;
+    void visit(const VarStmt& stmt) override;
+    void visit(const BlockStmt& stmt) override;
+    void visit(const IfStmt& stmt) override;
+    void visit(const WhileStmt& stmt) override;
+    void visit(const FunctionStmt& stmt) override;
+    void visit(const ReturnStmt& stmt) override;
+    void visit(const BreakStmt& stmt) override;
+    void visit(const ContinueStmt& stmt) override;
+};
+
+}  // namespace transpose
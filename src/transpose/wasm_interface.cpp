@@ -5,6 +5,7 @@
 #include <stdexcept>
 
 #include "transpose/transpiler.hpp"
+#include "transpose/wasm_transpiler.hpp"
 
 bool noLoop = false;
 
@@ -23,6 +24,15 @@ std::string compileToJavascript(const std::string& source) {
     }
 }
 
+std::string compileToMinifiedJavascript(const std::string& source) {
+    try {
+        return transpose::transpileToJavascript(source, true);
+    } catch (const std::exception& e) {
+        emscripten::val::global("Error").new_(std::string(e.what())).throw_();
+        return "";  // Never reached
+    }
+}
+
 std::string compileToJavascriptUserCodeOnly(const std::string& source) {
     try {
         return transpose::transpileToJavascriptUserCodeOnly(source);
@@ -35,6 +45,42 @@ std::string compileToJavascriptUserCodeOnly(const std::string& source) {
     }
 }
 
+// The program as a WebAssembly module, with the JavaScript runtime and the
+// loader that runs it (see wasmLoader()).
+std::string compileToWasmJavascript(const std::string& source) {
+    try {
+        return transpose::transpileToWasmJavascript(source);
+    } catch (const std::exception& e) {
+        emscripten::val::global("Error").new_(std::string(e.what())).throw_();
+        return "";  // Never reached
+    }
+}
+
+// One session for the playground, so that compiling after an edit redoes
+// only the statements it touched.
+transpose::IncrementalTranspiler& session() {
+    static transpose::IncrementalTranspiler transpiler;
+    return transpiler;
+}
+
+std::string compileIncrementally(const std::string& source) {
+    try {
+        return session().transpile(source);
+    } catch (const std::exception& e) {
+        emscripten::val::global("Error").new_(std::string(e.what())).throw_();
+        return "";  // Never reached
+    }
+}
+
+std::string compileIncrementallyUserCodeOnly(const std::string& source) {
+    try {
+        return session().transpileUserCodeOnly(source);
+    } catch (const std::exception& e) {
+        emscripten::val::global("Error").new_(std::string(e.what())).throw_();
+        return "";  // Never reached
+    }
+}
+
 void setNoLoopFlag(bool value) {
     noLoop = value;
 }
@@ -43,7 +89,11 @@ void setNoLoopFlag(bool value) {
 
 EMSCRIPTEN_BINDINGS(transpose_module) {
     emscripten::function("compile", &compileToJavascript);
+    emscripten::function("compileMinified", &compileToMinifiedJavascript);
     emscripten::function("compileUserCodeOnly", &compileToJavascriptUserCodeOnly);
+    emscripten::function("compileWasm", &compileToWasmJavascript);
+    emscripten::function("compileIncremental", &compileIncrementally);
+    emscripten::function("compileIncrementalUserCodeOnly", &compileIncrementallyUserCodeOnly);
     emscripten::function("setNoLoop", &setNoLoopFlag);
 }
 
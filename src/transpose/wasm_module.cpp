@@ -0,0 +1,321 @@
+#include "transpose/wasm_module.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace transpose::wasm {
+
+namespace {
+
+void unsignedLeb(std::string& out, uint64_t value) {
+    do {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        if (value != 0) byte |= 0x80;
+        out.push_back(static_cast<char>(byte));
+    } while (value != 0);
+}
+
+void signedLeb(std::string& out, int64_t value) {
+    while (true) {
+        uint8_t byte = value & 0x7F;
+        value >>= 7; // arithmetic
+        bool done = (value == 0 && !(byte & 0x40)) || (value == -1 && (byte & 0x40));
+        if (!done) byte |= 0x80;
+        out.push_back(static_cast<char>(byte));
+        if (done) return;
+    }
+}
+
+void name(std::string& out, const std::string& text) {
+    unsignedLeb(out, text.size());
+    out += text;
+}
+
+void section(std::string& out, uint8_t id, const std::string& contents) {
+    out.push_back(static_cast<char>(id));
+    unsignedLeb(out, contents.size());
+    out += contents;
+}
+
+void valueTypes(std::string& out, const std::vector<ValType>& types) {
+    unsignedLeb(out, types.size());
+    for (auto type : types) {
+        out.push_back(static_cast<char>(type));
+    }
+}
+
+}  // namespace
+
+Code::Code(const FuncType& type) : paramCount_(type.params.size()), params_(type.params) {}
+
+uint32_t Code::addLocal(ValType type) {
+    locals_.push_back(type);
+    return static_cast<uint32_t>(paramCount_ + locals_.size() - 1);
+}
+
+ValType Code::localType(uint32_t index) const {
+    return index < paramCount_ ? params_[index] : locals_[index - paramCount_];
+}
+
+void Code::indexed(Op opcode, uint32_t index) {
+    std::string leb;
+    unsignedLeb(leb, index);
+    bytes_.push_back(opcode);
+    bytes_.insert(bytes_.end(), leb.begin(), leb.end());
+}
+
+void Code::i32(int32_t value) {
+    std::string leb;
+    signedLeb(leb, value);
+    bytes_.push_back(I32Const);
+    bytes_.insert(bytes_.end(), leb.begin(), leb.end());
+}
+
+void Code::i64(int64_t value) {
+    std::string leb;
+    signedLeb(leb, value);
+    bytes_.push_back(I64Const);
+    bytes_.insert(bytes_.end(), leb.begin(), leb.end());
+}
+
+void Code::f64(double value) {
+    uint8_t raw[8];
+    std::memcpy(raw, &value, sizeof raw); // little-endian hosts only, as everywhere else
+    bytes_.push_back(F64Const);
+    bytes_.insert(bytes_.end(), raw, raw + sizeof raw);
+}
+
+void Code::callIndirect(uint32_t type) {
+    indexed(CallIndirect, type);
+    bytes_.push_back(0); // table 0
+}
+
+void Code::returnCallIndirect(uint32_t type) {
+    indexed(ReturnCallIndirect, type);
+    bytes_.push_back(0);
+}
+
+void Code::block(Op opcode) {
+    bytes_.push_back(opcode);
+    bytes_.push_back(0x40);
+}
+
+void Code::block(Op opcode, ValType result) {
+    bytes_.push_back(opcode);
+    bytes_.push_back(static_cast<uint8_t>(result));
+}
+
+void Code::memory(Op opcode, uint32_t offset) {
+    uint32_t alignment = 0;
+    switch (opcode) {
+        case I32Load: case I32Store: alignment = 2; break;
+        case I64Load: case I64Store: case F64Load: case F64Store: alignment = 3; break;
+        case I32Load8U: case I32Store8: alignment = 0; break;
+        default: throw std::logic_error("not a memory instruction");
+    }
+    std::string immediates;
+    unsignedLeb(immediates, alignment);
+    unsignedLeb(immediates, offset);
+    bytes_.push_back(opcode);
+    bytes_.insert(bytes_.end(), immediates.begin(), immediates.end());
+}
+
+void Code::memoryCopy() {
+    bytes_.insert(bytes_.end(), {0xFC, 10, 0, 0});
+}
+
+void Code::memorySize() {
+    bytes_.insert(bytes_.end(), {MemorySize, 0});
+}
+
+void Code::memoryGrow() {
+    bytes_.insert(bytes_.end(), {MemoryGrow, 0});
+}
+
+void Code::prepend(const Code& other) {
+    bytes_.insert(bytes_.begin(), other.bytes_.begin(), other.bytes_.end());
+}
+
+std::string Code::encode() const {
+    std::string body;
+    // locals are declared in runs of one type
+    std::vector<std::pair<uint32_t, ValType>> runs;
+    for (auto type : locals_) {
+        if (!runs.empty() && runs.back().second == type) {
+            runs.back().first++;
+        } else {
+            runs.emplace_back(1, type);
+        }
+    }
+    unsignedLeb(body, runs.size());
+    for (const auto& [count, type] : runs) {
+        unsignedLeb(body, count);
+        body.push_back(static_cast<char>(type));
+    }
+    body.append(bytes_.begin(), bytes_.end());
+    body.push_back(static_cast<char>(End));
+    std::string out;
+    unsignedLeb(out, body.size());
+    return out + body;
+}
+
+uint32_t Module::type(const FuncType& type) {
+    for (size_t i = 0; i < types_.size(); ++i) {
+        if (types_[i] == type) return static_cast<uint32_t>(i);
+    }
+    types_.push_back(type);
+    return static_cast<uint32_t>(types_.size() - 1);
+}
+
+uint32_t Module::importFunction(const std::string& module, const std::string& name, const FuncType& type) {
+    if (!functionTypes_.empty()) throw std::logic_error("imports must come before functions");
+    imports_.push_back({module, name, this->type(type)});
+    return static_cast<uint32_t>(imports_.size() - 1);
+}
+
+uint32_t Module::declareFunction(const FuncType& type) {
+    functionTypes_.push_back(this->type(type));
+    bodies_.emplace_back();
+    return static_cast<uint32_t>(imports_.size() + functionTypes_.size() - 1);
+}
+
+void Module::defineFunction(uint32_t function, const Code& code) {
+    bodies_.at(function - imports_.size()) = code.encode();
+}
+
+const FuncType& Module::functionType(uint32_t function) const {
+    if (function < imports_.size()) return types_[imports_[function].type];
+    return types_[functionTypes_.at(function - imports_.size())];
+}
+
+uint32_t Module::addGlobal(ValType type, int64_t initial) {
+    globals_.push_back({type, initial});
+    return static_cast<uint32_t>(globals_.size() - 1);
+}
+
+void Module::setGlobal(uint32_t global, int64_t initial) {
+    globals_.at(global).initial = initial;
+}
+
+uint32_t Module::tableEntry(uint32_t function) {
+    table_.push_back(function);
+    return static_cast<uint32_t>(table_.size() - 1);
+}
+
+uint32_t Module::data(const std::string& bytes) {
+    uint32_t address = dataEnd();
+    data_ += bytes;
+    data_.resize((data_.size() + 7) & ~size_t{7}, '\0');
+    return address;
+}
+
+void Module::exportFunction(const std::string& name, uint32_t function) {
+    exports_.push_back({name, 0, function});
+}
+
+void Module::exportMemory(const std::string& name) {
+    exports_.push_back({name, 2, 0});
+}
+
+std::string Module::encode() const {
+    std::string out("\0asm\1\0\0\0", 8);
+
+    std::string types;
+    unsignedLeb(types, types_.size());
+    for (const auto& type : types_) {
+        types.push_back(0x60);
+        valueTypes(types, type.params);
+        valueTypes(types, type.results);
+    }
+    section(out, 1, types);
+
+    std::string imports;
+    unsignedLeb(imports, imports_.size());
+    for (const auto& import : imports_) {
+        name(imports, import.module);
+        name(imports, import.name);
+        imports.push_back(0); // a function
+        unsignedLeb(imports, import.type);
+    }
+    section(out, 2, imports);
+
+    std::string functions;
+    unsignedLeb(functions, functionTypes_.size());
+    for (auto type : functionTypes_) {
+        unsignedLeb(functions, type);
+    }
+    section(out, 3, functions);
+
+    std::string table;
+    unsignedLeb(table, 1);
+    table.push_back(0x70); // funcref
+    table.push_back(0);    // no maximum
+    unsignedLeb(table, table_.size());
+    section(out, 4, table);
+
+    std::string memory;
+    unsignedLeb(memory, 1);
+    memory.push_back(0);
+    unsignedLeb(memory, (std::max(minimumMemory_, dataEnd()) + 0xFFFF) / 0x10000);
+    section(out, 5, memory);
+
+    std::string globals;
+    unsignedLeb(globals, globals_.size());
+    for (const auto& global : globals_) {
+        globals.push_back(static_cast<char>(global.type));
+        globals.push_back(1); // mutable
+        if (global.type == ValType::I32) {
+            globals.push_back(static_cast<char>(I32Const));
+        } else {
+            globals.push_back(static_cast<char>(I64Const));
+        }
+        signedLeb(globals, global.initial);
+        globals.push_back(static_cast<char>(End));
+    }
+    section(out, 6, globals);
+
+    std::string exports;
+    unsignedLeb(exports, exports_.size());
+    for (const auto& entry : exports_) {
+        name(exports, entry.name);
+        exports.push_back(static_cast<char>(entry.kind));
+        unsignedLeb(exports, entry.index);
+    }
+    section(out, 7, exports);
+
+    std::string elements;
+    unsignedLeb(elements, 1);
+    unsignedLeb(elements, 0); // active, table 0
+    elements.push_back(static_cast<char>(I32Const));
+    signedLeb(elements, 0);
+    elements.push_back(static_cast<char>(End));
+    unsignedLeb(elements, table_.size());
+    for (auto function : table_) {
+        unsignedLeb(elements, function);
+    }
+    section(out, 9, elements);
+
+    std::string code;
+    unsignedLeb(code, bodies_.size());
+    for (const auto& body : bodies_) {
+        if (body.empty()) throw std::logic_error("function declared but never defined");
+        code += body;
+    }
+    section(out, 10, code);
+
+    std::string data;
+    unsignedLeb(data, 1);
+    unsignedLeb(data, 0); // active, memory 0
+    data.push_back(static_cast<char>(I32Const));
+    signedLeb(data, dataBase);
+    data.push_back(static_cast<char>(End));
+    unsignedLeb(data, data_.size());
+    data += data_;
+    section(out, 11, data);
+
+    return out;
+}
+
+}  // namespace transpose::wasm
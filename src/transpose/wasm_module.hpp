@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace transpose::wasm {
+
+enum class ValType : uint8_t { I32 = 0x7F, I64 = 0x7E, F64 = 0x7C };
+
+struct FuncType {
+    std::vector<ValType> params;
+    std::vector<ValType> results;
+
+    bool operator==(const FuncType& other) const = default;
+};
+
+// the opcodes the backend uses
+enum Op : uint8_t {
+    Unreachable = 0x00, Block = 0x02, Loop = 0x03, If = 0x04, Else = 0x05, End = 0x0B,
+    Br = 0x0C, BrIf = 0x0D, Return = 0x0F, Call = 0x10, CallIndirect = 0x11, ReturnCall = 0x12,
+    ReturnCallIndirect = 0x13,
+    Drop = 0x1A, Select = 0x1B,
+    LocalGet = 0x20, LocalSet = 0x21, LocalTee = 0x22, GlobalGet = 0x23, GlobalSet = 0x24,
+    I32Load = 0x28, I64Load = 0x29, F64Load = 0x2B, I32Load8U = 0x2D,
+    I32Store = 0x36, I64Store = 0x37, F64Store = 0x39, I32Store8 = 0x3A,
+    MemorySize = 0x3F, MemoryGrow = 0x40,
+    I32Const = 0x41, I64Const = 0x42, F64Const = 0x44,
+    I32Eqz = 0x45, I32Eq = 0x46, I32Ne = 0x47, I32LtS = 0x48, I32LtU = 0x49, I32GtS = 0x4A, I32GtU = 0x4B,
+    I32LeS = 0x4C, I32LeU = 0x4D, I32GeS = 0x4E, I32GeU = 0x4F,
+    I64Eqz = 0x50, I64Eq = 0x51, I64Ne = 0x52, I64GtU = 0x56,
+    F64Eq = 0x61, F64Ne = 0x62, F64Lt = 0x63, F64Gt = 0x64, F64Le = 0x65, F64Ge = 0x66,
+    I32Clz = 0x67, I32Add = 0x6A, I32Sub = 0x6B, I32Mul = 0x6C, I32DivU = 0x6E, I32And = 0x71, I32Or = 0x72,
+    I32Xor = 0x73, I32Shl = 0x74, I32ShrU = 0x76,
+    I64Add = 0x7C, I64Sub = 0x7D, I64Mul = 0x7E, I64RemS = 0x81, I64And = 0x83, I64Or = 0x84, I64Xor = 0x85, I64Shl = 0x86,
+    I64ShrU = 0x88,
+    F64Abs = 0x99, F64Neg = 0x9A, F64Ceil = 0x9B, F64Floor = 0x9C, F64Trunc = 0x9D, F64Sqrt = 0x9F,
+    F64Add = 0xA0, F64Sub = 0xA1, F64Mul = 0xA2, F64Div = 0xA3,
+    I32WrapI64 = 0xA7, I32TruncF64U = 0xAB, I64ExtendI32U = 0xAD, I64TruncF64S = 0xB0, F64ConvertI32U = 0xB8,
+    F64ConvertI64S = 0xB9,
+    I64ReinterpretF64 = 0xBD, F64ReinterpretI64 = 0xBF,
+};
+
+// The body of one function under construction: its extra locals and its
+// instructions, appended in order.
+class Code {
+public:
+    explicit Code(const FuncType& type);
+
+    uint32_t addLocal(ValType type);
+    ValType localType(uint32_t index) const;
+
+    void op(Op opcode) { bytes_.push_back(opcode); }
+    void i32(int32_t value);
+    void i64(int64_t value);
+    void f64(double value);
+    void localGet(uint32_t index) { indexed(LocalGet, index); }
+    void localSet(uint32_t index) { indexed(LocalSet, index); }
+    void localTee(uint32_t index) { indexed(LocalTee, index); }
+    void globalGet(uint32_t index) { indexed(GlobalGet, index); }
+    void globalSet(uint32_t index) { indexed(GlobalSet, index); }
+    void call(uint32_t function) { indexed(Call, function); }
+    void returnCall(uint32_t function) { indexed(ReturnCall, function); }
+    void callIndirect(uint32_t type);
+    void returnCallIndirect(uint32_t type);
+    // a block, loop or if with no result or with one result
+    void block(Op opcode);
+    void block(Op opcode, ValType result);
+    void br(uint32_t depth) { indexed(Br, depth); }
+    void brIf(uint32_t depth) { indexed(BrIf, depth); }
+    // loads and stores, naturally aligned
+    void memory(Op opcode, uint32_t offset = 0);
+    void memoryCopy();
+    void memorySize();
+    void memoryGrow();
+
+    // code emitted elsewhere (without locals of its own) goes first
+    void prepend(const Code& other);
+    std::string encode() const;
+
+private:
+    size_t paramCount_;
+    std::vector<ValType> params_;
+    std::vector<ValType> locals_;
+    std::vector<uint8_t> bytes_;
+
+    void indexed(Op opcode, uint32_t index);
+};
+
+// A module being assembled: functions get their indices when they are
+// declared, so they can call each other before they are defined. Imports
+// have to be declared before any function.
+class Module {
+public:
+    uint32_t type(const FuncType& type);
+    uint32_t importFunction(const std::string& module, const std::string& name, const FuncType& type);
+    uint32_t declareFunction(const FuncType& type);
+    void defineFunction(uint32_t function, const Code& code);
+    const FuncType& functionType(uint32_t function) const;
+    uint32_t addGlobal(ValType type, int64_t initial);
+    void setGlobal(uint32_t global, int64_t initial);
+    // a slot of the function table, for call_indirect
+    uint32_t tableEntry(uint32_t function);
+    // static data, 8-byte aligned; returns its address
+    uint32_t data(const std::string& bytes);
+    uint32_t dataEnd() const { return dataBase + static_cast<uint32_t>(data_.size()); }
+    void setMinimumMemory(uint32_t bytes) { minimumMemory_ = bytes; }
+    void exportFunction(const std::string& name, uint32_t function);
+    void exportMemory(const std::string& name);
+
+    std::string encode() const;
+
+    static constexpr uint32_t dataBase = 16; // 0 stays an invalid address
+
+private:
+    struct Import {
+        std::string module;
+        std::string name;
+        uint32_t type;
+    };
+    struct Global {
+        ValType type;
+        int64_t initial;
+    };
+    struct Export {
+        std::string name;
+        uint8_t kind;
+        uint32_t index;
+    };
+
+    std::vector<FuncType> types_;
+    std::vector<Import> imports_;
+    std::vector<uint32_t> functionTypes_; // of defined functions
+    std::vector<std::string> bodies_;
+    std::vector<Global> globals_;
+    std::vector<uint32_t> table_;
+    std::string data_;
+    uint32_t minimumMemory_ = 0;
+    std::vector<Export> exports_;
+};
+
+}  // namespace transpose::wasm
@@ -0,0 +1,1874 @@
+#include "transpose/wasm_runtime.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+namespace transpose::wasm {
+
+using namespace layout;
+
+namespace {
+
+constexpr ValType I32 = ValType::I32;
+constexpr ValType I64 = ValType::I64;
+constexpr ValType F64 = ValType::F64;
+
+constexpr uint32_t noLine = std::numeric_limits<uint32_t>::max();
+
+struct NativeFunction {
+    const char* name;
+    int arity;
+    const char* display;
+    int host; // index into the loader's hostNatives, or -1
+};
+
+// the natives as the JS runtime defines them; the cold ones stay in
+// JavaScript and are reached through the host import
+const NativeFunction natives[] = {
+    {"clock", 0, "<native fn>", -1},        {"printf", -1, "<native printf>", 0},
+    {"sprintf", -1, "<native printf>", 1},  {"len", 1, "<native fn>", -1},
+    {"push", 2, "<native fn>", -1},         {"pop", 1, "<native fn>", -1},
+    {"readline", 0, "<native fn>", 2},      {"split", 2, "<native fn>", 3},
+    {"assert", -1, "<native fn>", 11},      {"for_each", 2, "<native fn>", -1},
+    {"tonumber", 1, "<native fn>", 4},      {"slurp", 0, "<native fn>", 5},
+    {"keys", 1, "<native fn>", 6},          {"floor", 1, "<native fn>", -1},
+    {"ceil", 1, "<native fn>", -1},         {"sin", 1, "<native fn>", -1},
+    {"cos", 1, "<native fn>", -1},          {"tan", 1, "<native fn>", -1},
+    {"asin", 1, "<native fn>", -1},         {"acos", 1, "<native fn>", -1},
+    {"atan", 1, "<native fn>", -1},         {"log", 1, "<native fn>", -1},
+    {"log10", 1, "<native fn>", -1},        {"sqrt", 1, "<native fn>", -1},
+    {"exp", 1, "<native fn>", -1},          {"fabs", 1, "<native fn>", -1},
+    {"pow", 2, "<native fn>", -1},          {"atan2", 2, "<native fn>", -1},
+    {"fmod", 2, "<native fn>", -1},         {"from_json", 1, "<native fn>", 7},
+    {"to_json", 1, "<native fn>", 8},       {"inf", 0, "<native fn>", -1},
+    {"substring", 3, "<native fn>", 9},     {"random_int", 3, "<native fn>", 10},
+};
+
+const NativeFunction& findNative(const std::string& name) {
+    for (const auto& native : natives) {
+        if (name == native.name) return native;
+    }
+    throw std::logic_error("no native named " + name);
+}
+
+const char* const imported1[] = {"sin", "cos", "tan", "asin", "acos", "atan", "log", "log10", "exp"};
+const char* const imported2[] = {"pow", "atan2", "fmod"};
+
+void appendU32(std::string& out, uint32_t value) {
+    char bytes[4];
+    std::memcpy(bytes, &value, sizeof bytes); // little-endian, like WebAssembly
+    out.append(bytes, sizeof bytes);
+}
+
+// loads a field of the object whose address is in local
+void field(Code& code, uint32_t local, uint32_t offset) {
+    code.localGet(local);
+    code.memory(I32Load, offset);
+}
+
+}  // namespace
+
+const std::vector<std::string>& nativeNames() {
+    static const std::vector<std::string> names = [] {
+        std::vector<std::string> names;
+        for (const auto& native : natives) {
+            names.emplace_back(native.name);
+        }
+        return names;
+    }();
+    return names;
+}
+
+bool isNative(const std::string& name) {
+    for (const auto& native : natives) {
+        if (name == native.name) return true;
+    }
+    return false;
+}
+
+int nativeArity(const std::string& name) {
+    return findNative(name).arity;
+}
+
+void emitTag(Code& code) {
+    code.i64(48);
+    code.op(I64ShrU);
+    code.op(I32WrapI64);
+}
+
+void emitIsNumber(Code& code) {
+    emitTag(code);
+    code.i32(NIL_TAG);
+    code.op(I32Sub);
+    code.i32(TOMBSTONE_TAG - NIL_TAG);
+    code.op(I32GtU);
+}
+
+void emitHasTag(Code& code, Tag tag) {
+    emitTag(code);
+    code.i32(tag);
+    code.op(I32Eq);
+}
+
+void emitBox(Code& code, Tag tag) {
+    code.op(I64ExtendI32U);
+    code.i64(tagged(tag));
+    code.op(I64Or);
+}
+
+void emitUnbox(Code& code) {
+    code.op(I32WrapI64);
+}
+
+void emitTruthy(Code& code) {
+    code.i64(NIL);
+    code.op(I64Sub);
+    code.i64(1);
+    code.op(I64GtU);
+}
+
+void emitBool(Code& code) {
+    code.op(I64ExtendI32U);
+    code.i64(FALSE);
+    code.op(I64Or);
+}
+
+const FuncType Runtime::callType{{I32, I32, I32}, {I64}};
+
+Runtime::Runtime(Module& module) : module(module) {
+    error = module.importFunction("rhythm", "error", {{I32, I32}, {}});
+    indexError = module.importFunction("rhythm", "indexError", {{I32, F64, I32}, {}});
+    arityError = module.importFunction("rhythm", "arityError", {{I32, I32, I32}, {}});
+    print = module.importFunction("rhythm", "print", {{I64}, {}});
+    host = module.importFunction("rhythm", "host", {{I32, I32, I32}, {I64}});
+    clock = module.importFunction("rhythm", "clock", {{}, {F64}});
+    for (const char* name : imported1) {
+        math[name] = module.importFunction("rhythm", name, {{F64}, {F64}});
+    }
+    for (const char* name : imported2) {
+        math[name] = module.importFunction("rhythm", name, {{F64, F64}, {F64}});
+    }
+    callTypeIndex = module.type(callType);
+
+    // placed by finish()
+    heapPointer = module.addGlobal(I32, 0);
+    freeLists = module.addGlobal(I32, 0);
+    scratch = module.addGlobal(I32, 0);
+
+    alloc = module.declareFunction({{I32}, {I32}});
+    fail = module.declareFunction({{I32, I32}, {}});
+    number = module.declareFunction({{I64, I32, I32}, {F64}});
+    newString = module.declareFunction({{I32}, {I32}});
+    hashString = module.declareFunction({{I32}, {I32}});
+    stringEquals = module.declareFunction({{I32, I32}, {I32}});
+    stringCompare = module.declareFunction({{I32, I32}, {I32}});
+    concat = module.declareFunction({{I32, I32}, {I32}});
+    add = module.declareFunction({{I64, I64, I32}, {I64}});
+    equals = module.declareFunction({{I64, I64}, {I32}});
+    less = module.declareFunction({{I64, I64, I32}, {I32}});
+    lessEqual = module.declareFunction({{I64, I64, I32}, {I32}});
+    greater = module.declareFunction({{I64, I64, I32}, {I32}});
+    greaterEqual = module.declareFunction({{I64, I64, I32}, {I32}});
+    modulo = module.declareFunction({{F64, F64, I32}, {F64}});
+    newArray = module.declareFunction({{I32}, {I32}});
+    allocBuffer = module.declareFunction({{I32}, {I32}});
+    freeBuffer = module.declareFunction({{I32, I32}, {}});
+    arrayPush = module.declareFunction({{I32, I64}, {}});
+    arrayPop = module.declareFunction({{I32}, {I64}});
+    slot = module.declareFunction({{I32, F64, I32}, {I32}});
+    hash = module.declareFunction({{I64}, {I32}});
+    newMap = module.declareFunction({{}, {I32}});
+    mapFind = module.declareFunction({{I32, I64}, {I32}});
+    mapGrow = module.declareFunction({{I32}, {}});
+    mapSet = module.declareFunction({{I32, I64, I64}, {}});
+    getIndex = module.declareFunction({{I64, I64, I32}, {I64}});
+    getIndexNumber = module.declareFunction({{I64, F64, I32}, {I64}});
+    setIndex = module.declareFunction({{I64, I64, I64, I32}, {I64}});
+    setIndexNumber = module.declareFunction({{I64, F64, I64, I32}, {I64}});
+    getProperty = module.declareFunction({{I64, I32, I32}, {I64}});
+    postfixIndex = module.declareFunction({{I64, I64, F64, I32}, {F64}});
+    cell = module.declareFunction({{I64}, {I32}});
+    closure = module.declareFunction({{I32, I32, I32, I32}, {I32}});
+    callee = module.declareFunction({{I64, I32, I32}, {I32}});
+    len = module.declareFunction({{I64}, {F64}});
+    forEach = module.declareFunction({{I64, I64}, {I64}});
+
+    defineMemory();
+    defineStrings();
+    defineOperators();
+    defineArrays();
+    defineMaps();
+    defineSubscripts();
+    defineCalls();
+    defineNatives();
+
+    // what the loader needs to build values
+    module.exportMemory("memory");
+    module.exportFunction("newString", newString);
+    module.exportFunction("newArray", newArray);
+    module.exportFunction("arrayPush", arrayPush);
+    module.exportFunction("newMap", newMap);
+    module.exportFunction("mapSet", mapSet);
+}
+
+uint32_t Runtime::string(const std::string& text) {
+    auto it = strings_.find(text);
+    if (it != strings_.end()) return it->second;
+    std::string bytes;
+    appendU32(bytes, static_cast<uint32_t>(text.size()));
+    appendU32(bytes, 0);
+    bytes += text;
+    return strings_[text] = module.data(bytes);
+}
+
+int64_t Runtime::staticClosure(uint32_t function, int arity, const std::string& display) {
+    std::string bytes;
+    appendU32(bytes, module.tableEntry(function));
+    appendU32(bytes, static_cast<uint32_t>(arity));
+    appendU32(bytes, string(display));
+    appendU32(bytes, 0);
+    return tagged(FUNCTION_TAG, module.data(bytes));
+}
+
+// call fail, with the line in a local or none
+void Runtime::raise(Code& code, uint32_t line, const std::string& message) {
+    if (line == noLine) {
+        code.i32(0);
+    } else {
+        code.localGet(line);
+    }
+    code.i32(static_cast<int32_t>(string(message)));
+    code.call(fail);
+    code.op(Unreachable);
+}
+
+void Runtime::finish(uint32_t scratchSlots) {
+    uint32_t end = module.dataEnd();
+    module.setGlobal(freeLists, end);
+    end += 32 * 4;
+    module.setGlobal(scratch, end);
+    end += 8 * std::max(scratchSlots, 4u);
+    module.setGlobal(heapPointer, end);
+    module.setMinimumMemory(end);
+}
+
+void Runtime::defineMemory() {
+    {
+        // a bump allocator: nothing is ever freed
+        Code c(module.functionType(alloc));
+        auto address = c.addLocal(I32);
+        auto end = c.addLocal(I32);
+        auto pages = c.addLocal(I32);
+        c.globalGet(heapPointer);
+        c.localTee(address);
+        c.localGet(0);
+        c.op(I32Add);
+        c.i32(7);
+        c.op(I32Add);
+        c.i32(-8);
+        c.op(I32And);
+        c.localTee(end);
+        c.memorySize();
+        c.i32(16);
+        c.op(I32Shl);
+        c.op(I32GtU);
+        c.block(If);
+        {
+            // grow by what is missing, but at least double
+            c.localGet(end);
+            c.memorySize();
+            c.i32(16);
+            c.op(I32Shl);
+            c.op(I32Sub);
+            c.i32(0xFFFF);
+            c.op(I32Add);
+            c.i32(16);
+            c.op(I32ShrU);
+            c.localTee(pages);
+            c.memorySize();
+            c.localGet(pages);
+            c.memorySize();
+            c.op(I32GtU);
+            c.op(Select);
+            c.memoryGrow();
+            c.i32(-1);
+            c.op(I32Eq);
+            c.block(If);
+            c.localGet(pages);
+            c.memoryGrow();
+            c.i32(-1);
+            c.op(I32Eq);
+            c.block(If);
+            raise(c, noLine, "out of memory");
+            c.op(End);
+            c.op(End);
+        }
+        c.op(End);
+        c.localGet(end);
+        c.globalSet(heapPointer);
+        c.localGet(address);
+        module.defineFunction(alloc, c);
+    }
+    {
+        Code c(module.functionType(fail));
+        c.localGet(0);
+        c.localGet(1);
+        c.call(error);
+        c.op(Unreachable);
+        module.defineFunction(fail, c);
+    }
+    {
+        Code c(module.functionType(number));
+        c.localGet(0);
+        emitIsNumber(c);
+        c.block(If, F64);
+        c.localGet(0);
+        c.op(F64ReinterpretI64);
+        c.op(Else);
+        c.localGet(1);
+        c.localGet(2);
+        c.call(fail);
+        c.op(Unreachable);
+        c.op(End);
+        module.defineFunction(number, c);
+    }
+    {
+        Code c(module.functionType(cell));
+        auto address = c.addLocal(I32);
+        c.i32(8);
+        c.call(alloc);
+        c.localTee(address);
+        c.localGet(0);
+        c.memory(I64Store);
+        c.localGet(address);
+        module.defineFunction(cell, c);
+    }
+}
+
+void Runtime::defineStrings() {
+    {
+        Code c(module.functionType(newString));
+        auto address = c.addLocal(I32);
+        c.localGet(0);
+        c.i32(STRING_BYTES);
+        c.op(I32Add);
+        c.call(alloc);
+        c.localTee(address);
+        c.localGet(0);
+        c.memory(I32Store, STRING_LENGTH);
+        c.localGet(address);
+        module.defineFunction(newString, c);
+    }
+    {
+        // FNV-1a, cached in the string; never 0 once computed
+        Code c(module.functionType(hashString));
+        auto h = c.addLocal(I32);
+        auto i = c.addLocal(I32);
+        auto n = c.addLocal(I32);
+        field(c, 0, STRING_HASH);
+        c.localTee(h);
+        c.block(If);
+        c.localGet(h);
+        c.op(Return);
+        c.op(End);
+        c.i32(static_cast<int32_t>(0x811C9DC5u));
+        c.localSet(h);
+        field(c, 0, STRING_LENGTH);
+        c.localSet(n);
+        c.block(Block);
+        c.block(Loop);
+        c.localGet(i);
+        c.localGet(n);
+        c.op(I32GeU);
+        c.brIf(1);
+        c.localGet(h);
+        c.localGet(0);
+        c.localGet(i);
+        c.op(I32Add);
+        c.memory(I32Load8U, STRING_BYTES);
+        c.op(I32Xor);
+        c.i32(16777619);
+        c.op(I32Mul);
+        c.localSet(h);
+        c.localGet(i);
+        c.i32(1);
+        c.op(I32Add);
+        c.localSet(i);
+        c.br(0);
+        c.op(End);
+        c.op(End);
+        c.localGet(0);
+        c.localGet(h);
+        c.i32(1);
+        c.op(I32Or);
+        c.localTee(h);
+        c.memory(I32Store, STRING_HASH);
+        c.localGet(h);
+        module.defineFunction(hashString, c);
+    }
+    {
+        Code c(module.functionType(stringEquals));
+        auto i = c.addLocal(I32);
+        auto n = c.addLocal(I32);
+        c.localGet(0);
+        c.localGet(1);
+        c.op(I32Eq);
+        c.block(If);
+        c.i32(1);
+        c.op(Return);
+        c.op(End);
+        field(c, 0, STRING_LENGTH);
+        c.localTee(n);
+        field(c, 1, STRING_LENGTH);
+        c.op(I32Ne);
+        c.block(If);
+        c.i32(0);
+        c.op(Return);
+        c.op(End);
+        c.block(Block);
+        c.block(Loop);
+        c.localGet(i);
+        c.localGet(n);
+        c.op(I32GeU);
+        c.brIf(1);
+        c.localGet(0);
+        c.localGet(i);
+        c.op(I32Add);
+        c.memory(I32Load8U, STRING_BYTES);
+        c.localGet(1);
+        c.localGet(i);
+        c.op(I32Add);
+        c.memory(I32Load8U, STRING_BYTES);
+        c.op(I32Ne);
+        c.block(If);
+        c.i32(0);
+        c.op(Return);
+        c.op(End);
+        c.localGet(i);
+        c.i32(1);
+        c.op(I32Add);
+        c.localSet(i);
+        c.br(0);
+        c.op(End);
+        c.op(End);
+        c.i32(1);
+        module.defineFunction(stringEquals, c);
+    }
+    {
+        // -1, 0 or 1, bytewise like std::string::compare
+        Code c(module.functionType(stringCompare));
+        auto i = c.addLocal(I32);
+        auto n = c.addLocal(I32);
+        auto a = c.addLocal(I32);
+        auto b = c.addLocal(I32);
+        field(c, 0, STRING_LENGTH);
+        field(c, 1, STRING_LENGTH);
+        field(c, 0, STRING_LENGTH);
+        field(c, 1, STRING_LENGTH);
+        c.op(I32LtU);
+        c.op(Select);
+        c.localSet(n);
+        c.block(Block);
+        c.block(Loop);
+        c.localGet(i);
+        c.localGet(n);
+        c.op(I32GeU);
+        c.brIf(1);
+        c.localGet(0);
+        c.localGet(i);
+        c.op(I32Add);
+        c.memory(I32Load8U, STRING_BYTES);
+        c.localTee(a);
+        c.localGet(1);
+        c.localGet(i);
+        c.op(I32Add);
+        c.memory(I32Load8U, STRING_BYTES);
+        c.localTee(b);
+        c.op(I32Ne);
+        c.block(If);
+        c.i32(-1);
+        c.i32(1);
+        c.localGet(a);
+        c.localGet(b);
+        c.op(I32LtU);
+        c.op(Select);
+        c.op(Return);
+        c.op(End);
+        c.localGet(i);
+        c.i32(1);
+        c.op(I32Add);
+        c.localSet(i);
+        c.br(0);
+        c.op(End);
+        c.op(End);
+        field(c, 0, STRING_LENGTH);
+        field(c, 1, STRING_LENGTH);
+        c.op(I32GtU);
+        field(c, 0, STRING_LENGTH);
+        field(c, 1, STRING_LENGTH);
+        c.op(I32LtU);
+        c.op(I32Sub);
+        module.defineFunction(stringCompare, c);
+    }
+    {
+        Code c(module.functionType(concat));
+        auto result = c.addLocal(I32);
+        auto n = c.addLocal(I32);
+        field(c, 0, STRING_LENGTH);
+        c.localTee(n);
+        field(c, 1, STRING_LENGTH);
+        c.op(I32Add);
+        c.call(newString);
+        c.localSet(result);
+        c.localGet(result);
+        c.i32(STRING_BYTES);
+        c.op(I32Add);
+        c.localGet(0);
+        c.i32(STRING_BYTES);
+        c.op(I32Add);
+        c.localGet(n);
+        c.memoryCopy();
+        c.localGet(result);
+        c.i32(STRING_BYTES);
+        c.op(I32Add);
+        c.localGet(n);
+        c.op(I32Add);
+        c.localGet(1);
+        c.i32(STRING_BYTES);
+        c.op(I32Add);
+        field(c, 1, STRING_LENGTH);
+        c.memoryCopy();
+        c.localGet(result);
+        module.defineFunction(concat, c);
+    }
+}
+
+// a comparison: numbers, or two strings
+void Runtime::compare(uint32_t function, Op numbers, Op strings) {
+    Code c(module.functionType(function));
+    c.localGet(0);
+    emitIsNumber(c);
+    c.localGet(1);
+    emitIsNumber(c);
+    c.op(I32And);
+    c.block(If);
+    c.localGet(0);
+    c.op(F64ReinterpretI64);
+    c.localGet(1);
+    c.op(F64ReinterpretI64);
+    c.op(numbers);
+    c.op(Return);
+    c.op(End);
+    c.localGet(0);
+    emitHasTag(c, STRING_TAG);
+    c.localGet(1);
+    emitHasTag(c, STRING_TAG);
+    c.op(I32And);
+    c.block(If);
+    c.localGet(0);
+    emitUnbox(c);
+    c.localGet(1);
+    emitUnbox(c);
+    c.call(stringCompare);
+    c.i32(0);
+    c.op(strings);
+    c.op(Return);
+    c.op(End);
+    raise(c, 2, "operands must be numbers");
+    module.defineFunction(function, c);
+}
+
+void Runtime::defineOperators() {
+    {
+        Code c(module.functionType(add));
+        c.localGet(0);
+        emitIsNumber(c);
+        c.localGet(1);
+        emitIsNumber(c);
+        c.op(I32And);
+        c.block(If);
+        c.localGet(0);
+        c.op(F64ReinterpretI64);
+        c.localGet(1);
+        c.op(F64ReinterpretI64);
+        c.op(F64Add);
+        c.op(I64ReinterpretF64);
+        c.op(Return);
+        c.op(End);
+        c.localGet(0);
+        emitHasTag(c, STRING_TAG);
+        c.localGet(1);
+        emitHasTag(c, STRING_TAG);
+        c.op(I32And);
+        c.block(If);
+        c.localGet(0);
+        emitUnbox(c);
+        c.localGet(1);
+        emitUnbox(c);
+        c.call(concat);
+        emitBox(c, STRING_TAG);
+        c.op(Return);
+        c.op(End);
+        raise(c, 2, "+ can only be between two numbers or two strings");
+        module.defineFunction(add, c);
+    }
+    {
+        Code c(module.functionType(equals));
+        c.localGet(0);
+        emitIsNumber(c);
+        c.localGet(1);
+        emitIsNumber(c);
+        c.op(I32And);
+        c.block(If);
+        c.localGet(0);
+        c.op(F64ReinterpretI64);
+        c.localGet(1);
+        c.op(F64ReinterpretI64);
+        c.op(F64Eq);
+        c.op(Return);
+        c.op(End);
+        c.localGet(0);
+        c.localGet(1);
+        c.op(I64Eq);
+        c.block(If);
+        c.i32(1);
+        c.op(Return);
+        c.op(End);
+        c.localGet(0);
+        emitHasTag(c, STRING_TAG);
+        c.localGet(1);
+        emitHasTag(c, STRING_TAG);
+        c.op(I32And);
+        c.block(If);
+        c.localGet(0);
+        emitUnbox(c);
+        c.localGet(1);
+        emitUnbox(c);
+        c.call(stringEquals);
+        c.op(Return);
+        c.op(End);
+        c.i32(0);
+        module.defineFunction(equals, c);
+    }
+    compare(less, F64Lt, I32LtS);
+    compare(lessEqual, F64Le, I32LeS);
+    compare(greater, F64Gt, I32GtS);
+    compare(greaterEqual, F64Ge, I32GeS);
+    {
+        // exact in int64 while both fit a double's mantissa
+        Code c(module.functionType(modulo));
+        auto integral = [&](uint32_t local) {
+            c.localGet(local);
+            c.localGet(local);
+            c.op(F64Trunc);
+            c.op(F64Sub);
+            c.f64(0);
+            c.op(F64Eq);
+        };
+        auto small = [&](uint32_t local) {
+            c.localGet(local);
+            c.op(F64Abs);
+            c.f64(9007199254740992.0);
+            c.op(F64Lt);
+        };
+        integral(0);
+        integral(1);
+        c.op(I32And);
+        c.op(I32Eqz);
+        c.block(If);
+        raise(c, 2, "% operation is between integers");
+        c.op(End);
+        small(0);
+        small(1);
+        c.op(I32And);
+        c.localGet(1);
+        c.f64(0);
+        c.op(F64Ne);
+        c.op(I32And);
+        c.block(If);
+        c.localGet(0);
+        c.op(I64TruncF64S);
+        c.localGet(1);
+        c.op(I64TruncF64S);
+        c.op(I64RemS);
+        c.op(F64ConvertI64S);
+        c.op(Return);
+        c.op(End);
+        c.localGet(0);
+        c.localGet(1);
+        c.localGet(0);
+        c.localGet(1);
+        c.op(F64Div);
+        c.op(F64Trunc);
+        c.op(F64Mul);
+        c.op(F64Sub);
+        module.defineFunction(modulo, c);
+    }
+}
+
+void Runtime::defineArrays() {
+    {
+        // element buffers come in powers of two, recycled per size class
+        Code c(module.functionType(allocBuffer));
+        auto head = c.addLocal(I32);
+        auto buffer = c.addLocal(I32);
+        c.globalGet(freeLists);
+        c.localGet(0);
+        c.i32(2);
+        c.op(I32Shl);
+        c.op(I32Add);
+        c.localTee(head);
+        c.memory(I32Load);
+        c.localTee(buffer);
+        c.block(If);
+        c.localGet(head);
+        field(c, buffer, 0);
+        c.memory(I32Store);
+        c.localGet(buffer);
+        c.op(Return);
+        c.op(End);
+        c.i32(8);
+        c.localGet(0);
+        c.op(I32Shl);
+        c.call(alloc);
+        module.defineFunction(allocBuffer, c);
+    }
+    {
+        Code c(module.functionType(freeBuffer));
+        auto head = c.addLocal(I32);
+        c.localGet(0);
+        c.globalGet(freeLists);
+        c.localGet(1);
+        c.i32(2);
+        c.op(I32Shl);
+        c.op(I32Add);
+        c.localTee(head);
+        c.memory(I32Load);
+        c.memory(I32Store);
+        c.localGet(head);
+        c.localGet(0);
+        c.memory(I32Store);
+        module.defineFunction(freeBuffer, c);
+    }
+    {
+        Code c(module.functionType(newArray));
+        auto sizeClass = c.addLocal(I32);
+        auto array = c.addLocal(I32);
+        c.i32(2);
+        c.i32(32);
+        c.localGet(0);
+        c.i32(1);
+        c.op(I32Sub);
+        c.op(I32Clz);
+        c.op(I32Sub);
+        c.localGet(0);
+        c.i32(4);
+        c.op(I32LeU);
+        c.op(Select);
+        c.localSet(sizeClass);
+        c.i32(ARRAY_SIZE);
+        c.call(alloc);
+        c.localTee(array);
+        c.i32(1);
+        c.localGet(sizeClass);
+        c.op(I32Shl);
+        c.memory(I32Store, ARRAY_CAPACITY);
+        c.localGet(array);
+        c.localGet(sizeClass);
+        c.call(allocBuffer);
+        c.memory(I32Store, ARRAY_DATA);
+        c.localGet(array);
+        module.defineFunction(newArray, c);
+    }
+    {
+        Code c(module.functionType(arrayPush));
+        auto length = c.addLocal(I32);
+        auto capacity = c.addLocal(I32);
+        auto data = c.addLocal(I32);
+        auto grown = c.addLocal(I32);
+        field(c, 0, ARRAY_LENGTH);
+        c.localSet(length);
+        field(c, 0, ARRAY_DATA);
+        c.localSet(data);
+        c.localGet(length);
+        field(c, 0, ARRAY_CAPACITY);
+        c.localTee(capacity);
+        c.op(I32Eq);
+        c.block(If);
+        {
+            c.i32(32);
+            c.localGet(capacity);
+            c.op(I32Clz);
+            c.op(I32Sub); // the next size class
+            c.call(allocBuffer);
+            c.localTee(grown);
+            c.localGet(data);
+            c.localGet(length);
+            c.i32(3);
+            c.op(I32Shl);
+            c.memoryCopy();
+            c.localGet(data);
+            c.i32(31);
+            c.localGet(capacity);
+            c.op(I32Clz);
+            c.op(I32Sub);
+            c.call(freeBuffer);
+            c.localGet(0);
+            c.localGet(grown);
+            c.localTee(data);
+            c.memory(I32Store, ARRAY_DATA);
+            c.localGet(0);
+            c.localGet(capacity);
+            c.i32(1);
+            c.op(I32Shl);
+            c.memory(I32Store, ARRAY_CAPACITY);
+        }
+        c.op(End);
+        c.localGet(data);
+        c.localGet(length);
+        c.i32(3);
+        c.op(I32Shl);
+        c.op(I32Add);
+        c.localGet(1);
+        c.memory(I64Store);
+        c.localGet(0);
+        c.localGet(length);
+        c.i32(1);
+        c.op(I32Add);
+        c.memory(I32Store, ARRAY_LENGTH);
+        module.defineFunction(arrayPush, c);
+    }
+    {
+        Code c(module.functionType(arrayPop));
+        auto length = c.addLocal(I32);
+        field(c, 0, ARRAY_LENGTH);
+        c.op(I32Eqz);
+        c.block(If);
+        raise(c, noLine, "pop() from empty array");
+        c.op(End);
+        c.localGet(0);
+        field(c, 0, ARRAY_LENGTH);
+        c.i32(1);
+        c.op(I32Sub);
+        c.localTee(length);
+        c.memory(I32Store, ARRAY_LENGTH);
+        field(c, 0, ARRAY_DATA);
+        c.localGet(length);
+        c.i32(3);
+        c.op(I32Shl);
+        c.op(I32Add);
+        c.memory(I64Load);
+        module.defineFunction(arrayPop, c);
+    }
+    {
+        // the address of an element, bounds checked
+        Code c(module.functionType(slot));
+        c.localGet(1);
+        c.localGet(1);
+        c.op(F64Trunc);
+        c.op(F64Ne);
+        c.block(If);
+        raise(c, 2, "index must be an integer");
+        c.op(End);
+        c.localGet(1);
+        c.f64(0);
+        c.op(F64Lt);
+        c.localGet(1);
+        field(c, 0, ARRAY_LENGTH);
+        c.op(F64ConvertI32U);
+        c.op(F64Ge);
+        c.op(I32Or);
+        c.block(If);
+        c.localGet(2);
+        c.localGet(1);
+        field(c, 0, ARRAY_LENGTH);
+        c.call(indexError);
+        c.op(Unreachable);
+        c.op(End);
+        field(c, 0, ARRAY_DATA);
+        c.localGet(1);
+        c.op(I32TruncF64U);
+        c.i32(3);
+        c.op(I32Shl);
+        c.op(I32Add);
+        module.defineFunction(slot, c);
+    }
+    {
+        Code c(module.functionType(len));
+        c.localGet(0);
+        emitHasTag(c, ARRAY_TAG);
+        c.localGet(0);
+        emitHasTag(c, STRING_TAG);
+        c.op(I32Or);
+        c.block(If);
+        // an array's length and a string's are both the first field
+        c.localGet(0);
+        emitUnbox(c);
+        c.memory(I32Load);
+        c.op(F64ConvertI32U);
+        c.op(Return);
+        c.op(End);
+        c.localGet(0);
+        emitHasTag(c, MAP_TAG);
+        c.block(If);
+        c.localGet(0);
+        emitUnbox(c);
+        c.memory(I32Load, MAP_COUNT);
+        c.op(F64ConvertI32U);
+        c.op(Return);
+        c.op(End);
+        raise(c, noLine, "len() argument must be array or map");
+        module.defineFunction(len, c);
+    }
+}
+
+void Runtime::defineMaps() {
+    // finds the free slot for a key with the hash on the stack and stores
+    // the entry number there
+    auto insertSlot = [&](Code& c, uint32_t slots, uint32_t mask, uint32_t index, uint32_t entry) {
+        c.localGet(mask);
+        c.op(I32And);
+        c.localSet(index);
+        c.block(Block);
+        c.block(Loop);
+        c.localGet(slots);
+        c.localGet(index);
+        c.i32(2);
+        c.op(I32Shl);
+        c.op(I32Add);
+        c.memory(I32Load);
+        c.op(I32Eqz);
+        c.brIf(1);
+        c.localGet(index);
+        c.i32(1);
+        c.op(I32Add);
+        c.localGet(mask);
+        c.op(I32And);
+        c.localSet(index);
+        c.br(0);
+        c.op(End);
+        c.op(End);
+        c.localGet(slots);
+        c.localGet(index);
+        c.i32(2);
+        c.op(I32Shl);
+        c.op(I32Add);
+        c.localGet(entry);
+        c.i32(1);
+        c.op(I32Add);
+        c.memory(I32Store);
+    };
+    {
+        // equal values hash alike: strings by contents, 0 and -0 together
+        Code c(module.functionType(hash));
+        auto h = c.addLocal(I32);
+        c.localGet(0);
+        emitHasTag(c, STRING_TAG);
+        c.block(If);
+        c.localGet(0);
+        emitUnbox(c);
+        c.returnCall(hashString);
+        c.op(End);
+        c.i64(0);
+        c.localGet(0);
+        c.localGet(0);
+        c.op(F64ReinterpretI64);
+        c.f64(0);
+        c.op(F64Eq);
+        c.op(Select);
+        c.localTee(0);
+        c.localGet(0);
+        c.i64(32);
+        c.op(I64ShrU);
+        c.op(I64Xor);
+        c.op(I32WrapI64);
+        c.i32(static_cast<int32_t>(0x9E3779B1u));
+        c.op(I32Mul);
+        c.localTee(h);
+        c.localGet(h);
+        c.i32(16);
+        c.op(I32ShrU);
+        c.op(I32Xor);
+        module.defineFunction(hash, c);
+    }
+    {
+        Code c(module.functionType(newMap));
+        c.i32(MAP_SIZE);
+        c.call(alloc);
+        module.defineFunction(newMap, c);
+    }
+    {
+        // the address of the entry holding key, or 0
+        Code c(module.functionType(mapFind));
+        auto mask = c.addLocal(I32);
+        auto slots = c.addLocal(I32);
+        auto entries = c.addLocal(I32);
+        auto index = c.addLocal(I32);
+        auto entry = c.addLocal(I32);
+        field(c, 0, MAP_CAPACITY);
+        c.op(I32Eqz);
+        c.block(If);
+        c.i32(0);
+        c.op(Return);
+        c.op(End);
+        field(c, 0, MAP_MASK);
+        c.localSet(mask);
+        field(c, 0, MAP_SLOTS);
+        c.localSet(slots);
+        field(c, 0, MAP_ENTRIES);
+        c.localSet(entries);
+        c.localGet(1);
+        c.call(hash);
+        c.localGet(mask);
+        c.op(I32And);
+        c.localSet(index);
+        c.block(Loop);
+        c.localGet(slots);
+        c.localGet(index);
+        c.i32(2);
+        c.op(I32Shl);
+        c.op(I32Add);
+        c.memory(I32Load);
+        c.localTee(entry);
+        c.op(I32Eqz);
+        c.block(If);
+        c.i32(0);
+        c.op(Return);
+        c.op(End);
+        c.localGet(entries);
+        c.localGet(entry);
+        c.i32(1);
+        c.op(I32Sub);
+        c.i32(4);
+        c.op(I32Shl);
+        c.op(I32Add);
+        c.localTee(entry);
+        c.memory(I64Load);
+        c.localGet(1);
+        c.call(equals);
+        c.block(If);
+        c.localGet(entry);
+        c.op(Return);
+        c.op(End);
+        c.localGet(index);
+        c.i32(1);
+        c.op(I32Add);
+        c.localGet(mask);
+        c.op(I32And);
+        c.localSet(index);
+        c.br(0);
+        c.op(End);
+        c.op(Unreachable);
+        module.defineFunction(mapFind, c);
+    }
+    {
+        // room for twice the live entries, dropping the deleted ones
+        Code c(module.functionType(mapGrow));
+        auto capacity = c.addLocal(I32);
+        auto entries = c.addLocal(I32);
+        auto slots = c.addLocal(I32);
+        auto mask = c.addLocal(I32);
+        auto old = c.addLocal(I32);
+        auto used = c.addLocal(I32);
+        auto i = c.addLocal(I32);
+        auto j = c.addLocal(I32);
+        auto entry = c.addLocal(I32);
+        auto index = c.addLocal(I32);
+        auto key = c.addLocal(I64);
+        // a power of two, at least 4: slots are found by masking the hash
+        c.i32(4);
+        c.i32(1);
+        c.i32(32);
+        field(c, 0, MAP_COUNT);
+        c.i32(1);
+        c.op(I32Shl);
+        c.i32(1);
+        c.op(I32Sub);
+        c.op(I32Clz);
+        c.op(I32Sub);
+        c.op(I32Shl);
+        c.localTee(capacity);
+        c.localGet(capacity);
+        c.i32(4);
+        c.op(I32LtU);
+        c.op(Select);
+        c.localTee(capacity);
+        c.i32(4);
+        c.op(I32Shl);
+        c.call(alloc);
+        c.localSet(entries);
+        c.localGet(capacity);
+        c.i32(3);
+        c.op(I32Shl);
+        c.call(alloc);
+        c.localSet(slots);
+        c.localGet(capacity);
+        c.i32(1);
+        c.op(I32Shl);
+        c.i32(1);
+        c.op(I32Sub);
+        c.localSet(mask);
+        field(c, 0, MAP_ENTRIES);
+        c.localSet(old);
+        field(c, 0, MAP_USED);
+        c.localSet(used);
+        c.block(Block);
+        c.block(Loop);
+        c.localGet(i);
+        c.localGet(used);
+        c.op(I32GeU);
+        c.brIf(1);
+        c.localGet(old);
+        c.localGet(i);
+        c.i32(4);
+        c.op(I32Shl);
+        c.op(I32Add);
+        c.localTee(entry);
+        c.memory(I64Load);
+        c.localTee(key);
+        c.i64(TOMBSTONE);
+        c.op(I64Ne);
+        c.block(If);
+        {
+            c.localGet(entries);
+            c.localGet(j);
+            c.i32(4);
+            c.op(I32Shl);
+            c.op(I32Add);
+            c.localTee(index);
+            c.localGet(key);
+            c.memory(I64Store);
+            c.localGet(index);
+            c.localGet(entry);
+            c.memory(I64Load, 8);
+            c.memory(I64Store, 8);
+            c.localGet(key);
+            c.call(hash);
+            insertSlot(c, slots, mask, index, j);
+            c.localGet(j);
+            c.i32(1);
+            c.op(I32Add);
+            c.localSet(j);
+        }
+        c.op(End);
+        c.localGet(i);
+        c.i32(1);
+        c.op(I32Add);
+        c.localSet(i);
+        c.br(0);
+        c.op(End);
+        c.op(End);
+        c.localGet(0);
+        c.localGet(j);
+        c.memory(I32Store, MAP_USED);
+        c.localGet(0);
+        c.localGet(capacity);
+        c.memory(I32Store, MAP_CAPACITY);
+        c.localGet(0);
+        c.localGet(slots);
+        c.memory(I32Store, MAP_SLOTS);
+        c.localGet(0);
+        c.localGet(entries);
+        c.memory(I32Store, MAP_ENTRIES);
+        c.localGet(0);
+        c.localGet(mask);
+        c.memory(I32Store, MAP_MASK);
+        module.defineFunction(mapGrow, c);
+    }
+    {
+        // storing nil deletes, as in the other runtimes
+        Code c(module.functionType(mapSet));
+        auto entry = c.addLocal(I32);
+        auto used = c.addLocal(I32);
+        auto slots = c.addLocal(I32);
+        auto mask = c.addLocal(I32);
+        auto index = c.addLocal(I32);
+        auto count = [&](int delta) {
+            c.localGet(0);
+            field(c, 0, MAP_COUNT);
+            c.i32(delta);
+            c.op(I32Add);
+            c.memory(I32Store, MAP_COUNT);
+        };
+        c.localGet(0);
+        c.localGet(1);
+        c.call(mapFind);
+        c.localTee(entry);
+        c.block(If);
+        {
+            c.localGet(2);
+            c.i64(NIL);
+            c.op(I64Eq);
+            c.block(If);
+            c.localGet(entry);
+            c.i64(TOMBSTONE);
+            c.memory(I64Store);
+            c.localGet(entry);
+            c.i64(NIL);
+            c.memory(I64Store, 8);
+            count(-1);
+            c.op(Else);
+            c.localGet(entry);
+            c.localGet(2);
+            c.memory(I64Store, 8);
+            c.op(End);
+            c.op(Return);
+        }
+        c.op(End);
+        c.localGet(2);
+        c.i64(NIL);
+        c.op(I64Eq);
+        c.block(If);
+        c.op(Return);
+        c.op(End);
+        field(c, 0, MAP_USED);
+        field(c, 0, MAP_CAPACITY);
+        c.op(I32Eq);
+        c.block(If);
+        c.localGet(0);
+        c.call(mapGrow);
+        c.op(End);
+        field(c, 0, MAP_USED);
+        c.localSet(used);
+        field(c, 0, MAP_ENTRIES);
+        c.localGet(used);
+        c.i32(4);
+        c.op(I32Shl);
+        c.op(I32Add);
+        c.localTee(entry);
+        c.localGet(1);
+        c.memory(I64Store);
+        c.localGet(entry);
+        c.localGet(2);
+        c.memory(I64Store, 8);
+        field(c, 0, MAP_SLOTS);
+        c.localSet(slots);
+        field(c, 0, MAP_MASK);
+        c.localSet(mask);
+        c.localGet(1);
+        c.call(hash);
+        insertSlot(c, slots, mask, index, used);
+        c.localGet(0);
+        c.localGet(used);
+        c.i32(1);
+        c.op(I32Add);
+        c.memory(I32Store, MAP_USED);
+        count(1);
+        module.defineFunction(mapSet, c);
+    }
+}
+
+void Runtime::defineSubscripts() {
+    auto ifTag = [](Code& c, uint32_t local, Tag tag) {
+        c.localGet(local);
+        emitHasTag(c, tag);
+        c.block(If);
+    };
+    // the value of a map entry whose address is on the stack, nil for none
+    auto entryValue = [](Code& c, uint32_t entry) {
+        c.localTee(entry);
+        c.block(If, I64);
+        c.localGet(entry);
+        c.memory(I64Load, 8);
+        c.op(Else);
+        c.i64(NIL);
+        c.op(End);
+    };
+    {
+        Code c(module.functionType(getIndex));
+        auto entry = c.addLocal(I32);
+        ifTag(c, 0, ARRAY_TAG);
+        c.localGet(0);
+        emitUnbox(c);
+        c.localGet(1);
+        c.localGet(2);
+        c.i32(static_cast<int32_t>(string("array index must be a number")));
+        c.call(number);
+        c.localGet(2);
+        c.call(slot);
+        c.memory(I64Load);
+        c.op(Return);
+        c.op(End);
+        ifTag(c, 0, MAP_TAG);
+        c.localGet(0);
+        emitUnbox(c);
+        c.localGet(1);
+        c.call(mapFind);
+        entryValue(c, entry);
+        c.op(Return);
+        c.op(End);
+        raise(c, 2, "subscript must be of an array or map");
+        module.defineFunction(getIndex, c);
+    }
+    {
+        Code c(module.functionType(getIndexNumber));
+        auto entry = c.addLocal(I32);
+        ifTag(c, 0, ARRAY_TAG);
+        c.localGet(0);
+        emitUnbox(c);
+        c.localGet(1);
+        c.localGet(2);
+        c.call(slot);
+        c.memory(I64Load);
+        c.op(Return);
+        c.op(End);
+        ifTag(c, 0, MAP_TAG);
+        c.localGet(0);
+        emitUnbox(c);
+        c.localGet(1);
+        c.op(I64ReinterpretF64);
+        c.call(mapFind);
+        entryValue(c, entry);
+        c.op(Return);
+        c.op(End);
+        raise(c, 2, "subscript must be of an array or map");
+        module.defineFunction(getIndexNumber, c);
+    }
+    for (bool numbered : {false, true}) {
+        auto function = numbered ? setIndexNumber : setIndex;
+        Code c(module.functionType(function));
+        ifTag(c, 0, ARRAY_TAG);
+        c.localGet(0);
+        emitUnbox(c);
+        c.localGet(1);
+        if (!numbered) {
+            c.localGet(3);
+            c.i32(static_cast<int32_t>(string("array index must be a number")));
+            c.call(number);
+        }
+        c.localGet(3);
+        c.call(slot);
+        c.localGet(2);
+        c.memory(I64Store);
+        c.localGet(2);
+        c.op(Return);
+        c.op(End);
+        ifTag(c, 0, MAP_TAG);
+        c.localGet(0);
+        emitUnbox(c);
+        c.localGet(1);
+        if (numbered) c.op(I64ReinterpretF64);
+        c.localGet(2);
+        c.call(mapSet);
+        c.localGet(2);
+        c.op(Return);
+        c.op(End);
+        raise(c, 3, "Only arrays and maps can be subscripted.");
+        module.defineFunction(function, c);
+    }
+    {
+        Code c(module.functionType(getProperty));
+        auto entry = c.addLocal(I32);
+        ifTag(c, 0, MAP_TAG);
+        c.localGet(0);
+        emitUnbox(c);
+        c.localGet(1);
+        emitBox(c, STRING_TAG);
+        c.call(mapFind);
+        entryValue(c, entry);
+        c.op(Return);
+        c.op(End);
+        raise(c, 2, "Only maps can have properties accessed with dot notation");
+        module.defineFunction(getProperty, c);
+    }
+    {
+        // obj[index]++ and --: the old number
+        Code c(module.functionType(postfixIndex));
+        auto address = c.addLocal(I32);
+        auto old = c.addLocal(F64);
+        auto adjust = [&](uint32_t offset) {
+            c.localGet(address);
+            c.localGet(address);
+            c.memory(I64Load, offset);
+            c.localGet(3);
+            c.i32(static_cast<int32_t>(string("Postfix operator requires a number")));
+            c.call(number);
+            c.localTee(old);
+            c.localGet(2);
+            c.op(F64Add);
+            c.op(I64ReinterpretF64);
+            c.memory(I64Store, offset);
+            c.localGet(old);
+            c.op(Return);
+        };
+        ifTag(c, 0, ARRAY_TAG);
+        c.localGet(0);
+        emitUnbox(c);
+        c.localGet(1);
+        c.localGet(3);
+        c.i32(static_cast<int32_t>(string("array index must be a number")));
+        c.call(number);
+        c.localGet(3);
+        c.call(slot);
+        c.localSet(address);
+        adjust(0);
+        c.op(End);
+        ifTag(c, 0, MAP_TAG);
+        c.localGet(0);
+        emitUnbox(c);
+        c.localGet(1);
+        c.call(mapFind);
+        c.localTee(address);
+        c.op(I32Eqz);
+        c.block(If);
+        raise(c, 3, "Postfix operator requires an existing numeric value");
+        c.op(End);
+        adjust(8);
+        c.op(End);
+        raise(c, 3, "subscript must be of an array or map");
+        module.defineFunction(postfixIndex, c);
+    }
+}
+
+void Runtime::defineCalls() {
+    {
+        Code c(module.functionType(closure));
+        auto address = c.addLocal(I32);
+        c.i32(CLOSURE_CELL);
+        c.localGet(3);
+        c.i32(2);
+        c.op(I32Shl);
+        c.op(I32Add);
+        c.call(alloc);
+        c.localTee(address);
+        c.localGet(0);
+        c.memory(I32Store, CLOSURE_SLOT);
+        c.localGet(address);
+        c.localGet(1);
+        c.memory(I32Store, CLOSURE_ARITY);
+        c.localGet(address);
+        c.localGet(2);
+        c.memory(I32Store, CLOSURE_DISPLAY);
+        c.localGet(address);
+        c.localGet(3);
+        c.memory(I32Store, CLOSURE_CELLS);
+        c.localGet(address);
+        module.defineFunction(closure, c);
+    }
+    {
+        // the closure to call with argc arguments
+        Code c(module.functionType(callee));
+        auto address = c.addLocal(I32);
+        auto arity = c.addLocal(I32);
+        c.localGet(0);
+        emitHasTag(c, FUNCTION_TAG);
+        c.op(I32Eqz);
+        c.block(If);
+        raise(c, 2, "Can only call functions and classes.");
+        c.op(End);
+        c.localGet(0);
+        emitUnbox(c);
+        c.localTee(address);
+        c.memory(I32Load, CLOSURE_ARITY);
+        c.localTee(arity);
+        c.localGet(1);
+        c.op(I32Ne);
+        c.localGet(arity);
+        c.i32(-1);
+        c.op(I32Ne);
+        c.op(I32And);
+        c.block(If);
+        c.localGet(2);
+        c.localGet(arity);
+        c.localGet(1);
+        c.call(arityError);
+        c.op(Unreachable);
+        c.op(End);
+        c.localGet(address);
+        module.defineFunction(callee, c);
+    }
+}
+
+void Runtime::defineNatives() {
+    Code c(module.functionType(forEach));
+    auto map = c.addLocal(I32);
+    auto function = c.addLocal(I32);
+    auto i = c.addLocal(I32);
+    auto entry = c.addLocal(I32);
+    auto key = c.addLocal(I64);
+    c.localGet(0);
+    emitHasTag(c, MAP_TAG);
+    c.op(I32Eqz);
+    c.block(If);
+    raise(c, noLine, "for_each(m, f), m must be a map");
+    c.op(End);
+    c.localGet(1);
+    emitHasTag(c, FUNCTION_TAG);
+    c.op(I32Eqz);
+    c.block(If);
+    raise(c, noLine, "for_each(m, f), f must be a function");
+    c.op(End);
+    c.localGet(1);
+    emitUnbox(c);
+    c.localTee(function);
+    c.memory(I32Load, CLOSURE_ARITY);
+    c.i32(2);
+    c.op(I32Ne);
+    c.localGet(function);
+    c.memory(I32Load, CLOSURE_ARITY);
+    c.i32(-1);
+    c.op(I32Ne);
+    c.op(I32And);
+    c.block(If);
+    raise(c, noLine, "for_each(m, f), f must take 2 arguments (k,v)");
+    c.op(End);
+    c.localGet(0);
+    emitUnbox(c);
+    c.localSet(map);
+    // entries added by f are visited too, as with a JavaScript Map
+    c.block(Block);
+    c.block(Loop);
+    c.localGet(i);
+    field(c, map, MAP_USED);
+    c.op(I32GeU);
+    c.brIf(1);
+    field(c, map, MAP_ENTRIES);
+    c.localGet(i);
+    c.i32(4);
+    c.op(I32Shl);
+    c.op(I32Add);
+    c.localTee(entry);
+    c.memory(I64Load);
+    c.localTee(key);
+    c.i64(TOMBSTONE);
+    c.op(I64Ne);
+    c.block(If);
+    c.globalGet(scratch);
+    c.localGet(key);
+    c.memory(I64Store);
+    c.globalGet(scratch);
+    c.localGet(entry);
+    c.memory(I64Load, 8);
+    c.memory(I64Store, 8);
+    c.localGet(function);
+    c.i32(2);
+    c.globalGet(scratch);
+    c.localGet(function);
+    c.memory(I32Load, CLOSURE_SLOT);
+    c.callIndirect(callTypeIndex);
+    c.op(Drop);
+    c.op(End);
+    c.localGet(i);
+    c.i32(1);
+    c.op(I32Add);
+    c.localSet(i);
+    c.br(0);
+    c.op(End);
+    c.op(End);
+    c.i64(NIL);
+    module.defineFunction(forEach, c);
+}
+
+uint32_t Runtime::native(const std::string& name) {
+    auto it = natives_.find(name);
+    if (it != natives_.end()) return it->second;
+    const auto& native = findNative(name);
+
+    FuncType type;
+    if (native.arity < 0) {
+        type = {{I32, I32}, {I64}};
+    } else {
+        type = {std::vector<ValType>(native.arity, I64), {I64}};
+    }
+    auto function = module.declareFunction(type);
+    natives_[name] = function;
+    Code c(type);
+    auto argument = [&](int index, const std::string& message) {
+        c.localGet(index);
+        c.i32(0);
+        c.i32(static_cast<int32_t>(string(message)));
+        c.call(number);
+    };
+
+    if (native.arity < 0) {
+        if (name == "assert") {
+            // only failing asserts need to format anything
+            c.localGet(0);
+            c.block(If, I32);
+            c.localGet(1);
+            c.memory(I64Load);
+            emitTruthy(c);
+            c.op(Else);
+            c.i32(0);
+            c.op(End);
+            c.block(If);
+            c.i64(NIL);
+            c.op(Return);
+            c.op(End);
+        }
+        c.i32(native.host);
+        c.localGet(0);
+        c.localGet(1);
+        c.call(host);
+    } else if (native.host >= 0) {
+        for (int i = 0; i < native.arity; ++i) {
+            c.globalGet(scratch);
+            c.localGet(i);
+            c.memory(I64Store, 8 * i);
+        }
+        c.i32(native.host);
+        c.i32(native.arity);
+        c.globalGet(scratch);
+        c.call(host);
+    } else if (name == "clock") {
+        c.call(clock);
+        c.op(I64ReinterpretF64);
+    } else if (name == "len") {
+        c.localGet(0);
+        c.call(len);
+        c.op(I64ReinterpretF64);
+    } else if (name == "push" || name == "pop") {
+        c.localGet(0);
+        emitHasTag(c, ARRAY_TAG);
+        c.op(I32Eqz);
+        c.block(If);
+        raise(c, noLine, name == "push" ? "push(array, v) needs array as first argument"
+                                        : "pop(array): array must be an array");
+        c.op(End);
+        c.localGet(0);
+        emitUnbox(c);
+        if (name == "push") {
+            c.localGet(1);
+            c.call(arrayPush);
+            c.localGet(1);
+        } else {
+            c.call(arrayPop);
+        }
+    } else if (name == "for_each") {
+        c.localGet(0);
+        c.localGet(1);
+        c.call(forEach);
+    } else if (name == "inf") {
+        c.f64(std::numeric_limits<double>::infinity());
+        c.op(I64ReinterpretF64);
+    } else if (native.arity == 1) {
+        argument(0, name + "() argument must be a number");
+        if (name == "floor") {
+            c.op(F64Floor);
+        } else if (name == "ceil") {
+            c.op(F64Ceil);
+        } else if (name == "sqrt") {
+            c.op(F64Sqrt);
+        } else if (name == "fabs") {
+            c.op(F64Abs);
+        } else {
+            c.call(math.at(name));
+        }
+        c.op(I64ReinterpretF64);
+    } else {
+        argument(0, name + "() arguments must be numbers");
+        argument(1, name + "() arguments must be numbers");
+        c.call(math.at(name));
+        c.op(I64ReinterpretF64);
+    }
+    module.defineFunction(function, c);
+    return function;
+}
+
+int64_t Runtime::nativeValue(const std::string& name) {
+    auto it = nativeValues_.find(name);
+    if (it != nativeValues_.end()) return it->second;
+    const auto& native = findNative(name);
+    auto implementation = this->native(name);
+    auto entry = module.declareFunction(callType);
+    Code c(callType);
+    if (native.arity < 0) {
+        c.localGet(1);
+        c.localGet(2);
+    } else {
+        for (int i = 0; i < native.arity; ++i) {
+            c.localGet(2);
+            c.memory(I64Load, 8 * i);
+        }
+    }
+    c.call(implementation);
+    module.defineFunction(entry, c);
+    return nativeValues_[name] = staticClosure(entry, native.arity, native.display);
+}
+
+std::string wasmLoader() {
+    return R"JS(
+(() => {
+  const NIL = 0x7FF9, BOOL = 0x7FFA, STRING = 0x7FFB, ARRAY = 0x7FFC, MAP = 0x7FFD, FUNCTION = 0x7FFE;
+  const TOMBSTONE = 0x7FFF;
+  // by the id the module passes to host()
+  const hostNatives = ['printf', 'sprintf', 'readline', 'split', 'tonumber', 'slurp', 'keys', 'from_json',
+    'to_json', 'substring', 'random_int', 'assert'];
+  const isNode = typeof process !== 'undefined' && process.versions && process.versions.node;
+  const bytes = typeof Buffer !== 'undefined'
+    ? Buffer.from(__wasmModule, 'base64')
+    : Uint8Array.from(atob(__wasmModule), (c) => c.charCodeAt(0));
+  const decoder = new TextDecoder();
+  const encoder = new TextEncoder();
+  const bits = new DataView(new ArrayBuffer(8));
+  const strings = new Map(); // strings never change once built
+  let exports = null;
+  let view = null;
+
+  function memory() {
+    if (view === null || view.buffer !== exports.memory.buffer) {
+      view = new DataView(exports.memory.buffer);
+    }
+    return view;
+  }
+
+  function readString(address) {
+    let text = strings.get(address);
+    if (text === undefined) {
+      const length = memory().getUint32(address, true);
+      text = decoder.decode(new Uint8Array(exports.memory.buffer, address + 8, length));
+      strings.set(address, text);
+    }
+    return text;
+  }
+
+  function decode(value) {
+    const tag = Number(BigInt.asUintN(64, value) >> 48n);
+    const address = Number(value & 0xFFFFFFFFn);
+    switch (tag) {
+      case NIL:
+        return null;
+      case BOOL:
+        return address !== 0;
+      case STRING:
+        return readString(address);
+      case ARRAY: {
+        const length = memory().getUint32(address, true);
+        const data = memory().getUint32(address + 8, true);
+        const elements = [];
+        for (let i = 0; i < length; ++i) {
+          elements.push(decode(memory().getBigInt64(data + 8 * i, true)));
+        }
+        return __rt.makeArray(elements);
+      }
+      case MAP: {
+        const used = memory().getUint32(address + 4, true);
+        const entries = memory().getUint32(address + 16, true);
+        const pairs = [];
+        for (let i = 0; i < used; ++i) {
+          const key = memory().getBigInt64(entries + 16 * i, true);
+          if (Number(BigInt.asUintN(64, key) >> 48n) !== TOMBSTONE) {
+            pairs.push([decode(key), decode(memory().getBigInt64(entries + 16 * i + 8, true))]);
+          }
+        }
+        return __rt.makeMap(pairs);
+      }
+      case FUNCTION: {
+        const arity = memory().getInt32(address + 4, true);
+        const display = readString(memory().getUint32(address + 8, true));
+        return __rt.makeNative('wasm', () => {
+          throw __rt.runtimeError(null, 'cannot call a WebAssembly function from JavaScript');
+        }, arity, display);
+      }
+      default:
+        bits.setBigInt64(0, value);
+        return bits.getFloat64(0);
+    }
+  }
+
+  function box(tag, address) {
+    return BigInt.asIntN(64, (BigInt(tag) << 48n) | BigInt(address));
+  }
+
+  function encode(value) {
+    if (value === null || value === undefined) {
+      return box(NIL, 0xFFFFFFFFFFFF);
+    }
+    if (typeof value === 'boolean') {
+      return box(BOOL, value ? 1 : 0);
+    }
+    if (typeof value === 'number') {
+      bits.setFloat64(0, value);
+      return bits.getBigInt64(0);
+    }
+    if (typeof value === 'string') {
+      const utf8 = encoder.encode(value);
+      const address = exports.newString(utf8.length);
+      new Uint8Array(exports.memory.buffer, address + 8, utf8.length).set(utf8);
+      return box(STRING, address);
+    }
+    if (Array.isArray(value)) {
+      const address = exports.newArray(value.length);
+      for (const element of value) {
+        exports.arrayPush(address, encode(element));
+      }
+      return box(ARRAY, address);
+    }
+    if (value instanceof Map) {
+      const address = exports.newMap();
+      for (const [key, element] of value) {
+        exports.mapSet(address, encode(key), encode(element));
+      }
+      return box(MAP, address);
+    }
+    throw __rt.runtimeError(null, 'cannot pass a JavaScript function to WebAssembly');
+  }
+
+  const lineOf = (line) => (line > 0 ? line : null);
+  const imports = {
+    rhythm: {
+      error: (line, message) => {
+        throw __rt.runtimeError(lineOf(line), readString(message));
+      },
+      indexError: (line, index, size) => {
+        throw __rt.runtimeError(lineOf(line), `Index out of bounds: ${index} (size: ${size})`);
+      },
+      arityError: (line, arity, count) => {
+        throw __rt.runtimeError(lineOf(line), `expected ${arity} arguments but got ${count}`);
+      },
+      print: (value) => {
+        __rt.print(decode(value));
+      },
+      host: (id, argc, args) => {
+        const values = [];
+        for (let i = 0; i < argc; ++i) {
+          values.push(decode(memory().getBigInt64(args + 8 * i, true)));
+        }
+        return encode(__rt.globals[hostNatives[id]](...values));
+      },
+      clock: () => Date.now() / 1000,
+      sin: Math.sin,
+      cos: Math.cos,
+      tan: Math.tan,
+      asin: Math.asin,
+      acos: Math.acos,
+      atan: Math.atan,
+      log: Math.log,
+      log10: Math.log10,
+      exp: Math.exp,
+      pow: Math.pow,
+      atan2: Math.atan2,
+      fmod: (a, b) => a % b,
+    },
+  };
+
+  function run(instance) {
+    exports = instance.exports;
+    try {
+      exports.run();
+    } catch (err) {
+      if (err && err.__isRhythmError) {
+        __rt.handleError(err);
+        return;
+      }
+      throw err;
+    }
+  }
+
+  if (isNode) {
+    run(new WebAssembly.Instance(new WebAssembly.Module(bytes), imports));
+  } else {
+    // browsers only compile small modules synchronously on the main thread;
+    // a page running the program awaits __rhythmIO.finished for its output
+    const finished = WebAssembly.instantiate(bytes, imports).then(({ instance }) => run(instance));
+    if (typeof __rhythmIO !== 'undefined') {
+      __rhythmIO.finished = finished;
+    }
+  }
+})();
+)JS";
+}
+
+}  // namespace transpose::wasm
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "transpose/wasm_module.hpp"
+
+namespace transpose::wasm {
+
+// A value is an i64. A number is the bits of its double; anything else is a
+// NaN arithmetic never produces, with a tag in the top 16 bits and, for heap
+// objects, the address of the object in the low 32.
+enum Tag : uint16_t {
+    NIL_TAG = 0x7FF9,
+    BOOL_TAG = 0x7FFA,
+    STRING_TAG = 0x7FFB,
+    ARRAY_TAG = 0x7FFC,
+    MAP_TAG = 0x7FFD,
+    FUNCTION_TAG = 0x7FFE,
+    TOMBSTONE_TAG = 0x7FFF, // a deleted map key, never a value
+};
+
+constexpr int64_t tagged(Tag tag, uint32_t payload = 0) {
+    return static_cast<int64_t>((static_cast<uint64_t>(tag) << 48) | payload);
+}
+
+// nil sits right below false, so both falsy values share one range check
+constexpr int64_t NIL = tagged(BOOL_TAG) - 1;
+constexpr int64_t FALSE = tagged(BOOL_TAG);
+constexpr int64_t TRUE = tagged(BOOL_TAG, 1);
+constexpr int64_t TOMBSTONE = tagged(TOMBSTONE_TAG);
+
+// Object layouts, as byte offsets. A string is its length, a cached hash (0
+// until computed) and the bytes. An array is its length, capacity and the
+// address of its elements; a map its live and used entry counts, capacity,
+// index slots, entries (key, value pairs in insertion order) and slot mask.
+// A closure is its table slot, arity, display string and captured cells.
+namespace layout {
+constexpr uint32_t STRING_LENGTH = 0, STRING_HASH = 4, STRING_BYTES = 8;
+constexpr uint32_t ARRAY_LENGTH = 0, ARRAY_CAPACITY = 4, ARRAY_DATA = 8, ARRAY_SIZE = 12;
+constexpr uint32_t MAP_COUNT = 0, MAP_USED = 4, MAP_CAPACITY = 8, MAP_SLOTS = 12, MAP_ENTRIES = 16, MAP_MASK = 20,
+                   MAP_SIZE = 24;
+constexpr uint32_t CLOSURE_SLOT = 0, CLOSURE_ARITY = 4, CLOSURE_DISPLAY = 8, CLOSURE_CELLS = 12, CLOSURE_CELL = 16;
+}  // namespace layout
+
+// inline sequences over the value on top of the stack
+void emitTag(Code& code);              // i64 -> its tag, i32
+void emitIsNumber(Code& code);         // i64 -> i32
+void emitHasTag(Code& code, Tag tag);  // i64 -> i32
+void emitBox(Code& code, Tag tag);     // i32 address -> i64
+void emitUnbox(Code& code);            // i64 -> i32 address
+void emitTruthy(Code& code);           // i64 -> i32
+void emitBool(Code& code);             // i32 -> i64
+
+// the natives of the runtime, and how many arguments each takes (-1 for
+// any number)
+const std::vector<std::string>& nativeNames();
+bool isNative(const std::string& name);
+int nativeArity(const std::string& name);
+
+// The part of a module every program needs: the imports from the
+// JavaScript side (I/O, errors, Math and the natives not worth writing in
+// WebAssembly) and the functions of the runtime, written with Code.
+class Runtime {
+public:
+    // every value call goes through the table as (env, argc, args) -> i64,
+    // the arguments in the scratch area
+    static const FuncType callType;
+
+    explicit Runtime(Module& module);
+
+    // a string in static data, interned
+    uint32_t string(const std::string& text);
+    // a closure in static data
+    int64_t staticClosure(uint32_t function, int arity, const std::string& display);
+    // the implementation of a native: (i64 x arity) -> i64, or
+    // (argc, args) -> i64 for those taking any number
+    uint32_t native(const std::string& name);
+    // the native as a value
+    int64_t nativeValue(const std::string& name);
+    // lays out memory after the static data; nothing may be added after
+    void finish(uint32_t scratchSlots);
+
+    Module& module;
+    uint32_t callTypeIndex;
+
+    // imports
+    uint32_t error, indexError, arityError, print, host, clock;
+    std::unordered_map<std::string, uint32_t> math;
+
+    // globals
+    uint32_t heapPointer, freeLists, scratch;
+
+    // functions
+    uint32_t alloc, fail, number, newString, hashString, stringEquals, stringCompare, concat, add, equals, less,
+        lessEqual, greater, greaterEqual, modulo, newArray, allocBuffer, freeBuffer, arrayPush, arrayPop, slot, hash,
+        newMap, mapFind, mapGrow, mapSet, getIndex, getIndexNumber, setIndex, setIndexNumber, getProperty,
+        postfixIndex, cell, closure, callee, len, forEach;
+
+private:
+    std::unordered_map<std::string, uint32_t> strings_;
+    std::unordered_map<std::string, uint32_t> natives_;
+    std::unordered_map<std::string, int64_t> nativeValues_;
+
+    void raise(Code& code, uint32_t line, const std::string& message);
+    void compare(uint32_t function, Op numbers, Op strings);
+    void defineMemory();
+    void defineStrings();
+    void defineOperators();
+    void defineArrays();
+    void defineMaps();
+    void defineSubscripts();
+    void defineCalls();
+    void defineNatives();
+};
+
+// The JavaScript that instantiates the module in __wasmModule (base64)
+// against the JS runtime's __rt and runs it. Under Node that happens before
+// it returns; in a browser it is asynchronous, and __rhythmIO.finished is
+// the promise of the run.
+std::string wasmLoader();
+
+}  // namespace transpose::wasm
@@ -0,0 +1,48 @@
+#include "transpose/wasm_transpiler.hpp"
+
+#include <cstdint>
+
+#include "transpose/frontend.hpp"
+#include "transpose/runtime.hpp"
+#include "transpose/wasm_generator.hpp"
+#include "transpose/wasm_runtime.hpp"
+#include "type_inference.hpp"
+
+namespace transpose {
+
+std::string transpileToWasm(const std::string& source) {
+    if (source.empty()) {
+        return {};
+    }
+
+    auto statements = parseWithCoreLibrary(source);
+
+    TypeInference types;
+    types.infer(statements);
+
+    WasmGenerator generator(types);
+    return generator.generate(statements);
+}
+
+std::string transpileToWasmJavascript(const std::string& source) {
+    if (source.empty()) {
+        return {};
+    }
+
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const auto binary = transpileToWasm(source);
+    std::string encoded;
+    encoded.reserve((binary.size() + 2) / 3 * 4);
+    for (size_t i = 0; i < binary.size(); i += 3) {
+        uint32_t chunk = static_cast<uint8_t>(binary[i]) << 16;
+        if (i + 1 < binary.size()) chunk |= static_cast<uint8_t>(binary[i + 1]) << 8;
+        if (i + 2 < binary.size()) chunk |= static_cast<uint8_t>(binary[i + 2]);
+        encoded += alphabet[(chunk >> 18) & 63];
+        encoded += alphabet[(chunk >> 12) & 63];
+        encoded += i + 1 < binary.size() ? alphabet[(chunk >> 6) & 63] : '=';
+        encoded += i + 2 < binary.size() ? alphabet[chunk & 63] : '=';
+    }
+    return runtimePrelude() + "const __wasmModule = '" + encoded + "';\n" + wasm::wasmLoader();
+}
+
+}  // namespace transpose
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+
+namespace transpose {
+
+// Transpile Rhythm source code (including the core library) into a
+// WebAssembly module exporting run(). It imports I/O, errors and some
+// natives from the JavaScript runtime, so it runs under wasmLoader().
+std::string transpileToWasm(const std::string& source);
+
+// The module from transpileToWasm, embedded in JavaScript that loads it
+// against the runtime and runs it.
+std::string transpileToWasmJavascript(const std::string& source);
+
+}  // namespace transpose
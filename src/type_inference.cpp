@@ -0,0 +1,421 @@
+#include "type_inference.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <utility>
+
+#include "native_properties.hpp"
+
+namespace {
+
+InferredType join(InferredType a, InferredType b) {
+    if (a == InferredType::NONE) return b;
+    if (b == InferredType::NONE) return a;
+    return a == b ? a : InferredType::UNKNOWN;
+}
+
+InferredType typeOfValue(const Value& value) {
+    if (std::holds_alternative<double>(value)) return InferredType::NUMBER;
+    if (std::holds_alternative<bool>(value)) return InferredType::BOOL;
+    if (std::holds_alternative<std::string>(value)) return InferredType::STRING;
+    if (std::holds_alternative<std::nullptr_t>(value)) return InferredType::NIL;
+    return InferredType::UNKNOWN;
+}
+
+}
+
+const char* typeName(InferredType type) {
+    switch (type) {
+        case InferredType::NONE: return "none";
+        case InferredType::NUMBER: return "number";
+        case InferredType::BOOL: return "bool";
+        case InferredType::STRING: return "string";
+        case InferredType::NIL: return "nil";
+        case InferredType::ARRAY: return "array";
+        case InferredType::MAP: return "map";
+        case InferredType::FUNCTION: return "function";
+        case InferredType::UNKNOWN: return "unknown";
+    }
+    return "unknown";
+}
+
+std::unordered_set<std::string> TypeInference::definedGlobals(const std::vector<std::unique_ptr<Stmt>>& statements) {
+    AssignedNames assigned;
+    assigned.walk(statements);
+    std::unordered_set<std::string> names(assigned.names.begin(), assigned.names.end());
+    for (const auto& stmt : statements) {
+        if (const auto* var = dynamic_cast<const VarStmt*>(stmt.get())) names.insert(var->name.lexeme);
+        if (const auto* function = dynamic_cast<const FunctionStmt*>(stmt.get())) names.insert(function->name.lexeme);
+    }
+    return names;
+}
+
+void TypeInference::infer(const std::vector<std::unique_ptr<Stmt>>& statements) {
+    infer(statements, definedGlobals(statements));
+}
+
+void TypeInference::infer(const std::vector<std::unique_ptr<Stmt>>& statements,
+                          const std::unordered_set<std::string>& programGlobals) {
+    globalNames.insert(programGlobals.begin(), programGlobals.end());
+    // types only ever widen, so this terminates after a few rounds
+    do {
+        changed = false;
+        flow = Flow{};
+        walk(statements);
+    } while (changed);
+}
+
+void TypeInference::dump() const {
+    printf("== types ==\n");
+    for (const auto& declaration : declarations) {
+        InferredType type = declaration.type == InferredType::NONE ? InferredType::UNKNOWN : declaration.type;
+        printf("[line %d] %s: %s", declaration.name.line, declaration.name.lexeme.c_str(), typeName(type));
+        if (declaration.parameter) {
+            printf(" (parameter)");
+        } else if (declaration.widenedAt > 0) {
+            printf(" (line %d assigns %s)", declaration.widenedAt, typeName(declaration.widenedBy));
+        }
+        printf("\n");
+    }
+}
+
+InferredType TypeInference::typeOf(const Expr& expr) const {
+    auto it = exprTypes.find(&expr);
+    if (it == exprTypes.end() || it->second == InferredType::NONE) return InferredType::UNKNOWN;
+    return it->second;
+}
+
+InferredType TypeInference::variableType(const Expr& expr) const {
+    auto it = references.find(&expr);
+    if (it == references.end()) return InferredType::UNKNOWN;
+    auto type = declarations[it->second].type;
+    return type == InferredType::NONE ? InferredType::UNKNOWN : type;
+}
+
+InferredType TypeInference::inferExpr(const Expr& expr) {
+    expr.accept(*this);
+    exprTypes[&expr] = result;
+    return result;
+}
+
+InferredType TypeInference::declarationType(const void* node) const {
+    auto it = declarationIndex.find(node);
+    if (it == declarationIndex.end()) return InferredType::UNKNOWN;
+    auto type = declarations[it->second].type;
+    return type == InferredType::NONE ? InferredType::UNKNOWN : type;
+}
+
+int TypeInference::declare(const void* node, const Token& name, bool parameter) {
+    auto [it, inserted] = declarationIndex.try_emplace(node, declarations.size());
+    if (inserted) {
+        declarations.push_back({name, InferredType::NONE, parameter});
+        declarations.back().function = function;
+    }
+    scopes.back()[name.lexeme] = it->second;
+    return it->second;
+}
+
+int TypeInference::resolve(const Token& name) const {
+    for (int i = scopes.size() - 1; i >= 0; i--) {
+        auto it = scopes[i].find(name.lexeme);
+        if (it != scopes[i].end()) return it->second;
+    }
+    return -1;
+}
+
+void TypeInference::assign(int declaration, InferredType type, int line) {
+    auto& target = declarations[declaration];
+    auto joined = join(target.type, type);
+    if (joined == target.type) return;
+    if (joined == InferredType::UNKNOWN && target.widenedAt == 0) {
+        target.widenedAt = line;
+        target.widenedBy = type;
+    }
+    target.type = joined;
+    changed = true;
+}
+
+void TypeInference::store(int declaration, InferredType type, int line) {
+    assign(declaration, type, line);
+    auto& target = declarations[declaration];
+    if (target.function != function && !target.assignedByClosure) {
+        // any call may now change it, so its reads fall back to the slot type
+        target.assignedByClosure = true;
+        changed = true;
+    }
+    if (!flow.reachable) return;
+    if (flow.types.size() <= static_cast<size_t>(declaration)) {
+        flow.types.resize(declaration + 1, InferredType::NONE);
+    }
+    flow.types[declaration] = type;
+}
+
+InferredType TypeInference::load(int declaration) const {
+    if (!flowTracked(declaration)) return declarations[declaration].type;
+    if (!flow.reachable || flow.types.size() <= static_cast<size_t>(declaration)) return InferredType::NONE;
+    return flow.types[declaration];
+}
+
+bool TypeInference::flowTracked(int declaration) const {
+    const auto& target = declarations[declaration];
+    return target.function == function && !target.assignedByClosure;
+}
+
+void TypeInference::merge(Flow& into, const Flow& from) {
+    if (!from.reachable) return;
+    if (!into.reachable) {
+        into = from;
+        return;
+    }
+    if (into.types.size() < from.types.size()) {
+        into.types.resize(from.types.size(), InferredType::NONE);
+    }
+    for (size_t i = 0; i < from.types.size(); i++) {
+        into.types[i] = join(into.types[i], from.types[i]);
+    }
+}
+
+bool TypeInference::sameFlow(const Flow& a, const Flow& b) {
+    if (a.reachable != b.reachable) return false;
+    auto size = std::max(a.types.size(), b.types.size());
+    for (size_t i = 0; i < size; i++) {
+        auto left = i < a.types.size() ? a.types[i] : InferredType::NONE;
+        auto right = i < b.types.size() ? b.types[i] : InferredType::NONE;
+        if (left != right) return false;
+    }
+    return true;
+}
+
+void TypeInference::inferFunction(const std::vector<Token>& params, const BlockStmt& body) {
+    // the body runs whenever the function is called, not where it is defined
+    auto outerFlow = std::exchange(flow, Flow{});
+    auto outerBreaks = std::exchange(breaks, {});
+    auto outerContinues = std::exchange(continues, {});
+    function++;
+    scopes.emplace_back();
+    for (const auto& param : params) {
+        store(declare(&param, param, true), InferredType::UNKNOWN, 0);
+    }
+    body.accept(*this);
+    scopes.pop_back();
+    function--;
+    flow = std::move(outerFlow);
+    breaks = std::move(outerBreaks);
+    continues = std::move(outerContinues);
+}
+
+void TypeInference::visit(const Binary& expr) {
+    auto left = inferExpr(*expr.left);
+    auto right = inferExpr(*expr.right);
+    switch (expr.op.type) {
+        case TokenType::EQUAL_EQUAL:
+        case TokenType::BANG_EQUAL:
+        case TokenType::GREATER:
+        case TokenType::GREATER_EQUAL:
+        case TokenType::LESS:
+        case TokenType::LESS_EQUAL:
+            result = InferredType::BOOL;
+            return;
+        default:
+            break;
+    }
+    if (left == InferredType::NONE || right == InferredType::NONE) {
+        result = InferredType::NONE;
+    } else if (left == InferredType::NUMBER && right == InferredType::NUMBER) {
+        result = InferredType::NUMBER;
+    } else if (expr.op.type == TokenType::PLUS && left == InferredType::STRING && right == InferredType::STRING) {
+        result = InferredType::STRING;
+    } else {
+        result = InferredType::UNKNOWN;
+    }
+}
+
+void TypeInference::visit(const Logical& expr) {
+    // and/or evaluate to one of their operands; the right one may not run
+    auto left = inferExpr(*expr.left);
+    auto skipped = flow;
+    result = join(left, inferExpr(*expr.right));
+    merge(flow, skipped);
+}
+
+void TypeInference::visit(const Ternary& expr) {
+    inferExpr(*expr.condition);
+    auto otherwise = flow;
+    auto thenType = inferExpr(*expr.thenBranch);
+    std::swap(flow, otherwise);
+    result = join(thenType, inferExpr(*expr.elseBranch));
+    merge(flow, otherwise);
+}
+
+void TypeInference::visit(const Grouping& expr) {
+    result = inferExpr(*expr.expression);
+}
+
+void TypeInference::visit(const Literal& expr) {
+    result = typeOfValue(expr.value);
+}
+
+void TypeInference::visit(const Unary& expr) {
+    auto right = inferExpr(*expr.right);
+    if (expr.op.type == TokenType::BANG) {
+        result = InferredType::BOOL;
+    } else {
+        result = right == InferredType::NUMBER || right == InferredType::NONE ? right : InferredType::UNKNOWN;
+    }
+}
+
+void TypeInference::visit(const Postfix& expr) {
+    if (const auto* variable = dynamic_cast<const Variable*>(expr.operand.get())) {
+        int declaration = resolve(variable->name);
+        if (declaration != -1) {
+            references[&expr] = declaration;
+            references[variable] = declaration;
+            auto type = load(declaration);
+            exprTypes[variable] = type;
+            // ++/-- only succeed on numbers, and evaluate to the old value
+            store(declaration, InferredType::NUMBER, expr.op.line);
+            result = type == InferredType::NUMBER || type == InferredType::NONE ? type : InferredType::UNKNOWN;
+            return;
+        }
+    }
+    inferExpr(*expr.operand);
+    result = InferredType::UNKNOWN;
+}
+
+void TypeInference::visit(const Variable& expr) {
+    int declaration = resolve(expr.name);
+    if (declaration != -1) {
+        references[&expr] = declaration;
+        result = load(declaration);
+    } else {
+        result = InferredType::UNKNOWN;
+    }
+}
+
+void TypeInference::visit(const Assignment& expr) {
+    result = inferExpr(*expr.right);
+    int declaration = resolve(expr.name);
+    if (declaration != -1) {
+        references[&expr] = declaration;
+        store(declaration, result, expr.name.line);
+    }
+}
+
+void TypeInference::visit(const Call& expr) {
+    inferExpr(*expr.callee);
+    for (const auto& argument : expr.arguments) {
+        inferExpr(*argument);
+    }
+    result = InferredType::UNKNOWN;
+    if (const auto* callee = dynamic_cast<const Variable*>(expr.callee.get())) {
+        const auto& name = callee->name.lexeme;
+        const auto* native = nativeProperties(name);
+        if (resolve(callee->name) == -1 && native && native->returnsNumber && !globalNames.count(name)) {
+            result = InferredType::NUMBER;
+        }
+    }
+}
+
+void TypeInference::visit(const ArrayLiteral& expr) {
+    for (const auto& element : expr.elements) {
+        inferExpr(*element);
+    }
+    result = InferredType::ARRAY;
+}
+
+void TypeInference::visit(const MapLiteral& expr) {
+    for (const auto& [key, value] : expr.pairs) {
+        inferExpr(*key);
+        inferExpr(*value);
+    }
+    result = InferredType::MAP;
+}
+
+void TypeInference::visit(const Subscript& expr) {
+    inferExpr(*expr.object);
+    inferExpr(*expr.index);
+    result = InferredType::UNKNOWN;
+}
+
+void TypeInference::visit(const PropertyAccess& expr) {
+    inferExpr(*expr.object);
+    result = InferredType::UNKNOWN;
+}
+
+void TypeInference::visit(const SubscriptAssignment& expr) {
+    inferExpr(*expr.object);
+    inferExpr(*expr.index);
+    result = inferExpr(*expr.value);
+}
+
+void TypeInference::visit(const FunctionExpr& expr) {
+    inferFunction(expr.params, *expr.body);
+    result = InferredType::FUNCTION;
+}
+
+void TypeInference::visit(const VarStmt& stmt) {
+    auto type = stmt.initializer ? inferExpr(*stmt.initializer) : InferredType::NIL;
+    if (scopes.empty()) return; // global
+    store(declare(&stmt, stmt.name, false), type, stmt.name.line);
+}
+
+void TypeInference::visit(const BlockStmt& stmt) {
+    scopes.emplace_back();
+    walk(stmt.statements);
+    scopes.pop_back();
+}
+
+void TypeInference::visit(const IfStmt& stmt) {
+    inferExpr(*stmt.condition);
+    auto otherwise = flow;
+    stmt.thenBlock->accept(*this);
+    std::swap(flow, otherwise);
+    if (stmt.elseBlock) stmt.elseBlock->accept(*this);
+    merge(flow, otherwise);
+}
+
+void TypeInference::visit(const WhileStmt& stmt) {
+    auto outerBreaks = std::move(breaks);
+    auto outerContinues = std::move(continues);
+    Flow exit;
+    // the head sees the entry state joined with every way back to it; that
+    // only ever widens, so this settles after a few passes over the body
+    while (true) {
+        auto head = flow;
+        breaks.clear();
+        continues.clear();
+        inferExpr(*stmt.condition);
+        exit = flow;
+        stmt.body->accept(*this);
+        for (const auto& state : continues) merge(flow, state);
+        if (stmt.increment) inferExpr(*stmt.increment);
+        merge(flow, head);
+        if (sameFlow(flow, head)) break;
+    }
+    for (const auto& state : breaks) merge(exit, state);
+    flow = std::move(exit);
+    breaks = std::move(outerBreaks);
+    continues = std::move(outerContinues);
+}
+
+void TypeInference::visit(const FunctionStmt& stmt) {
+    if (!scopes.empty()) {
+        store(declare(&stmt, stmt.name, false), InferredType::FUNCTION, stmt.name.line);
+    }
+    inferFunction(stmt.params, *stmt.body);
+}
+
+void TypeInference::visit(const ReturnStmt& stmt) {
+    if (stmt.value) inferExpr(*stmt.value);
+    flow.reachable = false;
+}
+
+void TypeInference::visit(const BreakStmt&) {
+    breaks.push_back(flow);
+    flow.reachable = false;
+}
+
+void TypeInference::visit(const ContinueStmt&) {
+    continues.push_back(flow);
+    flow.reachable = false;
+}
@@ -0,0 +1,118 @@
+#pragma once
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "ast_walker.hpp"
+
+enum class InferredType {
+    NONE, // nothing assigned yet; only seen while iterating
+    NUMBER, BOOL, STRING, NIL, ARRAY, MAP, FUNCTION,
+    UNKNOWN,
+};
+
+const char* typeName(InferredType type);
+
+// Infers a type for every local variable and expression of a program.
+// Each local has a slot type, the join of everything ever assigned to it
+// (initializer, assignments, ++/--, including from closures), iterated to a
+// fixpoint, so a "number" slot holds a number at every point it is read.
+// Reads are typed flow-sensitively: within the function declaring a local,
+// a read gets the join of the stores that can reach it along the branches
+// and loops in between, so a later widening store only affects the reads
+// after it. Locals a nested function assigns, and reads from inside a
+// nested function, fall back to the slot type.
+// Globals and parameters are unknown; calls are unknown except for the
+// native math functions and len(), as long as the program does not define
+// globals of those names.
+class TypeInference: public AstWalker {
+public:
+    void infer(const std::vector<std::unique_ptr<Stmt>>& statements);
+    // infers some top-level statements of a larger program, which defines
+    // or assigns programGlobals; may be called for several parts in turn
+    void infer(const std::vector<std::unique_ptr<Stmt>>& statements, const std::unordered_set<std::string>& programGlobals);
+    // the globals statements define, assign or increment, for redefines()
+    static std::unordered_set<std::string> definedGlobals(const std::vector<std::unique_ptr<Stmt>>& statements);
+    void dump() const;
+
+    InferredType typeOf(const Expr& expr) const;
+    // slot type of the local variable read or written by a Variable/Assignment/Postfix;
+    // UNKNOWN for globals and upvalues alike. typeOf() of a read can be narrower.
+    InferredType variableType(const Expr& expr) const;
+    // type of the local declared by node (its VarStmt, FunctionStmt or
+    // parameter Token); UNKNOWN for globals
+    InferredType declarationType(const void* node) const;
+    // whether the program defines or assigns a global of this name (e.g. shadows a native)
+    bool redefines(const std::string& global) const { return globalNames.count(global) > 0; }
+
+    using AstWalker::visit;
+    void visit(const Binary& expr) override;
+    void visit(const Logical& expr) override;
+    void visit(const Ternary& expr) override;
+    void visit(const Grouping& expr) override;
+    void visit(const Literal& expr) override;
+    void visit(const Unary& expr) override;
+    void visit(const Postfix& expr) override;
+    void visit(const Variable& expr) override;
+    void visit(const Assignment& expr) override;
+    void visit(const Call& expr) override;
+    void visit(const ArrayLiteral& expr) override;
+    void visit(const MapLiteral& expr) override;
+    void visit(const Subscript& expr) override;
+    void visit(const PropertyAccess& expr) override;
+    void visit(const SubscriptAssignment& expr) override;
+    void visit(const FunctionExpr& expr) override;
+
+    void visit(const VarStmt& stmt) override;
+    void visit(const BlockStmt& stmt) override;
+    void visit(const IfStmt& stmt) override;
+    void visit(const WhileStmt& stmt) override;
+    void visit(const FunctionStmt& stmt) override;
+    void visit(const ReturnStmt& stmt) override;
+    void visit(const BreakStmt& stmt) override;
+    void visit(const ContinueStmt& stmt) override;
+
+private:
+    struct Declaration {
+        Token name;
+        InferredType type = InferredType::NONE;
+        bool parameter = false;
+        int widenedAt = 0; // line of the assignment that made the type unknown
+        InferredType widenedBy = InferredType::NONE;
+        int function = 0; // nesting depth of the function declaring it
+        bool assignedByClosure = false; // stored to from a nested function
+    };
+
+    // types of the locals at the current point of the current function,
+    // indexed like declarations; NONE for not assigned on any path here
+    struct Flow {
+        std::vector<InferredType> types;
+        bool reachable = true;
+    };
+
+    std::vector<Declaration> declarations;
+    std::unordered_map<const void*, int> declarationIndex; // keyed by the declaring node
+    std::vector<std::unordered_map<std::string, int>> scopes;
+    std::unordered_map<const Expr*, InferredType> exprTypes;
+    std::unordered_map<const Expr*, int> references;
+    std::unordered_set<std::string> globalNames; // globals the program defines or assigns
+    InferredType result = InferredType::UNKNOWN;
+    bool changed = false;
+    Flow flow;
+    std::vector<Flow> breaks;    // states at the breaks of the innermost loop
+    std::vector<Flow> continues; // and at its continues
+    int function = 0;            // nesting depth of the function being walked
+
+    InferredType inferExpr(const Expr& expr);
+    int declare(const void* node, const Token& name, bool parameter);
+    int resolve(const Token& name) const;
+    void assign(int declaration, InferredType type, int line);
+    // a store to or read of a local at the current point
+    void store(int declaration, InferredType type, int line);
+    InferredType load(int declaration) const;
+    bool flowTracked(int declaration) const;
+    static void merge(Flow& into, const Flow& from);
+    static bool sameFlow(const Flow& a, const Flow& b);
+    void inferFunction(const std::vector<Token>& params, const BlockStmt& body);
+};
@@ -62,12 +62,16 @@ int Chunk::disassembleInstruction(int offset) {
             return simpleInstruction("OP_LESS", offset);
         case OP_JUMP_IF_FALSE:
             return jumpInstruction("OP_JUMP_IF_FALSE", 1, offset);
+        case OP_JUMP_IF_TRUE:
+            return jumpInstruction("OP_JUMP_IF_TRUE", 1, offset);
         case OP_JUMP:
             return jumpInstruction("OP_JUMP", 1, offset);
         case OP_LOOP:
             return jumpInstruction("OP_LOOP", -1, offset);
         case OP_CALL:
             return byteInstruction("OP_CALL", offset);
+        case OP_TAIL_CALL:
+            return byteInstruction("OP_TAIL_CALL", offset);
         case OP_ARRAY_LITERAL:
             return byteInstruction("OP_ARRAY_LITERAL", offset);
         case OP_MAP_LITERAL:
@@ -92,16 +96,18 @@ int Chunk::disassembleInstruction(int offset) {
             return simpleInstruction("OP_POSTFIX_INC_SUBSCRIPT", offset);
         case OP_POSTFIX_DEC_SUBSCRIPT:
             return simpleInstruction("OP_POSTFIX_DEC_SUBSCRIPT", offset);
-        case OP_CLOSURE: {
+        case OP_CLOSURE:
+        case OP_CLOSURE_LOCAL: {
+            const char* name = instruction == OP_CLOSURE ? "OP_CLOSURE" : "OP_CLOSURE_LOCAL";
             offset++;
             uint16_t constant = (uint16_t)(m_bytecodes[offset] << 8);
             constant |= m_bytecodes[offset + 1];
             offset += 2;
-            printf("%-16s %4d ", "OP_CLOSURE", constant);
+            printf("%-16s %4d ", name, constant);
             auto callable = std::get<LoxCallable*>(m_constants[constant]);
             auto function = dynamic_cast<BeatFunction*>(callable);
             if (!function) {
-                throw std::runtime_error("OP_CLOSURE must consume a BeatFunction on stack");
+                throw std::runtime_error(std::string(name) + " must consume a BeatFunction on stack");
             }
             std::cout << m_constants[constant] << std::endl;
             for (int j = 0; j < function->upvalueCount; j++) {
@@ -118,6 +124,48 @@ int Chunk::disassembleInstruction(int offset) {
             return byteInstruction("OP_SET_UPVALUE", offset);
         case OP_CLOSE_UPVALUE:
             return simpleInstruction("OP_CLOSE_UPVALUE", offset);
+        case OP_CONSTANT_LITERAL:
+            return constantInstruction("OP_CONSTANT_LITERAL", offset);
+        case OP_ADD_NUM:
+            return simpleInstruction("OP_ADD_NUM", offset);
+        case OP_SUBTRACT_NUM:
+            return simpleInstruction("OP_SUBTRACT_NUM", offset);
+        case OP_MULTIPLY_NUM:
+            return simpleInstruction("OP_MULTIPLY_NUM", offset);
+        case OP_DIVIDE_NUM:
+            return simpleInstruction("OP_DIVIDE_NUM", offset);
+        case OP_GREATER_NUM:
+            return simpleInstruction("OP_GREATER_NUM", offset);
+        case OP_LESS_NUM:
+            return simpleInstruction("OP_LESS_NUM", offset);
+        case OP_GET_LOCAL_NUM:
+            return byteInstruction("OP_GET_LOCAL_NUM", offset);
+        case OP_SET_LOCAL_NUM:
+            return byteInstruction("OP_SET_LOCAL_NUM", offset);
+        case OP_LENGTH:
+            return simpleInstruction("OP_LENGTH", offset);
+        case OP_SUBSCRIPT_UNCHECKED:
+            return simpleInstruction("OP_SUBSCRIPT_UNCHECKED", offset);
+        case OP_SUBSCRIPT_ASSIGNMENT_UNCHECKED:
+            return simpleInstruction("OP_SUBSCRIPT_ASSIGNMENT_UNCHECKED", offset);
+        case OP_ARRAY_LITERAL_LOCAL:
+            return byteInstruction("OP_ARRAY_LITERAL_LOCAL", offset);
+        case OP_MAP_LITERAL_LOCAL:
+            return byteInstruction("OP_MAP_LITERAL_LOCAL", offset);
+        case OP_CONSTANT_LITERAL_LOCAL:
+            return constantInstruction("OP_CONSTANT_LITERAL_LOCAL", offset);
+        case OP_ADD_QUICK:
+            return simpleInstruction("OP_ADD_QUICK", offset);
+        case OP_SUBTRACT_QUICK:
+            return simpleInstruction("OP_SUBTRACT_QUICK", offset);
+        case OP_MULTIPLY_QUICK:
+            return simpleInstruction("OP_MULTIPLY_QUICK", offset);
+        case OP_DIVIDE_QUICK:
+            return simpleInstruction("OP_DIVIDE_QUICK", offset);
+        case OP_GREATER_QUICK:
+            return simpleInstruction("OP_GREATER_QUICK", offset);
+        case OP_LESS_QUICK:
+            return simpleInstruction("OP_LESS_QUICK", offset);
         default:
             printf("Unknown opcode %d\n", instruction);
             return offset + 1;
@@ -125,6 +173,50 @@ int Chunk::disassembleInstruction(int offset) {
 }
 
 
+int Chunk::instructionLength(int offset) const {
+    switch (m_bytecodes[offset]) {
+        case OP_CONSTANT:
+        case OP_DEFINE_GLOBAL:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_POSTFIX_INC_GLOBAL:
+        case OP_POSTFIX_DEC_GLOBAL:
+        case OP_CONSTANT_LITERAL:
+        case OP_CONSTANT_LITERAL_LOCAL:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+        case OP_JUMP:
+        case OP_LOOP:
+            return 3;
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_LOCAL_NUM:
+        case OP_SET_LOCAL_NUM:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_ARRAY_LITERAL:
+        case OP_MAP_LITERAL:
+        case OP_ARRAY_LITERAL_LOCAL:
+        case OP_MAP_LITERAL_LOCAL:
+        case OP_POSTFIX_INC_LOCAL:
+        case OP_POSTFIX_DEC_LOCAL:
+        case OP_POSTFIX_INC_UPVALUE:
+        case OP_POSTFIX_DEC_UPVALUE:
+            return 2;
+        case OP_CLOSURE:
+        case OP_CLOSURE_LOCAL: {
+            uint16_t constant = (uint16_t)(m_bytecodes[offset + 1] << 8);
+            constant |= m_bytecodes[offset + 2];
+            auto function = dynamic_cast<BeatFunction*>(std::get<LoxCallable*>(m_constants[constant]));
+            return 3 + 2 * function->upvalueCount;
+        }
+        default:
+            return 1;
+    }
+}
+
 int Chunk::simpleInstruction(const char* name, int offset) {
     printf("%s\n", name);
     return offset + 1;
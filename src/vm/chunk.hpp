@@ -13,20 +13,39 @@ typedef enum  {
     OP_DEFINE_GLOBAL, OP_GET_GLOBAL, OP_SET_GLOBAL,
     OP_SET_LOCAL, OP_GET_LOCAL, OP_SET_UPVALUE, OP_GET_UPVALUE,
     OP_POP,
-    OP_JUMP_IF_FALSE, OP_JUMP, OP_LOOP, OP_CALL,
+    OP_JUMP_IF_FALSE, OP_JUMP_IF_TRUE, OP_JUMP, OP_LOOP, OP_CALL, OP_TAIL_CALL,
     OP_ARRAY_LITERAL, OP_MAP_LITERAL, OP_SUBSCRIPT, OP_SUBSCRIPT_ASSIGNMENT,
     OP_POSTFIX_INC_LOCAL, OP_POSTFIX_DEC_LOCAL,
     OP_POSTFIX_INC_GLOBAL, OP_POSTFIX_DEC_GLOBAL,
     OP_POSTFIX_INC_UPVALUE, OP_POSTFIX_DEC_UPVALUE,
     OP_POSTFIX_INC_SUBSCRIPT, OP_POSTFIX_DEC_SUBSCRIPT,
     OP_CLOSURE, OP_CLOSE_UPVALUE,
+    OP_CONSTANT_LITERAL,
+    // operands proven to be numbers by TypeInference; no type checks
+    OP_ADD_NUM, OP_SUBTRACT_NUM, OP_MULTIPLY_NUM, OP_DIVIDE_NUM, OP_GREATER_NUM, OP_LESS_NUM,
+    OP_GET_LOCAL_NUM, OP_SET_LOCAL_NUM,
+    OP_LENGTH, // len() of the native, without the call
+    // index proven in range by the compiler's counted-loop analysis
+    OP_SUBSCRIPT_UNCHECKED, OP_SUBSCRIPT_ASSIGNMENT_UNCHECKED,
+    // allocate in the frame's arena: EscapeAnalysis proved the value stays in the frame
+    OP_ARRAY_LITERAL_LOCAL, OP_MAP_LITERAL_LOCAL, OP_CONSTANT_LITERAL_LOCAL, OP_CLOSURE_LOCAL,
+    // operands a profile saw to be numbers: checked fast path, generic instruction otherwise
+    OP_ADD_QUICK, OP_SUBTRACT_QUICK, OP_MULTIPLY_QUICK, OP_DIVIDE_QUICK, OP_GREATER_QUICK, OP_LESS_QUICK,
     OP_END // not used, just for counting the number of opcodes
 } OpCode;
 
+// Function whose body was compiled into a caller's chunk (see Compiler::tryInline)
+struct InlineOrigin {
+    std::string name;
+    int callLine;
+    int parent; // enclosing inline origin, -1 when inlined directly into the chunk's function
+};
+
 // using Chunk = std::vector<uint8_t>;
 class Chunk {
 public:
     std::vector<uint8_t> m_bytecodes; // TODO: make this private
+    int currentOrigin = -1; // inline origin recorded for bytes written from now on
 
     void disassembleChunk(const std::string& name);
     int disassembleInstruction(int offset);
@@ -34,13 +53,33 @@ public:
     void write(uint8_t byte, int line) {
         m_bytecodes.push_back(byte);
         m_lines.push_back(line);
+        m_origins.push_back(currentOrigin);
+        m_sites.push_back(-1);
     }
 
     void writeShort(uint16_t value, int line) {
-        m_bytecodes.push_back((uint8_t)(value >> 8));
-        m_lines.push_back(line);
-        m_bytecodes.push_back((uint8_t)(value & 0xff));
-        m_lines.push_back(line);
+        write((uint8_t)(value >> 8), line);
+        write((uint8_t)(value & 0xff), line);
+    }
+
+    // tags the instruction at offset with a profile site (see Profile)
+    void setSite(int offset, int site) {
+        m_sites[offset] = site;
+    }
+
+    int addInlineOrigin(const std::string& name, int callLine) {
+        m_inlineOrigins.push_back({name, callLine, currentOrigin});
+        return m_inlineOrigins.size() - 1;
+    }
+
+    // size in bytes of the instruction at offset, operands included
+    [[nodiscard]] int instructionLength(int offset) const;
+    // swap in rewritten code; lines, origins and sites must have one entry per byte
+    void replaceCode(std::vector<uint8_t> bytecodes, std::vector<int> lines, std::vector<int> origins, std::vector<int> sites) {
+        m_bytecodes = std::move(bytecodes);
+        m_lines = std::move(lines);
+        m_origins = std::move(origins);
+        m_sites = std::move(sites);
     }
 
     int constantInstruction(const char* name, int offset);
@@ -54,6 +93,8 @@ public:
     void clear_lines()
     {
         m_lines.clear();
+        m_origins.clear();
+        m_sites.clear();
     }
     [[nodiscard]] const std::vector<uint8_t>& bytecodes() const {
         return m_bytecodes;
@@ -64,11 +105,25 @@ public:
     [[nodiscard]] const std::vector<int>& lines() const {
         return m_lines;
     }
+    [[nodiscard]] const std::vector<int>& origins() const {
+        return m_origins;
+    }
+    [[nodiscard]] const std::vector<int>& sites() const {
+        return m_sites;
+    }
+    [[nodiscard]] const std::vector<InlineOrigin>& inlineOrigins() const {
+        return m_inlineOrigins;
+    }
 private:
     std::vector<Value> m_constants;
     std::vector<int> m_lines;
+    std::vector<int> m_origins;
+    std::vector<int> m_sites; // profile site of the instruction starting at each offset, or -1
+    std::vector<InlineOrigin> m_inlineOrigins;
 };
 
+struct NativeCode;
+
 enum class BeatFunctionType {
     FUNCTION, SCRIPT,
 };
@@ -83,6 +138,12 @@ public:
     Chunk chunk;
     BeatFunctionType type;
     int upvalueCount = 0;
+    bool verified = false; // passed BytecodeVerifier, may run without structural checks
+    // emitted by Compiler, whose analyses are what justify its unchecked
+    // (_NUM, _UNCHECKED) instructions; the verifier cannot re-derive them
+    bool compiled = false;
+    int64_t hotness = 0; // calls and loop iterations counted for the JIT
+    NativeCode* native = nullptr; // set once the JIT compiled it
 
     BeatFunction(int _arity, const std::string &name, Chunk &chunk, BeatFunctionType type, int cnt): arity_(_arity), name(name), chunk(std::move(chunk)), type(type), upvalueCount(cnt) {}
 
@@ -1,22 +1,37 @@
 #include <filesystem>
 #include <format>
+#include <utility>
 
 #include "compiler.hpp"
+#include "ast_walker.hpp"
+#include "native_properties.hpp"
 #include "token.hpp"
 #include "vm/chunk.hpp"
 
 extern bool disassemble;
 
+// largest compiled function body, in bytes, whose calls get inlined
+static constexpr int INLINE_BUDGET = 64;
+// the same, at a call a profile found hot and always calling that function
+static constexpr int HOT_INLINE_BUDGET = 256;
+
 void Compiler::visit(const Binary &expr) {
     expr.left->accept(*this);
     expr.right->accept(*this);
-    OpCode opcode;
     auto line = expr.op.line;
+    bool numbers = typeOf(*expr.left) == InferredType::NUMBER && typeOf(*expr.right) == InferredType::NUMBER;
+    // operands a profile only ever saw as numbers get the checked fast path
+    bool quick = !numbers && profileOf() && profileOf()->expectsNumbers(&expr);
+    auto arithmetic = [&](OpCode generic, OpCode number, OpCode quickened) {
+        int offset = chunk.bytecodes().size();
+        chunk.write(numbers ? number : quick ? quickened : generic, line);
+        if (!numbers) tagSite(&expr, offset);
+    };
     switch (expr.op.type) {
-        case TokenType::PLUS: chunk.write(OP_ADD, line); break;
-        case TokenType::MINUS: chunk.write(OP_SUBTRACT, line); break;
-        case TokenType::STAR: chunk.write(OP_MULTIPLY, line); break;
-        case TokenType::SLASH: chunk.write(OP_DIVIDE, line); break;
+        case TokenType::PLUS: arithmetic(OP_ADD, OP_ADD_NUM, OP_ADD_QUICK); break;
+        case TokenType::MINUS: arithmetic(OP_SUBTRACT, OP_SUBTRACT_NUM, OP_SUBTRACT_QUICK); break;
+        case TokenType::STAR: arithmetic(OP_MULTIPLY, OP_MULTIPLY_NUM, OP_MULTIPLY_QUICK); break;
+        case TokenType::SLASH: arithmetic(OP_DIVIDE, OP_DIVIDE_NUM, OP_DIVIDE_QUICK); break;
         case TokenType::PERCENT: chunk.write(OP_MODULO, line); break;
 
         case TokenType::EQUAL_EQUAL: chunk.write(OP_EQUAL, line); break;
@@ -24,14 +39,14 @@ void Compiler::visit(const Binary &expr) {
             chunk.write(OP_EQUAL, line);
             chunk.write(OP_NOT, line);
             break;
-        case TokenType::GREATER: chunk.write(OP_GREATER, line); break;
-        case TokenType::LESS: chunk.write(OP_LESS, line); break;
+        case TokenType::GREATER: arithmetic(OP_GREATER, OP_GREATER_NUM, OP_GREATER_QUICK); break;
+        case TokenType::LESS: arithmetic(OP_LESS, OP_LESS_NUM, OP_LESS_QUICK); break;
         case TokenType::GREATER_EQUAL:
-            chunk.write(OP_LESS, line);
+            arithmetic(OP_LESS, OP_LESS_NUM, OP_LESS_QUICK);
             chunk.write(OP_NOT, line);
             break;
         case TokenType::LESS_EQUAL:
-            chunk.write(OP_GREATER, line);
+            arithmetic(OP_GREATER, OP_GREATER_NUM, OP_GREATER_QUICK);
             chunk.write(OP_NOT, line);
             break;
         default:
@@ -40,6 +55,13 @@ void Compiler::visit(const Binary &expr) {
     }
 }
 
+void Compiler::tagSite(const void* node, int offset) {
+    if (const auto* profile = profileOf()) {
+        int site = profile->siteOf(node);
+        if (site >= 0) chunk.setSite(offset, site);
+    }
+}
+
 
 void Compiler::visit(const Literal &expr) {
     int constant = chunk.addConstant(expr.value);
@@ -56,7 +78,7 @@ void Compiler::visit(const Logical &expr) {
         expr.left->accept(*this);
         int endJump = emitJump(OP_JUMP_IF_FALSE, expr.op.line);
         chunk.write(OP_POP, expr.op.line);
-        expr.right->accept(*this);
+        compileAt(*expr.right, slotOf(expr));
         patchJump(endJump);
     } else if (expr.op.type ==  TokenType::OR) {
         expr.left->accept(*this);
@@ -64,7 +86,7 @@ void Compiler::visit(const Logical &expr) {
         int endJump = emitJump(OP_JUMP, expr.op.line);
         patchJump(elseJump);
         chunk.write(OP_POP, expr.op.line);
-        expr.right->accept(*this);
+        compileAt(*expr.right, slotOf(expr));
         patchJump(endJump);
     } else {
         throw CompileException("logical expr op type must be OR or AND");
@@ -81,7 +103,7 @@ void Compiler::visit(const Ternary &expr) {
 
     // 3. Condition was true: pop condition, evaluate then branch
     chunk.write(OP_POP, expr.question.line);
-    expr.thenBranch->accept(*this);
+    compileAt(*expr.thenBranch, slotOf(expr));
 
     // 4. Jump over else branch
     int endJump = emitJump(OP_JUMP, expr.question.line);
@@ -89,14 +111,14 @@ void Compiler::visit(const Ternary &expr) {
     // 5. Else branch: pop condition, evaluate else branch
     patchJump(elseJump);
     chunk.write(OP_POP, expr.question.line);
-    expr.elseBranch->accept(*this);
+    compileAt(*expr.elseBranch, slotOf(expr));
 
     // 6. End of ternary
     patchJump(endJump);
 };
 
 void Compiler::visit(const Grouping &expr) {
-    expr.expression->accept(*this);
+    compileAt(*expr.expression, slotOf(expr));
 };
 
 void Compiler::visit(const Unary &expr) {
@@ -168,7 +190,7 @@ void Compiler::visit(const Postfix& expr) {
 void Compiler::visit(const Variable &expr) {
     int arg = resolveLocal(expr.name);
     if (arg != -1) {
-        chunk.write(OP_GET_LOCAL, expr.name.line);
+        chunk.write(variableType(expr) == InferredType::NUMBER ? OP_GET_LOCAL_NUM : OP_GET_LOCAL, expr.name.line);
         chunk.write(arg, expr.name.line);
         return;
     }
@@ -186,11 +208,11 @@ void Compiler::visit(const Variable &expr) {
 };
 
 void Compiler::visit(const Assignment &expr) {
-    expr.right->accept(*this);
+    compileAt(*expr.right, slotOf(expr));
 
     int arg = resolveLocal(expr.name);
     if (arg != -1) { // global var assignment
-        chunk.write(OP_SET_LOCAL, expr.name.line);
+        chunk.write(variableType(expr) == InferredType::NUMBER ? OP_SET_LOCAL_NUM : OP_SET_LOCAL, expr.name.line);
         chunk.write(arg, expr.name.line);
         return;
     }
@@ -208,12 +230,15 @@ void Compiler::visit(const Assignment &expr) {
 
 // returns the slot index in the locals stack in both Compiler/VM (as they mirror)
 // return -1 if no local varialbel found; assume to be global
-int Compiler::resolveLocal(Token token) {
-    for (int i= locals.size()-1; i>= 0; i--) {
+int Compiler::resolveLocal(Token token, bool fromClosure) {
+    // an inlined body only sees its own parameters and locals
+    int lowest = inlineStack.empty() ? 0 : inlineStack.back().base;
+    for (int i= locals.size()-1; i>= lowest; i--) {
         if (locals[i].name.lexeme == token.lexeme) {
             // declared but not defined; should error out; this is to prevent self-referential
-            // VarDef: var a = a;
-            if (locals[i].depth == -1) {
+            // VarDef: var a = a;. A closure may capture it: its initializer
+            // lands in the slot the upvalue points to.
+            if (locals[i].depth == -1 && !fromClosure) {
                 throw CompileException(std::format("local variable {} declared but not defined", token.lexeme));
             }
             return i;
@@ -223,9 +248,9 @@ int Compiler::resolveLocal(Token token) {
 }
 
 int Compiler::resolveUpvalue(Token name) {
-    if (enclosing == NULL) return -1;
+    if (enclosing == NULL || !inlineStack.empty()) return -1;
 
-    int local = enclosing->resolveLocal( name);
+    int local = enclosing->resolveLocal(name, true);
     if (local != -1) {
         // std::cout << "resolving upvalue -- found in enclsoing local "  << local << std::endl;
         enclosing->locals[local].isCaptured = true;
@@ -250,6 +275,18 @@ int Compiler::addUpvalue( uint8_t index,bool isLocal) {
 }
 
 void Compiler::visit(const Call &expr) {
+    emitCall(expr, OP_CALL, slotOf(expr));
+};
+
+void Compiler::emitCall(const Call &expr, OpCode op, int slot) {
+    if (tryInline(expr, slot)) {
+        return;
+    }
+    if (isNativeCall(expr, "len")) {
+        expr.arguments[0]->accept(*this);
+        chunk.write(OP_LENGTH, expr.paren.line);
+        return;
+    }
     expr.callee->accept(*this);
     for (const auto &arg : expr.arguments) {
         arg->accept(*this);
@@ -258,31 +295,110 @@ void Compiler::visit(const Call &expr) {
     if (argCount >= 256) {
         throw CompileException("cannot compile >= 256 arguments");
     }
-    chunk.write(OP_CALL, expr.paren.line);
+    chunk.write(op, expr.paren.line);
     chunk.write(argCount, expr.paren.line);
-};
+    tagSite(&expr, chunk.bytecodes().size() - 2);
+}
+
+// Evaluates a literal tree made only of constants (nested array/map literals included)
+// at compile time. Returns false as soon as any part needs runtime evaluation.
+bool Compiler::buildConstantLiteral(const Expr& expr, Value& out) {
+    if (const auto* literal = dynamic_cast<const Literal*>(&expr)) {
+        out = literal->value;
+        return true;
+    }
+    if (const auto* grouping = dynamic_cast<const Grouping*>(&expr)) {
+        return buildConstantLiteral(*grouping->expression, out);
+    }
+    if (const auto* unary = dynamic_cast<const Unary*>(&expr)) {
+        // -1 is parsed as unary minus applied to the number literal 1
+        Value operand;
+        if (unary->op.type != TokenType::MINUS || !buildConstantLiteral(*unary->right, operand)
+            || !std::holds_alternative<double>(operand)) {
+            return false;
+        }
+        out = -std::get<double>(operand);
+        return true;
+    }
+    if (const auto* array = dynamic_cast<const ArrayLiteral*>(&expr)) {
+        std::vector<Value> elements;
+        elements.reserve(array->elements.size());
+        for (const auto& elem : array->elements) {
+            Value value;
+            if (!buildConstantLiteral(*elem, value)) return false;
+            elements.push_back(std::move(value));
+        }
+        out = std::make_shared<Array>(elements);
+        return true;
+    }
+    if (const auto* map = dynamic_cast<const MapLiteral*>(&expr)) {
+        std::unordered_map<Value, Value> data;
+        data.reserve(map->pairs.size());
+        // OP_MAP_LITERAL pops pairs back to front, so the first of duplicated keys wins.
+        for (auto it = map->pairs.rbegin(); it != map->pairs.rend(); ++it) {
+            Value key, value;
+            if (!buildConstantLiteral(*it->first, key) || !buildConstantLiteral(*it->second, value)) return false;
+            // array/map keys compare by identity; a fresh one is expected on every evaluation
+            if (std::holds_alternative<std::shared_ptr<Array>>(key) || std::holds_alternative<std::shared_ptr<Map>>(key)) {
+                return false;
+            }
+            data[key] = std::move(value);
+        }
+        out = std::make_shared<Map>(data);
+        return true;
+    }
+    return false;
+}
+
+void Compiler::emitConstantLiteral(const Value& value, bool frameLocal, int line) {
+    int constant = chunk.addConstant(value);
+    if (constant >= 65536) {
+        throw CompileException("cannot compile >= 65536 constants");
+    }
+    chunk.write(frameLocal ? OP_CONSTANT_LITERAL_LOCAL : OP_CONSTANT_LITERAL, line);
+    chunk.writeShort(constant, line);
+}
 
 void Compiler::visit(const ArrayLiteral &expr) {
+    bool frameLocal = isFrameLocal(&expr);
+    Value table;
+    if (buildConstantLiteral(expr, table)) {
+        emitConstantLiteral(table, frameLocal, expr.get_line());
+        return;
+    }
+    if (expr.elements.size() > UINT8_MAX) {
+        throw CompileException("cannot compile array literal with > 255 non-constant elements");
+    }
     for (const auto &elem : expr.elements) {
         elem->accept(*this);
     }
-    chunk.write(OP_ARRAY_LITERAL, expr.get_line());
+    chunk.write(frameLocal ? OP_ARRAY_LITERAL_LOCAL : OP_ARRAY_LITERAL, expr.get_line());
     chunk.write(expr.elements.size(), expr.get_line());
 };
 
 void Compiler::visit(const MapLiteral &expr) {
+    bool frameLocal = isFrameLocal(&expr);
+    Value table;
+    if (buildConstantLiteral(expr, table)) {
+        emitConstantLiteral(table, frameLocal, expr.get_line());
+        return;
+    }
+    if (expr.pairs.size() > UINT8_MAX) {
+        throw CompileException("cannot compile map literal with > 255 non-constant pairs");
+    }
     for (const auto &pair : expr.pairs) {
         pair.first->accept(*this);
         pair.second->accept(*this);
     }
-    chunk.write(OP_MAP_LITERAL, expr.get_line());
+    chunk.write(frameLocal ? OP_MAP_LITERAL_LOCAL : OP_MAP_LITERAL, expr.get_line());
     chunk.write(expr.pairs.size(), expr.get_line());
 };
 
 void Compiler::visit(const Subscript &expr) {
     expr.object->accept(*this);
     expr.index->accept(*this);
-    chunk.write(OP_SUBSCRIPT, expr.index->get_line());
+    chunk.write(inCountedRange(*expr.object, *expr.index) ? OP_SUBSCRIPT_UNCHECKED : OP_SUBSCRIPT,
+                expr.index->get_line());
 };
 
 // obj.name := obj["name"]
@@ -301,7 +417,8 @@ void Compiler::visit(const SubscriptAssignment &expr) {
     expr.object->accept(*this);
     expr.index->accept(*this);
     expr.value->accept(*this);
-    chunk.write(OP_SUBSCRIPT_ASSIGNMENT, expr.index->get_line());
+    chunk.write(inCountedRange(*expr.object, *expr.index) ? OP_SUBSCRIPT_ASSIGNMENT_UNCHECKED : OP_SUBSCRIPT_ASSIGNMENT,
+                expr.index->get_line());
 };
 
 void Compiler::visit(const FunctionExpr &expr) {
@@ -316,7 +433,7 @@ void Compiler::visit(const FunctionExpr &expr) {
     int constant = chunk.addConstant((LoxCallable*)func);
     // chunk.write(OP_CONSTANT, expr.get_line());
     // chunk.writeShort(constant, expr.get_line());
-    chunk.write(OP_CLOSURE, expr.get_line());
+    chunk.write(isFrameLocal(&expr) ? OP_CLOSURE_LOCAL : OP_CLOSURE, expr.get_line());
     chunk.writeShort(constant, expr.get_line());
     for (int i=0; i<functionCompiler.upvalues.size(); i++) {
         chunk.write(functionCompiler.upvalues[i].isLocal ? 1 : 0, expr.get_line());
@@ -327,12 +444,12 @@ void Compiler::visit(const FunctionExpr &expr) {
 
 // statements
 void Compiler::visit(const ExpressionStmt &stmt) {
-    stmt.expr->accept(*this);
+    compileAt(*stmt.expr, locals.size());
     chunk.write(OP_POP, stmt.line); // pop the result of the expression
 };
 
 void Compiler::visit(const PrintStmt &stmt) {
-    stmt.expr->accept(*this);
+    compileAt(*stmt.expr, locals.size());
     chunk.write(OP_PRINT, stmt.expr->get_line()); // FIXME: there is no line info
 };
 
@@ -352,7 +469,8 @@ void Compiler::visit(const VarStmt &stmt) {
         locals.push_back({stmt.name, -1, false});
     }
     if (stmt.initializer) {
-        stmt.initializer->accept(*this);
+        // a local's initializer lands in the slot reserved for it above
+        compileAt(*stmt.initializer, scopeDepth > 0 ? locals.size() - 1 : locals.size());
     } else {
         chunk.write(OP_NIL, stmt.name.line);
     }
@@ -374,8 +492,13 @@ void Compiler::visit(const VarStmt &stmt) {
 
 void Compiler::visit(const BlockStmt &stmt) {
     beginScope();
-    for (const auto &stmt : stmt.statements) {
-        stmt->accept(*this);
+    for (size_t i = 0; i < stmt.statements.size(); i++) {
+        // the parser desugars for (var i = ..; ..; ..) into { var i = ..; while (..) }, and the
+        // IR optimizer may put loop invariants ($inv locals, plain arithmetic) in between
+        if (i > 0 && i == stmt.statements.size() - 1 && dynamic_cast<const WhileStmt*>(stmt.statements[i].get())
+            && isHoistedInvariants(stmt, 1, i))
+            forInitializer = dynamic_cast<const VarStmt*>(stmt.statements[0].get());
+        stmt.statements[i]->accept(*this);
     }
     endScope();
 };
@@ -399,18 +522,28 @@ void Compiler::patchJump(int offset) {
     chunk.m_bytecodes[offset + 1] = jump & 0xff;
 }
 
+// The branch laid out second needs no jump at its end, so when a profile
+// found the condition mostly true the then branch goes there:
+//     <condition> JUMP_IF_TRUE then; POP; <else>; JUMP end; then: POP; <then>; end:
 void Compiler::visit(const IfStmt &stmt) {
-    stmt.condition->accept(*this);
-    int thenJump = emitJump(OP_JUMP_IF_FALSE, stmt.condition->get_line());
-    chunk.write(OP_POP, stmt.condition->get_line());
-    stmt.thenBlock->accept(*this);
-    int elseJump = emitJump(OP_JUMP, stmt.condition->get_line());
-    patchJump(thenJump);
-    chunk.write(OP_POP, stmt.condition->get_line());
-    if (stmt.elseBlock) {
-        stmt.elseBlock->accept(*this);
+    int line = stmt.condition->get_line();
+    compileAt(*stmt.condition, locals.size());
+    bool thenLast = profileOf() && profileOf()->likelyTrue(&stmt);
+    const Stmt* first = thenLast ? stmt.elseBlock.get() : stmt.thenBlock.get();
+    const Stmt* second = thenLast ? stmt.thenBlock.get() : stmt.elseBlock.get();
+    int secondJump = emitJump(thenLast ? OP_JUMP_IF_TRUE : OP_JUMP_IF_FALSE, line);
+    tagSite(&stmt, secondJump - 1);
+    chunk.write(OP_POP, line);
+    if (first) {
+        first->accept(*this);
     }
-    patchJump(elseJump);
+    int endJump = emitJump(OP_JUMP, line);
+    patchJump(secondJump);
+    chunk.write(OP_POP, line);
+    if (second) {
+        second->accept(*this);
+    }
+    patchJump(endJump);
 };
 
 void Compiler::emitLoop(int loopStart) {
@@ -425,13 +558,25 @@ void Compiler::emitLoop(int loopStart) {
 }
 
 void Compiler::visit(const WhileStmt &stmt) {
+    const VarStmt* initializer = std::exchange(forInitializer, nullptr);
+    CountedLoop counted;
+    bool isCounted = matchCountedLoop(stmt, initializer, counted);
+
     int loopStart = chunk.m_bytecodes.size();
     beginLoop(loopStart);
 
-    stmt.condition->accept(*this);
-    int exitJump = emitJump(OP_JUMP_IF_FALSE, stmt.condition->get_line());
-    chunk.write(OP_POP, stmt.condition->get_line());
+    // while (true) / for (;;): no test to emit, the loop only exits via break
+    const auto* literal = dynamic_cast<const Literal*>(stmt.condition.get());
+    bool alwaysTrue = literal && is_truthy(literal->value);
+    int exitJump = -1;
+    if (!alwaysTrue) {
+        compileAt(*stmt.condition, locals.size());
+        exitJump = emitJump(OP_JUMP_IF_FALSE, stmt.condition->get_line());
+        chunk.write(OP_POP, stmt.condition->get_line());
+    }
+    if (isCounted) countedLoops.push_back(counted);
     stmt.body->accept(*this);
+    if (isCounted) countedLoops.pop_back();
 
     if (!loopStack.empty()) {
         for (int jumpLoc : loopStack.back().continueJumps) {
@@ -440,12 +585,14 @@ void Compiler::visit(const WhileStmt &stmt) {
         loopStack.back().continueJumps.clear();
     }
     if (stmt.increment) {
-        stmt.increment->accept(*this);
+        compileAt(*stmt.increment, locals.size());
         chunk.write(OP_POP, stmt.increment->get_line());
     }
     emitLoop(loopStart);
-    patchJump(exitJump);
-    chunk.write(OP_POP, stmt.condition->get_line());
+    if (!alwaysTrue) {
+        patchJump(exitJump);
+        chunk.write(OP_POP, stmt.condition->get_line());
+    }
 
     endLoop();  // End loop context and patch break/continue jumps
 };
@@ -531,7 +678,7 @@ void Compiler::visit(const FunctionStmt &stmt) {
     // chunk.write(OP_CONSTANT, stmt.name.line);
     // chunk.writeShort(constant, stmt.name.line);
     // chunk.write(OP_POP, stmt.name.line);
-    chunk.write(OP_CLOSURE, stmt.name.line);
+    chunk.write(isFrameLocal(&stmt) ? OP_CLOSURE_LOCAL : OP_CLOSURE, stmt.name.line);
     chunk.writeShort(constant, stmt.name.line);
     // std::cout << "upvalue count: " << func->upvalueCount << std::endl;
     // std::cout << "upvalues size: " << functionCompiler.upvalues.size() << std::endl;
@@ -547,6 +694,8 @@ void Compiler::visit(const FunctionStmt &stmt) {
         }
         chunk.write(OP_DEFINE_GLOBAL, stmt.name.line);
         chunk.writeShort(constant, stmt.name.line);
+        if (enclosing == nullptr && inlineStack.empty())
+            considerForInlining(stmt, *func);
     } else { // local variable declaration
         locals.back().depth = scopeDepth;
         // no need to emit any opcodes; just bookkeep the position of the local variables on
@@ -555,9 +704,367 @@ void Compiler::visit(const FunctionStmt &stmt) {
 };
 
 void Compiler::visit(const ReturnStmt &stmt) {
-    if (stmt.value)
-        stmt.value->accept(*this);
-    else
-        chunk.write(OP_NIL, stmt.kw.line); // return nil if no value is provided
+    if (!inlineStack.empty()) {
+        emitInlineReturn(stmt);
+        return;
+    }
+    if (stmt.value) {
+        emitReturnValue(*stmt.value, stmt.kw.line);
+        return;
+    }
+    chunk.write(OP_NIL, stmt.kw.line); // return nil if no value is provided
     chunk.write(OP_RETURN, stmt.kw.line);
 };
+
+// Calls in tail position reuse the current frame (OP_TAIL_CALL) so that
+// recursion-style loops, as forced by --no-loop, run in constant frame space.
+void Compiler::emitReturnValue(const Expr &value, int line) {
+    if (functionType == BeatFunctionType::FUNCTION) {
+        if (const auto* grouping = dynamic_cast<const Grouping*>(&value)) {
+            emitReturnValue(*grouping->expression, line);
+            return;
+        }
+        if (const auto* call = dynamic_cast<const Call*>(&value)) {
+            emitCall(*call, OP_TAIL_CALL, locals.size());
+            // only reached when the callee was native: its result is on the stack top
+            chunk.write(OP_RETURN, line);
+            return;
+        }
+        if (const auto* ternary = dynamic_cast<const Ternary*>(&value)) {
+            // both branches return, so no jump over the else branch is needed
+            ternary->condition->accept(*this);
+            int elseJump = emitJump(OP_JUMP_IF_FALSE, ternary->question.line);
+            chunk.write(OP_POP, ternary->question.line);
+            emitReturnValue(*ternary->thenBranch, line);
+            patchJump(elseJump);
+            chunk.write(OP_POP, ternary->question.line);
+            emitReturnValue(*ternary->elseBranch, line);
+            return;
+        }
+    }
+    compileAt(value, locals.size());
+    chunk.write(OP_RETURN, line);
+}
+
+void Compiler::compileAt(const Expr &expr, int slot) {
+    const Expr* savedExpr = slotExpr;
+    int savedIndex = slotIndex;
+    slotExpr = &expr;
+    slotIndex = slot;
+    expr.accept(*this);
+    slotExpr = savedExpr;
+    slotIndex = savedIndex;
+}
+
+// true when name is not shadowed by any local or upvalue visible here
+bool Compiler::isGlobal(const Token &name) const {
+    int lowest = inlineStack.empty() ? 0 : inlineStack.back().base;
+    for (int i = locals.size() - 1; i >= lowest; i--) {
+        if (locals[i].name.lexeme == name.lexeme) return false;
+    }
+    if (!inlineStack.empty()) return true;
+    for (const Compiler* outer = enclosing; outer; outer = outer->enclosing) {
+        for (const auto& local : outer->locals) {
+            if (local.name.lexeme == name.lexeme) return false;
+        }
+    }
+    return true;
+}
+
+namespace {
+
+// A body can be inlined if it creates no closures (its locals would have to
+// outlive the caller's stack slots) and never mentions its own name.
+class InlinableBody: public AstWalker {
+public:
+    const std::string& name;
+    bool inlinable = true;
+    explicit InlinableBody(const std::string& name): name(name) {}
+
+    using AstWalker::visit;
+    void visit(const Variable& expr) override {
+        if (expr.name.lexeme == name) inlinable = false;
+    }
+    void visit(const FunctionExpr&) override { inlinable = false; }
+    void visit(const FunctionStmt&) override { inlinable = false; }
+};
+
+}
+
+void Compiler::scanForInlining(const std::vector<std::unique_ptr<Stmt>>& statements) {
+    inlineCandidates.clear();
+    hotInlineCandidates.clear();
+    reassignedGlobals.clear();
+    if (!inlineFunctions || !optimize) return;
+
+    AssignedNames assigned;
+    assigned.walk(statements);
+    reassignedGlobals.insert(assigned.names.begin(), assigned.names.end());
+    std::unordered_set<std::string> declared;
+    for (const auto& stmt : statements) {
+        const Token* name = nullptr;
+        if (const auto* var = dynamic_cast<const VarStmt*>(stmt.get())) name = &var->name;
+        if (const auto* function = dynamic_cast<const FunctionStmt*>(stmt.get())) name = &function->name;
+        if (name && !declared.insert(name->lexeme).second) {
+            reassignedGlobals.insert(name->lexeme);
+        }
+    }
+}
+
+// Called once the global definition of stmt has been emitted: calls compiled
+// from here on run after the definition, so they may use the body directly.
+void Compiler::considerForInlining(const FunctionStmt &stmt, const BeatFunction &func) {
+    if (!inlineFunctions || !optimize) return;
+    if (reassignedGlobals.count(stmt.name.lexeme)) return;
+    int size = func.chunk.bytecodes().size();
+    bool hotOnly = size > INLINE_BUDGET;
+    if (hotOnly && (!profileOf() || size > HOT_INLINE_BUDGET)) return;
+    InlinableBody body{stmt.name.lexeme};
+    body.walk(stmt.body->statements);
+    if (body.inlinable) {
+        (hotOnly ? hotInlineCandidates : inlineCandidates)[stmt.name.lexeme] = &stmt;
+    }
+}
+
+// Expands a call to a small global function in place of OP_CALL:
+//
+//     NIL              result slot (or the local being initialized)
+//     <arguments>      become the parameters
+//     <body>           return e  =>  e; SET_LOCAL result; POP; POP params..; JUMP end
+//     POP params..
+//   end:
+//
+// Only possible when the call's value lands directly above the locals, since
+// the parameters are addressed as local slots.
+bool Compiler::tryInline(const Call &expr, int slot) {
+    if (!inlineFunctions || !optimize || slot == -1) return false;
+    const auto* callee = dynamic_cast<const Variable*>(expr.callee.get());
+    if (!callee) return false;
+    const FunctionStmt* found = nullptr;
+    auto it = root()->inlineCandidates.find(callee->name.lexeme);
+    if (it != root()->inlineCandidates.end()) {
+        found = it->second;
+    } else {
+        auto hot = root()->hotInlineCandidates.find(callee->name.lexeme);
+        if (hot != root()->hotInlineCandidates.end() && profileOf()->hotCallee(&expr) == callee->name.lexeme) {
+            found = hot->second;
+        }
+    }
+    if (!found) return false;
+    const FunctionStmt& function = *found;
+    if (function.params.size() != expr.arguments.size() || !isGlobal(callee->name)) return false;
+    for (const auto& context : inlineStack) {
+        if (context.name == function.name.lexeme) return false; // mutual recursion
+    }
+    // initializer of a local declared but not yet defined: return straight into it
+    bool intoPendingLocal = slot == (int)locals.size() - 1 && locals.back().depth == -1;
+    if (slot != (int)locals.size() && !intoPendingLocal) return false;
+    if (locals.size() + function.params.size() + INLINE_BUDGET > UINT8_MAX) return false;
+
+    int line = expr.paren.line;
+    chunk.write(OP_NIL, line);
+    for (const auto &arg : expr.arguments) {
+        arg->accept(*this);
+    }
+
+    int savedOrigin = chunk.currentOrigin;
+    chunk.currentOrigin = chunk.addInlineOrigin(function.name.lexeme, line);
+    beginScope();
+    if (!intoPendingLocal) {
+        locals.push_back({Token(TokenType::IDENTIFIER, "", nullptr, line), scopeDepth, false});
+    }
+    for (const auto &param : function.params) {
+        locals.push_back({param, scopeDepth, false});
+    }
+    inlineStack.push_back({function.name.lexeme, slot, slot + 1, {}, std::move(loopStack)});
+    loopStack.clear();
+
+    function.body->accept(*this);
+    // falling off the end returns nil, which the result slot already holds
+
+    for (size_t i = 0; i < function.params.size(); i++) {
+        chunk.write(OP_POP, line);
+        locals.pop_back();
+    }
+    auto context = std::move(inlineStack.back());
+    inlineStack.pop_back();
+    for (int jump : context.exitJumps) {
+        patchJump(jump);
+    }
+    loopStack = std::move(context.callerLoops);
+    if (!intoPendingLocal) {
+        locals.pop_back(); // from here on the result is an ordinary temporary
+    }
+    scopeDepth--;
+    chunk.currentOrigin = savedOrigin;
+    return true;
+}
+
+void Compiler::emitInlineReturn(const ReturnStmt &stmt) {
+    if (stmt.value) {
+        compileAt(*stmt.value, locals.size());
+        chunk.write(OP_SET_LOCAL, stmt.kw.line);
+        chunk.write(inlineStack.back().resultSlot, stmt.kw.line);
+        chunk.write(OP_POP, stmt.kw.line);
+    }
+    // drop everything the body pushed, down to its parameters
+    for (int i = locals.size() - 1; i >= inlineStack.back().base; i--) {
+        chunk.write(OP_POP, stmt.kw.line);
+    }
+    inlineStack.back().exitJumps.push_back(emitJump(OP_JUMP, stmt.kw.line));
+}
+
+namespace {
+
+// What a counted loop's body (and increment) may do to its index and array.
+class CountedLoopBody: public AstWalker {
+public:
+    const std::string& index;
+    const std::string& array;
+    bool writesIndex = false;
+    bool writesArray = false;
+    std::unordered_set<std::string> callees;   // names called directly
+    std::unordered_set<std::string> declared;  // names declared inside
+    bool callsUnknown = false;                 // calls something other than a named function
+
+    CountedLoopBody(const std::string& index, const std::string& array): index(index), array(array) {}
+
+    using AstWalker::visit;
+    void visit(const Assignment& expr) override {
+        written(expr.name.lexeme);
+        AstWalker::visit(expr);
+    }
+    void visit(const Postfix& expr) override {
+        if (const auto* variable = dynamic_cast<const Variable*>(expr.operand.get())) {
+            written(variable->name.lexeme);
+        }
+        AstWalker::visit(expr);
+    }
+    void visit(const Call& expr) override {
+        if (const auto* callee = dynamic_cast<const Variable*>(expr.callee.get())) {
+            callees.insert(callee->name.lexeme);
+        } else {
+            callsUnknown = true;
+        }
+        AstWalker::visit(expr);
+    }
+    void visit(const VarStmt& stmt) override {
+        declared.insert(stmt.name.lexeme);
+        AstWalker::visit(stmt);
+    }
+    void visit(const FunctionStmt& stmt) override {
+        declared.insert(stmt.name.lexeme);
+        for (const auto& param : stmt.params) declared.insert(param.lexeme);
+        AstWalker::visit(stmt);
+    }
+    void visit(const FunctionExpr& expr) override {
+        for (const auto& param : expr.params) declared.insert(param.lexeme);
+        AstWalker::visit(expr);
+    }
+
+private:
+    void written(const std::string& name) {
+        if (name == index) writesIndex = true;
+        if (name == array) writesArray = true;
+    }
+};
+
+bool isVariable(const Expr* expr, const std::string& name) {
+    const auto* variable = dynamic_cast<const Variable*>(expr);
+    return variable && variable->name.lexeme == name;
+}
+
+}
+
+// name refers to the VM's native of that name: the program never defines or
+// assigns it (only known when TypeInference ran) and nothing shadows it here
+bool Compiler::isNative(const Token &name) {
+    const TypeInference* facts = root()->types;
+    return facts && !facts->redefines(name.lexeme) && isGlobal(name);
+}
+
+bool Compiler::isNativeCall(const Call &expr, const char* name) {
+    const auto* callee = dynamic_cast<const Variable*>(expr.callee.get());
+    return callee && callee->name.lexeme == name && expr.arguments.size() == 1 && isNative(callee->name);
+}
+
+// Recognizes
+//
+//     for (var i = <integer >= 0>; i < len(A); i++ / i = i + 1) body
+//
+// where A is a variable, the body never assigns i or A, and every call in it
+// is to a native that cannot shrink an array. Each A[i] in the body then runs
+// right after `i < len(A)` held with i a non-negative integer, so the bounds
+// check and number conversion can be skipped. len(A) itself is compiled to
+// OP_LENGTH, which reads the current size, so a push in the body is still seen
+// by the next test.
+// statements [from, to) of block are all locals the IR optimizer hoisted out of the loop after them
+bool Compiler::isHoistedInvariants(const BlockStmt& block, size_t from, size_t to) {
+    for (size_t i = from; i < to; i++) {
+        const auto* var = dynamic_cast<const VarStmt*>(block.statements[i].get());
+        if (!var || var->name.lexeme.rfind("$inv", 0) != 0) return false;
+    }
+    return true;
+}
+
+bool Compiler::matchCountedLoop(const WhileStmt &stmt, const VarStmt* initializer, CountedLoop &loop) {
+    if (!initializer || !stmt.increment || !root()->types) return false;
+
+    const auto* condition = dynamic_cast<const Binary*>(stmt.condition.get());
+    if (!condition || condition->op.type != TokenType::LESS) return false;
+    const auto* index = dynamic_cast<const Variable*>(condition->left.get());
+    const auto* bound = dynamic_cast<const Call*>(condition->right.get());
+    if (!index || !bound || !isNativeCall(*bound, "len")) return false;
+    const auto* array = dynamic_cast<const Variable*>(bound->arguments[0].get());
+    if (!array || index->name.lexeme == array->name.lexeme) return false;
+    const std::string& i = index->name.lexeme;
+
+    const auto* start = dynamic_cast<const Literal*>(initializer->initializer.get());
+    if (initializer->name.lexeme != i || !start || !std::holds_alternative<double>(start->value)) return false;
+    double first = std::get<double>(start->value);
+    if (first < 0 || first != (double)(int64_t)first) return false;
+
+    bool stepsByOne = false;
+    if (const auto* postfix = dynamic_cast<const Postfix*>(stmt.increment.get())) {
+        stepsByOne = postfix->op.type == TokenType::PLUS_PLUS && isVariable(postfix->operand.get(), i);
+    } else if (const auto* assignment = dynamic_cast<const Assignment*>(stmt.increment.get())) {
+        const auto* sum = dynamic_cast<const Binary*>(assignment->right.get());
+        const auto* one = sum ? dynamic_cast<const Literal*>(sum->right.get()) : nullptr;
+        stepsByOne = assignment->name.lexeme == i && sum && sum->op.type == TokenType::PLUS &&
+                     isVariable(sum->left.get(), i) && one && one->value == Value(1.0);
+    }
+    if (!stepsByOne) return false;
+
+    CountedLoopBody body{i, array->name.lexeme};
+    stmt.body->accept(body);
+    if (body.writesIndex || body.writesArray || body.callsUnknown) return false;
+    for (const auto& callee : body.callees) {
+        const auto* native = nativeProperties(callee);
+        if (!native || !native->loopSafe || body.declared.count(callee)) return false;
+        if (!isNative(Token(TokenType::IDENTIFIER, callee, nullptr, 0))) return false;
+    }
+
+    loop.index = i;
+    loop.indexSlot = resolveLocal(index->name);
+    loop.array = array->name.lexeme;
+    loop.arraySlot = resolveLocal(array->name);
+    if (loop.indexSlot == -1) return false;
+    if (loop.arraySlot == -1 && !isGlobal(array->name)) return false; // an upvalue
+    return true;
+}
+
+// object[index] reads the array and counter of an enclosing counted loop
+bool Compiler::inCountedRange(const Expr &object, const Expr &index) {
+    const auto* array = dynamic_cast<const Variable*>(&object);
+    const auto* counter = dynamic_cast<const Variable*>(&index);
+    if (!array || !counter) return false;
+    for (const auto& loop : countedLoops) {
+        if (loop.array != array->name.lexeme || loop.index != counter->name.lexeme) continue;
+        // same bindings as in the loop header, not shadowed by a body local
+        if (resolveLocal(counter->name) != loop.indexSlot) continue;
+        int arraySlot = resolveLocal(array->name);
+        if (arraySlot != loop.arraySlot || (arraySlot == -1 && !isGlobal(array->name))) continue;
+        return true;
+    }
+    return false;
+}
@@ -1,9 +1,20 @@
 #pragma once
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
 #include "chunk.hpp"
+#include "escape_analysis.hpp"
 #include "expr.hpp"
+#include "peephole.hpp"
+#include "profile.hpp"
+#include "type_inference.hpp"
 #include "statement.hpp"
 #include "token.hpp"
 
+extern bool optimize;
+extern bool inlineFunctions;
+
 class CompileException: public std::runtime_error {
     public:
     CompileException(const std::string& msg): std::runtime_error(msg) {}
@@ -20,6 +31,7 @@ public:
         bool isCaptured;
     } Local;
     int scopeDepth = 0;
+    BeatFunctionType functionType = BeatFunctionType::SCRIPT;
     struct LoopContext {
         std::vector<int> breakJumps;    // Jump locations to patch for break
         std::vector<int> continueJumps; // Jump locations to patch for continue
@@ -28,6 +40,48 @@ public:
     };
     std::vector<LoopContext> loopStack; // Stack of nested loop contexts
 
+    // A call being expanded in place (see tryInline)
+    struct InlineContext {
+        std::string name;
+        int resultSlot;       // local slot the body's return value is stored into
+        int base;             // first slot visible to the body: its parameters
+        std::vector<int> exitJumps; // returns jump past the end of the body
+        std::vector<LoopContext> callerLoops; // break/continue in the body must not see these
+    };
+    std::vector<InlineContext> inlineStack;
+
+    // Only filled in the script compiler: top-level functions that calls may be
+    // inlined to, and names disqualified because they are assigned or redeclared.
+    std::unordered_map<std::string, const FunctionStmt*> inlineCandidates;
+    std::unordered_set<std::string> reassignedGlobals;
+    // too large to inline anywhere but at a call the profile found hot
+    std::unordered_map<std::string, const FunctionStmt*> hotInlineCandidates;
+
+    // A for loop `for (var i = n; i < len(A); i++)` whose body cannot move i or
+    // shrink A, so A[i] inside it is always in range (see matchCountedLoop)
+    struct CountedLoop {
+        std::string array;
+        int arraySlot;        // -1 for a global
+        std::string index;
+        int indexSlot;
+    };
+    std::vector<CountedLoop> countedLoops;
+
+    // facts from TypeInference for the program being compiled, if it ran
+    const TypeInference* types = nullptr;
+    InferredType typeOf(const Expr& expr) { return root()->types ? root()->types->typeOf(expr) : InferredType::UNKNOWN; }
+    InferredType variableType(const Expr& expr) { return root()->types ? root()->types->variableType(expr) : InferredType::UNKNOWN; }
+
+    // allocation sites EscapeAnalysis proved stay in their frame, if it ran
+    const EscapeAnalysis* escapes = nullptr;
+    bool isFrameLocal(const void* node) { return root()->escapes && root()->escapes->isFrameLocal(node); }
+
+    // sites to tag and feedback to specialize on, when profiling or compiling
+    // with a profile (beat --profile-out / --profile-in)
+    const Profile* profile = nullptr;
+    const Profile* profileOf() { return root()->profile; }
+    void tagSite(const void* node, int offset);
+
 
     // use as a stack for local variables
     // this compile-time stack will exactly mirror runtime VM stack std::vector<Value> locals
@@ -56,6 +110,9 @@ public:
 
     BeatFunction* compileBeatFunction(const std::unique_ptr<BlockStmt> &body, std::string name, int arity, BeatFunctionType type) {
         chunk = Chunk(); // reset the chunk
+        functionType = type;
+        if (type == BeatFunctionType::SCRIPT)
+            scanForInlining(body->statements);
         // upvalues.clear();
         // compile(std::move(stmts));
         if (type == BeatFunctionType::FUNCTION)
@@ -68,8 +125,12 @@ public:
 
         chunk.write(OP_NIL, 0);
         chunk.write(OP_RETURN, 0); // add return at the end of the function
+        if (optimize)
+            PeepholeOptimizer(chunk).run();
         // std::cout << "Compiling BeatFunction: " << name << " with upvalue count: " << upvalues.size() << std::endl;
-        return new BeatFunction(arity, name, chunk, type, upvalues.size());
+        auto* function = new BeatFunction(arity, name, chunk, type, upvalues.size());
+        function->compiled = true;
+        return function;
     }
 
     inline void clear() {
@@ -93,14 +154,34 @@ public:
             }
         }
     }
-    int resolveLocal(Token token);
+    // fromClosure: a nested function refers to it, which it may do from the
+    // local's own initializer (var f = fun() { f(); };)
+    int resolveLocal(Token token, bool fromClosure = false);
     int resolveUpvalue(Token name);
     int addUpvalue( uint8_t index,bool isLocal);
+    bool buildConstantLiteral(const Expr& expr, Value& out);
+    void emitConstantLiteral(const Value& value, bool frameLocal, int line);
 
 
     int emitJump(uint8_t instruction, int line);
     void patchJump(int offset);
     void emitLoop(int loopStart);
+    void emitCall(const Call& expr, OpCode op, int slot);
+    void emitReturnValue(const Expr& value, int line);
+    bool isNative(const Token& name);
+    bool isNativeCall(const Call& expr, const char* name);
+    bool matchCountedLoop(const WhileStmt& stmt, const VarStmt* initializer, CountedLoop& loop);
+    static bool isHoistedInvariants(const BlockStmt& block, size_t from, size_t to);
+    bool inCountedRange(const Expr& object, const Expr& index);
+
+    void compileAt(const Expr& expr, int slot);
+    int slotOf(const Expr& expr) const { return &expr == slotExpr ? slotIndex : -1; }
+    bool isGlobal(const Token& name) const;
+    Compiler* root() { return enclosing ? enclosing->root() : this; }
+    void scanForInlining(const std::vector<std::unique_ptr<Stmt>>& statements);
+    void considerForInlining(const FunctionStmt& stmt, const BeatFunction& func);
+    bool tryInline(const Call& expr, int slot);
+    void emitInlineReturn(const ReturnStmt& stmt);
 
     void beginLoop(int loopStart);
     void endLoop();
@@ -139,6 +220,12 @@ public:
 
 private:
     Chunk chunk;
+    // set by compileAt: the expression whose value lands in local slot slotIndex,
+    // i.e. nothing but locals sits below it on the stack
+    const Expr* slotExpr = nullptr;
+    int slotIndex = -1;
+    // the `var` clause of the for loop whose WhileStmt is about to be compiled
+    const VarStmt* forInitializer = nullptr;
     typedef struct {
         uint8_t index;
         bool isLocal;
@@ -0,0 +1,79 @@
+#include "frame_arena.hpp"
+
+#include <algorithm>
+#include <new>
+
+#include "chunk.hpp"
+
+FrameArena::~FrameArena() {
+    for (auto* closure : closures) closure->~BeatClosure();
+}
+
+void* FrameArena::take(size_t bytes) {
+    bytes = (bytes + GRAIN - 1) / GRAIN * GRAIN;
+    if (used + bytes > CHUNK_SIZE) {
+        if (!chunks.empty()) current++;
+        if (current == chunks.size()) chunks.push_back(std::make_unique<std::byte[]>(CHUNK_SIZE));
+        used = 0;
+    }
+    void* block = chunks[current].get() + used;
+    used += bytes;
+    return block;
+}
+
+void* FrameArena::allocate(size_t bytes) {
+    size_t sizeClass = (bytes + GRAIN - 1) / GRAIN - 1;
+    if (sizeClass >= SIZE_CLASSES) return ::operator new(bytes);
+    live++;
+    if (auto* block = freeLists[sizeClass]) {
+        freeLists[sizeClass] = block->next;
+        return block;
+    }
+    return take(bytes);
+}
+
+void FrameArena::deallocate(void* block, size_t bytes) {
+    size_t sizeClass = (bytes + GRAIN - 1) / GRAIN - 1;
+    if (sizeClass >= SIZE_CLASSES) {
+        ::operator delete(block);
+        return;
+    }
+    freeLists[sizeClass] = new (block) FreeBlock{freeLists[sizeClass]};
+    if (--live == 0 && detached) delete this;
+}
+
+BeatClosure* FrameArena::newClosure(BeatFunction* function) {
+    auto* closure = new (take(sizeof(BeatClosure))) BeatClosure(function);
+    closures.push_back(closure);
+    return closure;
+}
+
+void FrameArena::reset() {
+    for (auto* closure : closures) closure->~BeatClosure();
+    closures.clear();
+    current = 0;
+    used = chunks.empty() ? CHUNK_SIZE : 0;
+    std::fill(std::begin(freeLists), std::end(freeLists), nullptr);
+}
+
+FrameArenaPool::~FrameArenaPool() {
+    for (auto* arena : spare) delete arena;
+}
+
+FrameArena* FrameArenaPool::acquire() {
+    if (spare.empty()) return new FrameArena();
+    auto* arena = spare.back();
+    spare.pop_back();
+    return arena;
+}
+
+void FrameArenaPool::release(FrameArena* arena) {
+    if (arena->live > 0) {
+        for (auto* closure : arena->closures) closure->~BeatClosure();
+        arena->closures.clear();
+        arena->detached = true;
+        return;
+    }
+    arena->reset();
+    spare.push_back(arena);
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+class BeatClosure;
+class BeatFunction;
+
+// Memory for the arrays, maps and closures a frame creates at the sites
+// EscapeAnalysis proved never outlive it (the *_LOCAL opcodes). Blocks are
+// bump allocated from chunks and recycled by size while the frame runs, and
+// the whole arena is reset for reuse when the frame returns. Only the objects
+// themselves live here; an array's elements or a map's buckets are ordinary
+// heap memory.
+class FrameArena {
+public:
+    FrameArena() = default;
+    FrameArena(const FrameArena&) = delete;
+    FrameArena& operator=(const FrameArena&) = delete;
+    ~FrameArena();
+
+    void* allocate(size_t bytes);
+    void deallocate(void* block, size_t bytes);
+    BeatClosure* newClosure(BeatFunction* function);
+
+private:
+    static constexpr size_t GRAIN = 16;
+    static constexpr size_t SIZE_CLASSES = 16; // blocks up to 256 bytes come from the chunks
+    static constexpr size_t CHUNK_SIZE = 4096;
+
+    struct FreeBlock { FreeBlock* next; };
+
+    std::vector<std::unique_ptr<std::byte[]>> chunks;
+    size_t current = 0;           // chunk being bump allocated from
+    size_t used = CHUNK_SIZE;     // bytes taken from it
+    FreeBlock* freeLists[SIZE_CLASSES] = {};
+    std::vector<BeatClosure*> closures;
+    int live = 0;                 // blocks allocated and not yet deallocated
+    bool detached = false;        // released by its frame while blocks were still live
+
+    void* take(size_t bytes);
+    void reset();
+    friend class FrameArenaPool;
+};
+
+// Hands out arenas to frames and takes them back when the frames return.
+class FrameArenaPool {
+public:
+    FrameArenaPool() = default;
+    FrameArenaPool(const FrameArenaPool&) = delete;
+    FrameArenaPool& operator=(const FrameArenaPool&) = delete;
+    ~FrameArenaPool();
+
+    FrameArena* acquire();
+    // Destroys the arena's closures and recycles it. Should a value still
+    // point into it (it cannot, if the analysis is right), the arena is left
+    // to free itself once its last block is deallocated.
+    void release(FrameArena* arena);
+
+private:
+    std::vector<FrameArena*> spare;
+};
+
+// For std::allocate_shared: puts the object and its reference count in an arena.
+template <typename T>
+struct ArenaAllocator {
+    using value_type = T;
+    FrameArena* arena;
+
+    explicit ArenaAllocator(FrameArena* arena): arena(arena) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other): arena(other.arena) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(arena->allocate(n * sizeof(T))); }
+    void deallocate(T* p, size_t n) { arena->deallocate(p, n * sizeof(T)); }
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U>& other) const { return arena == other.arena; }
+};
@@ -0,0 +1,470 @@
+#include "jit.hpp"
+
+#include <bit>
+#include <cstddef>
+#include <cstring>
+#include <format>
+#include <unistd.h>
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
+
+#include "vm.hpp"
+#include "x64_assembler.hpp"
+
+namespace {
+
+using namespace x64;
+
+// Value layout the generated code relies on; Jit::supported checks it
+constexpr int VALUE = sizeof(Value);
+constexpr int INDEX = sizeof(Value) - alignof(Value); // the variant's index byte, after the largest alternative
+constexpr uint8_t DOUBLE = 0, NIL = 2, BOOL = 3, CALLABLE = 4;
+static_assert(std::is_same_v<std::variant_alternative_t<DOUBLE, Value>, double>);
+static_assert(std::is_same_v<std::variant_alternative_t<NIL, Value>, std::nullptr_t>);
+static_assert(std::is_same_v<std::variant_alternative_t<BOOL, Value>, bool>);
+static_assert(std::is_same_v<std::variant_alternative_t<CALLABLE, Value>, LoxCallable*>);
+
+// std::vector<Value> as three pointers: first element, end, end of storage
+constexpr int STACK_DATA = 0, STACK_END = 8, STACK_CAPACITY = 16;
+
+// registers kept across the whole function (all callee-saved)
+constexpr Reg VM_REG = RBX;
+constexpr Reg FRAME = R12;
+constexpr Reg STACK = R13;  // the std::vector
+constexpr Reg TOP = R14;    // end of the stack; written back before leaving the code
+constexpr Reg LOCALS = R15; // byte offset of the frame's first slot
+
+constexpr Mem top(int offset = 0) { return {TOP, offset - VALUE}; }
+constexpr Mem second(int offset = 0) { return {TOP, offset - 2 * VALUE}; }
+
+bool step(VM* vm) {
+    return vm->step();
+}
+
+// never fails short of running out of memory
+void grow(std::vector<Value>* stack) noexcept {
+    stack->reserve(stack->capacity() * 2);
+}
+
+uint16_t readShort(const uint8_t* code) {
+    return (uint16_t)((code[0] << 8) | code[1]);
+}
+
+class CodeGenerator {
+public:
+    explicit CodeGenerator(BeatFunction& function)
+        : function(function), code(function.chunk.bytecodes().data()), size(function.chunk.bytecodes().size()) {}
+
+    const std::vector<uint8_t>& generate() {
+        at.assign(size + 1, -1);
+        for (int offset = 0; offset < size; offset += function.chunk.instructionLength(offset)) {
+            at[offset] = a.newLabel();
+        }
+        at[size] = a.newLabel();
+        exit = a.newLabel();
+        failed = a.newLabel();
+
+        prologue();
+        for (int offset = 0; offset < size;) {
+            int next = offset + function.chunk.instructionLength(offset);
+            a.bind(at[offset]);
+            instruction(offset, next);
+            offset = next;
+        }
+        a.bind(at[size]); // verified code never gets here
+        epilogue();
+        return a.finish();
+    }
+
+    [[nodiscard]] int offsetOf(int bytecodeOffset) const {
+        return a.offsetOf(at[bytecodeOffset]);
+    }
+
+private:
+    BeatFunction& function;
+    const uint8_t* code;
+    int size;
+    Assembler a;
+    std::vector<Assembler::Label> at; // label of each instruction, by bytecode offset
+    Assembler::Label exit = -1, failed = -1;
+
+    // enter(vm, frame, stack, entry)
+    void prologue() {
+        a.push(RBX);
+        a.push(R12);
+        a.push(R13);
+        a.push(R14);
+        a.push(R15); // with the return address, keeps the stack 16-byte aligned for calls
+        a.movRR(VM_REG, RDI);
+        a.movRR(FRAME, RSI);
+        a.movRR(STACK, RDX);
+        a.load32(LOCALS, {FRAME, (int)offsetof(CallFrame, frame_pointer)});
+        a.imulImm(LOCALS, LOCALS, VALUE);
+        a.load(TOP, {STACK, STACK_END});
+        a.jmpReg(RCX);
+    }
+
+    void epilogue() {
+        auto done = a.newLabel();
+        a.bind(exit);
+        a.store({STACK, STACK_END}, TOP);
+        a.movImm32(RAX, 0);
+        a.jmp(done);
+        a.bind(failed);
+        a.movImm32(RAX, 1);
+        a.bind(done);
+        a.pop(R15);
+        a.pop(R14);
+        a.pop(R13);
+        a.pop(R12);
+        a.pop(RBX);
+        a.ret();
+    }
+
+    void setIp(int offset) {
+        a.movImm64(RAX, (uint64_t)(code + offset));
+        a.store({FRAME, (int)offsetof(CallFrame, ip)}, RAX);
+    }
+
+    // leave the instruction at offset to the interpreter loop
+    void exitAt(int offset) {
+        setIp(offset);
+        a.jmp(exit);
+    }
+
+    // run the instruction at offset in the interpreter and carry on
+    void interpret(int offset) {
+        a.store({STACK, STACK_END}, TOP);
+        setIp(offset);
+        a.movRR(RDI, VM_REG);
+        a.movImm64(RAX, (uint64_t)&step);
+        a.callReg(RAX);
+        a.testByteRR(RAX, RAX);
+        a.jcc(EQUAL, failed);
+        a.load(TOP, {STACK, STACK_END});
+    }
+
+    // room for one more value on the stack
+    void reserve() {
+        auto enough = a.newLabel();
+        a.cmp(TOP, {STACK, STACK_CAPACITY});
+        a.jcc(BELOW, enough);
+        a.store({STACK, STACK_END}, TOP);
+        a.movRR(RDI, STACK);
+        a.movImm64(RAX, (uint64_t)&grow);
+        a.callReg(RAX);
+        a.load(TOP, {STACK, STACK_END});
+        a.bind(enough);
+    }
+
+    // reg = address of the frame's first slot; changes when the stack grows
+    void locals(Reg reg) {
+        a.load(reg, {STACK, STACK_DATA});
+        a.addRR(reg, LOCALS);
+    }
+
+    void pushNumber(Reg bits) {
+        a.store(top(VALUE), bits);
+        a.storeByte(top(VALUE + INDEX), DOUBLE);
+        a.addImm(TOP, VALUE);
+    }
+
+    // replaces the two operands with the bool in the low byte of reg
+    void popTwoPushBool(Reg reg) {
+        a.storeByte(second(), reg);
+        a.storeByte(second(INDEX), BOOL);
+        a.addImm(TOP, -VALUE);
+    }
+
+    // jumps to otherwise unless index (a register) holds a value copied and
+    // dropped without running any C++ code: a number, nil, bool or function
+    void requireTrivial(Reg index, Assembler::Label otherwise) {
+        a.cmpImm32(index, 1); // a string
+        a.jcc(EQUAL, otherwise);
+        a.cmpImm32(index, CALLABLE);
+        a.jcc(ABOVE, otherwise); // arrays and maps
+    }
+
+    void requireNumbers(Assembler::Label otherwise) {
+        a.loadByte(RAX, top(INDEX));
+        a.loadByte(RCX, second(INDEX));
+        a.orRR32(RAX, RCX); // DOUBLE is 0
+        a.jcc(NOT_EQUAL, otherwise);
+    }
+
+    void arithmetic(SseOp op) {
+        a.movsdLoad(XMM0, second());
+        a.sse(op, XMM0, top());
+        a.movsdStore(second(), XMM0);
+        a.addImm(TOP, -VALUE);
+    }
+
+    void compare(uint8_t op) {
+        a.movsdLoad(XMM0, second());
+        a.movsdLoad(XMM1, top());
+        switch (op) {
+            case OP_LESS: // b > a, false if either is NaN
+                a.ucomisd(XMM1, XMM0);
+                a.setcc(ABOVE, RAX);
+                break;
+            case OP_GREATER:
+                a.ucomisd(XMM0, XMM1);
+                a.setcc(ABOVE, RAX);
+                break;
+            default: // OP_EQUAL: equal and ordered
+                a.ucomisd(XMM0, XMM1);
+                a.setcc(EQUAL, RAX);
+                a.setcc(NOT_PARITY, RCX);
+                a.andByteRR(RAX, RCX);
+                break;
+        }
+        popTwoPushBool(RAX);
+    }
+
+    // a number fast path with the interpreter as the fallback
+    template <typename FastPath>
+    void guarded(int offset, int next, FastPath fastPath) {
+        auto slow = a.newLabel();
+        fastPath(slow);
+        a.jmp(at[next]);
+        a.bind(slow);
+        interpret(offset);
+    }
+
+    void instruction(int offset, int next) {
+        uint8_t op = code[offset];
+        switch (op) {
+            case OP_CONSTANT: {
+                const auto& constant = function.chunk.constants()[readShort(code + offset + 1)];
+                if (!std::holds_alternative<double>(constant)) {
+                    interpret(offset);
+                    break;
+                }
+                reserve();
+                a.movImm64(RAX, std::bit_cast<uint64_t>(std::get<double>(constant)));
+                pushNumber(RAX);
+                break;
+            }
+            case OP_NIL:
+                reserve();
+                a.movImm32(RAX, 0);
+                a.store(top(VALUE), RAX);
+                a.storeByte(top(VALUE + INDEX), NIL);
+                a.addImm(TOP, VALUE);
+                break;
+            case OP_POP:
+                guarded(offset, next, [&](auto slow) {
+                    a.loadByte(RAX, top(INDEX));
+                    requireTrivial(RAX, slow);
+                    a.addImm(TOP, -VALUE);
+                });
+                break;
+            case OP_GET_LOCAL_NUM: {
+                int slot = code[offset + 1] * VALUE;
+                reserve();
+                locals(RAX);
+                a.load(RCX, {RAX, slot});
+                pushNumber(RCX);
+                break;
+            }
+            case OP_SET_LOCAL_NUM: {
+                int slot = code[offset + 1] * VALUE;
+                locals(RAX);
+                a.load(RCX, top());
+                a.store({RAX, slot}, RCX);
+                break;
+            }
+            case OP_GET_LOCAL: {
+                int slot = code[offset + 1] * VALUE;
+                reserve();
+                guarded(offset, next, [&](auto slow) {
+                    locals(RAX);
+                    a.loadByte(RCX, {RAX, slot + INDEX});
+                    requireTrivial(RCX, slow);
+                    a.load(RDX, {RAX, slot});
+                    a.store(top(VALUE), RDX);
+                    a.storeByte(top(VALUE + INDEX), RCX);
+                    a.addImm(TOP, VALUE);
+                });
+                break;
+            }
+            case OP_SET_LOCAL: {
+                int slot = code[offset + 1] * VALUE;
+                guarded(offset, next, [&](auto slow) {
+                    locals(RAX);
+                    a.loadByte(RCX, top(INDEX));
+                    requireTrivial(RCX, slow);
+                    a.loadByte(RDX, {RAX, slot + INDEX});
+                    requireTrivial(RDX, slow);
+                    a.load(RDX, top());
+                    a.store({RAX, slot}, RDX);
+                    a.storeByte({RAX, slot + INDEX}, RCX);
+                });
+                break;
+            }
+            case OP_POSTFIX_INC_LOCAL:
+            case OP_POSTFIX_DEC_LOCAL: {
+                int slot = code[offset + 1] * VALUE;
+                double delta = op == OP_POSTFIX_INC_LOCAL ? 1.0 : -1.0;
+                reserve();
+                guarded(offset, next, [&](auto slow) {
+                    locals(RAX);
+                    a.cmpByte({RAX, slot + INDEX}, DOUBLE);
+                    a.jcc(NOT_EQUAL, slow);
+                    a.movsdLoad(XMM0, {RAX, slot});
+                    a.movsdStore(top(VALUE), XMM0);
+                    a.storeByte(top(VALUE + INDEX), DOUBLE);
+                    a.movImm64(RCX, std::bit_cast<uint64_t>(delta));
+                    a.movqFromReg(XMM1, RCX);
+                    a.sseRR(SseOp::ADD, XMM0, XMM1);
+                    a.movsdStore({RAX, slot}, XMM0);
+                    a.addImm(TOP, VALUE);
+                });
+                break;
+            }
+            case OP_ADD_NUM:      arithmetic(SseOp::ADD); break;
+            case OP_SUBTRACT_NUM: arithmetic(SseOp::SUB); break;
+            case OP_MULTIPLY_NUM: arithmetic(SseOp::MUL); break;
+            case OP_DIVIDE_NUM:   arithmetic(SseOp::DIV); break;
+            case OP_LESS_NUM:     compare(OP_LESS); break;
+            case OP_GREATER_NUM:  compare(OP_GREATER); break;
+            case OP_ADD:
+            case OP_ADD_QUICK:
+                guarded(offset, next, [&](auto slow) { requireNumbers(slow); arithmetic(SseOp::ADD); });
+                break;
+            case OP_SUBTRACT:
+            case OP_SUBTRACT_QUICK:
+                guarded(offset, next, [&](auto slow) { requireNumbers(slow); arithmetic(SseOp::SUB); });
+                break;
+            case OP_MULTIPLY:
+            case OP_MULTIPLY_QUICK:
+                guarded(offset, next, [&](auto slow) { requireNumbers(slow); arithmetic(SseOp::MUL); });
+                break;
+            case OP_DIVIDE:
+            case OP_DIVIDE_QUICK:
+                guarded(offset, next, [&](auto slow) { requireNumbers(slow); arithmetic(SseOp::DIV); });
+                break;
+            case OP_LESS:
+            case OP_LESS_QUICK:
+                guarded(offset, next, [&](auto slow) { requireNumbers(slow); compare(OP_LESS); });
+                break;
+            case OP_GREATER:
+            case OP_GREATER_QUICK:
+                guarded(offset, next, [&](auto slow) { requireNumbers(slow); compare(OP_GREATER); });
+                break;
+            case OP_EQUAL:
+                guarded(offset, next, [&](auto slow) { requireNumbers(slow); compare(OP_EQUAL); });
+                break;
+            case OP_NOT:
+                guarded(offset, next, [&](auto slow) {
+                    a.cmpByte(top(INDEX), BOOL);
+                    a.jcc(NOT_EQUAL, slow);
+                    a.xorByte(top(), 1);
+                });
+                break;
+            case OP_JUMP:
+                a.jmp(at[next + readShort(code + offset + 1)]);
+                break;
+            case OP_LOOP:
+                a.jmp(at[next - readShort(code + offset + 1)]);
+                break;
+            case OP_JUMP_IF_FALSE:
+            case OP_JUMP_IF_TRUE: {
+                // only false and nil are falsy; the condition stays on the stack
+                auto target = at[next + readShort(code + offset + 1)];
+                bool onTrue = op == OP_JUMP_IF_TRUE;
+                auto notBool = a.newLabel();
+                a.loadByte(RAX, top(INDEX));
+                a.cmpImm32(RAX, BOOL);
+                a.jcc(NOT_EQUAL, notBool);
+                a.cmpByte(top(), 0);
+                a.jcc(onTrue ? NOT_EQUAL : EQUAL, target);
+                a.jmp(at[next]);
+                a.bind(notBool);
+                a.cmpImm32(RAX, NIL);
+                a.jcc(onTrue ? NOT_EQUAL : EQUAL, target);
+                break;
+            }
+            case OP_CALL:
+            case OP_TAIL_CALL:
+            case OP_RETURN:
+                exitAt(offset);
+                break;
+            default:
+                interpret(offset);
+                break;
+        }
+    }
+};
+
+}
+
+Jit::~Jit() {
+#if JIT_SUPPORTED
+    for (auto* native : compiled) {
+        munmap(native->memory, native->size);
+        delete native;
+    }
+#endif
+    if (perfMapFile) fclose(perfMapFile);
+}
+
+bool Jit::supported(std::vector<Value>& stack) {
+#if JIT_SUPPORTED
+    Value number = 1.5, nil = nullptr, boolean = true;
+    auto index = [](const Value& value) { return reinterpret_cast<const uint8_t*>(&value)[INDEX]; };
+    if (index(number) != DOUBLE || index(nil) != NIL || index(boolean) != BOOL) return false;
+    if ((void*)std::get_if<double>(&number) != (void*)&number || (void*)std::get_if<bool>(&boolean) != (void*)&boolean)
+        return false;
+    auto** pointers = reinterpret_cast<Value**>(&stack);
+    return sizeof(stack) == 3 * sizeof(Value*)
+        && pointers[STACK_DATA / 8] == stack.data()
+        && pointers[STACK_END / 8] == stack.data() + stack.size()
+        && pointers[STACK_CAPACITY / 8] == stack.data() + stack.capacity();
+#else
+    return false;
+#endif
+}
+
+void Jit::compile(BeatFunction& function) {
+#if JIT_SUPPORTED
+    if (function.native || !function.verified) return;
+    CodeGenerator generator(function);
+    const auto& machineCode = generator.generate();
+
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t size = (machineCode.size() + page - 1) / page * page;
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) return; // stays interpreted
+    std::memcpy(memory, machineCode.data(), machineCode.size());
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        return;
+    }
+
+    auto* native = new NativeCode{(NativeCode::Enter)memory, {}, memory, size, machineCode.size()};
+    const auto& chunk = function.chunk;
+    native->entries.assign(chunk.bytecodes().size(), nullptr);
+    for (int offset = 0; offset < (int)chunk.bytecodes().size(); offset += chunk.instructionLength(offset)) {
+        native->entries[offset] = (uint8_t*)memory + generator.offsetOf(offset);
+    }
+    compiled.push_back(native);
+    function.native = native;
+    if (perfMap) writePerfMap(function, *native);
+#endif
+}
+
+void Jit::writePerfMap(const BeatFunction& function, const NativeCode& native) {
+    if (!perfMapFile) {
+        perfMapFile = fopen(std::format("/tmp/perf-{}.map", getpid()).c_str(), "a");
+        if (!perfMapFile) return;
+    }
+    fprintf(perfMapFile, "%lx %zx beat:%s\n", (unsigned long)native.memory, native.codeSize,
+            function.name.empty() ? "script" : function.name.c_str());
+    fflush(perfMapFile);
+}
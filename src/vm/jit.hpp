@@ -0,0 +1,60 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "chunk.hpp"
+
+class VM;
+class CallFrame;
+
+// Machine code for one BeatFunction (see Jit).
+struct NativeCode {
+    // Runs the function from entry, one of entries, until it reaches an
+    // instruction it leaves to the interpreter (calls and returns). Returns 0
+    // with the frame's ip at that instruction, or 1 when the instruction it
+    // was running raised an error, which the VM holds.
+    using Enter = int (*)(VM* vm, CallFrame* frame, std::vector<Value>* stack, const void* entry);
+    Enter enter;
+    std::vector<const void*> entries; // address for each bytecode offset that starts an instruction
+    void* memory;
+    size_t size;     // of the mapping
+    size_t codeSize; // of the code at its start
+};
+
+// Baseline JIT for Linux x86-64. A function that gets hot (calls plus loop
+// iterations, counted by the interpreter) is translated instruction by
+// instruction into machine code working on the interpreter's own stack and
+// frames, so the interpreter can enter it at any instruction: at a call, on
+// return from one, or in the middle of a running loop (on-stack
+// replacement). Numbers, booleans, locals, constants and jumps are handled
+// inline; any other instruction, and the operands the inline code does not
+// expect, are run by the interpreter through VM::step. Calls and returns go
+// back to the interpreter loop.
+//
+// Only verified bytecode (see BytecodeVerifier) is compiled, and the
+// interpreter stays the reference: beat --no-jit runs without it.
+class Jit {
+public:
+    static constexpr int64_t HOT = 1000;
+    int64_t threshold = HOT;
+    bool perfMap = false; // write /tmp/perf-<pid>.map for perf to name compiled functions
+
+    ~Jit();
+
+    // whether the generated code's assumptions about how the C++ library lays
+    // out values and vectors hold
+    static bool supported(std::vector<Value>& stack);
+
+    // a call or loop iteration of function; compiles it when it gets hot
+    void countHot(BeatFunction& function) {
+        if (function.hotness++ == threshold) compile(function);
+    }
+    void compile(BeatFunction& function);
+
+private:
+    std::vector<NativeCode*> compiled;
+    FILE* perfMapFile = nullptr;
+
+    void writePerfMap(const BeatFunction& function, const NativeCode& native);
+};
@@ -1,13 +1,19 @@
 #include <fstream>
 #include <iostream>
 #include <cstring>
+#include <utility>
 
 #include "ast_printer.hpp"
 #include "chunk.hpp"
 #include "parser.hpp"
+#include "verifier.hpp"
 #include "vm.hpp"
 #include "version.hpp"
 #include "compiler.hpp"
+#include "constant_folder.hpp"
+#include "escape_analysis.hpp"
+#include "ir/ir_optimizer.hpp"
+#include "type_inference.hpp"
 #include "vm/vm_exception.hpp"
 #include "core/core_lib.hpp"
 
@@ -16,6 +22,18 @@ bool noLoop = false;
 bool disassemble = false;
 bool debug_trace_exeuction = false;
 bool op_counters_flag = false;
+bool optimize = true;
+bool inlineFunctions = true;
+bool inferTypes = true;
+bool dumpTypes = false;
+bool emitIr = false;
+bool escapeAnalysis = true;
+bool verifyBytecode = true;
+bool useJit = true;
+bool perfMap = false;
+int64_t jitThreshold = Jit::HOT;
+std::string profileIn;  // compile with the feedback in this profile
+std::string profileOut; // record feedback into this profile
 
 void run( VM &vm, Compiler &compiler, std::string &source);
 
@@ -37,6 +55,18 @@ void printUsage() {
     std::cout << "  -d, --disasm     Print disassembled bytecode chunk"    << std::endl;
     std::cout << "  -c, --counters   Print counters for OP codes" << std::endl;
     std::cout << "  -t, --trace      Trace execution for debugging purpose (SLOW!!)" << std::endl;
+    std::cout << "  --no-inline      Do not inline calls to small global functions" << std::endl;
+    std::cout << "  --dump-types     Print the inferred type of every local variable" << std::endl;
+    std::cout << "  --emit-ir        Print the optimized SSA IR" << std::endl;
+    std::cout << "  --no-escape      Allocate every array, map and closure on the heap" << std::endl;
+    std::cout << "  --no-verify      Run bytecode unverified, checking every instruction instead" << std::endl;
+    std::cout << "  --no-jit         Interpret everything; do not compile hot functions to machine code" << std::endl;
+    std::cout << "  --jit-threshold N  Compile a function after N calls and loop iterations (default " << Jit::HOT << ")" << std::endl;
+    std::cout << "  --perf-map       Write /tmp/perf-<pid>.map so perf can name compiled functions" << std::endl;
+    std::cout << "  --profile-out F  Record type, branch and call feedback into profile F" << std::endl;
+    std::cout << "  --profile-in F   Specialize the code for the feedback in profile F" << std::endl;
+    std::cout << "  --merge-profiles OUT IN...  Add up profiles of the same program into OUT" << std::endl;
+    std::cout << "  -O0              Disable constant folding, IR optimization, type inference, inlining, escape analysis and bytecode optimization" << std::endl;
 }
 
 void runFile(VM &vm,  Compiler &compiler, char *script_file) {
@@ -64,19 +94,95 @@ void run( VM &vm, Compiler &compiler, std::string &source) {
         std::cout << std::endl;
     }
 
+    if (optimize) {
+        ConstantFolder().fold(stmts);
+        IrOptimizer().optimize(stmts, emitIr ? &std::cout : nullptr);
+        ConstantFolder().fold(stmts); // branches on constants the IR passes found
+    }
+
+    TypeInference inference;
+    if (optimize && inferTypes) {
+        inference.infer(stmts);
+        if (dumpTypes)
+            inference.dump();
+    }
+
+    EscapeAnalysis escapes;
+    if (optimize && escapeAnalysis) {
+        escapes.analyze(stmts, [&vm](const std::string& name) { return vm.hasGlobal(name); });
+    }
+
+    // sites are numbered on the final tree, the one the compiler sees
+    Profile profile;
+    bool profiling = !profileIn.empty() || !profileOut.empty();
+    if (profiling) {
+        profile.number(stmts, source);
+        std::string error;
+        if (!profileIn.empty() && !profile.load(profileIn, error)) {
+            std::cerr << "Ignoring profile: " << error << std::endl;
+        }
+    }
+
     compiler.clear();
+    compiler.profile = profiling ? &profile : nullptr;
+    compiler.types = optimize && inferTypes ? &inference : nullptr;
+    compiler.escapes = optimize && escapeAnalysis ? &escapes : nullptr;
     auto block =  BlockStmt::create(std::move(stmts),0);
     // auto chunk = compiler.compile(std::move(stmts));
     auto script = compiler.compileBeatFunction(std::move(block), "", 0, BeatFunctionType::SCRIPT);
+    compiler.types = nullptr;
+    compiler.escapes = nullptr;
+    compiler.profile = nullptr;
     // chunk.write(OP_RETURN, 0); // TODO: remove me
     if (disassemble)
         script->chunk.disassembleChunk("test chunk");
 
+    std::string malformed;
+    if (verifyBytecode && !BytecodeVerifier().verify(*script, malformed)) {
+        throw CompileException("invalid bytecode: " + malformed);
+    }
+
+    vm.profile = profileOut.empty() ? nullptr : &profile;
     vm.run(new BeatClosure(script)); // leaking? probably fine if this is a script
+    vm.profile = nullptr;
+    if (!profileOut.empty()) {
+        profile.save(profileOut);
+    }
+}
+
+int mergeProfiles(int count, char** paths) {
+    if (count < 2) {
+        std::cerr << "Usage: beat --merge-profiles OUT IN..." << std::endl;
+        return 1;
+    }
+    Profile merged;
+    std::string error;
+    if (!merged.load(paths[1], error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    for (int i = 2; i < count; i++) {
+        Profile next;
+        if (!next.load(paths[i], error) || !merged.merge(next, error)) {
+            std::cerr << paths[i] << ": " << error << std::endl;
+            return 1;
+        }
+    }
+    merged.save(paths[0]);
+    return 0;
 }
 
 void runPrompt(VM &vm, Compiler &compiler)
 {
+    // a later line may redefine a function that an earlier line inlined,
+    // or a native that an earlier line assumed returns a number or keeps no
+    // reference to its arguments
+    inlineFunctions = false;
+    inferTypes = false;
+    escapeAnalysis = false;
+    // every line is a program of its own
+    profileIn.clear();
+    profileOut.clear();
     std::cout << "> ";
     for (std::string line; std::getline(std::cin, line);) {
         try {
@@ -95,7 +201,9 @@ void runPrompt(VM &vm, Compiler &compiler)
 }
 
 int main(int argc, char **argv) {
-
+    if (argc > 1 && std::strcmp(argv[1], "--merge-profiles") == 0) {
+        return mergeProfiles(argc - 2, argv + 2);
+    }
 
     // Parse command line arguments
     for (int i = 1; i < argc; i++) {
@@ -110,6 +218,9 @@ int main(int argc, char **argv) {
         if (std::strcmp(argv[i], "-a") == 0 || std::strcmp(argv[i], "--ast") == 0) {
             printAst = true;
         }
+        if (std::strcmp(argv[i], "-n") == 0 || std::strcmp(argv[i], "--no-loop") == 0) {
+            noLoop = true;
+        }
         if (std::strcmp(argv[i], "-d") == 0 || std::strcmp(argv[i], "--disasm") == 0) {
             disassemble = true;
         }
@@ -119,11 +230,66 @@ int main(int argc, char **argv) {
         if (std::strcmp(argv[i], "-c") == 0 || std::strcmp(argv[i], "--counters") == 0) {
             op_counters_flag = true;
         }
+        if (std::strcmp(argv[i], "--no-inline") == 0) {
+            inlineFunctions = false;
+        }
+        if (std::strcmp(argv[i], "--dump-types") == 0) {
+            dumpTypes = true;
+        }
+        if (std::strcmp(argv[i], "--emit-ir") == 0) {
+            emitIr = true;
+        }
+        if (std::strcmp(argv[i], "--profile-out") == 0 && i + 1 < argc) {
+            profileOut = argv[++i];
+        }
+        if (std::strcmp(argv[i], "--profile-in") == 0 && i + 1 < argc) {
+            profileIn = argv[++i];
+        }
+        if (std::strcmp(argv[i], "--no-escape") == 0) {
+            escapeAnalysis = false;
+        }
+        if (std::strcmp(argv[i], "--no-verify") == 0) {
+            verifyBytecode = false;
+        }
+        if (std::strcmp(argv[i], "--no-jit") == 0) {
+            useJit = false;
+        }
+        if (std::strcmp(argv[i], "--jit-threshold") == 0 && i + 1 < argc) {
+            jitThreshold = std::atoll(argv[++i]);
+        }
+        if (std::strcmp(argv[i], "--perf-map") == 0) {
+            perfMap = true;
+        }
+        if (std::strcmp(argv[i], "-O0") == 0) {
+            optimize = false;
+        }
+        if (std::strcmp(argv[i], "-O1") == 0) {
+            optimize = true;
+        }
     }
 
     Compiler compiler(nullptr);
     VM vm{};
+    // tracing, op counters and profiles watch every instruction the interpreter runs
+    Jit jit;
+    jit.threshold = jitThreshold;
+    jit.perfMap = perfMap;
+    if (useJit && !debug_trace_exeuction && !op_counters_flag && profileOut.empty()) {
+        vm.enableJit(&jit);
+    }
 
+    // --no-loop only restricts user code; the core library is written with loops.
+    // Core functions are not inlined either, so user scripts can still redefine them,
+    // and are not type-checked against natives (or analyzed for escapes through
+    // functions) the user script may redefine.
+    bool restrictLoops = std::exchange(noLoop, false);
+    bool inlineUserCode = std::exchange(inlineFunctions, false);
+    bool inferUserTypes = std::exchange(inferTypes, false);
+    bool dumpUserTypes = std::exchange(dumpTypes, false);
+    bool emitUserIr = std::exchange(emitIr, false);
+    bool analyzeUserEscapes = std::exchange(escapeAnalysis, false);
+    std::string userProfileIn = std::exchange(profileIn, "");
+    std::string userProfileOut = std::exchange(profileOut, "");
     try {
         std::string core_source(CORE_LIB_SOURCE);
         run(vm, compiler, core_source);
@@ -138,10 +304,24 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    noLoop = restrictLoops;
+    inlineFunctions = inlineUserCode;
+    inferTypes = inferUserTypes;
+    dumpTypes = dumpUserTypes;
+    emitIr = emitUserIr;
+    escapeAnalysis = analyzeUserEscapes;
+    profileIn = userProfileIn;
+    profileOut = userProfileOut;
+
     // Count non-option arguments
     int script_args = 0;
     char* script_file = nullptr;
     for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--profile-out") == 0 || std::strcmp(argv[i], "--profile-in") == 0
+            || std::strcmp(argv[i], "--jit-threshold") == 0) {
+            i++; // the profile file or threshold
+            continue;
+        }
         if (argv[i][0] != '-') {
             script_args++;
             if (script_args == 1) {
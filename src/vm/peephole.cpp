@@ -0,0 +1,232 @@
+#include "peephole.hpp"
+
+#include "compiler.hpp"
+
+namespace {
+
+bool isJump(uint8_t op) {
+    return op == OP_JUMP || op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_TRUE || op == OP_LOOP;
+}
+
+uint8_t getterFor(uint8_t setter) {
+    switch (setter) {
+        case OP_SET_LOCAL: return OP_GET_LOCAL;
+        case OP_SET_LOCAL_NUM: return OP_GET_LOCAL_NUM;
+        case OP_SET_GLOBAL: return OP_GET_GLOBAL;
+        case OP_SET_UPVALUE: return OP_GET_UPVALUE;
+        default: return OP_END;
+    }
+}
+
+}
+
+void PeepholeOptimizer::run() {
+    decode();
+    bool changed = true;
+    while (changed) {
+        markTargets();
+        changed = rewrite();
+        compact();
+    }
+    encode();
+}
+
+void PeepholeOptimizer::decode() {
+    const auto& bytes = chunk.bytecodes();
+    std::vector<int> indexAt(bytes.size() + 1, -1);
+    for (int offset = 0; offset < (int)bytes.size();) {
+        int length = chunk.instructionLength(offset);
+        indexAt[offset] = code.size();
+        code.push_back(Instruction{bytes[offset],
+                                   std::vector<uint8_t>(bytes.begin() + offset + 1, bytes.begin() + offset + length),
+                                   chunk.lines()[offset], chunk.origins()[offset], chunk.sites()[offset], offset});
+        offset += length;
+    }
+    indexAt[bytes.size()] = code.size();
+
+    for (auto& instruction : code) {
+        if (!isJump(instruction.op)) continue;
+        int jump = (instruction.operands[0] << 8) | instruction.operands[1];
+        int next = instruction.offset + 3;
+        instruction.target = indexAt[instruction.op == OP_LOOP ? next - jump : next + jump];
+    }
+}
+
+void PeepholeOptimizer::encode() {
+    std::vector<int> newOffset(code.size() + 1);
+    int offset = 0;
+    for (size_t i = 0; i < code.size(); i++) {
+        newOffset[i] = offset;
+        offset += 1 + code[i].operands.size();
+    }
+    newOffset[code.size()] = offset;
+
+    std::vector<uint8_t> bytes;
+    std::vector<int> lines;
+    std::vector<int> origins;
+    std::vector<int> sites;
+    bytes.reserve(offset);
+    lines.reserve(offset);
+    origins.reserve(offset);
+    sites.reserve(offset);
+    for (size_t i = 0; i < code.size(); i++) {
+        auto& instruction = code[i];
+        if (isJump(instruction.op)) {
+            int next = newOffset[i] + 3;
+            int jump = instruction.op == OP_LOOP ? next - newOffset[instruction.target] : newOffset[instruction.target] - next;
+            if (jump < 0 || jump > UINT16_MAX) throw CompileException("peephole: jump offset out of range");
+            instruction.operands = {(uint8_t)((jump >> 8) & 0xff), (uint8_t)(jump & 0xff)};
+        }
+        bytes.push_back(instruction.op);
+        bytes.insert(bytes.end(), instruction.operands.begin(), instruction.operands.end());
+        lines.insert(lines.end(), 1 + instruction.operands.size(), instruction.line);
+        origins.insert(origins.end(), 1 + instruction.operands.size(), instruction.origin);
+        sites.push_back(instruction.site);
+        sites.insert(sites.end(), instruction.operands.size(), -1);
+    }
+    chunk.replaceCode(std::move(bytes), std::move(lines), std::move(origins), std::move(sites));
+}
+
+void PeepholeOptimizer::markTargets() {
+    isTarget.assign(code.size() + 1, false);
+    for (const auto& instruction : code) {
+        if (instruction.target >= 0) isTarget[instruction.target] = true;
+    }
+}
+
+// drop removed instructions; jumps into a removed one land on the next survivor
+void PeepholeOptimizer::compact() {
+    std::vector<int> remap(code.size() + 1);
+    int live = code.size();
+    remap[code.size()] = live;
+    for (int i = code.size() - 1; i >= 0; i--) {
+        if (!code[i].removed) live = i;
+        remap[i] = live;
+    }
+    std::vector<int> newIndex(code.size() + 1);
+    int count = 0;
+    for (size_t i = 0; i < code.size(); i++) {
+        newIndex[i] = count;
+        if (!code[i].removed) count++;
+    }
+    newIndex[code.size()] = count;
+
+    std::vector<Instruction> kept;
+    kept.reserve(count);
+    for (auto& instruction : code) {
+        if (instruction.removed) continue;
+        if (instruction.target >= 0) {
+            instruction.target = newIndex[remap[instruction.target]];
+        }
+        kept.push_back(std::move(instruction));
+    }
+    code = std::move(kept);
+}
+
+int PeepholeOptimizer::next(int i) const {
+    while (i < (int)code.size() && code[i].removed) i++;
+    return i;
+}
+
+void PeepholeOptimizer::remove(int i) {
+    code[i].removed = true;
+    if (isTarget[i]) isTarget[next(i)] = true; // jumps here now fall through to the next survivor
+}
+
+bool PeepholeOptimizer::rewrite() {
+    bool changed = false;
+    for (int i = next(0); i < (int)code.size(); i = next(i + 1)) {
+        if (isJump(code[i].op)) {
+            changed |= threadJump(i);
+        }
+        changed |= fuseNotJump(i) || dropStoreReload(i) || dropNilPop(i) || dropJumpToNext(i);
+        if (!code[i].removed) {
+            changed |= dropUnreachable(i);
+        }
+    }
+    return changed;
+}
+
+// JUMP -> JUMP -> L becomes JUMP -> L; a conditional jump can also skip over
+// a second conditional jump of the same kind, since it tests the same value,
+// unless that one is a profile site that would then miss the test
+bool PeepholeOptimizer::threadJump(int i) {
+    auto& jump = code[i];
+    if (jump.op == OP_LOOP) return false;
+    int target = next(jump.target);
+    while (target < (int)code.size() && target != i) {
+        const auto& landing = code[target];
+        if (landing.op != OP_JUMP && (landing.op != jump.op || landing.site >= 0)) break;
+        int further = next(landing.target);
+        // OP_JUMP only encodes forward distances; offsets only shrink, so
+        // measuring in the original layout is conservative
+        int end = further < (int)code.size() ? code[further].offset : (int)chunk.bytecodes().size();
+        if (further <= i || end - (jump.offset + 3) > UINT16_MAX) break;
+        target = further;
+    }
+    if (target == next(jump.target)) return false;
+    jump.target = target;
+    return true;
+}
+
+// NOT; JUMP_IF_FALSE L => JUMP_IF_TRUE L, provided the negated value is
+// popped on both edges so nothing observes which of the two was left behind.
+// A jump tagged as a profile site keeps its NOT: the profiler records the
+// value the jump tests.
+bool PeepholeOptimizer::fuseNotJump(int i) {
+    if (code[i].op != OP_NOT) return false;
+    int j = next(i + 1);
+    if (j >= (int)code.size() || isTarget[j]) return false;
+    auto& jump = code[j];
+    if (jump.op != OP_JUMP_IF_FALSE && jump.op != OP_JUMP_IF_TRUE) return false;
+    if (jump.site >= 0) return false;
+    int fallthrough = next(j + 1);
+    int target = next(jump.target);
+    if (fallthrough >= (int)code.size() || code[fallthrough].op != OP_POP) return false;
+    if (target >= (int)code.size() || code[target].op != OP_POP) return false;
+    jump.op = jump.op == OP_JUMP_IF_FALSE ? OP_JUMP_IF_TRUE : OP_JUMP_IF_FALSE;
+    remove(i);
+    return true;
+}
+
+// x = e; x  =>  the assignment already leaves e on the stack
+bool PeepholeOptimizer::dropStoreReload(int i) {
+    uint8_t getter = getterFor(code[i].op);
+    if (getter == OP_END) return false;
+    int pop = next(i + 1);
+    if (pop >= (int)code.size() || code[pop].op != OP_POP || isTarget[pop]) return false;
+    int get = next(pop + 1);
+    if (get >= (int)code.size() || code[get].op != getter || isTarget[get]) return false;
+    if (code[get].operands != code[i].operands) return false;
+    remove(pop);
+    remove(get);
+    return true;
+}
+
+bool PeepholeOptimizer::dropNilPop(int i) {
+    if (code[i].op != OP_NIL) return false;
+    int pop = next(i + 1);
+    if (pop >= (int)code.size() || code[pop].op != OP_POP || isTarget[pop]) return false;
+    remove(i);
+    remove(pop);
+    return true;
+}
+
+bool PeepholeOptimizer::dropJumpToNext(int i) {
+    auto op = code[i].op;
+    if (op != OP_JUMP && op != OP_JUMP_IF_FALSE && op != OP_JUMP_IF_TRUE) return false;
+    if (next(code[i].target) != next(i + 1)) return false;
+    remove(i);
+    return true;
+}
+
+bool PeepholeOptimizer::dropUnreachable(int i) {
+    auto op = code[i].op;
+    if (op != OP_RETURN && op != OP_JUMP && op != OP_LOOP) return false;
+    bool changed = false;
+    for (int j = next(i + 1); j < (int)code.size() && !isTarget[j]; j = next(j + 1)) {
+        remove(j);
+        changed = true;
+    }
+    return changed;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "chunk.hpp"
+
+// Bytecode-level cleanup run on every finished chunk (-O0 turns it off).
+// The chunk is decoded into a list of instructions whose jumps refer to
+// other instructions rather than byte offsets, rewritten until nothing
+// changes, and re-encoded with jump offsets and line info relocated.
+//
+// Rewrites:
+//   SET_LOCAL x; POP; GET_LOCAL x   => SET_LOCAL x   (same for globals/upvalues)
+//   NOT; JUMP_IF_FALSE L            => JUMP_IF_TRUE L (when both edges pop the test)
+//   NIL; POP                        => (nothing)
+//   JUMP L where L: JUMP M          => JUMP M        (jump threading)
+//   JUMP to the next instruction    => (nothing)
+//   code after RETURN/JUMP/LOOP that no jump targets => (nothing)
+class PeepholeOptimizer {
+public:
+    explicit PeepholeOptimizer(Chunk& chunk): chunk(chunk) {}
+    void run();
+
+private:
+    struct Instruction {
+        uint8_t op;
+        std::vector<uint8_t> operands;
+        int line;
+        int origin;
+        int site;
+        int offset; // in the original chunk
+        int target = -1; // index of the jump destination
+        bool removed = false;
+    };
+
+    Chunk& chunk;
+    std::vector<Instruction> code;
+    std::vector<bool> isTarget;
+
+    void decode();
+    void encode();
+    void markTargets();
+    void compact();
+    int next(int i) const;
+    void remove(int i);
+    bool rewrite();
+    bool threadJump(int i);
+    bool fuseNotJump(int i);
+    bool dropStoreReload(int i);
+    bool dropNilPop(int i);
+    bool dropJumpToNext(int i);
+    bool dropUnreachable(int i);
+};
@@ -0,0 +1,190 @@
+#include "profile.hpp"
+
+#include <fstream>
+#include <sstream>
+
+#include "ast_walker.hpp"
+
+namespace {
+
+constexpr const char* MAGIC = "beat-profile";
+constexpr int VERSION = 1;
+
+// below this many observations a site keeps its generic code
+constexpr int64_t MIN_SAMPLES = 16;
+// calls a site must have made to be worth inlining a larger body into
+constexpr int64_t HOT_CALLS = 100;
+
+uint64_t fnv1a(const std::string& text) {
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// whether most covers at least 95% of all
+bool dominates(int64_t most, int64_t all) {
+    return all >= MIN_SAMPLES && most * 20 >= all * 19;
+}
+
+}
+
+// Numbers sites in preorder.
+class SiteNumbering: public AstWalker {
+public:
+    Profile& profile;
+    explicit SiteNumbering(Profile& profile): profile(profile) {}
+
+    using AstWalker::visit;
+    void visit(const Binary& expr) override {
+        profile.siteIds[&expr] = profile.sites++;
+        AstWalker::visit(expr);
+    }
+    void visit(const Call& expr) override {
+        profile.siteIds[&expr] = profile.sites++;
+        AstWalker::visit(expr);
+    }
+    void visit(const IfStmt& stmt) override {
+        profile.siteIds[&stmt] = profile.sites++;
+        AstWalker::visit(stmt);
+    }
+};
+
+void SiteFeedback::merge(const SiteFeedback& other) {
+    numbers += other.numbers;
+    others += other.others;
+    truthy += other.truthy;
+    falsy += other.falsy;
+    for (const auto& [name, count] : other.callees) {
+        callees[name] += count;
+    }
+}
+
+void Profile::number(const std::vector<std::unique_ptr<Stmt>>& statements, const std::string& source) {
+    fingerprint = fnv1a(source);
+    sites = 0;
+    siteIds.clear();
+    SiteNumbering{*this}.walk(statements);
+}
+
+int Profile::siteOf(const void* node) const {
+    auto it = siteIds.find(node);
+    return it == siteIds.end() ? -1 : it->second;
+}
+
+bool Profile::load(const std::string& path, std::string& error) {
+    std::ifstream in(path);
+    if (!in) {
+        error = "cannot open " + path;
+        return false;
+    }
+    std::string magic;
+    int version = 0;
+    uint64_t savedFingerprint = 0;
+    int savedSites = 0;
+    std::string keyword;
+    if (!(in >> magic >> version) || magic != MAGIC || version != VERSION
+        || !(in >> keyword >> std::hex >> savedFingerprint >> std::dec >> savedSites) || keyword != "program") {
+        error = path + " is not a beat profile";
+        return false;
+    }
+    bool numbered = !siteIds.empty() || fingerprint != 0;
+    if (numbered && (savedFingerprint != fingerprint || savedSites != sites)) {
+        error = path + " was recorded for a different program";
+        return false;
+    }
+    fingerprint = savedFingerprint;
+    sites = savedSites;
+
+    std::unordered_map<int, SiteFeedback> loaded;
+    std::string line;
+    std::getline(in, line);
+    while (std::getline(in, line)) {
+        if (line.empty()) continue;
+        std::istringstream fields(line);
+        int site;
+        std::string kind;
+        if (!(fields >> site >> kind) || site < 0 || site >= sites) {
+            error = path + ": bad line '" + line + "'";
+            return false;
+        }
+        auto& entry = loaded[site];
+        bool ok;
+        if (kind == "types") {
+            ok = (bool)(fields >> entry.numbers >> entry.others);
+        } else if (kind == "branch") {
+            ok = (bool)(fields >> entry.truthy >> entry.falsy);
+        } else if (kind == "call") {
+            int64_t count;
+            std::string name;
+            ok = (bool)(fields >> count) && (bool)std::getline(fields >> std::ws, name);
+            if (ok) entry.callees[name] += count;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            error = path + ": bad line '" + line + "'";
+            return false;
+        }
+    }
+    for (const auto& [site, entry] : loaded) {
+        feedback[site].merge(entry);
+    }
+    return true;
+}
+
+void Profile::save(const std::string& path) const {
+    std::ofstream out(path);
+    if (!out) throw std::runtime_error("cannot write profile " + path);
+    out << MAGIC << " " << VERSION << "\n";
+    out << "program " << std::hex << fingerprint << std::dec << " " << sites << "\n";
+    std::map<int, const SiteFeedback*> ordered;
+    for (const auto& [site, entry] : feedback) ordered[site] = &entry;
+    for (const auto& [site, entry] : ordered) {
+        if (entry->numbers || entry->others) out << site << " types " << entry->numbers << " " << entry->others << "\n";
+        if (entry->truthy || entry->falsy) out << site << " branch " << entry->truthy << " " << entry->falsy << "\n";
+        for (const auto& [name, count] : entry->callees) {
+            out << site << " call " << count << " " << name << "\n";
+        }
+    }
+}
+
+bool Profile::merge(const Profile& other, std::string& error) {
+    if (other.fingerprint != fingerprint || other.sites != sites) {
+        error = "profiles were recorded for different programs";
+        return false;
+    }
+    for (const auto& [site, entry] : other.feedback) {
+        feedback[site].merge(entry);
+    }
+    return true;
+}
+
+const SiteFeedback* Profile::find(const void* node) const {
+    auto it = feedback.find(siteOf(node));
+    return it == feedback.end() ? nullptr : &it->second;
+}
+
+bool Profile::expectsNumbers(const void* binary) const {
+    const auto* entry = find(binary);
+    return entry && dominates(entry->numbers, entry->numbers + entry->others);
+}
+
+bool Profile::likelyTrue(const void* ifStmt) const {
+    const auto* entry = find(ifStmt);
+    return entry && entry->truthy > entry->falsy && entry->truthy + entry->falsy >= MIN_SAMPLES;
+}
+
+std::string Profile::hotCallee(const void* call) const {
+    const auto* entry = find(call);
+    if (!entry) return "";
+    int64_t total = 0;
+    const std::pair<const std::string, int64_t>* top = nullptr;
+    for (const auto& callee : entry->callees) {
+        total += callee.second;
+        if (!top || callee.second > top->second) top = &callee;
+    }
+    return total >= HOT_CALLS && dominates(top->second, total) ? top->first : "";
+}
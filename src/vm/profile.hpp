@@ -0,0 +1,55 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "expr.hpp"
+#include "statement.hpp"
+
+// Feedback gathered at one instrumented instruction.
+struct SiteFeedback {
+    int64_t numbers = 0, others = 0; // binary operator: both operands numbers, or not
+    int64_t truthy = 0, falsy = 0;   // if statement: value of the condition
+    std::map<std::string, int64_t> callees; // call: name of the function called
+
+    void merge(const SiteFeedback& other);
+};
+
+// Type, branch and call-target feedback for one program, kept across runs
+// (beat --profile-out / --profile-in / --merge-profiles).
+//
+// A site is a binary operator, if statement or call of the program, numbered
+// in the order a walk of the optimized tree meets them; the compiler tags the
+// instruction it emits for a site with that number, so the numbers stay valid
+// however differently a later run compiles the site. A fingerprint of the
+// source ties a profile to the program it was recorded for.
+class Profile {
+public:
+    // numbers the sites of a program; source is its text
+    void number(const std::vector<std::unique_ptr<Stmt>>& statements, const std::string& source);
+    int siteOf(const void* node) const;
+    SiteFeedback& at(int site) { return feedback[site]; }
+
+    // read a profile file, adding its counts; false (and why) if it cannot be
+    // read or was recorded for another program
+    bool load(const std::string& path, std::string& error);
+    void save(const std::string& path) const;
+    bool merge(const Profile& other, std::string& error);
+
+    // what the compiler specializes on; all false/empty without enough samples
+    bool expectsNumbers(const void* binary) const;
+    bool likelyTrue(const void* ifStmt) const;
+    std::string hotCallee(const void* call) const; // "" unless nearly every call went to one function
+
+private:
+    uint64_t fingerprint = 0;
+    int sites = 0;
+    std::unordered_map<const void*, int> siteIds;
+    std::unordered_map<int, SiteFeedback> feedback;
+
+    const SiteFeedback* find(const void* node) const;
+    friend class SiteNumbering;
+};
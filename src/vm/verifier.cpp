@@ -0,0 +1,263 @@
+#include "verifier.hpp"
+
+#include <format>
+
+#include "lox_function.hpp"
+
+namespace {
+
+uint16_t readShort(const std::vector<uint8_t>& code, int offset) {
+    return (uint16_t)((code[offset] << 8) | code[offset + 1]);
+}
+
+BeatFunction* functionConstant(const Value& constant) {
+    auto* callable = std::get_if<LoxCallable*>(&constant);
+    return callable ? dynamic_cast<BeatFunction*>(*callable) : nullptr;
+}
+
+bool isJump(uint8_t op) {
+    return op == OP_JUMP_IF_FALSE || op == OP_JUMP_IF_TRUE || op == OP_JUMP || op == OP_LOOP;
+}
+
+int jumpTarget(const std::vector<uint8_t>& code, int offset) {
+    int distance = readShort(code, offset + 1);
+    return code[offset] == OP_LOOP ? offset + 3 - distance : offset + 3 + distance;
+}
+
+}
+
+StackEffect stackEffect(const Chunk& chunk, int offset) {
+    const auto& code = chunk.bytecodes();
+    switch (code[offset]) {
+        case OP_CONSTANT:
+        case OP_CONSTANT_LITERAL:
+        case OP_CONSTANT_LITERAL_LOCAL:
+        case OP_NIL:
+        case OP_GET_GLOBAL:
+        case OP_GET_LOCAL:
+        case OP_GET_LOCAL_NUM:
+        case OP_GET_UPVALUE:
+        case OP_POSTFIX_INC_LOCAL:
+        case OP_POSTFIX_DEC_LOCAL:
+        case OP_POSTFIX_INC_GLOBAL:
+        case OP_POSTFIX_DEC_GLOBAL:
+        case OP_POSTFIX_INC_UPVALUE:
+        case OP_POSTFIX_DEC_UPVALUE:
+        case OP_CLOSURE:
+        case OP_CLOSURE_LOCAL:
+            return {0, 1};
+        case OP_NEGATE:
+        case OP_NOT:
+        case OP_LENGTH:
+        case OP_SET_GLOBAL:
+        case OP_SET_LOCAL:
+        case OP_SET_LOCAL_NUM:
+        case OP_SET_UPVALUE:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+            return {1, 1};
+        case OP_ADD: case OP_SUBTRACT: case OP_MULTIPLY: case OP_DIVIDE: case OP_MODULO:
+        case OP_EQUAL: case OP_GREATER: case OP_LESS:
+        case OP_ADD_NUM: case OP_SUBTRACT_NUM: case OP_MULTIPLY_NUM: case OP_DIVIDE_NUM:
+        case OP_GREATER_NUM: case OP_LESS_NUM:
+        case OP_ADD_QUICK: case OP_SUBTRACT_QUICK: case OP_MULTIPLY_QUICK: case OP_DIVIDE_QUICK:
+        case OP_GREATER_QUICK: case OP_LESS_QUICK:
+        case OP_SUBSCRIPT:
+        case OP_SUBSCRIPT_UNCHECKED:
+        case OP_POSTFIX_INC_SUBSCRIPT:
+        case OP_POSTFIX_DEC_SUBSCRIPT:
+            return {2, 1};
+        case OP_SUBSCRIPT_ASSIGNMENT:
+        case OP_SUBSCRIPT_ASSIGNMENT_UNCHECKED:
+            return {3, 1};
+        case OP_PRINT:
+        case OP_POP:
+        case OP_DEFINE_GLOBAL:
+        case OP_CLOSE_UPVALUE:
+        case OP_RETURN:
+            return {1, 0};
+        case OP_CALL:
+        case OP_TAIL_CALL:
+            return {code[offset + 1] + 1, 1}; // callee and arguments, for the result
+        case OP_ARRAY_LITERAL:
+        case OP_ARRAY_LITERAL_LOCAL:
+            return {code[offset + 1], 1};
+        case OP_MAP_LITERAL:
+        case OP_MAP_LITERAL_LOCAL:
+            return {2 * code[offset + 1], 1};
+        default: // jumps
+            return {0, 0};
+    }
+}
+
+bool BytecodeVerifier::verify(BeatFunction& function, std::string& error) {
+    if (function.verified) return true;
+    this->function = &function;
+    problem.clear();
+    if (!decode() || !checkHeights()) {
+        error = problem;
+        return false;
+    }
+    function.verified = true;
+
+    for (const auto& constant : function.chunk.constants()) {
+        auto* nested = functionConstant(constant);
+        if (nested && !BytecodeVerifier().verify(*nested, error)) return false;
+    }
+    return true;
+}
+
+// Walks the chunk instruction by instruction, checking what can be checked
+// without knowing the stack height.
+bool BytecodeVerifier::decode() {
+    const auto& chunk = function->chunk;
+    const auto& code = chunk.bytecodes();
+    int size = code.size();
+    boundaries.assign(size + 1, false);
+    if (size == 0) return fail(0, "empty chunk");
+
+    for (int offset = 0; offset < size;) {
+        boundaries[offset] = true;
+        uint8_t op = code[offset];
+        if (op >= OP_END) return fail(offset, std::format("unknown opcode {}", op));
+        if (op == OP_CLOSURE || op == OP_CLOSURE_LOCAL) {
+            // the length depends on the function the operand names
+            if (offset + 3 > size) return fail(offset, "truncated instruction");
+            int constant = readShort(code, offset + 1);
+            if (constant >= (int)chunk.constants().size() || !functionConstant(chunk.constants()[constant]))
+                return fail(offset, "closure operand is not a function");
+        }
+        int length = chunk.instructionLength(offset);
+        if (offset + length > size) return fail(offset, "truncated instruction");
+        if (!checkOperands(offset)) return false;
+        offset += length;
+    }
+    for (int offset = 0; offset < size; offset += chunk.instructionLength(offset)) {
+        if (isJump(code[offset])) {
+            int target = jumpTarget(code, offset);
+            if (target < 0 || target >= size || !boundaries[target])
+                return fail(offset, std::format("jump to {} is not an instruction", target));
+        }
+    }
+    return true;
+}
+
+bool BytecodeVerifier::checkOperands(int offset) {
+    const auto& chunk = function->chunk;
+    const auto& code = chunk.bytecodes();
+    int constants = chunk.constants().size();
+    switch (code[offset]) {
+        case OP_CONSTANT:
+        case OP_CONSTANT_LITERAL:
+        case OP_CONSTANT_LITERAL_LOCAL:
+            if (readShort(code, offset + 1) >= constants) return fail(offset, "constant index out of range");
+            return true;
+        case OP_ADD_NUM: case OP_SUBTRACT_NUM: case OP_MULTIPLY_NUM: case OP_DIVIDE_NUM:
+        case OP_GREATER_NUM: case OP_LESS_NUM:
+        case OP_GET_LOCAL_NUM:
+        case OP_SET_LOCAL_NUM:
+        case OP_SUBSCRIPT_UNCHECKED:
+        case OP_SUBSCRIPT_ASSIGNMENT_UNCHECKED:
+            if (!function->compiled) return fail(offset, "unchecked instruction in bytecode the compiler did not produce");
+            return true;
+        case OP_DEFINE_GLOBAL:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_POSTFIX_INC_GLOBAL:
+        case OP_POSTFIX_DEC_GLOBAL: {
+            int constant = readShort(code, offset + 1);
+            if (constant >= constants || !std::holds_alternative<std::string>(chunk.constants()[constant]))
+                return fail(offset, "global name is not a string constant");
+            return true;
+        }
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_POSTFIX_INC_UPVALUE:
+        case OP_POSTFIX_DEC_UPVALUE:
+            if (code[offset + 1] >= function->upvalueCount) return fail(offset, "upvalue index out of range");
+            return true;
+        case OP_CLOSURE:
+        case OP_CLOSURE_LOCAL: {
+            auto* nested = functionConstant(chunk.constants()[readShort(code, offset + 1)]);
+            for (int i = 0; i < nested->upvalueCount; i++) {
+                bool isLocal = code[offset + 3 + 2 * i];
+                int index = code[offset + 4 + 2 * i];
+                if (!isLocal && index >= function->upvalueCount)
+                    return fail(offset, "captured upvalue index out of range");
+            }
+            return true;
+        }
+        default:
+            return true;
+    }
+}
+
+// Propagates stack heights along every path from the entry; a function
+// starts with its arguments on the stack.
+bool BytecodeVerifier::checkHeights() {
+    const auto& chunk = function->chunk;
+    const auto& code = chunk.bytecodes();
+    int size = code.size();
+    heights.assign(size, -1);
+    std::vector<int> pending;
+    if (!reach(0, function->type == BeatFunctionType::SCRIPT ? 0 : function->arity_, pending)) return false;
+
+    while (!pending.empty()) {
+        int offset = pending.back();
+        pending.pop_back();
+        uint8_t op = code[offset];
+        int height = heights[offset];
+        auto effect = stackEffect(chunk, offset);
+        if (height < effect.pops) return fail(offset, "stack underflow");
+
+        switch (op) {
+            case OP_GET_LOCAL:
+            case OP_GET_LOCAL_NUM:
+            case OP_POSTFIX_INC_LOCAL:
+            case OP_POSTFIX_DEC_LOCAL:
+                if (code[offset + 1] >= height) return fail(offset, "local slot out of range");
+                break;
+            case OP_SET_LOCAL:
+            case OP_SET_LOCAL_NUM:
+                if (code[offset + 1] >= height - 1) return fail(offset, "local slot out of range");
+                break;
+            case OP_CLOSURE:
+            case OP_CLOSURE_LOCAL: {
+                // a local function may capture the slot it is about to occupy
+                auto* nested = functionConstant(chunk.constants()[readShort(code, offset + 1)]);
+                for (int i = 0; i < nested->upvalueCount; i++) {
+                    if (code[offset + 3 + 2 * i] && code[offset + 4 + 2 * i] > height)
+                        return fail(offset, "captured local slot out of range");
+                }
+                break;
+            }
+            default:
+                break;
+        }
+
+        int after = height - effect.pops + effect.pushes;
+        if (isJump(op) && !reach(jumpTarget(code, offset), after, pending)) return false;
+        if (op == OP_RETURN || op == OP_JUMP || op == OP_LOOP) continue;
+        int next = offset + chunk.instructionLength(offset);
+        if (next == size) return fail(offset, "execution runs off the end of the chunk");
+        if (!reach(next, after, pending)) return false;
+    }
+    return true;
+}
+
+bool BytecodeVerifier::reach(int offset, int height, std::vector<int>& pending) {
+    if (heights[offset] == -1) {
+        heights[offset] = height;
+        pending.push_back(offset);
+        return true;
+    }
+    if (heights[offset] != height)
+        return fail(offset, std::format("stack height {} on one path and {} on another", heights[offset], height));
+    return true;
+}
+
+bool BytecodeVerifier::fail(int offset, const std::string& why) {
+    problem = std::format("{} at offset {}: {}",
+                          function->name.empty() ? "script" : function->name, offset, why);
+    return false;
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "chunk.hpp"
+
+// Values an instruction takes off the stack and puts back on it.
+struct StackEffect {
+    int pops;
+    int pushes;
+};
+
+// effect of the instruction at offset; its operands must be in the chunk
+StackEffect stackEffect(const Chunk& chunk, int offset);
+
+// Load-time check of compiled bytecode, so the VM can run it without
+// defending against malformed code on every instruction (see VM::execute).
+// For every function it proves that
+//   - each opcode is known and its operands lie inside the chunk,
+//   - constant operands are in the constant table and of the kind the
+//     instruction reads (a name, a function),
+//   - jumps land on instruction boundaries inside the chunk,
+//   - the stack height at each instruction is the same along every path,
+//     never drops below what an instruction pops, and no path runs off the
+//     end of the chunk,
+//   - local slots are below the stack height and upvalue indices below the
+//     function's upvalue count (and the enclosing one's, for captures),
+//   - instructions that skip a type or bounds check (the _NUM and _UNCHECKED
+//     ones) only appear in functions the compiler produced: they rely on its
+//     type inference and loop analysis, which bytecode alone does not carry.
+// Functions in the constant table are verified too. A verified function is
+// marked so it is not checked twice.
+class BytecodeVerifier {
+public:
+    // false, with the first problem found in error, if function or a
+    // function nested in it is malformed
+    bool verify(BeatFunction& function, std::string& error);
+
+private:
+    BeatFunction* function = nullptr;
+    std::vector<bool> boundaries; // offsets where an instruction starts
+    std::vector<int> heights;     // stack height before each instruction, -1 if not reached yet
+    std::string problem;
+
+    bool decode();
+    bool checkOperands(int offset);
+    bool checkHeights();
+    bool reach(int offset, int height, std::vector<int>& pending);
+    bool fail(int offset, const std::string& why);
+};
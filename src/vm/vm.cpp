@@ -3,6 +3,7 @@
 #include "token.hpp"
 #include "vm.hpp"
 #include "lox_function.hpp"
+#include "verifier.hpp"
 
 extern bool debug_trace_exeuction;
 extern bool op_counters_flag;
@@ -13,14 +14,71 @@ extern bool op_counters_flag;
         std::abort(); \
     }
 
+// Constant array/map literals are kept as templates in the constant table; every
+// evaluation gets its own copy so that writes never leak back into the template.
+// Given an arena, the outermost copy goes there; nested ones can be read out of
+// it and kept, so they stay on the heap.
+static Value cloneConstantLiteral(const Value& value, FrameArena* arena = nullptr) {
+    if (std::holds_alternative<std::shared_ptr<Array>>(value)) {
+        const auto& source = std::get<std::shared_ptr<Array>>(value)->data;
+        auto array = arena ? std::allocate_shared<Array>(ArenaAllocator<Array>(arena), source)
+                           : std::make_shared<Array>(source);
+        for (auto& element : array->data) {
+            if (std::holds_alternative<std::shared_ptr<Array>>(element) || std::holds_alternative<std::shared_ptr<Map>>(element))
+                element = cloneConstantLiteral(element);
+        }
+        return array;
+    }
+    if (std::holds_alternative<std::shared_ptr<Map>>(value)) {
+        const auto& source = std::get<std::shared_ptr<Map>>(value)->data;
+        auto map = arena ? std::allocate_shared<Map>(ArenaAllocator<Map>(arena), source)
+                         : std::make_shared<Map>(source);
+        for (auto& [_, element] : map->data) {
+            if (std::holds_alternative<std::shared_ptr<Array>>(element) || std::holds_alternative<std::shared_ptr<Map>>(element))
+                element = cloneConstantLiteral(element);
+        }
+        return map;
+    }
+    return value;
+}
+
+// Called before a tagged instruction runs (ip is past its opcode).
+void VM::observe(const CallFrame& frame, uint8_t instruction) {
+    const auto& chunk = frame.closure->function->chunk;
+    int site = chunk.sites()[frame.ip - 1 - chunk.m_bytecodes.data()];
+    if (site < 0) return;
+    auto& feedback = profile->at(site);
+    switch (instruction) {
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_TRUE:
+            (is_truthy(peek()) ? feedback.truthy : feedback.falsy)++;
+            break;
+        case OP_CALL:
+        case OP_TAIL_CALL: {
+            const auto& callee = peek(*frame.ip);
+            if (auto* function = std::get_if<LoxCallable*>(&callee)) {
+                auto* closure = dynamic_cast<BeatClosure*>(*function);
+                feedback.callees[closure ? closure->function->name : (*function)->toString()]++;
+            }
+            break;
+        }
+        default: // a binary operator
+            bool numbers = std::holds_alternative<double>(stack.back())
+                           && std::holds_alternative<double>(stack[stack.size() - 2]);
+            (numbers ? feedback.numbers : feedback.others)++;
+            break;
+    }
+}
 
 InterpretResult VM::run(BeatClosure *closure){
     if(closure->function->type == BeatFunctionType::SCRIPT) {
         // reset the stack and frames
         stack.clear();
+        for (auto& frame : frames) releaseArena(*frame);
         frames.clear();
         // initialize the frame;
         frames.push_back(std::make_shared<CallFrame>(closure, &closure->function->chunk.m_bytecodes[0], 0));
+        checked = !closure->function->verified;
     } else {
         error(0, "NOT IMPLEMENTED YET");
     }
@@ -39,11 +97,58 @@ InterpretResult VM::run(BeatClosure *closure){
 
 
 InterpretResult VM::run(int ret_frame) {
+    return checked ? execute<true>(ret_frame) : execute<false>(ret_frame);
+}
+
+bool VM::step() {
+    try {
+        execute<false, true>(0);
+        return true;
+    } catch (...) {
+        jitError = std::current_exception();
+        return false;
+    }
+}
+
+void VM::enterNative(CallFrame& frame) {
+    auto* native = frame.closure->function->native;
+    const auto* entry = native->entries[frame.ip - frame.closure->function->chunk.m_bytecodes.data()];
+    if (native->enter(this, &frame, &stack, entry) != 0) {
+        std::rethrow_exception(std::exchange(jitError, nullptr));
+    }
+}
+
+// The interpreter loop, in two versions. Checked defends against malformed
+// bytecode: unknown opcodes, stack underflow, operands outside the constant
+// table, the frame's locals, the closure's upvalues or the chunk. Code that
+// passed BytecodeVerifier cannot do any of that, so the unchecked version
+// skips those tests; the checks on the values a program computes (operand
+// types, arity, indices into arrays) are made by both. The unchecked version
+// also hands functions the JIT compiled to their machine code, after calls,
+// returns and loop back edges.
+template <bool Checked, bool Step>
+InterpretResult VM::execute(int ret_frame) {
 
 #define READ_BYTE() (*frame->ip++)
 #define READ_SHORT() (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
-#define READ_CONSTANT() (frame->closure->function->chunk.constants()[READ_SHORT()])
-#define READ_STRING() std::get<std::string>(READ_CONSTANT())
+#define CHECK(condition, message) \
+    do { \
+        if constexpr (Checked) { \
+            if (!(condition)) error(0, message); \
+        } \
+    } while (false)
+#define READ_CONSTANT() (constantAt(READ_SHORT()))
+#define READ_STRING() (nameAt(READ_SHORT()))
+#define READ_LOCAL() (localAt(READ_BYTE()))
+#define READ_UPVALUE() (upvalueAt(READ_BYTE()))
+// Native code runs until a call or return, so control can only pass to it
+// after one, or when the JIT compiles a running loop.
+#define RESUME_NATIVE() \
+    do { \
+        if constexpr (!Checked && !Step) { \
+            if (jit && frame->closure->function->native) enterNative(*frame); \
+        } \
+    } while (false)
 #define BINARY_OP(op) \
     do { \
         Value b = pop(); \
@@ -51,8 +156,45 @@ InterpretResult VM::run(int ret_frame) {
             error(0, "binary op operands must be numbers"); \
         stack.back() = std::get<double>(stack.back()) op std::get<double>(b); \
     } while (false)
+// numbers take the fast path; anything else goes to the generic instruction
+#define QUICK_BINARY_OP(op, generic) \
+    do { \
+        auto* b = std::get_if<double>(&stack.back()); \
+        auto* a = std::get_if<double>(&stack[stack.size() - 2]); \
+        if (!a || !b) goto generic; \
+        auto result = *a op *b; \
+        stack.pop_back(); \
+        stack.back() = result; \
+    } while (false)
+// unchecked access to a Value known to hold a double
+#define NUM(value) (*std::get_if<double>(&(value)))
 
     auto frame = frames.back();
+    // operand accessors; checked, they refuse anything outside the frame
+    auto constantAt = [&](uint16_t index) -> const Value& {
+        const auto& constants = frame->closure->function->chunk.constants();
+        CHECK(index < constants.size(), "constant index out of range");
+        return constants[index];
+    };
+    auto nameAt = [&](uint16_t index) -> const std::string& {
+        const auto& constant = constantAt(index);
+        CHECK(std::holds_alternative<std::string>(constant), "global name is not a string");
+        return *std::get_if<std::string>(&constant);
+    };
+    auto localAt = [&](uint8_t slot) -> Value& {
+        CHECK(frame->frame_pointer + slot < stack.size(), "local slot out of range");
+        return stack[frame->frame_pointer + slot];
+    };
+    auto upvalueAt = [&](uint8_t slot) -> Upvalue* {
+        CHECK(slot < frame->closure->upvalues.size() && frame->closure->upvalues[slot], "invalid upvalue");
+        return frame->closure->upvalues[slot];
+    };
+    auto jumpBy = [&](int distance) {
+        frame->ip += distance;
+        const auto& code = frame->closure->function->chunk.bytecodes();
+        CHECK(frame->ip >= code.data() && frame->ip < code.data() + code.size(), "jump out of the chunk");
+    };
+    RESUME_NATIVE();
     for (;;) {
         if (debug_trace_exeuction) {
             printf("          ");
@@ -65,8 +207,18 @@ InterpretResult VM::run(int ret_frame) {
             frame->closure->function->chunk.disassembleInstruction((int)(frame->ip - &frame->closure->function->chunk.m_bytecodes[0]));
         }
 
+        if constexpr (Checked) {
+            const auto& chunk = frame->closure->function->chunk;
+            int offset = frame->ip - chunk.bytecodes().data();
+            CHECK(offset < chunk.bytecodes().size(), "execution ran off the end of the chunk");
+            CHECK(chunk.bytecodes()[offset] < OP_END, "unknown instruction");
+            bool closure = chunk.bytecodes()[offset] == OP_CLOSURE || chunk.bytecodes()[offset] == OP_CLOSURE_LOCAL;
+            CHECK(closure || offset + chunk.instructionLength(offset) <= chunk.bytecodes().size(), "truncated instruction");
+            CHECK(stack.size() - frame->frame_pointer >= stackEffect(chunk, offset).pops, "stack underflow");
+        }
         uint8_t instruction = READ_BYTE();
         if (instruction < OP_END) op_counters[instruction]++;
+        if (profile) observe(*frame, instruction);
         switch (instruction) {
             case OP_CONSTANT: {
                 auto constant = READ_CONSTANT();
@@ -87,10 +239,7 @@ InterpretResult VM::run(int ret_frame) {
                 break;
             }
             case OP_NOT: {
-                if (std::holds_alternative<bool>(stack.back()))
-                    stack.back() = !std::get<bool>(stack.back());
-                else if (std::holds_alternative<std::nullptr_t>(stack.back()))
-                    stack.back() = true;
+                stack.back() = !is_truthy(stack.back());
                 break;
             }
             case OP_NEGATE: {
@@ -101,7 +250,7 @@ InterpretResult VM::run(int ret_frame) {
                 break;
             }
             // stack: [a, b] => [a+b]
-            case OP_ADD: {
+            case OP_ADD: generic_add: {
                 Value b = pop();
                 // Value a = pop();
                 if (std::holds_alternative<double>(b)) {
@@ -113,9 +262,9 @@ InterpretResult VM::run(int ret_frame) {
                 }
                 break;
             }
-            case OP_SUBTRACT: BINARY_OP(-); break;
-            case OP_MULTIPLY: BINARY_OP(*); break;
-            case OP_DIVIDE:   BINARY_OP(/); break;
+            case OP_SUBTRACT: generic_subtract: BINARY_OP(-); break;
+            case OP_MULTIPLY: generic_multiply: BINARY_OP(*); break;
+            case OP_DIVIDE:   generic_divide:   BINARY_OP(/); break;
             case OP_MODULO:   {
                 Value b = pop();
                 if (!std::holds_alternative<double>(b) || !std::holds_alternative<double>(stack.back())) {
@@ -133,7 +282,7 @@ InterpretResult VM::run(int ret_frame) {
                 stack.back() = (stack.back() == b);
                 break;
             }
-            case OP_GREATER:  {
+            case OP_GREATER: generic_greater: {
                 // BINARY_OP(<); break;
                 Value b = pop();
                 // Value a = pop();
@@ -148,7 +297,7 @@ InterpretResult VM::run(int ret_frame) {
                 }
                 break;
             }
-            case OP_LESS: {
+            case OP_LESS: generic_less: {
                 // BINARY_OP(<); break;
                 Value b = pop();
                 // Value a = pop();
@@ -164,12 +313,12 @@ InterpretResult VM::run(int ret_frame) {
                 break;
             }
             case OP_DEFINE_GLOBAL: {
-                auto name = READ_STRING();
+                const auto& name = READ_STRING();
                 globals[name] = pop();
                 break;
             }
             case OP_GET_GLOBAL: {
-                auto name = READ_STRING();
+                const auto& name = READ_STRING();
                 auto it = globals.find(name);
                 if (it == globals.end()) {
                     error(0, std::format("global variable {} not found", name));
@@ -178,35 +327,97 @@ InterpretResult VM::run(int ret_frame) {
                 break;
             }
             case OP_SET_GLOBAL: {
-                auto name = READ_STRING();
+                const auto& name = READ_STRING();
                 globals[name] = peek();
                 break;
             }
             case OP_SET_LOCAL: {
-                auto slot = READ_BYTE();
-                stack[frame->frame_pointer+slot] = peek();
+                READ_LOCAL() = peek();
                 break;
             }
             case OP_GET_LOCAL: {
-                auto slot = READ_BYTE();
-                push(stack[frame->frame_pointer+slot]);
+                push(READ_LOCAL());
+                break;
+            }
+            // Numeric fast paths: the compiler only emits these when TypeInference
+            // proved every operand (or the local's every value) is a number.
+            case OP_ADD_QUICK:      QUICK_BINARY_OP(+, generic_add); break;
+            case OP_SUBTRACT_QUICK: QUICK_BINARY_OP(-, generic_subtract); break;
+            case OP_MULTIPLY_QUICK: QUICK_BINARY_OP(*, generic_multiply); break;
+            case OP_DIVIDE_QUICK:   QUICK_BINARY_OP(/, generic_divide); break;
+            case OP_GREATER_QUICK:  QUICK_BINARY_OP(>, generic_greater); break;
+            case OP_LESS_QUICK:     QUICK_BINARY_OP(<, generic_less); break;
+            case OP_ADD_NUM: {
+                double b = NUM(stack.back());
+                stack.pop_back();
+                NUM(stack.back()) += b;
+                break;
+            }
+            case OP_SUBTRACT_NUM: {
+                double b = NUM(stack.back());
+                stack.pop_back();
+                NUM(stack.back()) -= b;
+                break;
+            }
+            case OP_MULTIPLY_NUM: {
+                double b = NUM(stack.back());
+                stack.pop_back();
+                NUM(stack.back()) *= b;
+                break;
+            }
+            case OP_DIVIDE_NUM: {
+                double b = NUM(stack.back());
+                stack.pop_back();
+                NUM(stack.back()) /= b;
+                break;
+            }
+            case OP_GREATER_NUM: {
+                double b = NUM(stack.back());
+                stack.pop_back();
+                stack.back() = NUM(stack.back()) > b;
+                break;
+            }
+            case OP_LESS_NUM: {
+                double b = NUM(stack.back());
+                stack.pop_back();
+                stack.back() = NUM(stack.back()) < b;
+                break;
+            }
+            case OP_GET_LOCAL_NUM: {
+                double value = NUM(READ_LOCAL());
+                stack.emplace_back(value);
+                break;
+            }
+            case OP_SET_LOCAL_NUM: {
+                NUM(READ_LOCAL()) = NUM(stack.back());
                 break;
             }
             case OP_JUMP_IF_FALSE: {
                 uint16_t offset = READ_SHORT();
                 if (!is_truthy(peek())) {
-                    frame->ip += offset;
+                    jumpBy(offset);
+                }
+                break;
+            }
+            case OP_JUMP_IF_TRUE: {
+                uint16_t offset = READ_SHORT();
+                if (is_truthy(peek())) {
+                    jumpBy(offset);
                 }
                 break;
             }
             case OP_JUMP: {
                 uint16_t offset = READ_SHORT();
-                frame->ip += offset;
+                jumpBy(offset);
                 break;
             }
             case OP_LOOP: {
                 uint16_t offset = READ_SHORT();
-                frame->ip -= offset;
+                jumpBy(-offset);
+                if constexpr (!Checked) {
+                    if (jit) jit->countHot(*frame->closure->function);
+                }
+                RESUME_NATIVE();
                 break;
             }
             case OP_RETURN: {
@@ -219,6 +430,7 @@ InterpretResult VM::run(int ret_frame) {
                 if (frames.size()>1) {
                     stack.resize(frame->frame_pointer-1); // restore stack to the frame pointer
                 }
+                releaseArena(*frame); // nothing allocated in it is referenced any more
                 frames.pop_back(); // pop the current frame
                 if (!frames.empty())
                     frame = frames.back();
@@ -226,19 +438,12 @@ InterpretResult VM::run(int ret_frame) {
                 if (frames.size() <= ret_frame) {
                     return INTERPRET_OK;
                 }
+                RESUME_NATIVE();
                 break;
             }
-            case OP_CALL: {
-                int argCount = READ_BYTE();
-                if (argCount > 255) {
-                    error(0, "cannot call function with more than 255 arguments");
-                }
-                if (argCount < 0) {
-                    error(0, "cannot call function with negative arguments");
-                }
-                if (argCount > stack.size() - frame->frame_pointer - 1) {
-                    error(0, "not enough arguments for function call");
-                }
+            case OP_CALL:
+            case OP_TAIL_CALL: {
+                int argCount = READ_BYTE(); // the stack holds them: checked before the switch
                 auto fun = peek(argCount);
                 if (!std::holds_alternative<LoxCallable*>(fun)) {
                     error(0, "OP_CALL cannot find LoxCallable* on stack");
@@ -250,9 +455,29 @@ InterpretResult VM::run(int ret_frame) {
                     if (beat_closure->arity() != argCount) {
                         error(0, std::format("function {} expected {} arguments but got {}", beat_closure->toString(), beat_closure->arity(), argCount));
                     }
+                    if constexpr (!Checked) {
+                        if (jit) jit->countHot(*beat_closure->function);
+                    }
+                    if (instruction == OP_TAIL_CALL) {
+                        // reuse the current frame: close its captured locals, then slide
+                        // callee and arguments down over the caller's slots
+                        closeUpvalues(&stack[frame->frame_pointer]);
+                        int base = frame->frame_pointer - 1;
+                        int first = stack.size() - argCount - 1;
+                        for (int i = 0; i <= argCount; i++) {
+                            stack[base + i] = std::move(stack[first + i]);
+                        }
+                        stack.resize(base + argCount + 1);
+                        frame->closure = beat_closure;
+                        frame->ip = &beat_closure->function->chunk.m_bytecodes[0];
+                        frame->elided_frames++;
+                        RESUME_NATIVE();
+                        break;
+                    }
                     // create a new call frame; frame pointer points to the first of the arguments
                     frames.push_back(std::make_shared<CallFrame>(beat_closure, &beat_closure->function->chunk.m_bytecodes[0], stack.size() - argCount));
                     frame = frames.back();
+                    RESUME_NATIVE();
                     break;
                 } else if (func != nullptr) { // not BeatFunction, must be subclass of LoxCallable, native functions
                     if (func->arity() != -1 && func->arity() != argCount) {
@@ -267,27 +492,40 @@ InterpretResult VM::run(int ret_frame) {
                     Value result = func->call(this, arguments);
                     pop(); // pop the function from the stack
                     push(result); // push the result of the function call
+                    RESUME_NATIVE();
                     break;
                 } else {
                     error(0, "OP_CALL cannot find LoxCallable* on stack");
                 }
                 break;
             }
-            case OP_ARRAY_LITERAL: {
+            case OP_ARRAY_LITERAL:
+            case OP_ARRAY_LITERAL_LOCAL: {
                 int size = READ_BYTE();
-                auto array = std::make_shared<Array>(std::vector<Value>());
-                array->data.reserve(size);
-                // array->reserve(size);
-                for (int i = 0; i < size; i++) {
-                    array->data.push_back(pop());
-                }
-                std::reverse(array->data.begin(), array->data.end()); // reverse the order of elements
+                // elements sit on the stack in source order; take them as one range
+                auto first = stack.end() - size;
+                auto array = instruction == OP_ARRAY_LITERAL_LOCAL
+                    ? std::allocate_shared<Array>(ArenaAllocator<Array>(arenaOf(*frame)), std::vector<Value>())
+                    : std::make_shared<Array>(std::vector<Value>());
+                array->data.assign(std::make_move_iterator(first), std::make_move_iterator(stack.end()));
+                stack.erase(first, stack.end());
                 push(array);
                 break;
             }
-            case OP_MAP_LITERAL: {
+            case OP_CONSTANT_LITERAL: {
+                push(cloneConstantLiteral(READ_CONSTANT()));
+                break;
+            }
+            case OP_CONSTANT_LITERAL_LOCAL: {
+                push(cloneConstantLiteral(READ_CONSTANT(), arenaOf(*frame)));
+                break;
+            }
+            case OP_MAP_LITERAL:
+            case OP_MAP_LITERAL_LOCAL: {
                 int size = READ_BYTE();
-                auto map = std::make_shared<Map>(std::unordered_map<Value, Value>());
+                auto map = instruction == OP_MAP_LITERAL_LOCAL
+                    ? std::allocate_shared<Map>(ArenaAllocator<Map>(arenaOf(*frame)), std::unordered_map<Value, Value>())
+                    : std::make_shared<Map>(std::unordered_map<Value, Value>());
                 for (int i = 0; i < size; i++) {
                     auto value = pop();
                     auto key = pop();
@@ -296,6 +534,31 @@ InterpretResult VM::run(int ret_frame) {
                 push(map);
                 break;
             }
+            case OP_LENGTH: {
+                Value& x = stack.back();
+                double length = 0;
+                if (auto* array = std::get_if<std::shared_ptr<Array>>(&x)) {
+                    length = (*array)->data.size();
+                } else if (auto* map = std::get_if<std::shared_ptr<Map>>(&x)) {
+                    length = (*map)->data.size();
+                } else if (auto* string = std::get_if<std::string>(&x)) {
+                    length = string->size();
+                } else {
+                    error(0, "len() argument must be array or map");
+                }
+                x = length;
+                break;
+            }
+            case OP_SUBSCRIPT_UNCHECKED: {
+                Value& obj = stack[stack.size() - 2];
+                if (auto* array = std::get_if<std::shared_ptr<Array>>(&obj)) {
+                    Value element = (*array)->data[(size_t)NUM(stack.back())];
+                    stack.pop_back();
+                    stack.back() = std::move(element);
+                    break;
+                }
+                [[fallthrough]]; // a map or string indexed by the loop counter
+            }
             case OP_SUBSCRIPT: {
                 auto i = pop();
                 auto obj = pop();
@@ -313,6 +576,17 @@ InterpretResult VM::run(int ret_frame) {
                 }
                 break;
             }
+            case OP_SUBSCRIPT_ASSIGNMENT_UNCHECKED: {
+                Value& obj = stack[stack.size() - 3];
+                if (auto* array = std::get_if<std::shared_ptr<Array>>(&obj)) {
+                    (*array)->data[(size_t)NUM(stack[stack.size() - 2])] = stack.back();
+                    obj = std::move(stack.back());
+                    stack.pop_back();
+                    stack.pop_back();
+                    break;
+                }
+                [[fallthrough]];
+            }
             case OP_SUBSCRIPT_ASSIGNMENT: {
                 auto value = pop();
                 auto i = pop();
@@ -338,8 +612,7 @@ InterpretResult VM::run(int ret_frame) {
             }
             case OP_POSTFIX_INC_LOCAL:
             case OP_POSTFIX_DEC_LOCAL: {
-                uint8_t slot = READ_BYTE();
-                Value& value = stack[frame->frame_pointer + slot];
+                Value& value = READ_LOCAL();
                 if (!std::holds_alternative<double>(value)) {
                     error(0, "Postfix operator requires a number");
                 }
@@ -351,7 +624,7 @@ InterpretResult VM::run(int ret_frame) {
             }
             case OP_POSTFIX_INC_GLOBAL:
             case OP_POSTFIX_DEC_GLOBAL: {
-                auto name = READ_STRING();
+                const auto& name = READ_STRING();
                 auto it = globals.find(name);
                 if (it == globals.end()) {
                     error(0, std::format("global variable {} not found", name));
@@ -368,12 +641,7 @@ InterpretResult VM::run(int ret_frame) {
             }
             case OP_POSTFIX_INC_UPVALUE:
             case OP_POSTFIX_DEC_UPVALUE: {
-                uint8_t slot = READ_BYTE();
-                auto upvalue = frame->closure->upvalues[slot];
-                if (!upvalue) {
-                    error(0, "Invalid upvalue for postfix operator");
-                }
-                Value* location = upvalue->location;
+                Value* location = READ_UPVALUE()->location;
                 if (!std::holds_alternative<double>(*location)) {
                     error(0, "Postfix operator requires a number");
                 }
@@ -427,41 +695,48 @@ InterpretResult VM::run(int ret_frame) {
                 error(0, std::format("OP_SUBSCRIPT obj can only be Array or Map"));
                 break;
             }
-            case OP_CLOSURE: {
-                auto func = std::get<LoxCallable*>(READ_CONSTANT());
-                auto beat_func = dynamic_cast<BeatFunction*>(func);
-                if (!beat_func) {
-                    error(0, "OP_CLOSURE operand must be a BeatFunction");
+            case OP_CLOSURE:
+            case OP_CLOSURE_LOCAL: {
+                const auto& constant = READ_CONSTANT();
+                BeatFunction* beat_func;
+                if constexpr (Checked) {
+                    auto* func = std::get_if<LoxCallable*>(&constant);
+                    beat_func = func ? dynamic_cast<BeatFunction*>(*func) : nullptr;
+                    CHECK(beat_func, "OP_CLOSURE operand must be a BeatFunction");
+                    const auto& code = frame->closure->function->chunk.bytecodes();
+                    CHECK(frame->ip + 2 * beat_func->upvalueCount <= code.data() + code.size(), "truncated instruction");
+                } else {
+                    beat_func = static_cast<BeatFunction*>(*std::get_if<LoxCallable*>(&constant));
                 }
-                auto closure = new BeatClosure(beat_func); //FIXME: this leaks?
+                auto closure = instruction == OP_CLOSURE_LOCAL
+                    ? arenaOf(*frame)->newClosure(beat_func)
+                    : new BeatClosure(beat_func); //FIXME: this leaks?
                 push(closure);
                 for (int i=0; i<closure->upvalues.size(); i++) {
                     uint8_t isLocal = READ_BYTE();
                     uint8_t index = READ_BYTE();
                     if (isLocal) {
                         // printf("XXX OP_CLOSURE %s:captured local index %d\n", closure->toString().c_str(), index);
-                        closure->upvalues[i] = captureUpvalue(&stack[frame->frame_pointer+index]);
+                        closure->upvalues[i] = captureUpvalue(&localAt(index));
                     } else {
                         // printf("XXX OP_CLOSURE %s:captured non-local index %d\n", closure->toString().c_str(), index);
-                        closure->upvalues[i] = frame->closure->upvalues[index];
+                        closure->upvalues[i] = upvalueAt(index);
                     }
                     printOpenUpvalues();
                 }
                 break;
             }
             case OP_GET_UPVALUE: {
-                uint8_t slot = READ_BYTE();
                 // printf("slot %d\n", slot);
                 // std::cout << "size of current upvalues " << frame->closure->upvalues.size() << std::endl;
                 // auto upvalue = frame->closure->upvalues[slot];
                 // printf("upvalue: location %p\n", upvalue->location );
                 // std::cout << "getupvalue "<< *frame->closure->upvalues[slot]->location << std::endl;
-                push(*frame->closure->upvalues[slot]->location);
+                push(*READ_UPVALUE()->location);
                 break;
             }
             case OP_SET_UPVALUE: {
-                uint8_t slot = READ_BYTE();
-                *frame->closure->upvalues[slot]->location = peek(0);
+                *READ_UPVALUE()->location = peek(0);
                 // no pop() here because assignment is an expression; need to leave sth on stack top.
                 break;
             }
@@ -476,10 +751,19 @@ InterpretResult VM::run(int ret_frame) {
             default:
                 throw std::runtime_error("Unknown instruction");
         }
+        if constexpr (Step) return INTERPRET_OK;
     }
 #undef READ_BYTE
+#undef READ_SHORT
+#undef CHECK
 #undef READ_CONSTANT
+#undef READ_STRING
+#undef READ_LOCAL
+#undef READ_UPVALUE
+#undef RESUME_NATIVE
 #undef BINARY_OP
+#undef QUICK_BINARY_OP
+#undef NUM
 
 }
 // for debuggin purpose
@@ -545,13 +829,23 @@ void VM::print_stack_trace() {
         auto& frame = frames[i];
         auto  function = frame->closure->function;
         size_t instruction = frame->ip - &function->chunk.m_bytecodes[0] - 1;
-        fprintf(stderr, "[line %d] in ",
-                function->chunk.lines()[instruction]);
+        int line = function->chunk.lines()[instruction];
+        // inlined bodies report their own line, then the line of the call they replaced
+        for (int origin = function->chunk.origins()[instruction]; origin != -1;) {
+            const auto& inlined = function->chunk.inlineOrigins()[origin];
+            fprintf(stderr, "[line %d] in %s() (inlined)\n", line, inlined.name.c_str());
+            line = inlined.callLine;
+            origin = inlined.parent;
+        }
+        fprintf(stderr, "[line %d] in ", line);
         if (function->name == "") {
             fprintf(stderr, "script\n");
         } else {
             fprintf(stderr, "%s()\n", function->name.c_str());
         }
+        if (frame->elided_frames > 0) {
+            fprintf(stderr, "    ... %d tail call frame(s) elided\n", frame->elided_frames);
+        }
     }
 }
 
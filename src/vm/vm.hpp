@@ -2,6 +2,9 @@
 
 #include "chunk.hpp"
 #include "compiler.hpp"
+#include "frame_arena.hpp"
+#include "jit.hpp"
+#include "profile.hpp"
 #include "native_func.hpp"
 #include "native_func_array.hpp"
 #include "native_func_math.hpp"
@@ -20,6 +23,8 @@ public:
     BeatClosure* closure;
     uint8_t* ip; // instruction pointer
     int frame_pointer; // where the function's stack starts in the VM stack
+    int elided_frames = 0; // tail calls that reused this frame, reported in stack traces
+    FrameArena* arena = nullptr; // taken on the first *_LOCAL allocation, released on return
 
     CallFrame(BeatClosure* closure, uint8_t* instruction_pointer, int fp)
         : closure(closure), ip(instruction_pointer), frame_pointer(fp) {}
@@ -30,11 +35,32 @@ class VM: public RuntimeContext {
     std::vector<std::shared_ptr<CallFrame>> frames; // call frame stack
 
     std::unordered_map<std::string, Value> globals;
+    FrameArenaPool arenas;
 
     // for profiling
     std::vector<int64_t> op_counters;
+
+    // whether the running code was not verified (see BytecodeVerifier) and
+    // must be defended against malformed instructions
+    bool checked = true;
+    // Step runs a single instruction of the top frame (see step)
+    template <bool Checked, bool Step = false>
+    InterpretResult execute(int ret_frame);
+
+    std::exception_ptr jitError; // raised by an instruction run for native code
+    void enterNative(CallFrame& frame);
 public:
     Upvalue* openUpvalues = nullptr;
+    Profile* profile = nullptr; // when set, feedback at tagged instructions is recorded into it
+    Jit* jit = nullptr; // when set, hot verified functions run as machine code
+
+    // uses jit if this platform supports it
+    void enableJit(Jit* compiler) {
+        if (Jit::supported(stack)) jit = compiler;
+    }
+    // runs the instruction at the top frame's ip for native code; false, with
+    // the error kept for enterNative to rethrow, if it raised one
+    bool step();
 
     explicit VM(): stack(), frames(), globals(), op_counters(OP_END)  {
         stack.reserve(256); // this is to prevent dynamicly enlarging stack that invalidates its pointers
@@ -88,6 +114,18 @@ public:
 
     Value callFunction(LoxCallable* func, const std::vector<Value>& args) override;
 
+    bool hasGlobal(const std::string& name) const { return globals.count(name) > 0; }
+
+    FrameArena* arenaOf(CallFrame& frame) {
+        if (!frame.arena) frame.arena = arenas.acquire();
+        return frame.arena;
+    }
+    void releaseArena(CallFrame& frame) {
+        if (frame.arena) arenas.release(std::exchange(frame.arena, nullptr));
+    }
+
+    void observe(const CallFrame& frame, uint8_t instruction);
+
     Upvalue* captureUpvalue(Value* local);
     void closeUpvalues(Value* last);
     void printOpenUpvalues();
@@ -0,0 +1,266 @@
+#include "x64_assembler.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+namespace x64 {
+
+namespace {
+constexpr uint8_t REX_W = 0x08;
+}
+
+Assembler::Label Assembler::newLabel() {
+    labels.push_back(-1);
+    return labels.size() - 1;
+}
+
+void Assembler::bind(Label label) {
+    labels[label] = code.size();
+}
+
+void Assembler::int32(int32_t value) {
+    uint8_t bytes[4];
+    std::memcpy(bytes, &value, 4);
+    code.insert(code.end(), bytes, bytes + 4);
+}
+
+void Assembler::rex(bool wide, int reg, int base, bool forceForByte) {
+    uint8_t prefix = 0x40 | (wide ? REX_W : 0) | ((reg >> 3) << 2) | (base >> 3);
+    if (prefix != 0x40 || forceForByte) byte(prefix);
+}
+
+// [base + disp32]; RSP and R12 as base need a SIB byte
+void Assembler::modrm(int reg, Mem mem) {
+    byte(0x80 | ((reg & 7) << 3) | (mem.base & 7));
+    if ((mem.base & 7) == RSP) byte(0x24);
+    int32(mem.disp);
+}
+
+void Assembler::modrmRR(int reg, int rm) {
+    byte(0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+void Assembler::push(Reg reg) {
+    rex(false, 0, reg);
+    byte(0x50 + (reg & 7));
+}
+
+void Assembler::pop(Reg reg) {
+    rex(false, 0, reg);
+    byte(0x58 + (reg & 7));
+}
+
+void Assembler::ret() {
+    byte(0xc3);
+}
+
+void Assembler::movRR(Reg dst, Reg src) {
+    rex(true, src, dst);
+    byte(0x89);
+    modrmRR(src, dst);
+}
+
+void Assembler::movImm64(Reg dst, uint64_t value) {
+    rex(true, 0, dst);
+    byte(0xb8 + (dst & 7));
+    uint8_t bytes[8];
+    std::memcpy(bytes, &value, 8);
+    code.insert(code.end(), bytes, bytes + 8);
+}
+
+void Assembler::movImm32(Reg dst, uint32_t value) {
+    rex(false, 0, dst);
+    byte(0xb8 + (dst & 7));
+    int32((int32_t)value);
+}
+
+void Assembler::load(Reg dst, Mem src) {
+    rex(true, dst, src.base);
+    byte(0x8b);
+    modrm(dst, src);
+}
+
+void Assembler::load32(Reg dst, Mem src) {
+    rex(true, dst, src.base);
+    byte(0x63);
+    modrm(dst, src);
+}
+
+void Assembler::loadByte(Reg dst, Mem src) {
+    rex(false, dst, src.base);
+    byte(0x0f);
+    byte(0xb6);
+    modrm(dst, src);
+}
+
+void Assembler::store(Mem dst, Reg src) {
+    rex(true, src, dst.base);
+    byte(0x89);
+    modrm(src, dst);
+}
+
+void Assembler::storeByte(Mem dst, Reg src) {
+    if (src > RBX) throw std::logic_error("storeByte needs the low byte of RAX..RBX");
+    rex(false, src, dst.base);
+    byte(0x88);
+    modrm(src, dst);
+}
+
+void Assembler::storeByte(Mem dst, uint8_t value) {
+    rex(false, 0, dst.base);
+    byte(0xc6);
+    modrm(0, dst);
+    byte(value);
+}
+
+void Assembler::xorByte(Mem dst, uint8_t value) {
+    rex(false, 0, dst.base);
+    byte(0x80);
+    modrm(6, dst);
+    byte(value);
+}
+
+void Assembler::addRR(Reg dst, Reg src) {
+    rex(true, src, dst);
+    byte(0x01);
+    modrmRR(src, dst);
+}
+
+void Assembler::addImm(Reg dst, int32_t value) {
+    rex(true, 0, dst);
+    byte(0x81);
+    modrmRR(0, dst);
+    int32(value);
+}
+
+void Assembler::imulImm(Reg dst, Reg src, int32_t value) {
+    rex(true, dst, src);
+    byte(0x69);
+    modrmRR(dst, src);
+    int32(value);
+}
+
+void Assembler::orRR32(Reg dst, Reg src) {
+    rex(false, src, dst);
+    byte(0x09);
+    modrmRR(src, dst);
+}
+
+void Assembler::cmpImm32(Reg reg, int32_t value) {
+    rex(false, 0, reg);
+    byte(0x81);
+    modrmRR(7, reg);
+    int32(value);
+}
+
+void Assembler::cmpByte(Mem mem, uint8_t value) {
+    rex(false, 0, mem.base);
+    byte(0x80);
+    modrm(7, mem);
+    byte(value);
+}
+
+void Assembler::cmp(Reg reg, Mem mem) {
+    rex(true, reg, mem.base);
+    byte(0x3b);
+    modrm(reg, mem);
+}
+
+void Assembler::andByteRR(Reg dst, Reg src) {
+    byte(0x20);
+    modrmRR(src, dst);
+}
+
+void Assembler::testByteRR(Reg a, Reg b) {
+    byte(0x84);
+    modrmRR(b, a);
+}
+
+void Assembler::setcc(Cond cond, Reg dst) {
+    byte(0x0f);
+    byte(0x90 + cond);
+    modrmRR(0, dst);
+}
+
+void Assembler::movsdLoad(Xmm dst, Mem src) {
+    byte(0xf2);
+    rex(false, dst, src.base);
+    byte(0x0f);
+    byte(0x10);
+    modrm(dst, src);
+}
+
+void Assembler::movsdStore(Mem dst, Xmm src) {
+    byte(0xf2);
+    rex(false, src, dst.base);
+    byte(0x0f);
+    byte(0x11);
+    modrm(src, dst);
+}
+
+void Assembler::movqFromReg(Xmm dst, Reg src) {
+    byte(0x66);
+    rex(true, dst, src);
+    byte(0x0f);
+    byte(0x6e);
+    modrmRR(dst, src);
+}
+
+void Assembler::sse(SseOp op, Xmm dst, Mem src) {
+    byte(0xf2);
+    rex(false, dst, src.base);
+    byte(0x0f);
+    byte((uint8_t)op);
+    modrm(dst, src);
+}
+
+void Assembler::sseRR(SseOp op, Xmm dst, Xmm src) {
+    byte(0xf2);
+    byte(0x0f);
+    byte((uint8_t)op);
+    modrmRR(dst, src);
+}
+
+void Assembler::ucomisd(Xmm a, Xmm b) {
+    byte(0x66);
+    byte(0x0f);
+    byte(0x2e);
+    modrmRR(a, b);
+}
+
+void Assembler::jmp(Label target) {
+    byte(0xe9);
+    fixups.push_back({(int)code.size(), target});
+    int32(0);
+}
+
+void Assembler::jcc(Cond cond, Label target) {
+    byte(0x0f);
+    byte(0x80 + cond);
+    fixups.push_back({(int)code.size(), target});
+    int32(0);
+}
+
+void Assembler::jmpReg(Reg target) {
+    rex(false, 0, target);
+    byte(0xff);
+    modrmRR(4, target);
+}
+
+void Assembler::callReg(Reg target) {
+    rex(false, 0, target);
+    byte(0xff);
+    modrmRR(2, target);
+}
+
+const std::vector<uint8_t>& Assembler::finish() {
+    for (const auto& fixup : fixups) {
+        if (labels[fixup.target] < 0) throw std::logic_error("jump to an unbound label");
+        int32_t rel = labels[fixup.target] - (fixup.at + 4);
+        std::memcpy(&code[fixup.at], &rel, 4);
+    }
+    fixups.clear();
+    return code;
+}
+
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// The few x86-64 instructions the baseline JIT (see Jit) emits, encoded into
+// a byte buffer. Memory operands are base + disp32; jumps use rel32 to labels
+// that are resolved when the code is finished.
+namespace x64 {
+
+enum Reg : uint8_t { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+enum Xmm : uint8_t { XMM0, XMM1 };
+
+struct Mem {
+    Reg base;
+    int32_t disp = 0;
+};
+
+// condition codes, as in the low nibble of jcc/setcc
+enum Cond : uint8_t { BELOW = 0x2, ABOVE_EQUAL = 0x3, EQUAL = 0x4, NOT_EQUAL = 0x5, ABOVE = 0x7, NOT_PARITY = 0xb };
+
+enum class SseOp : uint8_t { ADD = 0x58, MUL = 0x59, SUB = 0x5c, DIV = 0x5e };
+
+class Assembler {
+public:
+    using Label = int;
+
+    Label newLabel();
+    void bind(Label label);
+    [[nodiscard]] int offsetOf(Label label) const { return labels[label]; }
+
+    void push(Reg reg);
+    void pop(Reg reg);
+    void ret();
+    void movRR(Reg dst, Reg src);
+    void movImm64(Reg dst, uint64_t value);
+    void movImm32(Reg dst, uint32_t value); // zero-extends
+    void load(Reg dst, Mem src);             // 64 bits
+    void load32(Reg dst, Mem src);           // sign-extends to 64 bits
+    void loadByte(Reg dst, Mem src);         // zero-extends
+    void store(Mem dst, Reg src);            // 64 bits
+    void storeByte(Mem dst, Reg src);        // low byte of RAX..RBX
+    void storeByte(Mem dst, uint8_t value);
+    void xorByte(Mem dst, uint8_t value);
+    void addRR(Reg dst, Reg src);
+    void addImm(Reg dst, int32_t value);
+    void imulImm(Reg dst, Reg src, int32_t value);
+    void orRR32(Reg dst, Reg src);
+    void cmpImm32(Reg reg, int32_t value);
+    void cmpByte(Mem mem, uint8_t value);
+    void cmp(Reg reg, Mem mem);
+    void andByteRR(Reg dst, Reg src); // low bytes of RAX..RBX
+    void testByteRR(Reg a, Reg b);
+    void setcc(Cond cond, Reg dst);   // low byte of RAX..RBX
+
+    void movsdLoad(Xmm dst, Mem src);
+    void movsdStore(Mem dst, Xmm src);
+    void movqFromReg(Xmm dst, Reg src);
+    void sse(SseOp op, Xmm dst, Mem src);
+    void sseRR(SseOp op, Xmm dst, Xmm src);
+    void ucomisd(Xmm a, Xmm b);
+
+    void jmp(Label target);
+    void jcc(Cond cond, Label target);
+    void jmpReg(Reg target);
+    void callReg(Reg target);
+
+    // resolves jumps; the code is position independent once finished
+    const std::vector<uint8_t>& finish();
+
+private:
+    std::vector<uint8_t> code;
+    std::vector<int> labels; // offset of each bound label, -1 until bound
+    struct Fixup {
+        int at;    // offset of the rel32 field
+        Label target;
+    };
+    std::vector<Fixup> fixups;
+
+    void byte(uint8_t value) { code.push_back(value); }
+    void int32(int32_t value);
+    void rex(bool wide, int reg, int base, bool forceForByte = false);
+    void modrm(int reg, Mem mem);
+    void modrmRR(int reg, int rm);
+};
+
+}
@@ -0,0 +1,101 @@
+#!/usr/bin/env node
+// Runs a manifest through `transpose --batch` and checks that every program
+// exits, and writes to stdout and stderr, as it does run on its own by
+// transpose, then reports how long each way took.
+const { execFileSync, spawnSync } = require('child_process');
+const fs = require('fs');
+const path = require('path');
+
+function batch(transposeBin, manifest, workers) {
+  const start = process.hrtime.bigint();
+  const result = spawnSync(transposeBin, ['--batch', manifest, '-j', String(workers)], { maxBuffer: 1 << 28 });
+  const ms = Number(process.hrtime.bigint() - start) / 1e6;
+  if (result.error) throw result.error;
+  const output = result.stdout;
+  const jobs = [];
+  let at = 0;
+  while (at < output.length) {
+    const newline = output.indexOf('\n', at);
+    const header = output.toString('utf8', at, newline);
+    const [status, outLength, errLength] = header.split(' ', 3).map(Number);
+    const script = header.split(' ').slice(3).join(' ');
+    const start = newline + 1;
+    jobs.push({
+      script,
+      status,
+      stdout: output.toString('utf8', start, start + outLength),
+      stderr: output.toString('utf8', start + outLength, start + outLength + errLength),
+    });
+    at = start + outLength + errLength;
+  }
+  return { ms, jobs, status: result.status };
+}
+
+// Node reports an uncaught error under the file and line it came from, and
+// with its own version, which a program in a batch has neither of.
+function uncaught(stderr) {
+  return stderr
+    .replace(/^\S+:\d+\n.*\n *\^\n\n/, '')
+    .replace(/\n\nNode\.js v\S+\n$/, '\n')
+    .replace(/^ {4}at .*\n/gm, '');
+}
+
+function manifestJobs(manifest) {
+  const base = path.dirname(manifest);
+  return fs.readFileSync(manifest, 'utf8').split('\n')
+    .map((line) => line.trim().split(/\s+/))
+    .filter((fields) => fields[0] !== '' && !fields[0].startsWith('#'))
+    .map(([script, input]) => ({ script: path.join(base, script), input: input && path.join(base, input) }));
+}
+
+function run() {
+  if (process.argv.length < 4) {
+    console.error('Usage: node batch_run.cjs <transpose_bin> <manifest> [workers]');
+    process.exit(2);
+  }
+  const [transposeBin, manifest] = process.argv.slice(2);
+  const workers = Number(process.argv[4] || 4);
+  const expected = manifestJobs(manifest);
+
+  const batched = batch(transposeBin, manifest, workers);
+  let failed = false;
+  if (batched.jobs.length !== expected.length) {
+    console.error(`${batched.jobs.length} results for ${expected.length} programs`);
+    process.exit(1);
+  }
+
+  const start = process.hrtime.bigint();
+  expected.forEach((job, i) => {
+    const alone = spawnSync(transposeBin, [job.script], {
+      input: job.input ? fs.readFileSync(job.input) : '',
+      encoding: 'utf8',
+      maxBuffer: 1 << 28,
+    });
+    const result = batched.jobs[i];
+    const name = path.basename(job.script);
+    if (path.normalize(result.script) !== path.normalize(job.script)) {
+      console.error(`${name}: reported as ${result.script}`);
+      failed = true;
+    }
+    alone.stderr = uncaught(alone.stderr);
+    result.stderr = uncaught(result.stderr);
+    for (const field of ['status', 'stdout', 'stderr']) {
+      if (result[field] !== alone[field]) {
+        console.error(`${name}: ${field} in the batch was\n${result[field]}\nbut alone\n${alone[field]}`);
+        failed = true;
+      }
+    }
+  });
+  const aloneMs = Number(process.hrtime.bigint() - start) / 1e6;
+  if (batched.status !== (batched.jobs.some((job) => job.status !== 0) ? 1 : 0)) {
+    console.error(`transpose --batch exited with ${batched.status}`);
+    failed = true;
+  }
+
+  console.log(`${expected.length} programs: ${aloneMs.toFixed(0)} ms one transpose each, ` +
+              `${batched.ms.toFixed(0)} ms in one batch on ${workers} workers ` +
+              `(${(aloneMs / batched.ms).toFixed(1)}x)`);
+  process.exit(failed ? 1 : 0);
+}
+
+run();
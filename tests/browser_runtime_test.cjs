@@ -18,15 +18,19 @@ function normaliseOutput(values) {
   });
 }
 
-function run() {
+// With --wasm, runs the WebAssembly backend's output the way the playground
+// does: its loader instantiates the module asynchronously and leaves the
+// promise of the run in __rhythmIO.finished.
+async function run() {
   if (process.argv.length < 4) {
-    console.error('Usage: node browser_runtime_test.cjs <transpose_bin> <source_file>');
+    console.error('Usage: node browser_runtime_test.cjs <transpose_bin> <source_file> [--wasm]');
     process.exit(2);
   }
 
   const transposeBin = process.argv[2];
   const sourceFile = process.argv[3];
-  const js = execFileSync(transposeBin, ['--emit-js', sourceFile], {
+  const wasm = process.argv[4] === '--wasm';
+  const js = execFileSync(transposeBin, wasm ? ['--wasm', '--emit-js', sourceFile] : ['--emit-js', sourceFile], {
     encoding: 'utf8',
     cwd: path.resolve(__dirname, '..'),
   });
@@ -44,6 +48,10 @@ function run() {
       stdout: [],
       stderr: [],
     },
+    // browser globals a vm context lacks
+    atob,
+    TextDecoder,
+    TextEncoder,
   };
 
   context.globalThis = context;
@@ -51,6 +59,10 @@ function run() {
 
   vm.createContext(context);
   vm.runInContext(js, context, { filename: 'transpiled_rhythm.js' });
+  if (wasm) {
+    assert(context.__rhythmIO.finished, 'Expected the WebAssembly loader to leave a promise in __rhythmIO.finished');
+    await context.__rhythmIO.finished;
+  }
 
   const capturedStdout = normaliseOutput(context.__rhythmIO.stdout);
   const capturedStderr = normaliseOutput(context.__rhythmIO.stderr);
@@ -67,9 +79,7 @@ function run() {
   );
 }
 
-try {
-  run();
-} catch (error) {
+run().catch((error) => {
   console.error(error && error.stack ? error.stack : String(error));
   process.exit(1);
-}
+});
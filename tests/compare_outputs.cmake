@@ -0,0 +1,46 @@
+# Runs SCRIPT with beat (or whichever interpreter BEAT names) twice, with
+# REFERENCE_ARGS and with ARGS (both space-separated), and fails unless the two
+# runs print the same and exit the same way. Used to check that an execution
+# mode agrees with the interpreter:
+#   cmake -DBEAT=beat -DSCRIPT=x.rhy -DREFERENCE_ARGS=--no-jit "-DARGS=--jit-threshold 0" -P compare_outputs.cmake
+# With PROGRAM set, the second run executes PROGRAM with ARGS (say, SCRIPT
+# compiled by transpose --build, or transpose --wasm SCRIPT) instead of beat.
+# With INPUT set, both runs read that file on stdin.
+separate_arguments(reference_args UNIX_COMMAND "${REFERENCE_ARGS}")
+separate_arguments(args UNIX_COMMAND "${ARGS}")
+set(input)
+get_filename_component(reference_name ${BEAT} NAME_WE)
+if (INPUT)
+    set(input INPUT_FILE ${INPUT})
+endif()
+
+if (PROGRAM)
+    set(actual_command ${PROGRAM} ${args})
+    set(actual_name "${PROGRAM}")
+else()
+    set(actual_command ${BEAT} ${args} ${SCRIPT})
+    set(actual_name "${reference_name} ${ARGS}")
+endif()
+
+execute_process(
+    COMMAND ${BEAT} ${reference_args} ${SCRIPT}
+    ${input}
+    OUTPUT_VARIABLE expected_output
+    ERROR_VARIABLE  expected_errors
+    RESULT_VARIABLE expected_result
+)
+execute_process(
+    COMMAND ${actual_command}
+    ${input}
+    OUTPUT_VARIABLE actual_output
+    ERROR_VARIABLE  actual_errors
+    RESULT_VARIABLE actual_result
+)
+
+if (NOT expected_output STREQUAL actual_output)
+    message(FATAL_ERROR "${actual_name} printed\n${actual_output}\nbut ${reference_name} ${REFERENCE_ARGS} printed\n${expected_output}")
+endif()
+if (NOT expected_errors STREQUAL actual_errors OR NOT expected_result STREQUAL actual_result)
+    message(FATAL_ERROR "${actual_name} failed with (${actual_result})\n${actual_errors}\n"
+                        "but ${reference_name} ${REFERENCE_ARGS} with (${expected_result})\n${expected_errors}")
+endif()
@@ -0,0 +1,100 @@
+#!/usr/bin/env node
+// Feeds a script and a series of small edits to it through `transpose --serve`
+// and checks that each reply is what transpiling that version from scratch
+// gives, reporting how long the session took for each edit.
+const { execFileSync, spawnSync } = require('child_process');
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
+
+// Hoisted loop invariants are numbered per statement in a session and per
+// program otherwise.
+function normalize(js) {
+  return js.replace(/\$inv\d+/g, '$inv');
+}
+
+function edits(source) {
+  const versions = [source];
+  const edit = (change) => versions.push(change(versions[versions.length - 1]));
+  const middle = source.indexOf('\n', Math.floor(source.length / 2)) + 1;
+
+  // change digits across the program, one at a time
+  for (let i = 1; i <= 6; ++i) {
+    edit((text) => {
+      const at = text.slice(Math.floor((text.length * i) / 7)).search(/[0-9]/);
+      if (at < 0) return text;
+      const pos = Math.floor((text.length * i) / 7) + at;
+      return text.slice(0, pos) + String((Number(text[pos]) + 1) % 10) + text.slice(pos + 1);
+    });
+  }
+  edit((text) => text.slice(0, middle) + '// a comment\n' + text.slice(middle));
+  edit((text) => '\n\n' + text);
+  edit((text) => text + 'print "appended";\n');
+  edit((text) => text.slice(0, middle) + 'var = ;\n' + text.slice(middle));
+  edit((text) => text.replace('var = ;\n', ''));
+  edit((text) => text.replace('print "appended";\n', ''));
+  versions.push(source);
+  return versions;
+}
+
+function serve(transposeBin, versions) {
+  const input = versions.map((text) => `${Buffer.byteLength(text)}\n${text}`).join('');
+  const output = execFileSync(transposeBin, ['--serve'], { input, maxBuffer: 1 << 28, stdio: ['pipe', 'pipe', 'ignore'] });
+  const replies = [];
+  let at = 0;
+  while (at < output.length) {
+    const newline = output.indexOf('\n', at);
+    const [status, length, micros] = output.toString('utf8', at, newline).split(' ');
+    const start = newline + 1;
+    const end = start + Number(length);
+    replies.push({ ok: status === 'ok', text: output.toString('utf8', start, end), micros: Number(micros) });
+    at = end;
+  }
+  return replies;
+}
+
+function fromScratch(transposeBin, file, text) {
+  fs.writeFileSync(file, text);
+  const result = spawnSync(transposeBin, ['--emit-js', file], { encoding: 'utf8', maxBuffer: 1 << 28 });
+  return result.status === 0 ? { ok: true, text: result.stdout } : { ok: false, text: result.stderr.trim() };
+}
+
+function run() {
+  if (process.argv.length < 4) {
+    console.error('Usage: node incremental_transpile.cjs <transpose_bin> <script.rhy>...');
+    process.exit(2);
+  }
+  const transposeBin = process.argv[2];
+  const dir = fs.mkdtempSync(path.join(os.tmpdir(), 'rhythm-incremental-'));
+  let failed = false;
+  try {
+    for (const script of process.argv.slice(3)) {
+      const name = path.basename(script);
+      const versions = edits(fs.readFileSync(script, 'utf8'));
+      const replies = serve(transposeBin, versions);
+      if (replies.length !== versions.length) {
+        console.error(`${name}: ${replies.length} replies to ${versions.length} programs`);
+        failed = true;
+        continue;
+      }
+      const times = [];
+      versions.forEach((text, i) => {
+        const expected = fromScratch(transposeBin, path.join(dir, name), text);
+        const reply = replies[i];
+        if (reply.ok !== expected.ok || normalize(reply.text) !== normalize(expected.text)) {
+          console.error(`${name}: edit ${i} differs from transpiling it from scratch`);
+          failed = true;
+        }
+        if (reply.ok && i > 0) times.push(reply.micros);
+      });
+      times.sort((a, b) => a - b);
+      console.log(`${name}: first ${replies[0].micros} us, edits median ${times[times.length >> 1]} us, ` +
+                  `max ${times[times.length - 1]} us`);
+    }
+  } finally {
+    fs.rmSync(dir, { recursive: true, force: true });
+  }
+  process.exit(failed ? 1 : 0);
+}
+
+run();
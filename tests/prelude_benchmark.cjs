@@ -0,0 +1,96 @@
+#!/usr/bin/env node
+// Times transpiled benchmarks with the runtime prelude's arithmetic and
+// comparison helpers as they are, and again with the closure-based helpers
+// they replaced, which V8 could not inline. Both must print the same result.
+const { execFileSync } = require('child_process');
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
+
+const RUNS = 3;
+
+// The helpers as they were, each passing its operator to a shared function.
+const legacyHelpers = `
+Object.assign(__rt, (() => {
+  function ensureNumber(value, line, message) {
+    if (typeof value !== 'number' || Number.isNaN(value)) {
+      throw __rt.runtimeError(line, message);
+    }
+    return value;
+  }
+  function binaryNumberOp(left, right, line, op, message) {
+    return op(ensureNumber(left, line, message), ensureNumber(right, line, message));
+  }
+  function compareOp(left, right, line, comparator) {
+    const l = ensureNumber(left, line, 'operands must be numbers');
+    const r = ensureNumber(right, line, 'operands must be numbers');
+    return comparator(l, r);
+  }
+  return {
+    binaryMinus: (left, right, line) => binaryNumberOp(left, right, line, (a, b) => a - b, 'operands must be numbers'),
+    binaryDivide: (left, right, line) => binaryNumberOp(left, right, line, (a, b) => a / b, 'operands must be numbers'),
+    binaryMultiply: (left, right, line) => binaryNumberOp(left, right, line, (a, b) => a * b, 'operands must be numbers'),
+    greaterThan: (left, right, line) => compareOp(left, right, line, (a, b) => a > b),
+    greaterEqual: (left, right, line) => compareOp(left, right, line, (a, b) => a >= b),
+    lessThan: (left, right, line) => compareOp(left, right, line, (a, b) => a < b),
+    lessEqual: (left, right, line) => compareOp(left, right, line, (a, b) => a <= b),
+  };
+})());
+`;
+
+function withLegacyHelpers(js) {
+  // the prelude is the first statement, an IIFE
+  const marker = '\n})();\n';
+  const at = js.indexOf(marker);
+  if (at < 0) {
+    throw new Error('could not find the end of the runtime prelude');
+  }
+  return js.slice(0, at + marker.length) + legacyHelpers + js.slice(at + marker.length);
+}
+
+function time(file) {
+  let best = Infinity;
+  let output = '';
+  for (let i = 0; i < RUNS; ++i) {
+    const start = process.hrtime.bigint();
+    output = execFileSync(process.execPath, [file], { encoding: 'utf8' });
+    best = Math.min(best, Number(process.hrtime.bigint() - start) / 1e6);
+  }
+  // what follows the first line reports timings
+  return { ms: best, result: output.split('\n')[0] };
+}
+
+function run() {
+  if (process.argv.length < 4) {
+    console.error('Usage: node prelude_benchmark.cjs <transpose_bin> <script.rhy>...');
+    process.exit(2);
+  }
+  const transposeBin = process.argv[2];
+  const dir = fs.mkdtempSync(path.join(os.tmpdir(), 'rhythm-prelude-'));
+  let failed = false;
+  try {
+    for (const script of process.argv.slice(3)) {
+      const js = execFileSync(transposeBin, ['--emit-js', script], { encoding: 'utf8' });
+      const current = path.join(dir, 'current.cjs');
+      const legacy = path.join(dir, 'legacy.cjs');
+      fs.writeFileSync(current, js);
+      fs.writeFileSync(legacy, withLegacyHelpers(js));
+
+      const before = time(legacy);
+      const after = time(current);
+      const name = path.basename(script);
+      if (before.result !== after.result) {
+        console.error(`${name}: printed ${after.result}, the old helpers ${before.result}`);
+        failed = true;
+        continue;
+      }
+      console.log(`${name}: ${before.ms.toFixed(0)} ms -> ${after.ms.toFixed(0)} ms ` +
+                  `(${(before.ms / after.ms).toFixed(2)}x)`);
+    }
+  } finally {
+    fs.rmSync(dir, { recursive: true, force: true });
+  }
+  process.exit(failed ? 1 : 0);
+}
+
+run();
@@ -0,0 +1,57 @@
+#!/usr/bin/env node
+// Times transpiled benchmarks as usual and as under --no-loop, where calls
+// are counted, tail calls returned and deep recursion moved to the heap, to
+// show what that costs recursion too shallow to need it. Both must print the
+// same result.
+const { execFileSync } = require('child_process');
+const fs = require('fs');
+const os = require('os');
+const path = require('path');
+
+const RUNS = 5;
+
+function time(file) {
+  let best = Infinity;
+  let output = '';
+  for (let i = 0; i < RUNS; ++i) {
+    const start = process.hrtime.bigint();
+    output = execFileSync(process.execPath, [file], { encoding: 'utf8' });
+    best = Math.min(best, Number(process.hrtime.bigint() - start) / 1e6);
+  }
+  // what follows the first line reports timings
+  return { ms: best, result: output.split('\n')[0] };
+}
+
+function run() {
+  if (process.argv.length < 4) {
+    console.error('Usage: node recursion_benchmark.cjs <transpose_bin> <script.rhy>...');
+    process.exit(2);
+  }
+  const transposeBin = process.argv[2];
+  const dir = fs.mkdtempSync(path.join(os.tmpdir(), 'rhythm-recursion-'));
+  let failed = false;
+  try {
+    for (const script of process.argv.slice(3)) {
+      const plain = path.join(dir, 'plain.cjs');
+      const noLoop = path.join(dir, 'no_loop.cjs');
+      fs.writeFileSync(plain, execFileSync(transposeBin, ['--emit-js', script], { encoding: 'utf8' }));
+      fs.writeFileSync(noLoop, execFileSync(transposeBin, ['--no-loop', '--emit-js', script], { encoding: 'utf8' }));
+
+      const before = time(plain);
+      const after = time(noLoop);
+      const name = path.basename(script);
+      if (before.result !== after.result) {
+        console.error(`${name}: printed ${after.result} under --no-loop, ${before.result} without`);
+        failed = true;
+        continue;
+      }
+      console.log(`${name}: ${before.ms.toFixed(0)} ms -> ${after.ms.toFixed(0)} ms under --no-loop ` +
+                  `(${(after.ms / before.ms).toFixed(2)}x)`);
+    }
+  } finally {
+    fs.rmSync(dir, { recursive: true, force: true });
+  }
+  process.exit(failed ? 1 : 0);
+}
+
+run();
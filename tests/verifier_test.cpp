@@ -0,0 +1,103 @@
+// Hands BytecodeVerifier chunks that break each rule it enforces and checks
+// that they are rejected for the right reason. The compiler never produces
+// such code, so the example scripts cannot reach these paths.
+#include <initializer_list>
+#include <iostream>
+#include <string>
+
+#include "vm/chunk.hpp"
+#include "vm/verifier.hpp"
+
+namespace {
+
+int failures = 0;
+
+Chunk chunkOf(std::initializer_list<uint8_t> code) {
+    Chunk chunk;
+    for (auto byte : code) {
+        chunk.write(byte, 1);
+    }
+    return chunk;
+}
+
+// verifies function and checks that it is accepted, or rejected with an
+// error mentioning expected
+void expect(const std::string& name, BeatFunction& function, const std::string& expected) {
+    std::string error;
+    bool accepted = BytecodeVerifier().verify(function, error);
+    bool ok = expected.empty() ? accepted : !accepted && error.find(expected) != std::string::npos;
+    if (!ok) {
+        failures++;
+        std::cerr << "FAIL " << name << ": " << (accepted ? "accepted" : "rejected with '" + error + "'")
+                  << ", expected " << (expected.empty() ? "to be accepted" : "'" + expected + "'") << std::endl;
+    } else {
+        std::cout << "ok   " << name << std::endl;
+    }
+}
+
+void expect(const std::string& name, Chunk chunk, const std::string& expected, int upvalues = 0) {
+    BeatFunction function(0, name, chunk, BeatFunctionType::SCRIPT, upvalues);
+    expect(name, function, expected);
+}
+
+}
+
+int main() {
+    expect("valid", chunkOf({OP_NIL, OP_RETURN}), "");
+
+    // jumps
+    expect("jump past the end", chunkOf({OP_JUMP, 0, 16, OP_NIL, OP_RETURN}), "jump to 19 is not an instruction");
+    expect("loop before the start", chunkOf({OP_NIL, OP_LOOP, 0, 8, OP_RETURN}), "is not an instruction");
+    auto midInstruction = chunkOf({OP_JUMP, 0, 1, OP_CONSTANT, 0, 0, OP_RETURN});
+    midInstruction.addConstant(1.0);
+    expect("jump into an operand", midInstruction, "jump to 4 is not an instruction");
+
+    // stack heights
+    expect("stack underflow", chunkOf({OP_POP, OP_NIL, OP_RETURN}), "stack underflow");
+    expect("underflow after a call", chunkOf({OP_NIL, OP_CALL, 2, OP_RETURN}), "stack underflow");
+    // the jump reaches the return with the condition on the stack, the
+    // fall-through path with one more value
+    expect("heights differ where paths merge", chunkOf({OP_NIL, OP_JUMP_IF_FALSE, 0, 1, OP_NIL, OP_RETURN}),
+           "stack height 1 on one path and 2 on another");
+
+    // locals and upvalues
+    expect("local beyond the stack", chunkOf({OP_GET_LOCAL, 3, OP_RETURN}), "local slot out of range");
+    expect("store to the slot being stored", chunkOf({OP_NIL, OP_SET_LOCAL, 0, OP_RETURN}), "local slot out of range");
+    expect("upvalue with none captured", chunkOf({OP_GET_UPVALUE, 0, OP_RETURN}), "upvalue index out of range");
+    expect("upvalue past the captured ones", chunkOf({OP_GET_UPVALUE, 2, OP_RETURN}), "upvalue index out of range", 2);
+    expect("upvalue within the captured ones", chunkOf({OP_GET_UPVALUE, 1, OP_RETURN}), "", 2);
+
+    // falling off the end
+    expect("no return", chunkOf({OP_NIL, OP_POP}), "execution runs off the end of the chunk");
+    expect("conditional return", chunkOf({OP_NIL, OP_JUMP_IF_TRUE, 0, 1, OP_RETURN, OP_POP}),
+           "execution runs off the end of the chunk");
+
+    // instructions that trust the compiler's types and loop bounds
+    const std::string unchecked = "unchecked instruction in bytecode the compiler did not produce";
+    expect("number arithmetic on nil", chunkOf({OP_NIL, OP_NIL, OP_ADD_NUM, OP_RETURN}), unchecked);
+    expect("number comparison on nil", chunkOf({OP_NIL, OP_NIL, OP_LESS_NUM, OP_RETURN}), unchecked);
+    expect("number local holding nil", chunkOf({OP_NIL, OP_GET_LOCAL_NUM, 0, OP_RETURN}), unchecked);
+    expect("number store of nil", chunkOf({OP_NIL, OP_NIL, OP_SET_LOCAL_NUM, 0, OP_RETURN}), unchecked);
+    expect("unchecked subscript of nil", chunkOf({OP_NIL, OP_NIL, OP_SUBSCRIPT_UNCHECKED, OP_RETURN}), unchecked);
+    expect("unchecked store into nil",
+           chunkOf({OP_NIL, OP_NIL, OP_NIL, OP_SUBSCRIPT_ASSIGNMENT_UNCHECKED, OP_RETURN}), unchecked);
+    auto typed = chunkOf({OP_NIL, OP_GET_LOCAL_NUM, 0, OP_RETURN});
+    BeatFunction compiled(0, "compiled", typed, BeatFunctionType::SCRIPT, 0);
+    compiled.compiled = true;
+    expect("unchecked instruction from the compiler", compiled, "");
+
+    // a malformed function in the constant table rejects the script using it
+    auto bad = chunkOf({OP_POP, OP_RETURN});
+    BeatFunction nested(0, "nested", bad, BeatFunctionType::FUNCTION, 0);
+    auto script = chunkOf({OP_CONSTANT, 0, 0, OP_RETURN});
+    script.addConstant(static_cast<LoxCallable*>(&nested));
+    BeatFunction outer(0, "", script, BeatFunctionType::SCRIPT, 0);
+    expect("malformed nested function", outer, "nested at offset 0: stack underflow");
+
+    if (failures > 0) {
+        std::cerr << failures << " verifier test(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "OK" << std::endl;
+    return 0;
+}
@@ -8,9 +8,11 @@ import { indentWithTab } from "@codemirror/commands";
 const editorContainer = document.getElementById("editor");
 const stdinInput = document.getElementById("stdinInput");
 const noLoopToggle = document.getElementById("noLoop");
+const backendSelect = document.getElementById("backend");
 const compileButton = document.getElementById("compile");
 const compileRunButton = document.getElementById("compileRun");
 const jsOutput = document.getElementById("jsOutput");
+const jsSummary = document.getElementById("jsSummary");
 const stdoutBlock = document.getElementById("stdout");
 const stderrBlock = document.getElementById("stderr");
 const stderrSection = document.getElementById("stderrSection");
@@ -175,11 +177,23 @@ async function compileSource({ run }) {
       return;
     }
 
-    const js = module.compile(source);
-
-    // For display purposes, show only the user's code without runtime bloat
-    const userCode = module.compileUserCodeOnly(source);
-    jsOutput.value = userCode;
+    let js;
+    if (backendSelect.value === "wasm") {
+      // the module as base64, with the runtime and the loader that runs it;
+      // there is no readable user code to show apart from that
+      js = module.compileWasm(source);
+      jsSummary.textContent = "Generated WebAssembly loader";
+      jsOutput.value = js;
+    } else {
+      // the module keeps what it made of the last source and redoes only the
+      // statements an edit touched
+      js = module.compileIncremental(source);
+
+      // For display purposes, show only the user's code without runtime bloat
+      const userCode = module.compileIncrementalUserCodeOnly(source);
+      jsSummary.textContent = "Generated JavaScript";
+      jsOutput.value = userCode;
+    }
 
     if (!run) {
       setStatus("Compilation succeeded.", "success");
@@ -209,6 +223,10 @@ async function executeJavascript(js) {
   try {
     const runner = new Function(`${js}\n//# sourceURL=rhythm_transpiled.js`);
     runner();
+    // a WebAssembly program is still being instantiated at this point
+    if (window.__rhythmIO.finished) {
+      await window.__rhythmIO.finished;
+    }
 
     flushOutputs(window.__rhythmIO);
     const hasErrors = window.__rhythmIO.stderr.length > 0;